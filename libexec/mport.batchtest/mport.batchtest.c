@@ -0,0 +1,435 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests for batch package creation.  Synthetic packages are staged in a
+ * scratch directory with a plist each, queued with mport_createbatch_add()
+ * and built with mport_createbatch_run().  Some jobs are broken on purpose:
+ * one names a plist that does not exist and one lists a file that was never
+ * staged.  The run must report every job once, in the order they were
+ * queued, fail only the broken jobs with their own reason, and still write
+ * the bundles of the others.  Each check prints one line and the exit status
+ * is the number that failed.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mport.h>
+
+#define BATCH_JOBS	16
+#define BATCH_FILES	8
+#define BATCH_PREFIX	"/usr/local"
+/* where mport keeps its databases, under the root given to the instance */
+#define BATCH_INST_DIR	"/var/db/mport"
+
+enum job_kind {
+	JOB_GOOD,
+	JOB_NO_PLIST,		/* the plist file is missing */
+	JOB_NO_FILE		/* the plist lists a file that isn't staged */
+};
+
+struct batch_config {
+	char workdir[PATH_MAX];
+	char stage[PATH_MAX];
+	char repo[PATH_MAX];
+	char root[PATH_MAX];
+	int jobs;
+};
+
+/* messages from mport_createbatch_run(), in the order they arrived */
+static char **messages;
+static int nmessages;
+
+static void usage(void);
+static void check(const char *, bool, int *);
+static void record_msg(const char *);
+static enum job_kind job_kind(int, int);
+static void pkg_name(char *, size_t, int);
+static void stage_job(struct batch_config *, int, char *, size_t);
+static void queue_job(mportCreateBatch *, struct batch_config *, int, const char *);
+static int message_job(struct batch_config *, const char *, bool *);
+static bool test_ordering(struct batch_config *);
+static bool test_errors(struct batch_config *, int, const char *);
+static bool test_bundles(struct batch_config *);
+static void batch_mkdir(const char *);
+static int rmtree_cb(const char *, const struct stat *, int, struct FTW *);
+static void batch_rmtree(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	struct batch_config cfg;
+	mportInstance *mport;
+	mportCreateBatch *batch;
+	char plist[PATH_MAX];
+	char *errmsg;
+	bool keep = false;
+	int failed = 0;
+	int ch, i, ret;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.jobs = BATCH_JOBS;
+
+	while ((ch = getopt(argc, argv, "kn:w:")) != -1) {
+		switch (ch) {
+			case 'k':
+				keep = true;
+				break;
+			case 'n':
+				if ((cfg.jobs = atoi(optarg)) < 8)
+					errx(EXIT_FAILURE, "Invalid job count, at least 8 are needed: %s", optarg);
+				break;
+			case 'w':
+				if (atoi(optarg) < 1)
+					errx(EXIT_FAILURE, "Invalid worker count: %s", optarg);
+				/* the pool is sized from this when the first group is made */
+				if (setenv("MPORT_WORKERS", optarg, 1) != 0)
+					err(EXIT_FAILURE, "setenv");
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	strlcpy(cfg.workdir, "/tmp/mport.batchtest.XXXXXX", sizeof(cfg.workdir));
+	if (mkdtemp(cfg.workdir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	(void)snprintf(cfg.stage, sizeof(cfg.stage), "%s/stage", cfg.workdir);
+	(void)snprintf(cfg.repo, sizeof(cfg.repo), "%s/repo", cfg.workdir);
+	(void)snprintf(cfg.root, sizeof(cfg.root), "%s/root%s", cfg.workdir, BATCH_INST_DIR);
+	batch_mkdir(cfg.stage);
+	batch_mkdir(cfg.repo);
+	batch_mkdir(cfg.root);
+	cfg.root[strlen(cfg.root) - strlen(BATCH_INST_DIR)] = '\0';
+
+	if ((mport = mport_instance_new()) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+	mport_set_msg_cb(mport, record_msg);
+	/* verbose, so jobs that succeed are reported as well */
+	if (mport_instance_init(mport, cfg.root, cfg.repo, true, MPORT_VVERBOSE) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+
+	if ((batch = mport_createbatch_new()) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+	for (i = 0; i < cfg.jobs; i++) {
+		stage_job(&cfg, i, plist, sizeof(plist));
+		queue_job(batch, &cfg, i, plist);
+	}
+
+	ret = mport_createbatch_run(mport, batch);
+	errmsg = strdup(ret == MPORT_OK ? "" : mport_err_string());
+
+	check("ordering", test_ordering(&cfg), &failed);
+	check("errors", test_errors(&cfg, ret, errmsg), &failed);
+	check("bundles", test_bundles(&cfg), &failed);
+
+	free(errmsg);
+	for (i = 0; i < nmessages; i++)
+		free(messages[i]);
+	free(messages);
+	mport_createbatch_free(batch);
+	mport_instance_free(mport);
+
+	if (!keep)
+		batch_rmtree(cfg.workdir);
+
+	return (failed);
+}
+
+static void
+check(const char *name, bool ok, int *failed)
+{
+
+	printf("%-16s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		(*failed)++;
+}
+
+static void
+record_msg(const char *msg)
+{
+
+	/* the run reports each job once; anything past that is a failure in itself */
+	if (strncmp(msg, "Created ", 8) != 0 && strncmp(msg, "Unable to create ", 17) != 0)
+		return;
+	if ((messages = reallocf(messages, (nmessages + 1) * sizeof(char *))) == NULL ||
+	    (messages[nmessages] = strdup(msg)) == NULL)
+		err(EXIT_FAILURE, "strdup");
+	nmessages++;
+}
+
+/* the broken jobs sit a few places in, so workers are busy on both sides of them */
+static enum job_kind
+job_kind(int i, int jobs)
+{
+
+	if (i == 3)
+		return (JOB_NO_PLIST);
+	if (i == jobs - 3)
+		return (JOB_NO_FILE);
+
+	return (JOB_GOOD);
+}
+
+static void
+pkg_name(char *name, size_t len, int i)
+{
+
+	(void)snprintf(name, len, "batch-%04d", i);
+}
+
+/* stage the files of job i and write its plist, unless it is to be missing */
+static void
+stage_job(struct batch_config *cfg, int i, char *plist, size_t len)
+{
+	char name[32], dir[PATH_MAX], file[PATH_MAX];
+	FILE *fp, *pl;
+	int f;
+
+	pkg_name(name, sizeof(name), i);
+	(void)snprintf(plist, len, "%s/%s.plist", cfg->workdir, name);
+	(void)snprintf(dir, sizeof(dir), "%s/%s%s/share/batch/%s", cfg->stage, name, BATCH_PREFIX, name);
+	batch_mkdir(dir);
+
+	if (job_kind(i, cfg->jobs) == JOB_NO_PLIST)
+		return;
+
+	if ((pl = fopen(plist, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", plist);
+	for (f = 0; f < BATCH_FILES; f++) {
+		fprintf(pl, "share/batch/%s/file%d\n", name, f);
+		if (job_kind(i, cfg->jobs) == JOB_NO_FILE && f == BATCH_FILES - 1)
+			continue;
+		(void)snprintf(file, sizeof(file), "%s/file%d", dir, f);
+		if ((fp = fopen(file, "w")) == NULL)
+			err(EXIT_FAILURE, "%s", file);
+		fprintf(fp, "%s file %d\n", name, f);
+		fclose(fp);
+	}
+	fprintf(pl, "@dir share/batch/%s\n", name);
+	fclose(pl);
+}
+
+static void
+queue_job(mportCreateBatch *batch, struct batch_config *cfg, int i, const char *plist)
+{
+	mportPackageMeta *pack;
+	mportCreateExtras *extra;
+	char name[32];
+
+	pkg_name(name, sizeof(name), i);
+
+	pack = mport_pkgmeta_new();
+	extra = mport_createextras_new();
+	if (pack == NULL || extra == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+
+	(void)snprintf(extra->sourcedir, sizeof(extra->sourcedir), "%s/%s", cfg->stage, name);
+	(void)snprintf(extra->pkg_filename, sizeof(extra->pkg_filename), "%s/%s-1.0.mport", cfg->repo, name);
+
+	pack->name = strdup(name);
+	pack->version = strdup("1.0");
+	pack->prefix = strdup(BATCH_PREFIX);
+	pack->comment = strdup("Synthetic batch package");
+	if (asprintf(&pack->origin, "tests/%s", name) == -1)
+		pack->origin = NULL;
+	pack->categories = calloc(2, sizeof(char *));
+	if (pack->categories != NULL) {
+		pack->categories[0] = strdup("tests");
+		pack->categories_count = 1;
+	}
+	if (pack->name == NULL || pack->version == NULL || pack->prefix == NULL || pack->comment == NULL ||
+	    pack->origin == NULL || pack->categories == NULL || pack->categories[0] == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+
+	if (mport_createbatch_add(batch, pack, extra, plist) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+}
+
+/* the job a result message is about, or -1; *ok is set when it succeeded */
+static int
+message_job(struct batch_config *cfg, const char *msg, bool *ok)
+{
+	char name[32];
+	size_t len;
+	int i;
+
+	for (i = 0; i < cfg->jobs; i++) {
+		pkg_name(name, sizeof(name), i);
+		len = strlen(name);
+		if (strncmp(msg, "Created ", 8) == 0 && strncmp(msg + 8 + strlen(cfg->repo) + 1, name, len) == 0 &&
+		    strcmp(msg + 8 + strlen(cfg->repo) + 1 + len, "-1.0.mport") == 0) {
+			*ok = true;
+			return (i);
+		}
+		if (strncmp(msg, "Unable to create ", 17) == 0 && strncmp(msg + 17, name, len) == 0 &&
+		    strncmp(msg + 17 + len, "-1.0: ", 6) == 0) {
+			*ok = false;
+			return (i);
+		}
+	}
+
+	return (-1);
+}
+
+/* one result per job, in the order the jobs were queued */
+static bool
+test_ordering(struct batch_config *cfg)
+{
+	bool ok;
+	int i;
+
+	if (nmessages != cfg->jobs)
+		return (false);
+
+	for (i = 0; i < nmessages; i++) {
+		if (message_job(cfg, messages[i], &ok) != i)
+			return (false);
+	}
+
+	return (true);
+}
+
+/* only the broken jobs fail, each with its own reason, and the run says how many */
+static bool
+test_errors(struct batch_config *cfg, int ret, const char *errmsg)
+{
+	char expect[64];
+	bool ok;
+	int i, j;
+
+	(void)snprintf(expect, sizeof(expect), "2 of %d packages could not be created", cfg->jobs);
+	if (ret == MPORT_OK || errmsg == NULL || strstr(errmsg, expect) == NULL)
+		return (false);
+
+	for (i = 0; i < nmessages; i++) {
+		if ((j = message_job(cfg, messages[i], &ok)) == -1)
+			return (false);
+
+		switch (job_kind(j, cfg->jobs)) {
+			case JOB_GOOD:
+				if (!ok)
+					return (false);
+				break;
+			case JOB_NO_PLIST:
+				if (ok || strstr(messages[i], "Couldn't open plist") == NULL)
+					return (false);
+				break;
+			case JOB_NO_FILE:
+				if (ok || strstr(messages[i], "unknown error") != NULL ||
+				    strstr(messages[i], "Couldn't open plist") != NULL)
+					return (false);
+				break;
+		}
+	}
+
+	return (true);
+}
+
+/* the jobs that succeeded left a bundle behind */
+static bool
+test_bundles(struct batch_config *cfg)
+{
+	struct stat st;
+	char name[32], path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < cfg->jobs; i++) {
+		if (job_kind(i, cfg->jobs) != JOB_GOOD)
+			continue;
+		pkg_name(name, sizeof(name), i);
+		(void)snprintf(path, sizeof(path), "%s/%s-1.0.mport", cfg->repo, name);
+		if (stat(path, &st) != 0 || st.st_size == 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+static void
+batch_mkdir(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	strlcpy(path, dir, sizeof(path));
+	for (p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/')) {
+		if (p != NULL)
+			*p = '\0';
+		if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+			err(EXIT_FAILURE, "Couldn't create %s", path);
+		if (p == NULL)
+			break;
+		*p = '/';
+	}
+}
+
+static int
+rmtree_cb(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+
+	if (remove(path) != 0)
+		warn("%s", path);
+
+	return (0);
+}
+
+static void
+batch_rmtree(const char *dir)
+{
+
+	(void)nftw(dir, rmtree_cb, 64, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.batchtest [-k] [-n jobs] [-w workers]\n");
+	exit(2);
+}
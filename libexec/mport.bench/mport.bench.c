@@ -0,0 +1,835 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * End-to-end benchmark: build a synthetic repository of bundles with
+ * mport_create_primative(), describe it with a generated index, serve it
+ * from a local HTTP stand-in for a mirror and time the package operations
+ * against a throwaway root.  Results are written as JSON so runs can be
+ * compared between commits.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sha256.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+#include <mport.h>
+
+#define BENCH_PREFIX	"/usr/local"
+/* where mport keeps its databases, under the root given to the instance */
+#define BENCH_INST_DIR	"/var/db/mport"
+#define BENCH_REPEAT	100	/* list and search are averaged over this many calls */
+
+enum bench_phase {
+	PHASE_FETCH,
+	PHASE_MERGE,
+	PHASE_INSTALL,
+	PHASE_VERIFY,
+	PHASE_LIST,
+	PHASE_SEARCH,
+	PHASE_UPGRADE,
+	PHASE_DELETE,
+	PHASE_MAX
+};
+
+static const char *phase_names[PHASE_MAX] = {
+	"fetch", "merge", "install", "verify", "list", "search", "upgrade", "delete"
+};
+
+/* bundles are built for both versions up front, the index selects one */
+static const char *versions[2] = { "1.0", "2.0" };
+
+struct bench_config {
+	int packages;
+	int files;
+	size_t size;
+	int depth;
+	int rounds;
+	int listener;
+	in_port_t port;
+	char workdir[PATH_MAX];
+	char repo[PATH_MAX];
+	char stage[PATH_MAX];
+	char root[PATH_MAX];
+	char cache[PATH_MAX];
+	char index[PATH_MAX];
+};
+
+static void usage(void);
+static double now(void);
+static void quiet_msg(const char *);
+static void quiet_progress_init(const char *);
+static void quiet_progress_step(int, int, const char *);
+static void quiet_progress_free(void);
+static int quiet_confirm(const char *, const char *, const char *, int);
+static void bench_mkdir(const char *);
+static int rmtree_cb(const char *, const struct stat *, int, struct FTW *);
+static void bench_rmtree(const char *);
+static mportInstance *bench_open(struct bench_config *);
+static void pkg_name(char *, size_t, int);
+static void write_file(const char *, size_t, uint32_t);
+static void create_bundle(mportInstance *, struct bench_config *, int, int);
+static void index_exec(sqlite3 *, const char *);
+static void write_index(struct bench_config *, int);
+static void serve_start(struct bench_config *, pthread_t *);
+static void *serve(void *);
+static void serve_one(struct bench_config *, int);
+static void bench_round(struct bench_config *, double *);
+static void report(FILE *, struct bench_config *, double, double **);
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_config cfg;
+	mportInstance *mport;
+	pthread_t server;
+	FILE *out = stdout;
+	const char *outfile = NULL;
+	double *times[PHASE_MAX];
+	double round[PHASE_MAX];
+	double setup;
+	bool keep = false;
+	bool madedir = false;
+	int ch, i, v, r;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.packages = 100;
+	cfg.files = 10;
+	cfg.size = 4096;
+	cfg.depth = 5;
+	cfg.rounds = 3;
+
+	while ((ch = getopt(argc, argv, "d:f:kn:o:r:s:w:")) != -1) {
+		switch (ch) {
+			case 'd':
+				if ((cfg.depth = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid dependency depth: %s", optarg);
+				break;
+			case 'f':
+				if ((cfg.files = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid file count: %s", optarg);
+				break;
+			case 'k':
+				keep = true;
+				break;
+			case 'n':
+				if ((cfg.packages = atoi(optarg)) < 1 || cfg.packages > 99999)
+					errx(EXIT_FAILURE, "Invalid package count: %s", optarg);
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'r':
+				if ((cfg.rounds = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid round count: %s", optarg);
+				break;
+			case 's':
+				if (atoi(optarg) < 0)
+					errx(EXIT_FAILURE, "Invalid file size: %s", optarg);
+				cfg.size = (size_t)atoi(optarg);
+				break;
+			case 'w':
+				if (realpath(optarg, cfg.workdir) == NULL)
+					err(EXIT_FAILURE, "%s", optarg);
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	if (cfg.workdir[0] == '\0') {
+		strlcpy(cfg.workdir, "/tmp/mport.bench.XXXXXXXX", sizeof(cfg.workdir));
+		if (mkdtemp(cfg.workdir) == NULL)
+			err(EXIT_FAILURE, "mkdtemp");
+		madedir = true;
+	}
+
+	(void)snprintf(cfg.repo, sizeof(cfg.repo), "%s/repo", cfg.workdir);
+	(void)snprintf(cfg.stage, sizeof(cfg.stage), "%s/stage", cfg.workdir);
+	(void)snprintf(cfg.root, sizeof(cfg.root), "%s/root", cfg.workdir);
+	(void)snprintf(cfg.cache, sizeof(cfg.cache), "%s/cache", cfg.workdir);
+	(void)snprintf(cfg.index, sizeof(cfg.index), "%s/index.db", cfg.workdir);
+	bench_mkdir(cfg.repo);
+	bench_mkdir(cfg.stage);
+	bench_mkdir(cfg.cache);
+	(void)snprintf(cfg.root + strlen(cfg.root), sizeof(cfg.root) - strlen(cfg.root), "%s", BENCH_INST_DIR);
+	bench_mkdir(cfg.root);
+	cfg.root[strlen(cfg.root) - strlen(BENCH_INST_DIR)] = '\0';
+
+	if (outfile != NULL && (out = fopen(outfile, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", outfile);
+
+	/* every operation below goes through the index and mirror in workdir */
+	if (setenv("PKG_DB", cfg.index, 1) == -1 || setenv("NO_PROXY", "127.0.0.1", 1) == -1)
+		err(EXIT_FAILURE, "setenv");
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	serve_start(&cfg, &server);
+
+	setup = now();
+	mport = mport_instance_new();
+	mport_set_msg_cb(mport, quiet_msg);
+	if (mport_instance_init(mport, cfg.root, cfg.cache, true, MPORT_VQUIET) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	for (v = 0; v < 2; v++) {
+		for (i = 0; i < cfg.packages; i++)
+			create_bundle(mport, &cfg, i, v);
+	}
+	mport_instance_free(mport);
+	setup = now() - setup;
+
+	for (i = 0; i < PHASE_MAX; i++) {
+		if ((times[i] = calloc(cfg.rounds, sizeof(double))) == NULL)
+			err(EXIT_FAILURE, "calloc");
+	}
+
+	for (r = 0; r < cfg.rounds; r++) {
+		bench_round(&cfg, round);
+		for (i = 0; i < PHASE_MAX; i++)
+			times[i][r] = round[i];
+	}
+
+	report(out, &cfg, setup, times);
+	if (out != stdout)
+		fclose(out);
+
+	pthread_cancel(server);
+	pthread_join(server, NULL);
+	close(cfg.listener);
+
+	for (i = 0; i < PHASE_MAX; i++)
+		free(times[i]);
+
+	if (madedir && !keep)
+		bench_rmtree(cfg.workdir);
+
+	return (0);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+
+/* the JSON report owns stdout, so the library is kept quiet */
+static void
+quiet_msg(const char *msg)
+{
+}
+
+static void
+quiet_progress_init(const char *title)
+{
+}
+
+static void
+quiet_progress_step(int current, int total, const char *msg)
+{
+}
+
+static void
+quiet_progress_free(void)
+{
+}
+
+static int
+quiet_confirm(const char *msg, const char *yes, const char *no, int def)
+{
+
+	return (MPORT_OK);
+}
+
+
+static void
+bench_mkdir(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	strlcpy(path, dir, sizeof(path));
+	for (p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/')) {
+		if (p != NULL)
+			*p = '\0';
+		if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+			err(EXIT_FAILURE, "Couldn't create %s", path);
+		if (p == NULL)
+			break;
+		*p = '/';
+	}
+}
+
+static int
+rmtree_cb(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+
+	if (remove(path) != 0)
+		warn("%s", path);
+
+	return (0);
+}
+
+static void
+bench_rmtree(const char *dir)
+{
+
+	(void)nftw(dir, rmtree_cb, 64, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+}
+
+
+/*
+ * Open an instance on the throwaway root with the generated index attached.
+ * noIndex keeps mport_index_load() from trying to refresh it.
+ */
+static mportInstance *
+bench_open(struct bench_config *cfg)
+{
+	mportInstance *mport;
+
+	if ((mport = mport_instance_new()) == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	mport_set_msg_cb(mport, quiet_msg);
+	mport_set_progress_init_cb(mport, quiet_progress_init);
+	mport_set_progress_step_cb(mport, quiet_progress_step);
+	mport_set_progress_free_cb(mport, quiet_progress_free);
+	mport_set_confirm_cb(mport, quiet_confirm);
+
+	if (mport_instance_init(mport, cfg->root, cfg->cache, true, MPORT_VQUIET) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+
+	if (mport_index_load(mport) != MPORT_OK)
+		errx(EXIT_FAILURE, "Unable to load the generated index: %s", mport_err_string());
+
+	return (mport);
+}
+
+
+static void
+pkg_name(char *name, size_t len, int i)
+{
+
+	(void)snprintf(name, len, "bench-%05d", i);
+}
+
+
+/* incompressible filler, different for every file and version */
+static void
+write_file(const char *path, size_t size, uint32_t seed)
+{
+	FILE *fp;
+	uint32_t buf[1024];
+	size_t n, i;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+
+	seed |= 1;
+	while (size > 0) {
+		for (i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			buf[i] = seed;
+		}
+		n = size < sizeof(buf) ? size : sizeof(buf);
+		if (fwrite(buf, 1, n, fp) != n)
+			err(EXIT_FAILURE, "%s", path);
+		size -= n;
+	}
+
+	if (fclose(fp) != 0)
+		err(EXIT_FAILURE, "%s", path);
+}
+
+
+/*
+ * Package i depends on package i - 1 unless it starts a new chain, so the
+ * repository is made of chains depth packages long.
+ */
+static void
+create_bundle(mportInstance *mport, struct bench_config *cfg, int i, int v)
+{
+	mportPackageMeta *pack;
+	mportCreateExtras *extra;
+	mportAssetList *assetlist;
+	char name[32], dep[32];
+	char dir[PATH_MAX], file[PATH_MAX], rel[PATH_MAX];
+	int f;
+
+	pkg_name(name, sizeof(name), i);
+
+	pack = mport_pkgmeta_new();
+	extra = mport_createextras_new();
+	assetlist = mport_assetlist_new();
+	if (pack == NULL || extra == NULL || assetlist == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	(void)snprintf(extra->sourcedir, sizeof(extra->sourcedir), "%s/%s-%s", cfg->stage, name, versions[v]);
+	(void)snprintf(extra->pkg_filename, sizeof(extra->pkg_filename), "%s/%s-%s.mport", cfg->repo, name,
+	    versions[v]);
+	(void)snprintf(dir, sizeof(dir), "%s%s/share/bench/%s", extra->sourcedir, BENCH_PREFIX, name);
+	bench_mkdir(dir);
+
+	for (f = 0; f < cfg->files; f++) {
+		(void)snprintf(file, sizeof(file), "%s/file%05d", dir, f);
+		write_file(file, cfg->size, (uint32_t)(i * 7919 + f * 31 + v));
+		(void)snprintf(rel, sizeof(rel), "share/bench/%s/file%05d", name, f);
+		if (mport_assetlist_append(assetlist, ASSET_FILE, rel) == NULL)
+			errx(EXIT_FAILURE, "Failed to allocate memory");
+	}
+	(void)snprintf(rel, sizeof(rel), "share/bench/%s", name);
+	if (mport_assetlist_append(assetlist, ASSET_DIRRM, rel) == NULL ||
+	    mport_assetlist_append(assetlist, ASSET_DIRRMTRY, "share/bench") == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	pack->name = strdup(name);
+	pack->version = strdup(versions[v]);
+	pack->prefix = strdup(BENCH_PREFIX);
+	pack->comment = strdup("Synthetic benchmark package");
+	asprintf(&pack->origin, "benchmarks/%s", name);
+	pack->categories = calloc(2, sizeof(char *));
+	if (pack->categories != NULL) {
+		pack->categories[0] = strdup("benchmarks");
+		pack->categories_count = 1;
+	}
+	if (pack->name == NULL || pack->version == NULL || pack->prefix == NULL || pack->comment == NULL ||
+	    pack->origin == NULL || pack->categories == NULL || pack->categories[0] == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	if (i % cfg->depth != 0) {
+		pkg_name(dep, sizeof(dep), i - 1);
+		if ((extra->depends = calloc(2, sizeof(char *))) == NULL)
+			errx(EXIT_FAILURE, "Failed to allocate memory");
+		if (asprintf(&extra->depends[0], "%s:benchmarks/%s:>=%s", dep, dep, versions[v]) == -1)
+			errx(EXIT_FAILURE, "Failed to allocate memory");
+		extra->depends_count = 1;
+	}
+
+	if (mport_create_primative(mport, assetlist, pack, extra) != MPORT_OK)
+		errx(EXIT_FAILURE, "Unable to create %s: %s", extra->pkg_filename, mport_err_string());
+
+	mport_assetlist_free(assetlist);
+	mport_pkgmeta_free(pack);
+	mport_createextras_free(extra);
+}
+
+
+static void
+index_exec(sqlite3 *db, const char *sql)
+{
+
+	if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "index.db: %s", sqlite3_errmsg(db));
+}
+
+
+/*
+ * (Re)write the index so that it offers version v of every package and
+ * points the default mirror region at the local server.
+ */
+static void
+write_index(struct bench_config *cfg, int v)
+{
+	sqlite3 *db;
+	sqlite3_stmt *pkg, *dep;
+	char name[32], prev[32], bundle[64], path[PATH_MAX];
+	char *hash, *sql;
+	int i;
+
+	(void)unlink(cfg->index);
+	if (sqlite3_open(cfg->index, &db) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", cfg->index, sqlite3_errmsg(db));
+
+	index_exec(db, "CREATE TABLE packages (pkg text NOT NULL, version text NOT NULL, comment text, "
+	    "bundlefile text NOT NULL, license text, hash text, type int)");
+	index_exec(db, "CREATE TABLE depends (pkg text NOT NULL, version text NOT NULL, d_pkg text NOT NULL, "
+	    "d_version text NOT NULL)");
+	index_exec(db, "CREATE TABLE moved (port text NOT NULL, moved_to text, why text, date text)");
+	index_exec(db, "CREATE TABLE aliases (pkg text NOT NULL, alias text NOT NULL)");
+	index_exec(db, "CREATE TABLE mirrors (country text NOT NULL, mirror text NOT NULL)");
+	index_exec(db, "CREATE INDEX packages_pkg ON packages (pkg)");
+	index_exec(db, "CREATE INDEX depends_pkg ON depends (pkg, version)");
+
+	sql = sqlite3_mprintf("INSERT INTO mirrors VALUES ('us', 'http://127.0.0.1:%d')", (int)cfg->port);
+	index_exec(db, sql);
+	sqlite3_free(sql);
+
+	index_exec(db, "BEGIN TRANSACTION");
+	if (sqlite3_prepare_v2(db, "INSERT INTO packages VALUES (?, ?, 'Synthetic benchmark package', ?, 'bsd2', ?, 0)",
+	    -1, &pkg, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO depends VALUES (?, ?, ?, ?)", -1, &dep, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "index.db: %s", sqlite3_errmsg(db));
+
+	for (i = 0; i < cfg->packages; i++) {
+		pkg_name(name, sizeof(name), i);
+		(void)snprintf(bundle, sizeof(bundle), "%s-%s.mport", name, versions[v]);
+		(void)snprintf(path, sizeof(path), "%s/%s", cfg->repo, bundle);
+		if ((hash = SHA256_File(path, NULL)) == NULL)
+			errx(EXIT_FAILURE, "Unable to hash %s", path);
+
+		sqlite3_bind_text(pkg, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 2, versions[v], -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 3, bundle, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 4, hash, -1, SQLITE_STATIC);
+		if (sqlite3_step(pkg) != SQLITE_DONE)
+			errx(EXIT_FAILURE, "index.db: %s", sqlite3_errmsg(db));
+		sqlite3_reset(pkg);
+		free(hash);
+
+		if (i % cfg->depth == 0)
+			continue;
+
+		pkg_name(prev, sizeof(prev), i - 1);
+		sqlite3_bind_text(dep, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(dep, 2, versions[v], -1, SQLITE_STATIC);
+		sqlite3_bind_text(dep, 3, prev, -1, SQLITE_STATIC);
+		sqlite3_bind_text(dep, 4, versions[v], -1, SQLITE_STATIC);
+		if (sqlite3_step(dep) != SQLITE_DONE)
+			errx(EXIT_FAILURE, "index.db: %s", sqlite3_errmsg(db));
+		sqlite3_reset(dep);
+	}
+
+	sqlite3_finalize(pkg);
+	sqlite3_finalize(dep);
+	index_exec(db, "COMMIT TRANSACTION");
+	sqlite3_close(db);
+}
+
+
+/*
+ * A stand-in for a mirror: HTTP/1.0, one request per connection, and the
+ * last path component names the bundle in the repository directory, so the
+ * arch and release parts of the mirror layout don't matter.
+ */
+static void
+serve_start(struct bench_config *cfg, pthread_t *thread)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if ((cfg->listener = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = 0;
+
+	if (bind(cfg->listener, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+	    getsockname(cfg->listener, (struct sockaddr *)&sin, &len) == -1 ||
+	    listen(cfg->listener, 64) == -1)
+		err(EXIT_FAILURE, "local mirror");
+	cfg->port = ntohs(sin.sin_port);
+
+	if ((errno = pthread_create(thread, NULL, serve, cfg)) != 0)
+		err(EXIT_FAILURE, "pthread_create");
+}
+
+static void *
+serve(void *arg)
+{
+	struct bench_config *cfg = arg;
+	int fd;
+
+	for (;;) {
+		/* accept(2) is the cancellation point main() stops us at */
+		if ((fd = accept(cfg->listener, NULL, NULL)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			warn("accept");
+			break;
+		}
+		serve_one(cfg, fd);
+		close(fd);
+	}
+
+	return (NULL);
+}
+
+static void
+serve_one(struct bench_config *cfg, int fd)
+{
+	char req[4096], method[8], target[1024], path[PATH_MAX], buf[65536];
+	char *base;
+	struct stat st;
+	size_t have = 0;
+	ssize_t n;
+	int file;
+
+	/* the request line and headers, the body of a GET is empty */
+	while (have < sizeof(req) - 1) {
+		if ((n = read(fd, req + have, sizeof(req) - 1 - have)) <= 0)
+			return;
+		have += (size_t)n;
+		req[have] = '\0';
+		if (strstr(req, "\r\n\r\n") != NULL)
+			break;
+	}
+
+	if (sscanf(req, "%7s %1023s", method, target) != 2)
+		return;
+
+	base = strrchr(target, '/');
+	base = base == NULL ? target : base + 1;
+	(void)snprintf(path, sizeof(path), "%s/%s", cfg->repo, base);
+
+	if (*base == '\0' || strstr(base, "..") != NULL || (file = open(path, O_RDONLY)) == -1) {
+		dprintf(fd, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		return;
+	}
+
+	if (fstat(file, &st) == -1) {
+		close(file);
+		return;
+	}
+
+	dprintf(fd, "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n"
+	    "Content-Length: %jd\r\nConnection: close\r\n\r\n", (intmax_t)st.st_size);
+
+	if (strcmp(method, "GET") == 0) {
+		while ((n = read(file, buf, sizeof(buf))) > 0) {
+			if (write(fd, buf, (size_t)n) != n)
+				break;
+		}
+	}
+
+	close(file);
+}
+
+
+/*
+ * One pass over every phase.  The index offers 1.0 for fetch through search,
+ * then 2.0 for the upgrade; the delete leaves the root empty for the next
+ * round.
+ */
+static void
+bench_round(struct bench_config *cfg, double *t)
+{
+	mportInstance *mport;
+	mportTransaction *txn;
+	mportPackageMeta **packs, **p;
+	mportIndexEntry **e;
+	char name[32], bundle[64], merged[PATH_MAX];
+	char term[] = "bench-*";
+	const char **bundles;
+	char **paths;
+	double start;
+	int i, count;
+
+	write_index(cfg, 0);
+	mport = bench_open(cfg);
+
+	bench_rmtree(cfg->cache);
+	bench_mkdir(cfg->cache);
+	start = now();
+	for (i = 0; i < cfg->packages; i++) {
+		pkg_name(name, sizeof(name), i);
+		(void)snprintf(bundle, sizeof(bundle), "%s-%s.mport", name, versions[0]);
+		if (mport_fetch_bundle(mport, cfg->cache, bundle) != MPORT_OK)
+			errx(EXIT_FAILURE, "fetch %s: %s", bundle, mport_err_string());
+	}
+	t[PHASE_FETCH] = now() - start;
+
+	/* every bundle of the repository into one, as for a base image set */
+	if ((bundles = calloc(cfg->packages + 1, sizeof(char *))) == NULL ||
+	    (paths = calloc(cfg->packages, sizeof(char *))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < cfg->packages; i++) {
+		pkg_name(name, sizeof(name), i);
+		if (asprintf(&paths[i], "%s/%s-%s.mport", cfg->repo, name, versions[0]) == -1)
+			err(EXIT_FAILURE, "asprintf");
+		bundles[i] = paths[i];
+	}
+	(void)snprintf(merged, sizeof(merged), "%s/merged.mport", cfg->workdir);
+	start = now();
+	if (mport_merge_primative(mport, bundles, merged) != MPORT_OK)
+		errx(EXIT_FAILURE, "merge: %s", mport_err_string());
+	t[PHASE_MERGE] = now() - start;
+	(void)unlink(merged);
+	for (i = 0; i < cfg->packages; i++)
+		free(paths[i]);
+	free(paths);
+	free(bundles);
+
+	/* install fetches again; only chain tops are asked for, the rest come in as dependencies */
+	bench_rmtree(cfg->cache);
+	bench_mkdir(cfg->cache);
+	start = now();
+	if ((txn = mport_txn_begin(mport)) == NULL)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	for (i = 0; i < cfg->packages; i++) {
+		if ((i + 1) % cfg->depth != 0 && i != cfg->packages - 1)
+			continue;
+		pkg_name(name, sizeof(name), i);
+		if (mport_txn_add_install(txn, name, NULL, MPORT_EXPLICIT) != MPORT_OK)
+			errx(EXIT_FAILURE, "install %s: %s", name, mport_err_string());
+	}
+	if (mport_txn_commit(txn) != MPORT_OK)
+		errx(EXIT_FAILURE, "install: %s", mport_err_string());
+	mport_txn_free(txn);
+	t[PHASE_INSTALL] = now() - start;
+
+	start = now();
+	if (mport_pkgmeta_list(mport, &packs) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	for (p = packs; p != NULL && *p != NULL; p++) {
+		if (mport_verify_package(mport, *p) != MPORT_OK)
+			errx(EXIT_FAILURE, "verify %s: %s", (*p)->name, mport_err_string());
+	}
+	mport_pkgmeta_vec_free(packs);
+	t[PHASE_VERIFY] = now() - start;
+
+	start = now();
+	for (i = 0; i < BENCH_REPEAT; i++) {
+		if (mport_pkgmeta_list(mport, &packs) != MPORT_OK)
+			errx(EXIT_FAILURE, "%s", mport_err_string());
+		mport_pkgmeta_vec_free(packs);
+	}
+	t[PHASE_LIST] = (now() - start) / BENCH_REPEAT;
+
+	start = now();
+	for (i = 0; i < BENCH_REPEAT; i++) {
+		if (mport_index_search_term(mport, &e, term) != MPORT_OK)
+			errx(EXIT_FAILURE, "%s", mport_err_string());
+		mport_index_entry_free_vec(e);
+	}
+	t[PHASE_SEARCH] = (now() - start) / BENCH_REPEAT;
+
+	mport_instance_free(mport);
+	write_index(cfg, 1);
+	mport = bench_open(cfg);
+
+	start = now();
+	if (mport_upgrade(mport) < 0)
+		errx(EXIT_FAILURE, "upgrade: %s", mport_err_string());
+	t[PHASE_UPGRADE] = now() - start;
+
+	/* mport_upgrade() only reports failures through the message callback */
+	if (mport_pkgmeta_search_master(mport, &packs, "version=%Q", versions[1]) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	for (count = 0, p = packs; p != NULL && *p != NULL; p++)
+		count++;
+	mport_pkgmeta_vec_free(packs);
+	if (count != cfg->packages)
+		errx(EXIT_FAILURE, "upgrade: %d of %d packages upgraded", count, cfg->packages);
+
+	start = now();
+	if ((txn = mport_txn_begin(mport)) == NULL)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	for (i = 0; i < cfg->packages; i++) {
+		pkg_name(name, sizeof(name), i);
+		if (mport_txn_add_delete(txn, name) != MPORT_OK)
+			errx(EXIT_FAILURE, "delete %s: %s", name, mport_err_string());
+	}
+	if (mport_txn_commit(txn) != MPORT_OK)
+		errx(EXIT_FAILURE, "delete: %s", mport_err_string());
+	mport_txn_free(txn);
+	t[PHASE_DELETE] = now() - start;
+
+	mport_instance_free(mport);
+}
+
+
+static void
+report(FILE *out, struct bench_config *cfg, double setup, double **times)
+{
+	double min, max, sum;
+	int i, r;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"packages\": %d,\n", cfg->packages);
+	fprintf(out, "  \"files\": %d,\n", cfg->files);
+	fprintf(out, "  \"size\": %zu,\n", cfg->size);
+	fprintf(out, "  \"depth\": %d,\n", cfg->depth);
+	fprintf(out, "  \"rounds\": %d,\n", cfg->rounds);
+	fprintf(out, "  \"setup\": %.6f,\n", setup);
+	fprintf(out, "  \"phases\": {\n");
+
+	for (i = 0; i < PHASE_MAX; i++) {
+		min = max = sum = times[i][0];
+		fprintf(out, "    \"%s\": {\"runs\": [%.6f", phase_names[i], times[i][0]);
+		for (r = 1; r < cfg->rounds; r++) {
+			fprintf(out, ", %.6f", times[i][r]);
+			if (times[i][r] < min)
+				min = times[i][r];
+			if (times[i][r] > max)
+				max = times[i][r];
+			sum += times[i][r];
+		}
+		fprintf(out, "], \"min\": %.6f, \"mean\": %.6f, \"max\": %.6f}%s\n", min, sum / cfg->rounds, max,
+		    i == PHASE_MAX - 1 ? "" : ",");
+	}
+
+	fprintf(out, "  }\n");
+	fprintf(out, "}\n");
+}
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.bench [-k] [-n packages] [-f files] [-s size] [-d depth] [-r rounds]\n");
+	fprintf(stderr, "                   [-w workdir] [-o output]\n");
+	exit(2);
+}
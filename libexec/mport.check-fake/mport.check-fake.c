@@ -29,18 +29,26 @@
 #include <sys/cdefs.h>
 __MBSDID("$MidnightBSD$");
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <mport.h>
+#include <pthread.h>
+#include <search.h>
 #include <sysexits.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <regex.h>
+#include <ucl.h>
 
 #ifdef PRINT_DIAG
 #define DIAG(fmt, ...) warnx(fmt, ##__VA_ARGS__);
@@ -48,20 +56,69 @@ __MBSDID("$MidnightBSD$");
 #define DIAG(fmt, ...) 
 #endif
 
+/*
+ * The plist is loaded into a hash of the paths its files should have
+ * under destdir, and destdir is walked once with fts(3).  Every file met
+ * is looked up in the hash; the ones that aren't there are reported as
+ * not in the plist, and the plist files never met as not installed.
+ * The regular files are then searched for destdir by a pool of threads.
+ */
+struct fake_file {
+	const char *data;	/* path as listed in the plist */
+	char *cwd;		/* @cwd it was listed under */
+	bool check;		/* an @file the fake is judged on */
+	bool found;		/* met in the walk of destdir */
+	bool contains;		/* destdir was found in it */
+	int error;		/* errno if it couldn't be searched */
+	char path[];		/* where it should be under destdir */
+};
+
+/* the last directory of the plist resolved; consecutive entries mostly share one */
+struct fake_dir {
+	char path[PATH_MAX];	/* as written, under destdir */
+	char real[PATH_MAX];	/* resolved, or empty to keep it as written */
+};
+
+struct fake_list {
+	void **items;
+	size_t count;
+	size_t size;
+};
+
+struct fake_search {
+	const char *needle;
+	size_t needle_len;
+	struct fake_list *files;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
 static void usage(void);
-static int check_fake(mportAssetList *, const char *, const char *, const char *);
-static int grep_file(const char *, const char *);
+static int load_plist(mportAssetList *, const char *, const char *, struct fake_list *);
+static struct fake_file *fake_file_new(const char *, const char *, const char *, bool, struct fake_dir *);
+static int walk_destdir(const char *, regex_t *, struct fake_list *, struct fake_list *);
+static void search_files(struct fake_list *, const char *, int);
+static void *search_worker(void *);
+static int search_file(const char *, const char *, size_t, bool *);
+static int report(struct fake_list *, struct fake_list *, const char *, const char *, const char *);
+static void list_append(struct fake_list *, void *);
+static int compare_paths(const void *, const void *);
 
 int
 main(int argc, char *argv[]) 
 {
-	int ch, ret;
+	int ch, ret, jobs = 0;
 	const char *skip = NULL, *prefix = NULL, *destdir = NULL, *assetlistfile = NULL;
+	const char *reportfile = NULL;
 	mportAssetList *assetlist;
 	FILE *fp;
 	const char *chroot_path = NULL;
+	char *anchored_skip, *root;
+	char realroot[PATH_MAX];
+	regex_t skipre;
+	struct fake_list plist = { NULL, 0, 0 }, unlisted = { NULL, 0, 0 }, search = { NULL, 0, 0 };
 
-	while ((ch = getopt(argc, argv, "c:f:d:s:p:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:f:d:j:o:s:p:")) != -1) {
 		switch (ch) {
 			case 'c':
 				chroot_path = optarg;
@@ -78,6 +135,12 @@ main(int argc, char *argv[])
 			case 'f':
 				assetlistfile = optarg;
 				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 'o':
+				reportfile = optarg;
+				break;
 			case '?':
 			default:
 				usage();
@@ -108,10 +171,45 @@ main(int argc, char *argv[])
 	if (mport_parse_plistfile(fp, assetlist) != MPORT_OK)
 		err(EX_DATAERR, "Invalid assetlist");
 
+	fclose(fp);
+
+	if (skip != NULL) {
+		DIAG("Compiling skip: %s", skip)
+
+		if (asprintf(&anchored_skip, "^%s$", skip) == -1)
+			err(EX_OSERR, "Could not build skip regex");
+
+		if (regcomp(&skipre, anchored_skip, REG_EXTENDED|REG_NOSUB) != 0)
+			errx(EX_DATAERR, "Could not compile skip regex");
+
+		free(anchored_skip);
+	}
+
+	/* paths are compared as strings, so spell destdir without a trailing slash */
+	if ((root = strdup(destdir)) == NULL)
+		err(EX_OSERR, "Could not copy destdir");
+	while (root[0] != '\0' && root[strlen(root) - 1] == '/')
+		root[strlen(root) - 1] = '\0';
+
+	/* the walk and the plist paths use the resolved destdir, the search the one given */
+	if (realpath(root[0] == '\0' ? "/" : root, realroot) == NULL)
+		err(EX_NOINPUT, "Could not resolve %s", destdir);
+	if (strcmp(realroot, "/") == 0)
+		realroot[0] = '\0';
+
 	DIAG("running check_fake")
 	
 	printf("Checking %s\n", destdir);
-	ret = check_fake(assetlist, destdir, prefix, skip);
+
+	ret = load_plist(assetlist, realroot, prefix, &plist);
+
+	if (walk_destdir(realroot, skip != NULL ? &skipre : NULL, &unlisted, &search) != 0)
+		ret = 1;
+
+	search_files(&search, root, jobs);
+
+	if (report(&plist, &unlisted, root, prefix, reportfile) != 0)
+		ret = 1;
 	
 	if (ret == 0) {
 		printf("Fake succeeded.\n");
@@ -119,162 +217,431 @@ main(int argc, char *argv[])
 		printf("Fake failed.\n");
 	}
 	
+	if (skip != NULL)
+		regfree(&skipre);
+
 	mport_assetlist_free(assetlist);
 	
 	return ret;
 }
 
+/*
+ * Enter every file of the plist into the hash and, in plist order, into
+ * plist.  Only @file entries decide the outcome, as they always have; the
+ * rest are there so they aren't reported as missing from the plist.
+ */
 static int
-check_fake(mportAssetList *assetlist, const char *destdir, const char *prefix, const char *skip)
+load_plist(mportAssetList *assetlist, const char *destdir, const char *prefix, struct fake_list *plist)
 {
 	mportAssetListEntry *e;
-	char cwd[FILENAME_MAX], file[FILENAME_MAX];
-	char *anchored_skip;
-	struct stat st;
-	regex_t skipre;
-	int ret = 0;
+	struct fake_file *f;
+	struct fake_dir lastdir;
+	const char *cwd = prefix;
+	ENTRY item, *found;
+	size_t total = 0;
 
-	DIAG("checking skip: %s", skip)
-		
-	if (skip != NULL) {
-		DIAG("Compiling skip: %s", skip)
-		
-		if (asprintf(&anchored_skip, "^%s$", skip) == -1)
-			err(EX_OSERR, "Could not build skip regex");
-		
-		if (regcomp(&skipre, anchored_skip, REG_EXTENDED|REG_NOSUB) != 0)
-			errx(EX_DATAERR, "Could not compile skip regex");
-			
-		free(anchored_skip);	
-	}
-	
-	DIAG("Coping prefix (%s) to cwd", prefix)
-	
-	(void)strlcpy(cwd, prefix, FILENAME_MAX);
+	STAILQ_FOREACH(e, assetlist, next)
+		total++;
+
+	if (hcreate(total * 2 + 1) == 0)
+		err(EX_OSERR, "Could not create plist hash");
+
+	lastdir.path[0] = '\0';
 
 	DIAG("Starting loop, cwd: %s", cwd)
-	
+
 	STAILQ_FOREACH(e, assetlist, next) {
-		if (e->type == ASSET_CWD) {
-				if (e->data == NULL) {
-					DIAG("Setting cwd to '%s'", prefix)
-					(void)strlcpy(cwd, prefix, FILENAME_MAX);
-				} else {
-					DIAG("Setting cwd to '%s'", e->data)
-					(void)strlcpy(cwd, e->data, FILENAME_MAX);
-				}
-				
+		switch (e->type) {
+			case ASSET_CWD:
+				cwd = e->data == NULL ? prefix : e->data;
+				DIAG("Setting cwd to '%s'", cwd)
+				continue;
+			case ASSET_FILE:
+			case ASSET_FILE_OWNER_MODE:
+			case ASSET_SAMPLE:
+			case ASSET_SAMPLE_OWNER_MODE:
+			case ASSET_SHELL:
+			case ASSET_INFO:
 				break;
+			default:
+				continue;
 		}
-		
-		if (e->type != ASSET_FILE)
+
+		f = fake_file_new(destdir, cwd, e->data, e->type == ASSET_SAMPLE ||
+		    e->type == ASSET_SAMPLE_OWNER_MODE, &lastdir);
+		f->check = e->type == ASSET_FILE;
+
+		item.key = f->path;
+		item.data = f;
+		if ((found = hsearch(item, ENTER)) == NULL)
+			err(EX_OSERR, "Could not add %s to the plist hash", f->path);
+
+		/* listed twice; the first one stands for both */
+		if (found->data != f) {
+			((struct fake_file *)found->data)->check |= f->check;
+			free(f->cwd);
+			free(f);
 			continue;
+		}
 
-		if (e->data[0] == '/')
-			(void)snprintf(file, FILENAME_MAX, "%s%s", destdir, e->data);
-		else		
-			(void)snprintf(file, FILENAME_MAX, "%s%s/%s", destdir, cwd, e->data);
+		list_append(plist, f);
+	}
 
-		DIAG("checking %s", file)
-			
-		if (lstat(file, &st) != 0) {
-			(void)snprintf(file, FILENAME_MAX, "%s/%s", cwd, e->data);
-			
-			if (lstat(file, &st) == 0) {
-				(void)printf("		%s installed in %s\n", e->data, cwd);
-			} else {
-				(void)printf("		%s not installed.\n", e->data);
-			}
-			
-			ret = 1;
+	return 0;
+}
+
+static struct fake_file *
+fake_file_new(const char *destdir, const char *cwd, const char *data, bool sample, struct fake_dir *lastdir)
+{
+	struct fake_file *f;
+	char path[FILENAME_MAX], resolved[FILENAME_MAX];
+	char *src, *dst, *base;
+	size_t len;
+
+	if (data[0] == '/')
+		(void)snprintf(path, sizeof(path), "%s%s", destdir, data);
+	else		
+		(void)snprintf(path, sizeof(path), "%s%s/%s", destdir, cwd, data);
+
+	/* collapse doubled slashes, and drop the second filename of a @sample */
+	for (src = dst = path; *src != '\0'; src++) {
+		if (sample && (*src == ' ' || *src == '\t'))
+			break;
+		if (*src == '/' && dst > path && dst[-1] == '/')
 			continue;
+		*dst++ = *src;
+	}
+	*dst = '\0';
+
+	/*
+	 * The walk meets files by their real path, so resolve "./", ".." and
+	 * symlinked directories in the stage the way the old per-file lstat
+	 * did.  The last component is left alone, so a symlink is matched as
+	 * itself, and a directory that resolves outside destdir is kept as
+	 * written.  The directory is only resolved again when it differs from
+	 * the previous entry's.
+	 */
+	if ((base = strrchr(path, '/')) != NULL && base != path) {
+		*base++ = '\0';
+		if (strcmp(path, lastdir->path) != 0) {
+			(void)strlcpy(lastdir->path, path, sizeof(lastdir->path));
+			len = strlen(destdir);
+			if (realpath(path, lastdir->real) == NULL || strncmp(lastdir->real, destdir, len) != 0 ||
+			    (lastdir->real[len] != '/' && lastdir->real[len] != '\0'))
+				lastdir->real[0] = '\0';
 		}
-		
-		if (S_ISLNK(st.st_mode))
-			continue;	 /* skip symlinks */
+		if (lastdir->real[0] != '\0') {
+			(void)snprintf(resolved, sizeof(resolved), "%s/%s",
+			    strcmp(lastdir->real, "/") == 0 ? "" : lastdir->real, base);
+			(void)strlcpy(path, resolved, sizeof(path));
+		} else
+			base[-1] = '/';
+	}
 
-		/* if file matches skip continue */
-		if (skip != NULL && (regexec(&skipre, e->data, 0, NULL, 0) == 0))
-			continue;			 
-		
-		DIAG("==> Grepping %s", file)
-		/* grep file for fake destdir */
-		if (grep_file(file, destdir)) {
-			(void)printf("		%s contains the fake destdir\n", e->data);
-			ret = 1;
+	if ((f = calloc(1, sizeof(*f) + strlen(path) + 1)) == NULL)
+		err(EX_OSERR, "Could not allocate plist entry");
+
+	strcpy(f->path, path);
+	f->data = data;
+	if ((f->cwd = strdup(cwd)) == NULL)
+		err(EX_OSERR, "Could not allocate plist entry");
+
+	return f;
+}
+
+/*
+ * Walk destdir, marking the plist files found.  Files not in the plist are
+ * added to unlisted, and the regular @file entries to be searched for
+ * destdir to search.
+ */
+static int
+walk_destdir(const char *destdir, regex_t *skipre, struct fake_list *unlisted, struct fake_list *search)
+{
+	FTS *fts;
+	FTSENT *ent;
+	ENTRY item, *found;
+	struct fake_file *f;
+	char top[PATH_MAX];
+	char *paths[2];
+	size_t skip_len;
+	int ret = 0;
+
+	/* fts_open() takes a non-const argv */
+	(void)strlcpy(top, destdir[0] == '\0' ? "/" : destdir, sizeof(top));
+	paths[0] = top;
+	paths[1] = NULL;
+	skip_len = strlen(destdir);
+
+	if ((fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		err(EX_OSERR, "Could not walk %s", paths[0]);
+
+	for (;;) {
+		errno = 0;
+		if ((ent = fts_read(fts)) == NULL)
+			break;
+
+		switch (ent->fts_info) {
+			case FTS_D:
+			case FTS_DP:
+			case FTS_DC:
+				continue;
+			case FTS_DNR:
+			case FTS_ERR:
+			case FTS_NS:
+				warnx("%s: %s", ent->fts_path, strerror(ent->fts_errno));
+				ret = 1;
+				continue;
+			default:
+				break;
+		}
+
+		item.key = ent->fts_path;
+		if ((found = hsearch(item, FIND)) == NULL) {
+			list_append(unlisted, strdup(ent->fts_path + skip_len));
+			continue;
 		}
+
+		f = found->data;
+		f->found = true;
+
+		/* symlinks are only checked for presence */
+		if (!f->check || ent->fts_info != FTS_F)
+			continue;
+
+		/* if file matches skip continue */
+		if (skipre != NULL && regexec(skipre, f->data, 0, NULL, 0) == 0)
+			continue;
+
+		list_append(search, f);
 	}
-	
-	if (skip != NULL)
-		regfree(&skipre);
-	
+
+	if (errno != 0) {
+		warn("Could not walk %s", paths[0]);
+		ret = 1;
+	}
+
+	fts_close(fts);
+
 	return ret;
-} 
-			
+}
+
+/*
+ * Search the files for destdir with jobs threads, or one per CPU.
+ */
+static void
+search_files(struct fake_list *files, const char *destdir, int jobs)
+{
+	struct fake_search search;
+	pthread_t *threads;
+	int started, i;
+
+	if (files->count == 0)
+		return;
+
+	if (jobs <= 0)
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+	if ((size_t)jobs > files->count)
+		jobs = (int)files->count;
+
+	search.needle = destdir;
+	search.needle_len = strlen(destdir);
+	search.files = files;
+	search.next = 0;
+	pthread_mutex_init(&search.lock, NULL);
+
+	if ((threads = calloc(jobs, sizeof(pthread_t))) == NULL)
+		err(EX_OSERR, "Could not allocate threads");
+
+	/* this thread is a worker too, so no extra thread is needed for one job */
+	for (started = 0; started < jobs - 1; started++)
+		if (pthread_create(&threads[started], NULL, search_worker, &search) != 0)
+			break;
+
+	search_worker(&search);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
 
+	pthread_mutex_destroy(&search.lock);
+	free(threads);
+}
+
+static void *
+search_worker(void *arg)
+{
+	struct fake_search *search = arg;
+	struct fake_file *f;
+
+	for (;;) {
+		pthread_mutex_lock(&search->lock);
+		f = search->next < search->files->count ? search->files->items[search->next++] : NULL;
+		pthread_mutex_unlock(&search->lock);
+
+		if (f == NULL)
+			return NULL;
+
+		DIAG("==> Searching %s", f->path)
+		f->error = search_file(f->path, search->needle, search->needle_len, &f->contains);
+	}
+}
+
+/*
+ * Look for the fake destdir in a file.  It is a plain string, so the whole
+ * file is mapped and scanned with memmem(3) rather than matched line by line.
+ */
 static int
-grep_file(const char *filename, const char *destdir)
+search_file(const char *path, const char *needle, size_t len, bool *contains)
 {
-	FILE *file;
-	char *line, *nline;
-	char *destdir_fixed;
-	static regex_t regex;
-	static int compiled = 0;
-	size_t len;
-	int ret = 0;
-	
-	DIAG("===> Compiling destdir: %s", destdir)
-	
-	/* Should we cache the compiled regex? */
-	if (!compiled) {
-		/* + is a special character, deal with it so archivers/zipios++ works */
-		destdir_fixed = mport_string_replace(destdir, "+", "\\+");
-		DIAG("===> destdir_fixed for regular expression: %s", destdir_fixed)
-		if (regcomp(&regex, destdir_fixed, REG_EXTENDED|REG_NOSUB) != 0)
-			errx(EX_DATAERR, "Could not compile destdir regex");
-		free(destdir_fixed);
-		compiled++;
+	struct stat st;
+	void *map;
+	int fd;
+
+	*contains = false;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return errno;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return errno;
 	}
-	
-	if ((file = fopen(filename, "r")) == NULL)
-		err(EX_SOFTWARE, "Couldn't open %s", filename);
-		
-	while ((line = fgetln(file, &len)) != NULL) {
-		nline = NULL;
-		/* if we end in \n just switch it to \0, otherwise we need more mem */
-		if (line[len - 1] == '\n') {
-			line[len - 1] = '\0';
-		} else {
-			nline = (char *)malloc((len + 1) * sizeof(char));
-			if (nline == NULL)
-				err(EX_OSERR, "Couldn't allocate nline buf");
-			
-			memcpy(nline, line, len);
-			nline[len] = '\0';
-			line = nline;
-		}
-		
-		if (regexec(&regex, line, 0, NULL, 0) == 0) {
-			DIAG("===> Match line: %s", line);
-			free(nline);
+
+	if (st.st_size == 0 || len == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return errno;
+
+	(void)posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	*contains = memmem(map, st.st_size, needle, len) != NULL;
+	munmap(map, st.st_size);
+
+	return 0;
+}
+
+/*
+ * Print the problems found, and with reportfile also write them there as
+ * JSON.  Returns non-zero if the fake failed.
+ */
+static int
+report(struct fake_list *plist, struct fake_list *unlisted, const char *destdir, const char *prefix,
+    const char *reportfile)
+{
+	ucl_object_t *root, *missing, *contains, *unreadable, *orphans, *obj;
+	struct fake_file *f;
+	char file[FILENAME_MAX];
+	unsigned char *json;
+	struct stat st;
+	FILE *fp;
+	size_t i;
+	int ret = 0;
+
+	root = ucl_object_typed_new(UCL_OBJECT);
+	missing = ucl_object_typed_new(UCL_ARRAY);
+	contains = ucl_object_typed_new(UCL_ARRAY);
+	unreadable = ucl_object_typed_new(UCL_ARRAY);
+	orphans = ucl_object_typed_new(UCL_ARRAY);
+
+	for (i = 0; i < plist->count; i++) {
+		f = plist->items[i];
+
+		if (!f->check)
+			continue;
+
+		if (!f->found) {
+			obj = ucl_object_typed_new(UCL_OBJECT);
+			ucl_object_insert_key(obj, ucl_object_fromstring(f->data), "path", 0, false);
+			ucl_object_insert_key(obj, ucl_object_fromstring(f->cwd), "cwd", 0, false);
+
+			(void)snprintf(file, FILENAME_MAX, "%s/%s", f->cwd, f->data);
+			if (lstat(file, &st) == 0) {
+				(void)printf("		%s installed in %s\n", f->data, f->cwd);
+				ucl_object_insert_key(obj, ucl_object_frombool(true), "installed_live", 0, false);
+			} else {
+				(void)printf("		%s not installed.\n", f->data);
+				ucl_object_insert_key(obj, ucl_object_frombool(false), "installed_live", 0, false);
+			}
+
+			ucl_array_append(missing, obj);
+			ret = 1;
+		} else if (f->error != 0) {
+			(void)printf("		%s could not be read: %s\n", f->data, strerror(f->error));
+			obj = ucl_object_typed_new(UCL_OBJECT);
+			ucl_object_insert_key(obj, ucl_object_fromstring(f->data), "path", 0, false);
+			ucl_object_insert_key(obj, ucl_object_fromstring(strerror(f->error)), "error", 0, false);
+			ucl_array_append(unreadable, obj);
+			ret = 1;
+		} else if (f->contains) {
+			(void)printf("		%s contains the fake destdir\n", f->data);
+			ucl_array_append(contains, ucl_object_fromstring(f->data));
 			ret = 1;
-			break;
 		}
-		free(nline);
 	}
-	
-	if (ferror(file) != 0)
-		err(EX_IOERR, "Error reading %s", filename);
-	
-	regfree(&regex);
-	fclose(file);
+
+	/* not fatal: ports may stage files they deliberately leave out */
+	qsort(unlisted->items, unlisted->count, sizeof(void *), compare_paths);
+	for (i = 0; i < unlisted->count; i++) {
+		(void)printf("		%s is not in the plist\n", (char *)unlisted->items[i]);
+		ucl_array_append(orphans, ucl_object_fromstring(unlisted->items[i]));
+	}
+
+	ucl_object_insert_key(root, ucl_object_fromstring(destdir), "destdir", 0, false);
+	ucl_object_insert_key(root, ucl_object_fromstring(prefix), "prefix", 0, false);
+	ucl_object_insert_key(root, ucl_object_frombool(ret == 0), "passed", 0, false);
+	ucl_object_insert_key(root, ucl_object_fromint(plist->count), "files", 0, false);
+	ucl_object_insert_key(root, missing, "missing", 0, false);
+	ucl_object_insert_key(root, contains, "contains_destdir", 0, false);
+	ucl_object_insert_key(root, unreadable, "unreadable", 0, false);
+	ucl_object_insert_key(root, orphans, "not_in_plist", 0, false);
+
+	if (reportfile != NULL) {
+		if ((json = ucl_object_emit(root, UCL_EMIT_JSON)) == NULL)
+			errx(EX_SOFTWARE, "Could not build report");
+
+		if ((fp = fopen(reportfile, "w")) == NULL)
+			err(EX_CANTCREAT, "Could not open %s", reportfile);
+		if (fprintf(fp, "%s\n", json) < 0 || fclose(fp) != 0)
+			err(EX_IOERR, "Could not write %s", reportfile);
+
+		free(json);
+	}
+
+	ucl_object_unref(root);
+
 	return ret;
 }
-			
+
 static void
-usage(void) 
+list_append(struct fake_list *list, void *item)
 {
-	errx(EX_USAGE, "Usage: mport.check-fake [-s skip] [-c <chroot directory>] <-f plistfile> <-d destdir> <-p prefix>");
+
+	if (item == NULL)
+		err(EX_OSERR, "Could not allocate list item");
+
+	if (list->count == list->size) {
+		list->size = list->size == 0 ? 64 : list->size * 2;
+		if ((list->items = reallocarray(list->items, list->size, sizeof(void *))) == NULL)
+			err(EX_OSERR, "Could not grow list");
+	}
+
+	list->items[list->count++] = item;
 }
 
+static int
+compare_paths(const void *a, const void *b)
+{
 
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+			
+static void
+usage(void) 
+{
+	errx(EX_USAGE, "Usage: mport.check-fake [-s skip] [-c <chroot directory>] [-j jobs] [-o report] <-f plistfile> <-d destdir> <-p prefix>");
+}
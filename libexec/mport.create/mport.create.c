@@ -42,6 +42,8 @@ static void usage(void);
 
 static void check_for_required_args(const mportPackageMeta *, const mportCreateExtras *);
 
+static int create_batch(mportInstance *, const char *, int);
+
 int main(int argc, char *argv[])
 {
 	int ch;
@@ -53,6 +55,8 @@ int main(int argc, char *argv[])
 	FILE *fp;
 	struct tm expDate;
 	int result = EXIT_SUCCESS;
+	const char *batchfile = NULL;
+	int workers = 0;
 
 	if (mport == NULL || pack == NULL || extra == NULL || assetlist == NULL) {
 		errx(EXIT_FAILURE, "Failed to allocate memory");
@@ -68,8 +72,14 @@ int main(int argc, char *argv[])
 		errx(EXIT_FAILURE, "%s", mport_err_string());
 	}
 
-	while ((ch = getopt(argc, argv, "C:D:E:M:O:P:S:c:d:e:f:i:j:l:m:n:o:p:r:s:t:v:x:")) != -1) {
+	while ((ch = getopt(argc, argv, "C:D:E:HM:O:P:S:b:c:d:e:f:i:j:l:m:n:o:p:r:s:t:v:w:x:z:")) != -1) {
 		switch (ch) {
+			case 'b':
+				batchfile = optarg;
+				break;
+			case 'w':
+				workers = atoi(optarg);
+				break;
 			case 'o':
 				strlcpy(extra->pkg_filename, optarg, sizeof(extra->pkg_filename));
 				break;
@@ -172,6 +182,12 @@ int main(int argc, char *argv[])
 					pack->deprecated = strdup(optarg);
 				}
 				break;
+			case 'z':
+				extra->dictionary = strdup(optarg);
+				break;
+			case 'H':
+				extra->dedup = true;
+				break;
 			case '?':
 			default:
 				usage();
@@ -179,6 +195,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (batchfile != NULL) {
+		if (create_batch(mport, batchfile, workers) != MPORT_OK) {
+			warnx("%s", mport_err_string());
+			result = EXIT_FAILURE;
+		}
+		goto cleanup;
+	}
+
 	check_for_required_args(pack, extra);
 	if (plist_seen == 0) {
 		warnx("Required arg missing: plist");
@@ -196,13 +220,38 @@ int main(int argc, char *argv[])
 cleanup:
 	mport_pkgmeta_free(pack);
 	mport_createextras_free(extra);
-	/* TODO: fix asset free mport_assetlist_free(assetlist); */
+	mport_assetlist_free(assetlist);
 	mport_instance_free(mport);
 
 	return result;
 }
 
 
+/*
+ * Build every package described in the batch spec file on a pool of
+ * worker threads.  See mport_createbatch_load() for the file format.
+ */
+static int
+create_batch(mportInstance *mport, const char *batchfile, int workers)
+{
+	mportCreateBatch *batch;
+	int ret;
+
+	if ((batch = mport_createbatch_new()) == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	batch->workers = workers;
+
+	ret = mport_createbatch_load(batch, batchfile);
+	if (ret == MPORT_OK)
+		ret = mport_createbatch_run(mport, batch);
+
+	mport_createbatch_free(batch);
+
+	return ret;
+}
+
+
 #define CHECK_ARG(exp, errmsg) \
   if (exp == NULL) { \
     warnx("Required arg missing: %s", #errmsg); \
@@ -224,6 +273,7 @@ static void check_for_required_args(const mportPackageMeta *pkg, const mportCrea
 static void usage(void)
 {
 	fprintf(stderr, "\nmport.create <arguments>\n");
+	fprintf(stderr, "mport.create -b <batch spec file> [-w <workers>]\n");
 	fprintf(stderr, "Arguments:\n");
 	fprintf(stderr, "\t-n <package name>\n");
 	fprintf(stderr, "\t-v <package version>\n");
@@ -243,6 +293,8 @@ static void usage(void)
 	fprintf(stderr, "\t-m <pkg-message file>\n");
 	fprintf(stderr, "\t-M <mtree file>\n");
 	fprintf(stderr, "\t-t <categories>\n");
+	fprintf(stderr, "\t-z <zstd dictionary>\n");
+	fprintf(stderr, "\t-H (store identical files as hardlinks)\n");
 	exit(1);
 }
 
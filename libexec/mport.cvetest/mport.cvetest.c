@@ -0,0 +1,313 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests for the reader of the security site's CVE lists, behind audits and
+ * the generated vulnerability database.  Synthetic lists are parsed from
+ * memory: one exercising every field that is kept, one whose ranges carry
+ * more string data than the reader keeps for a CVE, one with more ranges
+ * than it keeps, and a malformed one.  A range the reader can't keep whole
+ * must be dropped, never handed on with a missing bound that would make it
+ * cover every version.  Each check prints one line and the exit status is
+ * the number that failed.
+ */
+
+#include <sys/cdefs.h>
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mport.h>
+#include "mport_test.h"
+
+#define TEST_PURL_LEN		1000
+#define TEST_LONG_RANGES	600	/* with their purls, well past what is kept */
+#define TEST_MANY_RANGES	1100
+#define TEST_RANGES_KEPT	1024	/* CVE_RANGES_MAX in cve.c */
+
+/* what the callback saw of each CVE */
+struct test_seen {
+	int cves;
+	bool fields_ok;
+	bool bounded;		/* every range kept both of its bounds */
+	bool in_order;		/* and they are the ones written, in order */
+	bool outside_clean;	/* a version below every range matched none */
+	size_t nranges;
+	bool trailer_ok;	/* the CVE after the large one was read right */
+};
+
+static void usage(void);
+static void check(const char *, bool, int *);
+static FILE *test_open(char *);
+static bool test_fields(void);
+static int fields_cb(const struct mport_cve *, void *);
+static bool test_range_strings(void);
+static bool test_range_count(void);
+static int ranges_cb(const struct mport_cve *, void *);
+static bool test_malformed(void);
+
+int
+main(int argc, char *argv[])
+{
+	int failed = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "")) != -1) {
+		switch (ch) {
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	check("fields", test_fields(), &failed);
+	check("range strings", test_range_strings(), &failed);
+	check("range count", test_range_count(), &failed);
+	check("malformed", test_malformed(), &failed);
+
+	return (failed);
+}
+
+static void
+check(const char *name, bool ok, int *failed)
+{
+
+	printf("%-16s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		(*failed)++;
+}
+
+/* a stream reading the list in buf */
+static FILE *
+test_open(char *buf)
+{
+	FILE *fp;
+
+	if ((fp = fmemopen(buf, strlen(buf), "r")) == NULL)
+		err(EXIT_FAILURE, "fmemopen");
+
+	return (fp);
+}
+
+/* every kept field, escapes, skipped values and each way of giving a range */
+static bool
+test_fields(void)
+{
+	char list[] =
+	    "[ {\"cveId\": \"CVE-2024-0001\", \"description\": \"a \\\"quoted\\\"\\nline \\u00e9 \\ud83d\\ude00\","
+	    " \"severity\": \"HIGH\", \"baseScore\": 7.5, \"references\": [ {\"url\": \"x\"}, [1, 2] ],"
+	    " \"products\": ["
+	    "  {\"vendor\": \"v\", \"version\": \"2.0\"},"
+	    "  {\"versionStartIncluding\": \"3.0\", \"versionEndExcluding\": \"3.5\", \"purl\": \"pkg:generic/p\"},"
+	    "  {\"versionStartExcluding\": \"4.0\"},"
+	    "  {\"version\": \"*\"},"
+	    "  {\"vendor\": \"no range\"}, {}, 17"
+	    " ] },"
+	    " {\"cveId\": \"CVE-2024-0002\", \"products\": [] } ]";
+	struct test_seen seen;
+	FILE *fp;
+	int ret;
+
+	memset(&seen, 0, sizeof(seen));
+	fp = test_open(list);
+	ret = mport_cve_parse(fp, fields_cb, &seen);
+	fclose(fp);
+
+	return (ret == MPORT_OK && seen.cves == 2 && seen.fields_ok);
+}
+
+static int
+fields_cb(const struct mport_cve *cve, void *arg)
+{
+	struct test_seen *seen = arg;
+	const struct mport_cve_range *r = cve->ranges;
+
+	if (++seen->cves == 2) {
+		seen->fields_ok = seen->fields_ok && strcmp(cve->id, "CVE-2024-0002") == 0 &&
+		    cve->description == NULL && cve->severity == NULL && cve->score < 0 && cve->nranges == 0;
+		return (MPORT_OK);
+	}
+
+	seen->fields_ok = strcmp(cve->id, "CVE-2024-0001") == 0 &&
+	    strcmp(cve->description, "a \"quoted\"\nline \xc3\xa9 \xf0\x9f\x98\x80") == 0 &&
+	    strcmp(cve->severity, "HIGH") == 0 && cve->score == 7.5 && cve->nranges == 4;
+	if (!seen->fields_ok)
+		return (MPORT_OK);
+
+	/* up to 2.0, inclusive */
+	seen->fields_ok = r[0].min == NULL && strcmp(r[0].max, "2.0") == 0 && !r[0].max_excluded &&
+	    mport_cve_range_match(&r[0], "1.0") && mport_cve_range_match(&r[0], "2.0") &&
+	    !mport_cve_range_match(&r[0], "2.1");
+	/* from 3.0 up to but not including 3.5 */
+	seen->fields_ok = seen->fields_ok && strcmp(r[1].min, "3.0") == 0 && strcmp(r[1].max, "3.5") == 0 &&
+	    r[1].max_excluded && !r[1].min_excluded && strcmp(r[1].purl, "pkg:generic/p") == 0 &&
+	    !mport_cve_range_match(&r[1], "2.9") && mport_cve_range_match(&r[1], "3.0") &&
+	    mport_cve_range_match(&r[1], "3.4") && !mport_cve_range_match(&r[1], "3.5");
+	/* anything after 4.0 */
+	seen->fields_ok = seen->fields_ok && strcmp(r[2].min, "4.0") == 0 && r[2].min_excluded && r[2].max == NULL &&
+	    !mport_cve_range_match(&r[2], "4.0") && mport_cve_range_match(&r[2], "9.0");
+	/* every version */
+	seen->fields_ok = seen->fields_ok && r[3].min == NULL && r[3].max == NULL &&
+	    mport_cve_range_match(&r[3], "0.1");
+
+	return (MPORT_OK);
+}
+
+/*
+ * A CVE listing many products with long package URLs.  The bounds come last
+ * in each entry, so once the reader's room runs out they are the strings
+ * cut short.  A CVE after it must be read as usual.
+ */
+static bool
+test_range_strings(void)
+{
+	struct test_seen seen;
+	char *list, *purl;
+	size_t len;
+	FILE *fp, *out;
+	int i, ret;
+
+	if ((purl = malloc(TEST_PURL_LEN + 1)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memset(purl, 'p', TEST_PURL_LEN);
+	purl[TEST_PURL_LEN] = '\0';
+
+	if ((out = open_memstream(&list, &len)) == NULL)
+		err(EXIT_FAILURE, "open_memstream");
+	fprintf(out, "[{\"cveId\": \"CVE-2024-1000\", \"products\": [");
+	for (i = 0; i < TEST_LONG_RANGES; i++)
+		fprintf(out, "%s{\"purl\": \"pkg:generic/%s\", \"versionStartIncluding\": \"1.%d\", "
+		    "\"versionEndIncluding\": \"1.%d.9\"}", i == 0 ? "" : ",", purl, i, i);
+	fprintf(out, "]}, {\"cveId\": \"CVE-2024-1001\", \"products\": [{\"version\": \"5.0\"}]}]");
+	fclose(out);
+	free(purl);
+
+	memset(&seen, 0, sizeof(seen));
+	fp = test_open(list);
+	ret = mport_cve_parse(fp, ranges_cb, &seen);
+	fclose(fp);
+	free(list);
+
+	/* some were kept, not all of them, and none of those lost a bound */
+	return (ret == MPORT_OK && seen.cves == 2 && seen.nranges > 0 && seen.nranges < TEST_LONG_RANGES &&
+	    seen.bounded && seen.in_order && seen.outside_clean && seen.trailer_ok);
+}
+
+/* more ranges than are kept; the ones past the limit are dropped */
+static bool
+test_range_count(void)
+{
+	struct test_seen seen;
+	char *list;
+	size_t len;
+	FILE *fp, *out;
+	int i, ret;
+
+	if ((out = open_memstream(&list, &len)) == NULL)
+		err(EXIT_FAILURE, "open_memstream");
+	fprintf(out, "[{\"cveId\": \"CVE-2024-2000\", \"products\": [");
+	for (i = 0; i < TEST_MANY_RANGES; i++)
+		fprintf(out, "%s{\"versionStartIncluding\": \"1.%d\", \"versionEndIncluding\": \"1.%d.9\"}",
+		    i == 0 ? "" : ",", i, i);
+	fprintf(out, "]}, {\"cveId\": \"CVE-2024-2001\", \"products\": [{\"version\": \"5.0\"}]}]");
+	fclose(out);
+
+	memset(&seen, 0, sizeof(seen));
+	fp = test_open(list);
+	ret = mport_cve_parse(fp, ranges_cb, &seen);
+	fclose(fp);
+	free(list);
+
+	return (ret == MPORT_OK && seen.cves == 2 && seen.nranges == TEST_RANGES_KEPT && seen.bounded &&
+	    seen.in_order && seen.outside_clean && seen.trailer_ok);
+}
+
+static int
+ranges_cb(const struct mport_cve *cve, void *arg)
+{
+	struct test_seen *seen = arg;
+	char min[32], max[32];
+	size_t i;
+
+	if (++seen->cves == 2) {
+		seen->trailer_ok = cve->nranges == 1 && cve->ranges[0].min == NULL && cve->ranges[0].max != NULL &&
+		    strcmp(cve->ranges[0].max, "5.0") == 0;
+		return (MPORT_OK);
+	}
+
+	seen->nranges = cve->nranges;
+	seen->bounded = seen->in_order = seen->outside_clean = true;
+	for (i = 0; i < cve->nranges; i++) {
+		if (cve->ranges[i].min == NULL || cve->ranges[i].max == NULL) {
+			seen->bounded = false;
+			continue;
+		}
+		(void)snprintf(min, sizeof(min), "1.%zu", i);
+		(void)snprintf(max, sizeof(max), "1.%zu.9", i);
+		if (strcmp(cve->ranges[i].min, min) != 0 || strcmp(cve->ranges[i].max, max) != 0)
+			seen->in_order = false;
+		if (mport_cve_range_match(&cve->ranges[i], "0.5"))
+			seen->outside_clean = false;
+	}
+
+	return (MPORT_OK);
+}
+
+static bool
+test_malformed(void)
+{
+	char list[] = "[{\"cveId\": \"CVE-2024-3000\", \"products\": [{\"version\": \"1.0\"";
+	struct test_seen seen;
+	FILE *fp;
+	int ret;
+
+	memset(&seen, 0, sizeof(seen));
+	fp = test_open(list);
+	ret = mport_cve_parse(fp, ranges_cb, &seen);
+	fclose(fp);
+
+	return (ret != MPORT_OK && seen.cves == 0);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.cvetest\n");
+	exit(2);
+}
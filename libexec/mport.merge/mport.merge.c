@@ -46,15 +46,20 @@ int main(int argc, char *argv[]) {
 	const char **inputfiles;
 	mportInstance *mport;
 	const char *chroot_path = NULL;
+	bool members = false;
+	int ret;
 
 	if (argc == 1)
 		usage();
 
-	while ((ch = getopt(argc, argv, "c:o:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:mo:")) != -1) {
 		switch (ch) {
 			case 'c':
 				chroot_path = optarg;
 				break;
+			case 'm':
+				members = true;
+				break;
 			case 'o':
 				outfile = optarg;
 				break;
@@ -94,7 +99,12 @@ int main(int argc, char *argv[]) {
 
 	inputfiles[i] = NULL;
 
-	if (mport_merge_primative(mport, (const char **) inputfiles, outfile) != MPORT_OK)
+	if (members)
+		ret = mport_merge_members_primative(mport, (const char **) inputfiles, outfile);
+	else
+		ret = mport_merge_primative(mport, (const char **) inputfiles, outfile);
+
+	if (ret != MPORT_OK)
 		errx(EX_SOFTWARE, "Could not merge package files: %s", mport_err_string());
 
 	mport_instance_free(mport); 
@@ -106,6 +116,6 @@ int main(int argc, char *argv[]) {
 
 static void
 usage(void) {
-	fprintf(stderr, "Usage: mport.merge -c <chroot path> -o <outputfilename> <pkgfile1> <pkgfile2> ...\n");
+	fprintf(stderr, "Usage: mport.merge [-m] -c <chroot path> -o <outputfilename> <pkgfile1> <pkgfile2> ...\n");
 	exit(2);
 }
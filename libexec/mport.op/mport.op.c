@@ -0,0 +1,241 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Headless driver for asynchronous operations: starts an install, upgrade
+ * or index fetch with the mport_op API and waits on mport_op_fd() with
+ * poll(2), printing each event as one line on stdout.  Questions are
+ * answered from the command line, and the operation is cancelled on SIGINT
+ * or after a timeout.  Useful to script front ends against, and to exercise
+ * cancellation.
+ */
+
+#include <sys/cdefs.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mport.h>
+
+enum answer {
+	ANSWER_DEFAULT,
+	ANSWER_YES,
+	ANSWER_NO
+};
+
+static volatile sig_atomic_t interrupted;
+
+static void usage(void);
+static void on_interrupt(int);
+static long elapsed_ms(const struct timespec *);
+static bool handle_event(mportOperation *, mportEvent *, enum answer, int *);
+
+int
+main(int argc, char *argv[])
+{
+	mportInstance *mport;
+	mportOperation *op = NULL;
+	mportEvent *ev;
+	struct pollfd pfd;
+	struct sigaction sa;
+	struct timespec start;
+	enum answer answer = ANSWER_DEFAULT;
+	const char *version = NULL;
+	long cancel_ms = -1;
+	bool cancelled = false, done = false;
+	int ch, timeout, result = MPORT_ERR_FATAL;
+
+	while ((ch = getopt(argc, argv, "nt:v:y")) != -1) {
+		switch (ch) {
+			case 'n':
+				answer = ANSWER_NO;
+				break;
+			case 't':
+				if ((cancel_ms = atoi(optarg)) < 0)
+					errx(EXIT_FAILURE, "Invalid timeout: %s", optarg);
+				break;
+			case 'v':
+				version = optarg;
+				break;
+			case 'y':
+				answer = ANSWER_YES;
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		usage();
+	if (strcmp(argv[0], "install") == 0 ? argc != 2 : argc != 1)
+		usage();
+
+	mport = mport_instance_new();
+
+	if (mport_instance_init(mport, NULL, NULL, false, MPORT_VNORMAL) != MPORT_OK) {
+		warnx("Init failed: %s", mport_err_string());
+		mport_instance_free(mport);
+		return (EXIT_FAILURE);
+	}
+
+	if (strcmp(argv[0], "index") != 0 && mport_index_load(mport) != MPORT_OK) {
+		warnx("Unable to load index: %s", mport_err_string());
+		mport_instance_free(mport);
+		return (EXIT_FAILURE);
+	}
+
+	if (strcmp(argv[0], "install") == 0)
+		op = mport_op_install(mport, argv[1], version, MPORT_EXPLICIT);
+	else if (strcmp(argv[0], "upgrade") == 0)
+		op = mport_op_upgrade(mport);
+	else if (strcmp(argv[0], "index") == 0)
+		op = mport_op_fetch_index(mport);
+	else
+		usage();
+
+	if (op == NULL) {
+		warnx("Unable to start: %s", mport_err_string());
+		mport_instance_free(mport);
+		return (EXIT_FAILURE);
+	}
+
+	/* no SA_RESTART, so poll(2) returns and the operation can be cancelled */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_interrupt;
+	sigemptyset(&sa.sa_mask);
+	(void)sigaction(SIGINT, &sa, NULL);
+	(void)sigaction(SIGTERM, &sa, NULL);
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	pfd.fd = mport_op_fd(op);
+	pfd.events = POLLIN;
+
+	while (!done) {
+		timeout = -1;
+		if (cancel_ms >= 0 && !cancelled) {
+			timeout = (int)(cancel_ms - elapsed_ms(&start));
+			if (timeout < 0)
+				timeout = 0;
+		}
+
+		if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+			err(EXIT_FAILURE, "poll");
+
+		if (!cancelled && (interrupted || (cancel_ms >= 0 && elapsed_ms(&start) >= cancel_ms))) {
+			printf("cancel\n");
+			mport_op_cancel(op);
+			cancelled = true;
+		}
+
+		while (!done && (ev = mport_op_next_event(op)) != NULL) {
+			done = handle_event(op, ev, answer, &result);
+			mport_event_free(ev);
+		}
+		(void)fflush(stdout);
+	}
+
+	mport_op_free(op);
+	mport_instance_free(mport);
+
+	return (result == MPORT_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void
+on_interrupt(int sig)
+{
+
+	interrupted = 1;
+}
+
+static long
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/* print one event; returns true once the operation is done */
+static bool
+handle_event(mportOperation *op, mportEvent *ev, enum answer answer, int *result)
+{
+	bool yes;
+
+	switch (ev->type) {
+		case MPORT_EVENT_MSG:
+			printf("msg %s\n", ev->msg);
+			break;
+		case MPORT_EVENT_PROGRESS_INIT:
+			printf("progress-init %s\n", ev->msg);
+			break;
+		case MPORT_EVENT_PROGRESS_STEP:
+			printf("progress %d/%d %s\n", ev->current, ev->total, ev->msg == NULL ? "" : ev->msg);
+			break;
+		case MPORT_EVENT_PROGRESS_FREE:
+			printf("progress-free\n");
+			break;
+		case MPORT_EVENT_CONFIRM:
+			if (answer == ANSWER_DEFAULT)
+				yes = ev->def == 1;
+			else
+				yes = answer == ANSWER_YES;
+			printf("confirm %s -> %s\n", ev->msg, yes ? "yes" : "no");
+			if (mport_op_confirm(op, yes) != MPORT_OK)
+				warnx("confirm failed: %s", mport_err_string());
+			break;
+		case MPORT_EVENT_DONE:
+			*result = ev->result;
+			printf("done %d %s\n", ev->result, ev->msg == NULL ? "" : ev->msg);
+			return (true);
+	}
+
+	return (false);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: mport.op [-y | -n] [-t cancel_ms] [-v version] install pkgname\n");
+	fprintf(stderr, "       mport.op [-y | -n] [-t cancel_ms] upgrade | index\n");
+	exit(2);
+}
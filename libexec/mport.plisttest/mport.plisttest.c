@@ -0,0 +1,497 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Comparison harness for mport_parse_plistfile().  A large synthetic plist,
+ * covering every command, the owner/mode forms, blank and white space only
+ * lines, tabs, carriage returns, embedded NULs and a missing final newline,
+ * is parsed by the library and by the line based reader it replaced, kept
+ * here as the reference.  The plist is fed as a whole file, from an offset
+ * part way in, as a small file and through a pipe, and every entry must
+ * match the reference.  Parse times are printed for both.
+ */
+
+#include <sys/cdefs.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mport.h>
+
+#define PLIST_LINES	200000
+#define PLIST_SMALL	40	/* lines; less than one read buffer */
+#define PLIST_NITEMS(a)	(sizeof(a) / sizeof((a)[0]))
+
+struct feed {
+	const char *buf;
+	size_t len;
+	int fd;
+};
+
+static const char *commands[] = {
+	"comment", "preexec", "preunexec", "postexec", "postunexec", "exec",
+	"unexec", "dir", "dirrm", "dirrmtry", "cwd", "cd", "srcdir", "mode",
+	"owner", "group", "noinst", "ignore", "ignore_inst", "info", "name",
+	"display", "pkgdep", "conflicts", "mtree", "option", "sample", "shell",
+	"ldconfig-linux", "ldconfig", "rmempty", "glib-schemas", "kld",
+	"desktop-file-utils", "touch", "bogus", "c", "dirx"
+};
+
+static const char *owner_modes[] = {
+	"(root,wheel,0755)", "(,,0644)", "(www,,)", "(root,wheel)", "()", "(,,",
+	"dir(root,wheel,0755)", "dir(,operator,)", "sample(root,wheel,0640)",
+	"sample(,,0600)"
+};
+
+static void usage(void);
+static double now(void);
+static char *generate(size_t, unsigned int, size_t *);
+static FILE *open_file(const char *, size_t, long);
+static FILE *open_pipe(const char *, size_t, pthread_t *, struct feed *);
+static void *feed_pipe(void *);
+static mportAssetList *parse(FILE *, bool, double *);
+static bool compare(const char *, mportAssetList *, mportAssetList *);
+static int ref_parse(FILE *, mportAssetList *);
+static int ref_owner_mode(mportAssetList *, mportAssetListEntry *, char *);
+static mportAssetListEntryType ref_command(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	mportAssetList *want, *got;
+	pthread_t feeder;
+	struct feed feed;
+	FILE *fp;
+	char *buf;
+	size_t len, half;
+	double reftime, newtime;
+	unsigned int seed = 1;
+	int lines = PLIST_LINES;
+	int failed = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+			case 'n':
+				if ((lines = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid line count: %s", optarg);
+				break;
+			case 's':
+				seed = (unsigned int)atoi(optarg);
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	buf = generate((size_t)lines, seed, &len);
+
+	/* the whole file */
+	want = parse(fp = open_file(buf, len, 0), true, &reftime);
+	fclose(fp);
+	got = parse(fp = open_file(buf, len, 0), false, &newtime);
+	fclose(fp);
+	if (!compare("file", want, got))
+		failed++;
+	printf("%d lines: reference %.6fs, parser %.6fs\n", lines, reftime, newtime);
+	mport_assetlist_free(want);
+	mport_assetlist_free(got);
+
+	/* starting part way in, at a line boundary */
+	half = (const char *)memchr(buf + len / 2, '\n', len - len / 2) - buf + 1;
+	want = parse(fp = open_file(buf, len, (long)half), true, NULL);
+	fclose(fp);
+	got = parse(fp = open_file(buf, len, (long)half), false, NULL);
+	fclose(fp);
+	if (!compare("offset", want, got))
+		failed++;
+	mport_assetlist_free(want);
+	mport_assetlist_free(got);
+
+	/* the whole file, through a pipe */
+	want = parse(fp = open_file(buf, len, 0), true, NULL);
+	fclose(fp);
+	got = parse(fp = open_pipe(buf, len, &feeder, &feed), false, NULL);
+	fclose(fp);
+	pthread_join(feeder, NULL);
+	if (!compare("pipe", want, got))
+		failed++;
+	mport_assetlist_free(want);
+	mport_assetlist_free(got);
+	free(buf);
+
+	/* small, without a final newline */
+	buf = generate(PLIST_SMALL, seed, &len);
+	want = parse(fp = open_file(buf, len, 0), true, NULL);
+	fclose(fp);
+	got = parse(fp = open_file(buf, len, 0), false, NULL);
+	fclose(fp);
+	if (!compare("small", want, got))
+		failed++;
+	mport_assetlist_free(want);
+	mport_assetlist_free(got);
+	free(buf);
+
+	return (failed);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+/* lines of every shape the parser has to cope with; no final newline */
+static char *
+generate(size_t lines, unsigned int seed, size_t *len_p)
+{
+	char *buf = NULL;
+	size_t len = 0, i;
+	FILE *fp;
+	int r;
+
+	if ((fp = open_memstream(&buf, &len)) == NULL)
+		err(EXIT_FAILURE, "open_memstream");
+
+	srandom(seed);
+	for (i = 0; i < lines; i++) {
+		r = (int)(random() % 100);
+		if (r < 55)
+			fprintf(fp, "share/doc/pkg%zu/file%ld.txt", i % 97, random() % 1000);
+		else if (r < 75)
+			fprintf(fp, "@%s %s/%zu", commands[random() % PLIST_NITEMS(commands)], "bin", i);
+		else if (r < 80)
+			fprintf(fp, "@%s", commands[random() % PLIST_NITEMS(commands)]);
+		else if (r < 85)
+			fprintf(fp, "@%s lib/file%zu.so", owner_modes[random() % PLIST_NITEMS(owner_modes)], i);
+		else if (r < 87)
+			fprintf(fp, "@comment ORIGIN:devel/pkg%zu", i);
+		else if (r < 89)
+			fprintf(fp, "@comment DEPORIGIN:lang/dep%zu", i);
+		else if (r < 91)
+			fprintf(fp, "%s", (random() & 1) ? "" : " \t ");
+		else if (r < 93)
+			fprintf(fp, "@exec\t/bin/echo %zu \t\r", i);
+		else if (r < 95)
+			fprintf(fp, "file with trailing space %zu   ", i);
+		else if (r < 97)
+			fprintf(fp, "crlf%zu\r", i);
+		else if (r < 99)
+			fprintf(fp, "nul%zu%cafter  ", i, '\0');
+		else
+			fprintf(fp, "@");
+		if (i + 1 < lines)
+			fputc('\n', fp);
+	}
+
+	if (fclose(fp) != 0)
+		err(EXIT_FAILURE, "open_memstream");
+
+	*len_p = len;
+
+	return (buf);
+}
+
+/* a read only stream on a temporary copy of buf, positioned at offset */
+static FILE *
+open_file(const char *buf, size_t len, long offset)
+{
+	char path[] = "/tmp/mport.plisttest.XXXXXXXX";
+	FILE *fp;
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1)
+		err(EXIT_FAILURE, "mkstemp");
+	if (write(fd, buf, len) != (ssize_t)len)
+		err(EXIT_FAILURE, "write");
+	close(fd);
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+	unlink(path);
+
+	if (fseek(fp, offset, SEEK_SET) != 0)
+		err(EXIT_FAILURE, "fseek");
+
+	return (fp);
+}
+
+static FILE *
+open_pipe(const char *buf, size_t len, pthread_t *feeder, struct feed *feed)
+{
+	FILE *fp;
+	int fds[2];
+
+	if (pipe(fds) == -1)
+		err(EXIT_FAILURE, "pipe");
+
+	*feed = (struct feed){ .buf = buf, .len = len, .fd = fds[1] };
+	if (pthread_create(feeder, NULL, feed_pipe, feed) != 0)
+		errx(EXIT_FAILURE, "Could not start the pipe writer.");
+
+	if ((fp = fdopen(fds[0], "r")) == NULL)
+		err(EXIT_FAILURE, "fdopen");
+
+	return (fp);
+}
+
+static void *
+feed_pipe(void *arg)
+{
+	struct feed *feed = arg;
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < feed->len && (n = write(feed->fd, feed->buf + off, feed->len - off)) > 0)
+		off += (size_t)n;
+	close(feed->fd);
+
+	return (NULL);
+}
+
+static mportAssetList *
+parse(FILE *fp, bool reference, double *elapsed)
+{
+	mportAssetList *list;
+	double start;
+	int ret;
+
+	if ((list = mport_assetlist_new()) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+
+	start = now();
+	ret = reference ? ref_parse(fp, list) : mport_parse_plistfile(fp, list);
+	if (elapsed != NULL)
+		*elapsed = now() - start;
+
+	if (ret != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+
+	return (list);
+}
+
+static bool
+compare(const char *name, mportAssetList *want, mportAssetList *got)
+{
+	mportAssetListEntry *w, *g;
+	size_t n = 0;
+
+	for (w = STAILQ_FIRST(want), g = STAILQ_FIRST(got); w != NULL && g != NULL;
+	    w = STAILQ_NEXT(w, next), g = STAILQ_NEXT(g, next), n++) {
+		if (w->type != g->type || (w->data == NULL) != (g->data == NULL) ||
+		    (w->data != NULL && strcmp(w->data, g->data) != 0) ||
+		    strcmp(w->owner, g->owner) != 0 || strcmp(w->group, g->group) != 0 ||
+		    strcmp(w->mode, g->mode) != 0) {
+			printf("%-8s FAILED at entry %zu: type %d/%d \"%s\"/\"%s\"\n", name, n,
+			    w->type, g->type, w->data == NULL ? "(null)" : w->data,
+			    g->data == NULL ? "(null)" : g->data);
+			return (false);
+		}
+	}
+
+	if (w != NULL || g != NULL) {
+		printf("%-8s FAILED: %s has more than %zu entries\n", name,
+		    w != NULL ? "reference" : "parser", n);
+		return (false);
+	}
+
+	printf("%-8s ok, %zu entries\n", name, n);
+
+	return (true);
+}
+
+/*
+ * The reference: the fgetln(3) based reader from before plists were parsed
+ * from a buffer, changed only to copy each line instead of writing into
+ * fgetln's buffer.
+ */
+static int
+ref_parse(FILE *fp, mportAssetList *list)
+{
+	mportAssetListEntryType type;
+	mportAssetListEntry *entry;
+	char *copy = NULL, *line, *cmnd, *owner_mode, *pos;
+	const char *got;
+	size_t length, size = 0;
+
+	while ((got = fgetln(fp, &length)) != NULL) {
+		if (got[length - 1] == '\n') {
+			if (length == 1)
+				continue;
+			length--;
+		}
+
+		if (length + 1 > size) {
+			size = length + 1;
+			if ((copy = reallocf(copy, size)) == NULL)
+				errx(EXIT_FAILURE, "Out of memory.");
+		}
+		memcpy(copy, got, length);
+		copy[length] = '\0';
+		line = copy;
+
+		type = ASSET_FILE;
+		cmnd = NULL;
+
+		if (*line == '@') {
+			line++;
+			cmnd = strsep(&line, " \t");
+			type = ref_command(cmnd);
+		}
+
+		if (line != NULL) {
+			if (type == ASSET_COMMENT) {
+				if (!strncmp(line, "ORIGIN:", 7)) {
+					line += 7;
+					type = ASSET_ORIGIN;
+				} else if (!strncmp(line, "DEPORIGIN:", 10)) {
+					line += 10;
+					type = ASSET_DEPORIGIN;
+				}
+			}
+
+			pos = line + strlen(line) - 1;
+			while (pos >= line && isspace((unsigned char)*pos)) {
+				*pos = '\0';
+				pos--;
+			}
+		}
+
+		if ((entry = mport_assetlist_append(list, type, line)) == NULL)
+			errx(EXIT_FAILURE, "Out of memory.");
+
+		if (type == ASSET_FILE_OWNER_MODE)
+			owner_mode = cmnd;
+		else if (type == ASSET_DIR_OWNER_MODE)
+			owner_mode = &cmnd[3];
+		else if (type == ASSET_SAMPLE_OWNER_MODE)
+			owner_mode = &cmnd[6];
+		else
+			continue;
+
+		if (ref_owner_mode(list, entry, owner_mode) != MPORT_OK)
+			errx(EXIT_FAILURE, "%s", mport_err_string());
+	}
+
+	free(copy);
+
+	return (MPORT_OK);
+}
+
+static int
+ref_owner_mode(mportAssetList *list, mportAssetListEntry *entry, char *cmdLine)
+{
+	char *permissions[3] = {NULL, NULL, NULL};
+	char *start, *op;
+	int i = 0;
+	int ret;
+
+	if ((op = start = strdup(cmdLine)) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+
+	while (strsep(&op, "(,)") != NULL) {
+		if (i == 3)
+			break;
+		permissions[i] = op;
+		i++;
+	}
+
+	ret = mport_asset_set_attrs(list, entry, permissions[0], permissions[1], permissions[2]);
+	free(start);
+
+	return (ret);
+}
+
+static mportAssetListEntryType
+ref_command(const char *s)
+{
+	static const struct {
+		const char *name;
+		mportAssetListEntryType type;
+	} names[] = {
+		{ "comment", ASSET_COMMENT }, { "preexec", ASSET_PREEXEC },
+		{ "preunexec", ASSET_PREUNEXEC }, { "postexec", ASSET_POSTEXEC },
+		{ "postunexec", ASSET_POSTUNEXEC }, { "exec", ASSET_EXEC },
+		{ "unexec", ASSET_UNEXEC }, { "dir", ASSET_DIR },
+		{ "dirrm", ASSET_DIRRM }, { "dirrmtry", ASSET_DIRRMTRY },
+		{ "cwd", ASSET_CWD }, { "cd", ASSET_CWD }, { "srcdir", ASSET_SRC },
+		{ "mode", ASSET_CHMOD }, { "owner", ASSET_CHOWN },
+		{ "group", ASSET_CHGRP }, { "noinst", ASSET_NOINST },
+		{ "ignore", ASSET_IGNORE }, { "ignore_inst", ASSET_IGNORE_INST },
+		{ "info", ASSET_INFO }, { "name", ASSET_NAME },
+		{ "display", ASSET_DISPLAY }, { "pkgdep", ASSET_PKGDEP },
+		{ "conflicts", ASSET_CONFLICTS }, { "mtree", ASSET_MTREE },
+		{ "option", ASSET_OPTION }, { "sample", ASSET_SAMPLE },
+		{ "shell", ASSET_SHELL }, { "ldconfig-linux", ASSET_LDCONFIG_LINUX },
+		{ "ldconfig", ASSET_LDCONFIG }, { "rmempty", ASSET_RMEMPTY },
+		{ "glib-schemas", ASSET_GLIB_SCHEMAS }, { "kld", ASSET_KLD },
+		{ "desktop-file-utils", ASSET_DESKTOP_FILE_UTILS },
+		{ "touch", ASSET_TOUCH }
+	};
+	size_t i;
+
+	for (i = 0; i < PLIST_NITEMS(names); i++) {
+		if (strcmp(s, names[i].name) == 0)
+			return (names[i].type);
+	}
+
+	if (strncmp(s, "dir(", 4) == 0)
+		return (ASSET_DIR_OWNER_MODE);
+	if (strncmp(s, "sample(", 7) == 0)
+		return (ASSET_SAMPLE_OWNER_MODE);
+	if (s[0] == '(')
+		return (ASSET_FILE_OWNER_MODE);
+
+	return (ASSET_INVALID);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.plisttest [-n lines] [-s seed]\n");
+	exit(2);
+}
@@ -0,0 +1,584 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tests and a benchmark for the worker pool behind the task group API:
+ * callback ordering, concurrency limits, fail-fast, nested groups,
+ * cancellation and the waiting thread's error state.  Each check prints one
+ * line and the exit status is the number that failed.  With -b, a CPU bound
+ * workload is also timed serially and on the pool.
+ */
+
+#include <sys/cdefs.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mport.h>
+#include "mport_test.h"
+
+#define TEST_TASKS	64
+#define TEST_LIMIT	3
+#define TEST_FAIL_AT	4
+#define TEST_NEST	8
+#define TEST_CANCEL	128	/* more than the most workers there can be */
+#define BENCH_WORK	2000000
+
+struct test_state {
+	mportInstance *mport;
+	struct mport_taskgroup *tg;
+	pthread_mutex_t lock;
+	int running;
+	int max_running;
+	int ran;
+	int next_done;
+	bool misordered;
+	bool timed_out;
+	int sum;
+};
+
+struct test_task {
+	struct test_state *state;
+	int index;
+	uint32_t out;
+};
+
+static void usage(void);
+static double now(void);
+static void nap(long);
+static void check(const char *, bool, int *);
+static void state_init(struct test_state *, mportInstance *);
+static int task_count(void *);
+static int order_done(void *, int, const char *, void *);
+static bool test_ordering(mportInstance *);
+static int task_limited(void *);
+static bool test_limit(mportInstance *);
+static int task_failfast(void *);
+static bool test_failfast(mportInstance *);
+static int task_inner(void *);
+static int task_outer(void *);
+static bool test_nesting(mportInstance *);
+static int cancel_done(void *, int, const char *, void *);
+static bool test_cancel_cb(mportInstance *);
+static int task_cancel(void *);
+static bool test_cancel(mportInstance *);
+static int task_clears(void *);
+static bool test_errstate(mportInstance *);
+static int task_work(void *);
+static void bench(mportInstance *, int);
+
+int
+main(int argc, char *argv[])
+{
+	mportInstance *mport;
+	bool benchmark = false;
+	int tasks = TEST_TASKS;
+	int failed = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "bn:w:")) != -1) {
+		switch (ch) {
+			case 'b':
+				benchmark = true;
+				break;
+			case 'n':
+				if ((tasks = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid task count: %s", optarg);
+				break;
+			case 'w':
+				if (atoi(optarg) < 1)
+					errx(EXIT_FAILURE, "Invalid worker count: %s", optarg);
+				/* the pool is sized from this when the first group is made */
+				if (setenv("MPORT_WORKERS", optarg, 1) != 0)
+					err(EXIT_FAILURE, "setenv");
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	/* the pool needs no database, so the instance is not initialized */
+	if ((mport = mport_instance_new()) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+
+	printf("workers: %d\n", mport_pool_workers(mport));
+
+	check("ordering", test_ordering(mport), &failed);
+	check("limit", test_limit(mport), &failed);
+	check("failfast", test_failfast(mport), &failed);
+	check("nesting", test_nesting(mport), &failed);
+	check("cancel callback", test_cancel_cb(mport), &failed);
+	check("cancel", test_cancel(mport), &failed);
+	check("error state", test_errstate(mport), &failed);
+
+	if (benchmark)
+		bench(mport, tasks);
+
+	mport_instance_free(mport);
+
+	return (failed);
+}
+
+static void
+check(const char *name, bool ok, int *failed)
+{
+
+	printf("%-16s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		(*failed)++;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+static void
+nap(long usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	(void)nanosleep(&ts, NULL);
+}
+
+static void
+state_init(struct test_state *state, mportInstance *mport)
+{
+
+	memset(state, 0, sizeof(struct test_state));
+	state->mport = mport;
+	pthread_mutex_init(&state->lock, NULL);
+}
+
+static int
+task_count(void *arg)
+{
+	struct test_task *t = arg;
+
+	/* finish out of order, later tasks sooner */
+	nap((TEST_TASKS - t->index) * 100);
+
+	pthread_mutex_lock(&t->state->lock);
+	t->state->ran++;
+	pthread_mutex_unlock(&t->state->lock);
+
+	return (MPORT_OK);
+}
+
+static int
+order_done(void *arg, int result, const char *msg, void *cbarg)
+{
+	struct test_task *t = arg;
+	struct test_state *state = cbarg;
+
+	if (result != MPORT_OK || t->index != state->next_done)
+		state->misordered = true;
+	state->next_done++;
+
+	return (MPORT_OK);
+}
+
+/* the done callback sees every task, in the order they were added */
+static bool
+test_ordering(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_TASKS];
+	struct mport_taskgroup *tg;
+	int i, ret;
+
+	state_init(&state, mport);
+	if ((tg = mport_taskgroup_new(mport, 0, 0)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_TASKS; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(tg, task_count, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(tg, order_done, &state);
+	mport_taskgroup_free(tg);
+
+	return (ret == MPORT_OK && !state.misordered && state.next_done == TEST_TASKS &&
+	    state.ran == TEST_TASKS);
+}
+
+static int
+task_limited(void *arg)
+{
+	struct test_task *t = arg;
+	struct test_state *state = t->state;
+
+	pthread_mutex_lock(&state->lock);
+	if (++state->running > state->max_running)
+		state->max_running = state->running;
+	pthread_mutex_unlock(&state->lock);
+
+	nap(1000);
+
+	pthread_mutex_lock(&state->lock);
+	state->running--;
+	state->ran++;
+	pthread_mutex_unlock(&state->lock);
+
+	return (MPORT_OK);
+}
+
+/* no more than the limit run at once, counting the waiting thread */
+static bool
+test_limit(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_TASKS];
+	struct mport_taskgroup *tg;
+	int i, ret;
+
+	state_init(&state, mport);
+	if ((tg = mport_taskgroup_new(mport, 0, TEST_LIMIT)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_TASKS; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(tg, task_limited, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(tg, NULL, NULL);
+	mport_taskgroup_free(tg);
+
+	return (ret == MPORT_OK && state.ran == TEST_TASKS && state.max_running >= 1 &&
+	    state.max_running <= TEST_LIMIT);
+}
+
+static int
+task_failfast(void *arg)
+{
+	struct test_task *t = arg;
+
+	pthread_mutex_lock(&t->state->lock);
+	t->state->ran++;
+	pthread_mutex_unlock(&t->state->lock);
+
+	if (t->index == TEST_FAIL_AT)
+		return (mport_set_errx(MPORT_ERR_FATAL, "task %d failed", t->index));
+
+	return (MPORT_OK);
+}
+
+/*
+ * With a limit of one, nothing after the failing task may start, and wait
+ * reports the failure with the task's own message.
+ */
+static bool
+test_failfast(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_TASKS];
+	struct mport_taskgroup *tg;
+	char expect[32];
+	bool ok;
+	int i, ret;
+
+	state_init(&state, mport);
+	if ((tg = mport_taskgroup_new(mport, MPORT_TASKGROUP_FAILFAST, 1)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_TASKS; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(tg, task_failfast, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(tg, NULL, NULL);
+
+	(void)snprintf(expect, sizeof(expect), "task %d failed", TEST_FAIL_AT);
+	ok = ret == MPORT_ERR_FATAL && strcmp(mport_err_string(), expect) == 0 &&
+	    state.ran == TEST_FAIL_AT + 1 && mport_taskgroup_cancelled(tg);
+
+	mport_taskgroup_free(tg);
+	mport_err_clear();
+
+	return (ok);
+}
+
+static int
+task_inner(void *arg)
+{
+	struct test_task *t = arg;
+
+	pthread_mutex_lock(&t->state->lock);
+	t->state->sum += t->index;
+	pthread_mutex_unlock(&t->state->lock);
+
+	return (MPORT_OK);
+}
+
+/* each outer task waits on a group of its own, from whatever thread runs it */
+static int
+task_outer(void *arg)
+{
+	struct test_task *t = arg;
+	struct test_task inner[TEST_NEST];
+	struct mport_taskgroup *tg;
+	int i, ret;
+
+	if ((tg = mport_taskgroup_new(t->state->mport, 0, 0)) == NULL)
+		return (mport_set_errx(MPORT_ERR_FATAL, "Out of memory."));
+
+	for (i = 0; i < TEST_NEST; i++) {
+		inner[i] = (struct test_task){ .state = t->state, .index = t->index * TEST_NEST + i };
+		(void)mport_taskgroup_add(tg, task_inner, &inner[i]);
+	}
+	ret = mport_taskgroup_wait(tg, NULL, NULL);
+	mport_taskgroup_free(tg);
+
+	return (ret);
+}
+
+static bool
+test_nesting(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_NEST];
+	struct mport_taskgroup *tg;
+	int i, n, ret;
+
+	state_init(&state, mport);
+	if ((tg = mport_taskgroup_new(mport, 0, 0)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_NEST; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(tg, task_outer, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(tg, NULL, NULL);
+	mport_taskgroup_free(tg);
+
+	n = TEST_NEST * TEST_NEST;
+
+	return (ret == MPORT_OK && state.sum == n * (n - 1) / 2);
+}
+
+static int
+cancel_done(void *arg, int result, const char *msg, void *cbarg)
+{
+	struct test_task *t = arg;
+
+	return (t->index == TEST_FAIL_AT ? MPORT_ERR_WARN : MPORT_OK);
+}
+
+/* a callback's error is returned and the tasks not yet started never run */
+static bool
+test_cancel_cb(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_TASKS];
+	struct mport_taskgroup *tg;
+	int i, ret;
+
+	state_init(&state, mport);
+	if ((tg = mport_taskgroup_new(mport, 0, 1)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_TASKS; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(tg, task_count, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(tg, cancel_done, &state);
+	mport_taskgroup_free(tg);
+
+	return (ret == MPORT_ERR_WARN && state.ran < TEST_TASKS);
+}
+
+/*
+ * The first task cancels the group; the others that got started poll for it
+ * and stop.
+ */
+static int
+task_cancel(void *arg)
+{
+	struct test_task *t = arg;
+	struct test_state *state = t->state;
+	int i;
+
+	pthread_mutex_lock(&state->lock);
+	state->ran++;
+	pthread_mutex_unlock(&state->lock);
+
+	if (t->index == 0) {
+		nap(10000);
+		mport_taskgroup_cancel(state->tg);
+		return (MPORT_OK);
+	}
+
+	for (i = 0; i < 5000 && !mport_taskgroup_cancelled(state->tg); i++)
+		nap(1000);
+
+	if (i == 5000) {
+		pthread_mutex_lock(&state->lock);
+		state->timed_out = true;
+		pthread_mutex_unlock(&state->lock);
+	}
+
+	return (MPORT_OK);
+}
+
+static bool
+test_cancel(mportInstance *mport)
+{
+	struct test_state state;
+	struct test_task tasks[TEST_CANCEL];
+	int i, ret, workers;
+
+	state_init(&state, mport);
+	if ((state.tg = mport_taskgroup_new(mport, 0, 0)) == NULL)
+		return (false);
+
+	for (i = 0; i < TEST_CANCEL; i++) {
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+		(void)mport_taskgroup_add(state.tg, task_cancel, &tasks[i]);
+	}
+	ret = mport_taskgroup_wait(state.tg, NULL, NULL);
+	mport_taskgroup_free(state.tg);
+	mport_err_clear();
+
+	/* at most one task per worker plus the waiter can have been running */
+	workers = mport_pool_workers(mport);
+
+	return (ret != MPORT_OK && !state.timed_out && state.ran <= workers + 1);
+}
+
+static int
+task_clears(void *arg)
+{
+
+	(void)mport_set_errx(MPORT_ERR_FATAL, "task error");
+	mport_err_clear();
+
+	return (MPORT_OK);
+}
+
+/* tasks run on the waiting thread must not disturb its error state */
+static bool
+test_errstate(mportInstance *mport)
+{
+	struct mport_taskgroup *tg;
+	bool ok;
+	int i, ret;
+
+	if ((tg = mport_taskgroup_new(mport, 0, 0)) == NULL)
+		return (false);
+
+	(void)mport_set_errx(MPORT_ERR_WARN, "caller error");
+
+	for (i = 0; i < TEST_TASKS; i++)
+		(void)mport_taskgroup_add(tg, task_clears, NULL);
+	ret = mport_taskgroup_wait(tg, NULL, NULL);
+	mport_taskgroup_free(tg);
+
+	ok = ret == MPORT_OK && mport_err_code() == MPORT_ERR_WARN &&
+	    strcmp(mport_err_string(), "caller error") == 0;
+	mport_err_clear();
+
+	return (ok);
+}
+
+static int
+task_work(void *arg)
+{
+	struct test_task *t = arg;
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < BENCH_WORK; i++)
+		h = (h ^ (uint32_t)(i + t->index)) * 16777619u;
+	t->out = h;
+
+	return (MPORT_OK);
+}
+
+static void
+bench(mportInstance *mport, int ntasks)
+{
+	struct test_state state;
+	struct test_task *tasks;
+	struct mport_taskgroup *tg;
+	double start, serial, pooled;
+	int i;
+
+	if ((tasks = calloc(ntasks, sizeof(struct test_task))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	state_init(&state, mport);
+	for (i = 0; i < ntasks; i++)
+		tasks[i] = (struct test_task){ .state = &state, .index = i };
+
+	start = now();
+	for (i = 0; i < ntasks; i++)
+		(void)task_work(&tasks[i]);
+	serial = now() - start;
+
+	if ((tg = mport_taskgroup_new(mport, 0, 0)) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+	start = now();
+	for (i = 0; i < ntasks; i++)
+		(void)mport_taskgroup_add(tg, task_work, &tasks[i]);
+	if (mport_taskgroup_wait(tg, NULL, NULL) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+	pooled = now() - start;
+	mport_taskgroup_free(tg);
+
+	printf("bench: %d tasks, serial %.6fs, pool %.6fs, speedup %.2f\n", ntasks, serial, pooled,
+	    pooled > 0 ? serial / pooled : 0.0);
+
+	free(tasks);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.pooltest [-b] [-n tasks] [-w workers]\n");
+	exit(2);
+}
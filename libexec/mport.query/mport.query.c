@@ -179,7 +179,7 @@ build_where(int argc, char **argv) {
 		} else if (strcmp(column, "origin") == 0) {
 			clause = sqlite3_mprintf("origin=%Q", arg);
 		} else if (strcmp(column, "version") == 0) {
-			clause = sqlite3_mprintf("mport_version_cmp(version, %Q)%s0", arg, op);
+			clause = sqlite3_mprintf("version_key%smport_version_key(%Q)", op, arg);
 		} else {
 			usage();
 		}
@@ -0,0 +1,940 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scale tests: generate a master.db and an index.db the size of a big host
+ * and a full repository, then time the queries behind mport which, list
+ * updates, search, the delete dependency check and stats against them.
+ * Results are written as JSON.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+#include <mport.h>
+
+#define SCALE_PREFIX	"/usr/local"
+/* where mport keeps its databases, under the root given to the instance */
+#define SCALE_INST_DIR	"/var/db/mport"
+#define SCALE_MASTER_DB	SCALE_INST_DIR "/master.db"
+#define SCALE_MAXDEPS	8
+#define SCALE_NITEMS(a)	(sizeof(a) / sizeof((a)[0]))
+
+enum scale_query {
+	QUERY_WHICH,
+	QUERY_LIST_UPDATES,
+	QUERY_SEARCH,
+	QUERY_DELETE_CHECK,
+	QUERY_STATS,
+	QUERY_MAX
+};
+
+static const char *query_names[QUERY_MAX] = {
+	"which", "list_updates", "search", "delete_check", "stats"
+};
+
+static const char *prefixes[] = {
+	"", "", "", "", "lib", "p5-", "py311-", "rubygem-", "xorg-", "font-"
+};
+
+static const char *syllables[] = {
+	"ab", "ce", "di", "fo", "gu", "ka", "le", "mi", "no", "pu", "ra", "se", "ti", "vo", "xu", "zy"
+};
+
+static const char *categories[] = {
+	"archivers", "databases", "devel", "editors", "graphics", "lang", "mail", "math",
+	"multimedia", "net", "print", "security", "sysutils", "textproc", "www", "x11"
+};
+
+struct scale_pkg {
+	char name[48];
+	int major, minor, patch;
+	int category;
+	int ndeps;
+	int deps[SCALE_MAXDEPS];
+	bool installed;
+	int64_t assets;
+};
+
+struct scale_config {
+	int index_packages;
+	int installed;
+	int64_t assets;
+	int samples;
+	int rounds;
+	uint64_t seed;
+	struct scale_pkg *pkgs;
+	char workdir[PATH_MAX];
+	char root[PATH_MAX];
+	char index[PATH_MAX];
+};
+
+struct scale_result {
+	double *calls;
+	int count;
+};
+
+static uint64_t rng_state;
+
+static void usage(void);
+static double now(void);
+static uint64_t rng(void);
+static void quiet_msg(const char *);
+static void quiet_progress_init(const char *);
+static void quiet_progress_step(int, int, const char *);
+static void quiet_progress_free(void);
+static int quiet_index_cb(const mportIndexEntry *, void *);
+static void scale_model(struct scale_config *);
+static int scale_install(struct scale_config *, int);
+static void db_exec(sqlite3 *, const char *);
+static void db_step(sqlite3 *, sqlite3_stmt *);
+static int db_count(sqlite3 *, const char *);
+static void scale_mkdirp(const char *);
+static int rmtree_cb(const char *, const struct stat *, int, struct FTW *);
+static void scale_rmtree(const char *);
+static void gen_index(struct scale_config *);
+static void gen_master(struct scale_config *);
+static void scale_installed_name(char *, size_t, struct scale_config *, int);
+static void asset_path(char *, size_t, const struct scale_pkg *, int64_t);
+static mportInstance *scale_open(struct scale_config *);
+static char **scale_sample(mportInstance *, const char *, int);
+static void scale_run(struct scale_config *, struct scale_result *);
+static void result_add(struct scale_result *, double);
+static int double_cmp(const void *, const void *);
+static void report(FILE *, struct scale_config *, double, struct scale_result *);
+
+int
+main(int argc, char *argv[])
+{
+	struct scale_config cfg;
+	struct scale_result results[QUERY_MAX];
+	FILE *out = stdout;
+	const char *outfile = NULL;
+	char path[PATH_MAX];
+	double generate = -1;
+	bool generate_only = false;
+	bool test_only = false;
+	bool keep = false;
+	bool madedir = false;
+	int ch, i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.index_packages = 30000;
+	cfg.installed = 3000;
+	cfg.assets = 2000000;
+	cfg.samples = 200;
+	cfg.rounds = 5;
+	cfg.seed = 1;
+
+	while ((ch = getopt(argc, argv, "a:gi:ko:p:q:r:s:tw:")) != -1) {
+		switch (ch) {
+			case 'a':
+				if ((cfg.assets = strtoll(optarg, NULL, 10)) < 1)
+					errx(EXIT_FAILURE, "Invalid asset count: %s", optarg);
+				break;
+			case 'g':
+				generate_only = true;
+				break;
+			case 'i':
+				if ((cfg.index_packages = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid index package count: %s", optarg);
+				break;
+			case 'k':
+				keep = true;
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'p':
+				if ((cfg.installed = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid installed package count: %s", optarg);
+				break;
+			case 'q':
+				if ((cfg.samples = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid sample count: %s", optarg);
+				break;
+			case 'r':
+				if ((cfg.rounds = atoi(optarg)) < 1)
+					errx(EXIT_FAILURE, "Invalid round count: %s", optarg);
+				break;
+			case 's':
+				cfg.seed = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				test_only = true;
+				break;
+			case 'w':
+				if (realpath(optarg, cfg.workdir) == NULL)
+					err(EXIT_FAILURE, "%s", optarg);
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0 || (generate_only && test_only))
+		usage();
+
+	if (cfg.installed > cfg.index_packages)
+		errx(EXIT_FAILURE, "More packages installed (%d) than in the index (%d)", cfg.installed,
+		    cfg.index_packages);
+
+	if (cfg.workdir[0] == '\0') {
+		if (test_only)
+			errx(EXIT_FAILURE, "-t needs the fixture directory given with -w");
+		strlcpy(cfg.workdir, "/tmp/mport.scale.XXXXXXXX", sizeof(cfg.workdir));
+		if (mkdtemp(cfg.workdir) == NULL)
+			err(EXIT_FAILURE, "mkdtemp");
+		madedir = true;
+	}
+
+	(void)snprintf(cfg.root, sizeof(cfg.root), "%s/root", cfg.workdir);
+	(void)snprintf(cfg.index, sizeof(cfg.index), "%s/index.db", cfg.workdir);
+	(void)snprintf(path, sizeof(path), "%s%s", cfg.root, SCALE_INST_DIR);
+	scale_mkdirp(path);
+
+	if (setenv("PKG_DB", cfg.index, 1) == -1)
+		err(EXIT_FAILURE, "setenv");
+
+	if (!test_only) {
+		(void)snprintf(path, sizeof(path), "%s%s", cfg.root, SCALE_MASTER_DB);
+		(void)unlink(path);
+
+		generate = now();
+		rng_state = cfg.seed == 0 ? 1 : cfg.seed;
+		scale_model(&cfg);
+		gen_index(&cfg);
+		gen_master(&cfg);
+		free(cfg.pkgs);
+		generate = now() - generate;
+
+		if (generate_only) {
+			fprintf(stderr, "Fixtures written to %s in %.1f seconds\n", cfg.workdir, generate);
+			return (0);
+		}
+	}
+
+	if (outfile != NULL && (out = fopen(outfile, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", outfile);
+
+	scale_run(&cfg, results);
+	report(out, &cfg, generate, results);
+	if (out != stdout)
+		fclose(out);
+
+	for (i = 0; i < QUERY_MAX; i++)
+		free(results[i].calls);
+
+	if (madedir && !keep)
+		scale_rmtree(cfg.workdir);
+
+	return (0);
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+
+/* xorshift64*, so a seed always produces the same fixtures */
+static uint64_t
+rng(void)
+{
+
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return (rng_state * 0x2545F4914F6CDD1DULL);
+}
+
+
+static void
+quiet_msg(const char *msg)
+{
+}
+
+static void
+quiet_progress_init(const char *title)
+{
+}
+
+static void
+quiet_progress_step(int current, int total, const char *msg)
+{
+}
+
+static void
+quiet_progress_free(void)
+{
+}
+
+static int
+quiet_index_cb(const mportIndexEntry *e, void *arg)
+{
+
+	return (MPORT_OK);
+}
+
+
+/*
+ * Lay out the repository in memory before anything is written, so the index
+ * and the master database agree.  Dependencies only point at lower numbered
+ * packages, most of them at the first few percent, which play the part of
+ * the handful of libraries everything links against.
+ */
+static void
+scale_model(struct scale_config *cfg)
+{
+	struct scale_pkg *p;
+	int64_t total, assigned;
+	int i, j, k, d, n, popular;
+	size_t len;
+
+	if ((cfg->pkgs = calloc(cfg->index_packages, sizeof(struct scale_pkg))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	popular = cfg->index_packages / 20 > 0 ? cfg->index_packages / 20 : 1;
+
+	for (i = 0; i < cfg->index_packages; i++) {
+		p = &cfg->pkgs[i];
+
+		/* the syllables spell out i, which keeps every name unique */
+		strlcpy(p->name, prefixes[rng() % SCALE_NITEMS(prefixes)], sizeof(p->name));
+		n = i;
+		do {
+			strlcat(p->name, syllables[n % SCALE_NITEMS(syllables)], sizeof(p->name));
+			n /= SCALE_NITEMS(syllables);
+		} while (n > 0);
+		len = strlen(p->name);
+		if (rng() % 4 == 0)
+			(void)snprintf(p->name + len, sizeof(p->name) - len, "%d", (int)(rng() % 30) + 1);
+
+		p->major = (int)(rng() % 12);
+		p->minor = (int)(rng() % 20) + 1;
+		p->patch = (int)(rng() % 10);
+		p->category = (int)(rng() % SCALE_NITEMS(categories));
+
+		if (i == 0 || rng() % 100 < 40)
+			continue;
+		n = (int)(rng() % SCALE_MAXDEPS) + 1;
+		for (j = 0; j < n; j++) {
+			d = (int)(rng() % 100 < 60 ? rng() % (i < popular ? i : popular) : rng() % i);
+			for (k = 0; k < p->ndeps && p->deps[k] != d; k++)
+				;
+			if (k == p->ndeps)
+				p->deps[p->ndeps++] = d;
+		}
+	}
+
+	/* pick packages until enough are installed; each one brings its dependencies */
+	for (n = 0; n < cfg->installed; ) {
+		i = (int)(rng() % cfg->index_packages);
+		n += scale_install(cfg, i);
+	}
+	cfg->installed = n;
+
+	/*
+	 * Most packages have a few dozen files, some a few hundred, and a few
+	 * (think compilers and TeX) tens of thousands.  Scale the draw to the
+	 * asset total.
+	 */
+	for (total = 0, i = 0; i < cfg->index_packages; i++) {
+		p = &cfg->pkgs[i];
+		if (!p->installed)
+			continue;
+		k = (int)(rng() % 100);
+		if (k < 70)
+			p->assets = 5 + (int64_t)(rng() % 55);
+		else if (k < 95)
+			p->assets = 60 + (int64_t)(rng() % 940);
+		else
+			p->assets = 1000 + (int64_t)(rng() % 19000);
+		total += p->assets;
+	}
+	for (assigned = 0, i = 0; i < cfg->index_packages; i++) {
+		p = &cfg->pkgs[i];
+		if (!p->installed)
+			continue;
+		p->assets = p->assets * cfg->assets / total;
+		if (p->assets < 1)
+			p->assets = 1;
+		assigned += p->assets;
+	}
+	/* rounding leftovers go to the first installed package */
+	for (i = 0; i < cfg->index_packages; i++) {
+		if (cfg->pkgs[i].installed) {
+			if (cfg->pkgs[i].assets + cfg->assets - assigned > 0)
+				cfg->pkgs[i].assets += cfg->assets - assigned;
+			break;
+		}
+	}
+}
+
+/* returns how many packages were newly marked installed */
+static int
+scale_install(struct scale_config *cfg, int i)
+{
+	struct scale_pkg *p = &cfg->pkgs[i];
+	int j, n = 1;
+
+	if (p->installed)
+		return (0);
+	p->installed = true;
+
+	for (j = 0; j < p->ndeps; j++)
+		n += scale_install(cfg, p->deps[j]);
+
+	return (n);
+}
+
+
+static void
+db_exec(sqlite3 *db, const char *sql)
+{
+
+	if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", sql, sqlite3_errmsg(db));
+}
+
+static void
+db_step(sqlite3 *db, sqlite3_stmt *stmt)
+{
+
+	if (sqlite3_step(stmt) != SQLITE_DONE)
+		errx(EXIT_FAILURE, "%s", sqlite3_errmsg(db));
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+static int
+db_count(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int count;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW)
+		errx(EXIT_FAILURE, "%s: %s", sql, sqlite3_errmsg(db));
+	count = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return (count);
+}
+
+static void
+scale_mkdirp(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	strlcpy(path, dir, sizeof(path));
+	for (p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/')) {
+		if (p != NULL)
+			*p = '\0';
+		if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+			err(EXIT_FAILURE, "Couldn't create %s", path);
+		if (p == NULL)
+			break;
+		*p = '/';
+	}
+}
+
+static int
+rmtree_cb(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+
+	if (remove(path) != 0)
+		warn("%s", path);
+
+	return (0);
+}
+
+static void
+scale_rmtree(const char *dir)
+{
+
+	(void)nftw(dir, rmtree_cb, 64, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+}
+
+
+/* the index layout the build cluster publishes */
+static void
+gen_index(struct scale_config *cfg)
+{
+	sqlite3 *db;
+	sqlite3_stmt *pkg, *dep;
+	struct scale_pkg *p, *d;
+	char version[32], dversion[32], bundle[96], comment[128], hash[65];
+	int i, j;
+
+	(void)unlink(cfg->index);
+	if (sqlite3_open(cfg->index, &db) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", cfg->index, sqlite3_errmsg(db));
+
+	db_exec(db, "CREATE TABLE packages (pkg text NOT NULL, version text NOT NULL, comment text, "
+	    "bundlefile text NOT NULL, license text, hash text, type int)");
+	db_exec(db, "CREATE TABLE depends (pkg text NOT NULL, version text NOT NULL, d_pkg text NOT NULL, "
+	    "d_version text NOT NULL)");
+	db_exec(db, "CREATE TABLE moved (port text NOT NULL, moved_to text, why text, date text)");
+	db_exec(db, "CREATE TABLE aliases (pkg text NOT NULL, alias text NOT NULL)");
+	db_exec(db, "CREATE TABLE mirrors (country text NOT NULL, mirror text NOT NULL)");
+	db_exec(db, "INSERT INTO mirrors VALUES ('us', 'http://127.0.0.1')");
+
+	db_exec(db, "BEGIN TRANSACTION");
+	if (sqlite3_prepare_v2(db, "INSERT INTO packages VALUES (?, ?, ?, ?, 'bsd2', ?, 0)", -1, &pkg,
+	    NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO depends VALUES (?, ?, ?, ?)", -1, &dep, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "index.db: %s", sqlite3_errmsg(db));
+
+	for (i = 0; i < cfg->index_packages; i++) {
+		p = &cfg->pkgs[i];
+		(void)snprintf(version, sizeof(version), "%d.%d.%d", p->major, p->minor, p->patch);
+		(void)snprintf(bundle, sizeof(bundle), "%s-%s.mport", p->name, version);
+		(void)snprintf(comment, sizeof(comment), "%s utility from the %s collection", p->name,
+		    categories[p->category]);
+		(void)snprintf(hash, sizeof(hash), "%016jx%016jx%016jx%016jx", (uintmax_t)rng(), (uintmax_t)rng(),
+		    (uintmax_t)rng(), (uintmax_t)rng());
+
+		sqlite3_bind_text(pkg, 1, p->name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 2, version, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 3, comment, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 4, bundle, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 5, hash, -1, SQLITE_STATIC);
+		db_step(db, pkg);
+
+		for (j = 0; j < p->ndeps; j++) {
+			d = &cfg->pkgs[p->deps[j]];
+			(void)snprintf(dversion, sizeof(dversion), "%d.%d.%d", d->major, d->minor, d->patch);
+			sqlite3_bind_text(dep, 1, p->name, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 2, version, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 3, d->name, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 4, dversion, -1, SQLITE_STATIC);
+			db_step(db, dep);
+		}
+	}
+
+	sqlite3_finalize(pkg);
+	sqlite3_finalize(dep);
+	db_exec(db, "COMMIT TRANSACTION");
+	sqlite3_close(db);
+}
+
+
+/*
+ * Fill a master database through a real instance, so the schema is whatever
+ * this libmport creates.  About one installed package in six is a version
+ * behind the index, which gives list updates something to report, and one
+ * in a hundred has left the index altogether.
+ */
+static void
+gen_master(struct scale_config *cfg)
+{
+	mportInstance *mport;
+	sqlite3 *db;
+	sqlite3_stmt *pkg, *dep, *cat, *asset;
+	struct scale_pkg *p, *d;
+	char name[64], dname[64], version[32], dversion[32], origin[96], dorigin[96], path[PATH_MAX], hash[65];
+	char *os_release;
+	int64_t f;
+	int i, j;
+
+	mport = scale_open(cfg);
+	db = mport->db;
+	if ((os_release = mport_get_osrelease(mport)) == NULL)
+		errx(EXIT_FAILURE, "Unable to determine OS release");
+
+	db_exec(db, "BEGIN TRANSACTION");
+	if (sqlite3_prepare_v2(db, "INSERT INTO packages (pkg, version, origin, prefix, comment, os_release, "
+	    "status, automatic, install_date, flatsize, version_key) "
+	    "VALUES (?, ?, ?, '" SCALE_PREFIX "', 'Scale test package', ?, 'clean', ?, ?, ?, mport_version_key(?))",
+	    -1, &pkg, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO depends (pkg, depend_pkgname, depend_pkgversion, depend_port) "
+	    "VALUES (?, ?, ?, ?)", -1, &dep, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO categories (pkg, category) VALUES (?, ?)", -1, &cat,
+	    NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, "INSERT INTO assets (pkg, type, data, checksum) VALUES (?, ?, ?, ?)", -1, &asset,
+	    NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "master.db: %s", sqlite3_errmsg(db));
+
+	for (i = 0; i < cfg->index_packages; i++) {
+		p = &cfg->pkgs[i];
+		if (!p->installed)
+			continue;
+
+		scale_installed_name(name, sizeof(name), cfg, i);
+		if (i % 6 == 0 && p->minor > 1)
+			(void)snprintf(version, sizeof(version), "%d.%d.%d", p->major, p->minor - 1, p->patch);
+		else
+			(void)snprintf(version, sizeof(version), "%d.%d.%d", p->major, p->minor, p->patch);
+		(void)snprintf(origin, sizeof(origin), "%s/%s", categories[p->category], p->name);
+
+		sqlite3_bind_text(pkg, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 2, version, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 3, origin, -1, SQLITE_STATIC);
+		sqlite3_bind_text(pkg, 4, os_release, -1, SQLITE_STATIC);
+		sqlite3_bind_int(pkg, 5, rng() % 3 == 0 ? MPORT_EXPLICIT : MPORT_AUTOMATIC);
+		sqlite3_bind_int64(pkg, 6, (sqlite3_int64)(time(NULL) - (time_t)(rng() % (3 * 365 * 86400))));
+		sqlite3_bind_int64(pkg, 7, (sqlite3_int64)(p->assets * 12288));
+		sqlite3_bind_text(pkg, 8, version, -1, SQLITE_STATIC);
+		db_step(db, pkg);
+
+		sqlite3_bind_text(cat, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_text(cat, 2, categories[p->category], -1, SQLITE_STATIC);
+		db_step(db, cat);
+
+		for (j = 0; j < p->ndeps; j++) {
+			d = &cfg->pkgs[p->deps[j]];
+			scale_installed_name(dname, sizeof(dname), cfg, p->deps[j]);
+			(void)snprintf(dversion, sizeof(dversion), ">=%d.%d", d->major, d->minor > 1 ? d->minor - 1 : 0);
+			(void)snprintf(dorigin, sizeof(dorigin), "%s/%s", categories[d->category], d->name);
+			sqlite3_bind_text(dep, 1, name, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 2, dname, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 3, dversion, -1, SQLITE_STATIC);
+			sqlite3_bind_text(dep, 4, dorigin, -1, SQLITE_STATIC);
+			db_step(db, dep);
+		}
+
+		for (f = 0; f < p->assets; f++) {
+			asset_path(path, sizeof(path), p, f);
+			(void)snprintf(hash, sizeof(hash), "%016jx%016jx%016jx%016jx", (uintmax_t)rng(),
+			    (uintmax_t)rng(), (uintmax_t)rng(), (uintmax_t)rng());
+			sqlite3_bind_text(asset, 1, name, -1, SQLITE_STATIC);
+			sqlite3_bind_int(asset, 2, ASSET_FILE);
+			sqlite3_bind_text(asset, 3, path, -1, SQLITE_STATIC);
+			sqlite3_bind_text(asset, 4, hash, -1, SQLITE_STATIC);
+			db_step(db, asset);
+		}
+		(void)snprintf(path, sizeof(path), "share/%s", p->name);
+		sqlite3_bind_text(asset, 1, name, -1, SQLITE_STATIC);
+		sqlite3_bind_int(asset, 2, ASSET_DIRRMTRY);
+		sqlite3_bind_text(asset, 3, path, -1, SQLITE_STATIC);
+		db_step(db, asset);
+	}
+
+	sqlite3_finalize(pkg);
+	sqlite3_finalize(dep);
+	sqlite3_finalize(cat);
+	sqlite3_finalize(asset);
+	db_exec(db, "COMMIT TRANSACTION");
+
+	free(os_release);
+	mport_instance_free(mport);
+}
+
+
+/* packages that have since left the index were installed under another name */
+static void
+scale_installed_name(char *name, size_t len, struct scale_config *cfg, int i)
+{
+
+	if (i % 100 == 99)
+		(void)snprintf(name, len, "%s-legacy", cfg->pkgs[i].name);
+	else
+		strlcpy(name, cfg->pkgs[i].name, len);
+}
+
+
+/*
+ * File assets are stored as absolute paths.  Spread them over the places a
+ * port installs to, weighted towards share/, whose deep trees are where the
+ * big packages keep most of their files.
+ */
+static void
+asset_path(char *path, size_t len, const struct scale_pkg *p, int64_t f)
+{
+	uint64_t r = rng();
+	int a = (int)(r % 97), b = (int)((r >> 8) % 31), sect = (int)((r >> 16) % 9) + 1;
+
+	switch ((r >> 24) % 20) {
+		case 0:
+		case 1:
+		case 2:
+			(void)snprintf(path, len, SCALE_PREFIX "/bin/%s-%jd", p->name, (intmax_t)f);
+			break;
+		case 3:
+			(void)snprintf(path, len, SCALE_PREFIX "/sbin/%s-%jd", p->name, (intmax_t)f);
+			break;
+		case 4:
+		case 5:
+		case 6:
+			(void)snprintf(path, len, SCALE_PREFIX "/lib/lib%s-%jd.so.%d", p->name, (intmax_t)f, p->major);
+			break;
+		case 7:
+		case 8:
+			(void)snprintf(path, len, SCALE_PREFIX "/include/%s/d%02d/h%jd.h", p->name, b, (intmax_t)f);
+			break;
+		case 9:
+			(void)snprintf(path, len, SCALE_PREFIX "/share/man/man%d/%s-%jd.%d.gz", sect, p->name,
+			    (intmax_t)f, sect);
+			break;
+		case 10:
+			(void)snprintf(path, len, SCALE_PREFIX "/share/doc/%s/d%02d/doc%jd.html", p->name, b,
+			    (intmax_t)f);
+			break;
+		default:
+			(void)snprintf(path, len, SCALE_PREFIX "/share/%s/d%02d/d%02d/f%jd.dat", p->name, a, b,
+			    (intmax_t)f);
+			break;
+	}
+}
+
+
+static mportInstance *
+scale_open(struct scale_config *cfg)
+{
+	mportInstance *mport;
+
+	if ((mport = mport_instance_new()) == NULL)
+		errx(EXIT_FAILURE, "Failed to allocate memory");
+
+	mport_set_msg_cb(mport, quiet_msg);
+	mport_set_progress_init_cb(mport, quiet_progress_init);
+	mport_set_progress_step_cb(mport, quiet_progress_step);
+	mport_set_progress_free_cb(mport, quiet_progress_free);
+
+	if (mport_instance_init(mport, cfg->root, NULL, true, MPORT_VQUIET) != MPORT_OK)
+		errx(EXIT_FAILURE, "%s", mport_err_string());
+
+	return (mport);
+}
+
+
+/* a NULL terminated random sample of a single text column */
+static char **
+scale_sample(mportInstance *mport, const char *sql, int count)
+{
+	sqlite3_stmt *stmt;
+	char **vec, *query;
+	int i = 0;
+
+	if ((vec = calloc(count + 1, sizeof(char *))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	if ((query = sqlite3_mprintf("%s ORDER BY random() LIMIT %d", sql, count)) == NULL)
+		errx(EXIT_FAILURE, "Out of memory.");
+	if (sqlite3_prepare_v2(mport->db, query, -1, &stmt, NULL) != SQLITE_OK)
+		errx(EXIT_FAILURE, "%s: %s", query, sqlite3_errmsg(mport->db));
+	sqlite3_free(query);
+	while (i < count && sqlite3_step(stmt) == SQLITE_ROW) {
+		if ((vec[i++] = strdup((const char *)sqlite3_column_text(stmt, 0))) == NULL)
+			err(EXIT_FAILURE, "strdup");
+	}
+	sqlite3_finalize(stmt);
+
+	return (vec);
+}
+
+
+/*
+ * Samples are drawn from the databases, not the model, so -t can run
+ * against fixtures written by an earlier -g.  Each query goes through the
+ * same entry point as the command it stands for.
+ */
+static void
+scale_run(struct scale_config *cfg, struct scale_result *results)
+{
+	mportInstance *mport;
+	mportPackageMeta *pack, **packs, **updepends;
+	mportListPrint print;
+	mportStats *stats;
+	char **paths, **names, **terms, **s;
+	char term[64];
+	double start;
+	int r;
+
+	memset(results, 0, sizeof(struct scale_result) * QUERY_MAX);
+	for (r = 0; r < QUERY_MAX; r++) {
+		if ((results[r].calls = calloc(cfg->samples > cfg->rounds ? cfg->samples : cfg->rounds,
+		    sizeof(double))) == NULL)
+			err(EXIT_FAILURE, "calloc");
+	}
+
+	mport = scale_open(cfg);
+	if (mport_index_load(mport) != MPORT_OK)
+		errx(EXIT_FAILURE, "Unable to load the index: %s", mport_err_string());
+
+	(void)snprintf(term, sizeof(term), "SELECT data FROM assets WHERE type=%d", ASSET_FILE);
+	paths = scale_sample(mport, term, cfg->samples);
+	names = scale_sample(mport, "SELECT pkg FROM packages", cfg->samples);
+	terms = scale_sample(mport, "SELECT substr(pkg, 3, 4) FROM idx.packages WHERE length(pkg) > 6", cfg->samples);
+
+	/* mport which */
+	for (s = paths; *s != NULL; s++) {
+		start = now();
+		if (mport_asset_get_package_from_file_path(mport, *s, &pack) != MPORT_OK)
+			errx(EXIT_FAILURE, "which %s: %s", *s, mport_err_string());
+		result_add(&results[QUERY_WHICH], now() - start);
+		mport_pkgmeta_free(pack);
+	}
+
+	/* mport list updates */
+	memset(&print, 0, sizeof(print));
+	print.update = true;
+	for (r = 0; r < cfg->rounds; r++) {
+		start = now();
+		if (mport_list_print(mport, &print) != MPORT_OK)
+			errx(EXIT_FAILURE, "list updates: %s", mport_err_string());
+		result_add(&results[QUERY_LIST_UPDATES], now() - start);
+	}
+
+	/* mport search, with the where clause the command uses */
+	for (s = terms; *s != NULL; s++) {
+		(void)snprintf(term, sizeof(term), "*%s*", *s);
+		start = now();
+		if (mport_index_foreach(mport, quiet_index_cb, NULL, "pkg glob %Q or comment glob %Q", term,
+		    term) != MPORT_OK)
+			errx(EXIT_FAILURE, "search %s: %s", term, mport_err_string());
+		result_add(&results[QUERY_SEARCH], now() - start);
+	}
+
+	/* what mport delete checks before removing a package */
+	for (s = names; *s != NULL; s++) {
+		if (mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", *s) != MPORT_OK || packs == NULL)
+			errx(EXIT_FAILURE, "Unable to look up %s: %s", *s, mport_err_string());
+		start = now();
+		if (mport_pkgmeta_get_updepends(mport, *packs, &updepends) != MPORT_OK)
+			errx(EXIT_FAILURE, "updepends %s: %s", *s, mport_err_string());
+		result_add(&results[QUERY_DELETE_CHECK], now() - start);
+		mport_pkgmeta_vec_free(updepends);
+		mport_pkgmeta_vec_free(packs);
+	}
+
+	/* mport stats */
+	for (r = 0; r < cfg->rounds; r++) {
+		start = now();
+		if (mport_stats(mport, &stats) != MPORT_OK)
+			errx(EXIT_FAILURE, "stats: %s", mport_err_string());
+		result_add(&results[QUERY_STATS], now() - start);
+		mport_stats_free(stats);
+	}
+
+	/* report the sizes actually on disk, -t may be looking at other fixtures */
+	cfg->index_packages = db_count(mport->db, "SELECT COUNT(*) FROM idx.packages");
+	cfg->installed = db_count(mport->db, "SELECT COUNT(*) FROM packages");
+	cfg->assets = db_count(mport->db, "SELECT COUNT(*) FROM assets");
+
+	mport_instance_free(mport);
+	for (s = paths; *s != NULL; s++)
+		free(*s);
+	for (s = names; *s != NULL; s++)
+		free(*s);
+	for (s = terms; *s != NULL; s++)
+		free(*s);
+	free(paths);
+	free(names);
+	free(terms);
+}
+
+static void
+result_add(struct scale_result *result, double seconds)
+{
+
+	result->calls[result->count++] = seconds;
+}
+
+static int
+double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+
+static void
+report(FILE *out, struct scale_config *cfg, double generate, struct scale_result *results)
+{
+	struct scale_result *q;
+	double sum;
+	int i, j;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"index_packages\": %d,\n", cfg->index_packages);
+	fprintf(out, "  \"installed\": %d,\n", cfg->installed);
+	fprintf(out, "  \"assets\": %jd,\n", (intmax_t)cfg->assets);
+	fprintf(out, "  \"seed\": %ju,\n", (uintmax_t)cfg->seed);
+	if (generate < 0)
+		fprintf(out, "  \"generate\": null,\n");
+	else
+		fprintf(out, "  \"generate\": %.6f,\n", generate);
+	fprintf(out, "  \"queries\": {\n");
+
+	for (i = 0; i < QUERY_MAX; i++) {
+		q = &results[i];
+		fprintf(out, "    \"%s\": {\"calls\": %d", query_names[i], q->count);
+		if (q->count > 0) {
+			qsort(q->calls, q->count, sizeof(double), double_cmp);
+			for (sum = 0, j = 0; j < q->count; j++)
+				sum += q->calls[j];
+			fprintf(out, ", \"min\": %.6f, \"median\": %.6f, \"p95\": %.6f, \"max\": %.6f, \"mean\": %.6f",
+			    q->calls[0], q->calls[q->count / 2], q->calls[(q->count * 95) / 100 < q->count ?
+			    (q->count * 95) / 100 : q->count - 1], q->calls[q->count - 1], sum / q->count);
+		}
+		fprintf(out, "}%s\n", i == QUERY_MAX - 1 ? "" : ",");
+	}
+
+	fprintf(out, "  }\n");
+	fprintf(out, "}\n");
+}
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.scale [-g | -t] [-k] [-i index packages] [-p installed packages]\n");
+	fprintf(stderr, "                   [-a assets] [-q samples] [-r rounds] [-s seed] [-w workdir]\n");
+	fprintf(stderr, "                   [-o output]\n");
+	exit(2);
+}
@@ -0,0 +1,88 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <mport.h>
+
+static void usage(void);
+
+/*
+ * Train a zstd dictionary over a sample of bundles.  The dictionary is
+ * written to the output file and its ID printed; the repository ships it in
+ * the index's dictionaries table under that ID, and bundles are then built
+ * with mport.create -z.
+ */
+int
+main(int argc, char *argv[])
+{
+	const char *outfile = NULL;
+	size_t size = 0;
+	unsigned int id;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "o:s:")) != -1) {
+		switch (ch) {
+			case 'o':
+				outfile = optarg;
+				break;
+			case 's':
+				size = strtoul(optarg, NULL, 10);
+				break;
+			case '?':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (outfile == NULL || argc == 0)
+		usage();
+
+	if (mport_zdict_train((const char **)argv, outfile, size, &id) != MPORT_OK)
+		errx(EX_SOFTWARE, "Could not train dictionary: %s", mport_err_string());
+
+	printf("%u\n", id);
+
+	return (0);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: mport.zdict [-s <dictionary size>] -o <outputfile> <pkgfile1> <pkgfile2> ...\n");
+	exit(2);
+}
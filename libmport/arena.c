@@ -0,0 +1,217 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Region allocation for query results.
+ *
+ * A vector of package or index metadata is a few hundred small strings per
+ * dozen rows; allocating them from one region means the whole result is
+ * released with a single call, and the long tail of freed fragments that
+ * upgrade runs used to leave behind goes away.  Values that repeat from row
+ * to row (prefixes, OS releases, licenses and the like) are interned so each
+ * is stored once per region.
+ */
+
+#include "mport.h"
+#include "mport_private.h"
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_MIN		(16 * 1024)
+#define ARENA_CHUNK_MAX		(1024 * 1024)
+#define ARENA_INTERN_MIN	64
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	alignas(max_align_t) char data[];
+};
+
+struct mport_arena {
+	struct arena_chunk *chunks;
+	size_t next_size;
+	const char **interned;	/* open addressed hash table */
+	size_t ninterned;
+	size_t intern_size;
+};
+
+static uint32_t arena_hash(const char *);
+static int arena_intern_grow(struct mport_arena *);
+
+struct mport_arena *
+mport_arena_new(void)
+{
+
+	return (calloc(1, sizeof(struct mport_arena)));
+}
+
+void
+mport_arena_free(struct mport_arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(arena->interned);
+	free(arena);
+}
+
+/* zeroed memory, suitably aligned for anything, that lives as long as the arena */
+void *
+mport_arena_alloc(struct mport_arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	size_t want;
+	void *p;
+
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		if (arena->next_size == 0)
+			arena->next_size = ARENA_CHUNK_MIN;
+		want = size > arena->next_size ? size : arena->next_size;
+
+		if ((chunk = malloc(sizeof(struct arena_chunk) + want)) == NULL)
+			return (NULL);
+		chunk->size = want;
+		chunk->used = 0;
+
+		/* an oversized allocation goes behind the current chunk, which may still have room */
+		if (want > arena->next_size && arena->chunks != NULL) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+			if (arena->next_size < ARENA_CHUNK_MAX)
+				arena->next_size *= 2;
+		}
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(p, 0, size);
+
+	return (p);
+}
+
+char *
+mport_arena_strdup(struct mport_arena *arena, const char *s)
+{
+	size_t len;
+	char *p;
+
+	if (s == NULL)
+		return (NULL);
+
+	len = strlen(s) + 1;
+	if ((p = mport_arena_alloc(arena, len)) != NULL)
+		memcpy(p, s, len);
+
+	return (p);
+}
+
+/*
+ * Like mport_arena_strdup(), but equal strings share one copy.  The result
+ * must not be modified.
+ */
+char *
+mport_arena_intern(struct mport_arena *arena, const char *s)
+{
+	size_t i, mask;
+	char *p;
+
+	if (s == NULL)
+		return (NULL);
+
+	if (arena->ninterned * 2 >= arena->intern_size && arena_intern_grow(arena) != 0)
+		return (NULL);
+
+	mask = arena->intern_size - 1;
+	for (i = arena_hash(s) & mask; arena->interned[i] != NULL; i = (i + 1) & mask)
+		if (strcmp(arena->interned[i], s) == 0)
+			return ((char *)arena->interned[i]);
+
+	if ((p = mport_arena_strdup(arena, s)) == NULL)
+		return (NULL);
+
+	arena->interned[i] = p;
+	arena->ninterned++;
+
+	return (p);
+}
+
+static int
+arena_intern_grow(struct mport_arena *arena)
+{
+	const char **table;
+	size_t size, i, j, mask;
+
+	size = arena->intern_size == 0 ? ARENA_INTERN_MIN : arena->intern_size * 2;
+	if ((table = calloc(size, sizeof(char *))) == NULL)
+		return (-1);
+
+	mask = size - 1;
+	for (i = 0; i < arena->intern_size; i++) {
+		if (arena->interned[i] == NULL)
+			continue;
+		for (j = arena_hash(arena->interned[i]) & mask; table[j] != NULL; j = (j + 1) & mask)
+			;
+		table[j] = arena->interned[i];
+	}
+
+	free(arena->interned);
+	arena->interned = table;
+	arena->intern_size = size;
+
+	return (0);
+}
+
+/* FNV-1a */
+static uint32_t
+arena_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+
+	return (h);
+}
@@ -136,32 +136,22 @@ mport_asset_get_assetlist(mportInstance *mport, mportPackageMeta *pack, mportAss
 			break; // we finalize below
 		}
 
-		e = (mportAssetListEntry *) calloc(1, sizeof(mportAssetListEntry));
-
-		if (e == NULL) {
-			err = "Out of memory";
-			result = MPORT_ERR_FATAL;
-			break; // we finalize below
-		}
-
-		e->type = (mportAssetListEntryType) sqlite3_column_int(stmt, 0);
+		mportAssetListEntryType type = (mportAssetListEntryType) sqlite3_column_int(stmt, 0);
 		const unsigned char *data = sqlite3_column_text(stmt, 1);
 		const unsigned char *checksum = sqlite3_column_text(stmt, 2);
 		const unsigned char *owner = sqlite3_column_text(stmt, 3);
 		const unsigned char *group = sqlite3_column_text(stmt, 4);
 		const unsigned char *mode = sqlite3_column_text(stmt, 5);
 
-		e->data = (data == NULL) ? NULL : strdup((char *) data);
-		if (checksum != NULL)
-			strlcpy(e->checksum, checksum, 65);
-		if (owner != NULL)
-			strlcpy(e->owner, owner, MAXLOGNAME);
-		if (group != NULL)
-			strlcpy(e->group, group, MAXLOGNAME * 2);
-		if (mode != NULL)
-			strlcpy(e->mode, mode, 5);
-
-		STAILQ_INSERT_TAIL(alist, e, next);
+		if ((e = mport_assetlist_append(alist, type, (const char *) data)) == NULL ||
+		    mport_asset_set_attrs(alist, e, (const char *) owner, (const char *) group,
+		    (const char *) mode) != MPORT_OK) {
+			err = "Out of memory";
+			result = MPORT_ERR_FATAL;
+			break; // we finalize below
+		}
+		/* a malformed checksum is treated as missing, as verify does */
+		(void) mport_asset_set_checksum(e, (const char *) checksum);
 	}
 
 	sqlite3_finalize(stmt);
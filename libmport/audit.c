@@ -35,18 +35,48 @@
 #include <err.h>
 #include <unistd.h>
 
-#include <ucl.h>
-
-static char *readJsonFile(char *jsonFile);
-
+struct audit_out {
+	mportInstance *mport;
+	FILE *fp;
+	const char *name;
+	const char *version;
+	bool first;
+	bool done;
+};
+
+struct audit_cves {
+	const char *version;
+	mportCVE **cves;
+	size_t count;
+	size_t max;
+};
+
+static void audit_print(struct audit_out *, const char *, const char *, const char *);
+static void audit_print_depends(struct audit_out *, mportPackageMeta *);
+static void audit_next(struct audit_out *, char **, char **, const char *, const char *, bool);
+static int audit_found_init(struct audit_cves *, const char *);
+static bool audit_fetched(mportInstance *, const char *);
+static int audit_package(mportInstance *, mportPackageMeta *, struct audit_cves *);
+static int audit_add(struct audit_cves *, const char *, const char *, const char *, double, const char *);
+static int audit_cve_cb(const struct mport_cve *, void *);
+static int audit_local(mportInstance *, mportPackageMeta *, struct audit_cves *);
+static int audit_remote(mportInstance *, const char *, struct audit_cves *);
+
+/* mport_audit(mport, packageName, dependOn)
+ *
+ * Returns a printable report of the known vulnerabilities of an installed
+ * package, or an empty string if there are none.  The local vulnerability
+ * database is used when it has the package's product, otherwise the security
+ * site is asked about the package's CPE.
+ */
 MPORT_PUBLIC_API char *
 mport_audit(mportInstance *mport, const char *packageName, bool dependOn)
 {
 	mportPackageMeta **packs = NULL;
-	mportPackageMeta **depends = NULL;
-	mportPackageMeta **depends_orig = NULL;
+	struct audit_out out;
+	struct audit_cves found;
 	char *pkgAudit = NULL;
-	struct ucl_parser *parser = NULL;
+	size_t size, i;
 
 	if (mport == NULL) {
 		SET_ERROR(MPORT_ERR_FATAL, "mport not initialized");
@@ -65,212 +95,422 @@ mport_audit(mportInstance *mport, const char *packageName, bool dependOn)
 		return (NULL);
 	}
 
-	if (packs != NULL) {
-		if ((*packs)->cpe != NULL && (*packs)->cpe[0] != '\0') {
-			char *path = mport_fetch_cves(mport, (*packs)->cpe);
-			char *jsonData = readJsonFile(path);
-			if (jsonData == NULL) {
-				SET_ERROR(MPORT_ERR_FATAL, "Error opening CVE file");
-				if (path != NULL) {
-					unlink(path);
-					free(path);
-					path = NULL;
-				}
-				mport_pkgmeta_vec_free(packs);
-				packs = NULL;
-
-				return (NULL);
-			}
+	if (packs == NULL || (*packs)->cpe == NULL || (*packs)->cpe[0] == '\0') {
+		mport_pkgmeta_vec_free(packs);
+		return (NULL);
+	}
 
-			size_t len = strlen(jsonData);
+	if (audit_package(mport, *packs, &found) != MPORT_OK) {
+		mport_pkgmeta_vec_free(packs);
+		return (NULL);
+	}
 
-			// Create a UCL parser and parse the JSON string
-			parser = ucl_parser_new(0);
-			if (!ucl_parser_add_chunk(parser, (const unsigned char *)jsonData, len)) {
-				SET_ERRORX(MPORT_ERR_FATAL, "Failed to parse JSON: %s\n",
-				    ucl_parser_get_error(parser));
-				ucl_parser_free(parser);
+	out.mport = mport;
+	out.name = (*packs)->name;
+	out.version = (*packs)->version;
+	out.first = true;
+	out.done = false;
+
+	if ((out.fp = open_memstream(&pkgAudit, &size)) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Error allocating memory for audit entries");
+		mport_cve_free_vec(found.cves);
+		mport_pkgmeta_vec_free(packs);
+		return (NULL);
+	}
 
-				free(jsonData);
-				jsonData = NULL;
+	for (i = 0; i < found.count; i++)
+		audit_print(&out, found.cves[i]->id, found.cves[i]->description, found.cves[i]->severity);
 
-				unlink(path);
-				free(path);
-				path = NULL;
+	if (dependOn)
+		audit_print_depends(&out, *packs);
 
-				mport_pkgmeta_vec_free(packs);
-				packs = NULL;
+	fclose(out.fp);
+	mport_cve_free_vec(found.cves);
+	mport_pkgmeta_vec_free(packs);
 
-				return (NULL);
-			}
+	return pkgAudit;
+}
 
-			ucl_object_t *root = ucl_parser_get_object(parser);
-			ucl_parser_free(parser);
+/* mport_audit_cves(mport, packageName, cves)
+ *
+ * Find the known vulnerabilities of an installed package, like mport_audit(),
+ * as a NULL terminated vector.  The vector is empty if there are none, and
+ * *cves is set to NULL if the package isn't installed or has no CPE to look
+ * up.  Free it with mport_cve_free_vec().
+ */
+MPORT_PUBLIC_API int
+mport_audit_cves(mportInstance *mport, const char *packageName, mportCVE ***cves)
+{
+	mportPackageMeta **packs = NULL;
+	struct audit_cves found;
+	int ret = MPORT_OK;
 
-			const ucl_object_t *cur;
-			ucl_object_iter_t it = NULL;
+	*cves = NULL;
 
-			size_t size;
-			FILE *bufferFp = open_memstream(&pkgAudit, &size);
-			if (bufferFp == NULL) {
-				SET_ERROR(MPORT_ERR_FATAL, "Error allocating memory for audit entries");
-				free(jsonData);
-				jsonData = NULL;
+	if (mport == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
 
-				unlink(path);
-				free(path);
-				path = NULL;
-				
-				mport_pkgmeta_vec_free(packs);
-				packs = NULL;
+	if (packageName == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Package name not found.");
 
-				return (NULL);
-			}
+	if (mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", packageName) != MPORT_OK) {
+		mport_pkgmeta_vec_free(packs);
+		RETURN_CURRENT_ERROR;
+	}
 
-			bool first = true;
-			while ((cur = ucl_object_iterate(root, &it, true))) {
-				if (ucl_object_type(cur) != UCL_OBJECT) {
-					SET_ERROR(MPORT_ERR_FATAL, "Expected an object in the array");
-					continue;
-				}
-
-				bool isVulnerable = false;
-				const ucl_object_t *products = ucl_object_find_key(cur, "products");
-				if (products != NULL && ucl_object_type(products) == UCL_ARRAY) {
-					ucl_object_iter_t pit = NULL;
-					const ucl_object_t *product;
-
-					for (product = ucl_object_iterate(products, &pit, true);
-					     product != NULL;
-					     product = ucl_object_iterate(products, &pit, true)) {
-						const ucl_object_t *version =
-						    ucl_object_find_key(product, "version");
-						if (version != NULL &&
-						    ucl_object_type(version) == UCL_STRING) {
-							const char *version_str =
-							    ucl_object_tostring(version);
-
-							if (version_str == NULL)
-							    continue;
-
-							// Skip based on the version field
-							if ('*' == version_str[0] || mport_version_cmp((*packs)->version, version_str) <= 0) {
-								isVulnerable = true;
-								break;
-							}
-						}
-					}
-				}
-
-				if (!isVulnerable) {
-					continue;
-				}
-
-				if (mport->verbosity == MPORT_VQUIET) {
-					fprintf(bufferFp, "%s-%s\n", (*packs)->name, (*packs)->version);
-					break;
-				}
-
-				if (first) {
-					fprintf(bufferFp, "%s-%s is vulnerable:\n\n",
-					    (*packs)->name, (*packs)->version);
-					first = false;
-				}
-
-				const ucl_object_t *cveId = ucl_object_find_key(cur, "cveId");
-				if (cveId != NULL && ucl_object_type(cveId) == UCL_STRING) {
-					fprintf(bufferFp, "%s\n", ucl_object_tostring(cveId));
-
-					const ucl_object_t *desc = ucl_object_find_key(cur, "description");
-					if (desc != NULL && ucl_object_type(desc) == UCL_STRING) {
-						fprintf(bufferFp, "Description: %s\n", ucl_object_tostring(desc));
-					}
-					const ucl_object_t *severity = ucl_object_find_key(cur, "severity");
-					if (severity != NULL && ucl_object_type(severity) == UCL_STRING) {
-						fprintf(bufferFp, "Severity: %s\n", ucl_object_tostring(severity));
-					}
-					fprintf(bufferFp, "\n");
-				}
-			}
+	if (packs != NULL && (*packs)->cpe != NULL && (*packs)->cpe[0] != '\0') {
+		ret = audit_package(mport, *packs, &found);
+		if (ret == MPORT_OK)
+			*cves = found.cves;
+	}
 
-			if (dependOn) {
-				if (mport_pkgmeta_get_downdepends(mport, (*packs), &depends_orig) == MPORT_OK) {
-					if (depends_orig != NULL) {
-						depends = depends_orig;
-						fprintf(bufferFp, "Packages that depend on %s:", (*packs)->name);
-						while (*depends != NULL) {
-							fprintf(bufferFp, " %s", (*depends)->name);
-							depends++;
-						}
-						fprintf(bufferFp, "\n");
-
-						mport_pkgmeta_vec_free(depends_orig);
-						depends_orig = NULL;
-						depends = NULL;
-					}
-				}
-			}
+	mport_pkgmeta_vec_free(packs);
+
+	return (ret);
+}
+
+MPORT_PUBLIC_API void
+mport_cve_free_vec(mportCVE **cves)
+{
+	mportCVE **cve;
+
+	if (cves == NULL)
+		return;
 
-			free(jsonData);
-			jsonData = NULL;
+	for (cve = cves; *cve != NULL; cve++) {
+		free((*cve)->id);
+		free((*cve)->description);
+		free((*cve)->severity);
+		free((*cve)->version);
+		free(*cve);
+	}
+
+	free(cves);
+}
+
+/* mport_audit_installed(mport, dependOn)
+ *
+ * Like mport_audit() for every installed package, answered from the local
+ * vulnerability database with a single query.  Packages whose product the
+ * database was built without, such as ones installed since it was generated,
+ * are looked up on the security site instead; if that fails they are named
+ * through the message callback rather than reported clean.  Fails if there
+ * is no vulnerability database.
+ */
+MPORT_PUBLIC_API char *
+mport_audit_installed(mportInstance *mport, bool dependOn)
+{
+	mportPackageMeta **packs = NULL;
+	sqlite3_stmt *stmt;
+	struct audit_out out;
+	struct audit_cves found;
+	char *pkgAudit = NULL, *name = NULL, *version = NULL;
+	const char *pkg, *pkgversion;
+	size_t size, i;
+	int ret = MPORT_OK;
+
+	if (mport == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+		return (NULL);
+	}
+
+	if (mport_vulndb_load(mport) != MPORT_OK)
+		return (NULL);
+
+	/* the second half gives one row, with its CPE, for each package of an unknown product */
+	if (mport_db_prepare(mport->db, &stmt,
+	    "SELECT pkg, version, cve_id, description, severity, cpe FROM ("
+	    "SELECT p.pkg AS pkg, p.version AS version, v.cve_id AS cve_id, v.description AS description, "
+	    "v.severity AS severity, NULL AS cpe FROM packages p "
+	    "JOIN vuln.vulnerabilities v ON v.product = mport_cpe_product(p.cpe) "
+	    "WHERE p.cpe IS NOT NULL AND p.cpe != '' AND " MPORT_VULNDB_AFFECTS("v.", "p.version_key") " "
+	    "GROUP BY p.pkg, v.cve_id "
+	    "UNION ALL SELECT pkg, version, NULL, NULL, NULL, cpe FROM packages "
+	    "WHERE cpe IS NOT NULL AND cpe != '' AND "
+	    "IFNULL(mport_cpe_product(cpe), '') NOT IN (SELECT product FROM vuln.products)) "
+	    "ORDER BY pkg, cve_id") != MPORT_OK)
+		return (NULL);
 
-			fclose(bufferFp);
-			bufferFp = NULL;
+	if ((out.fp = open_memstream(&pkgAudit, &size)) == NULL) {
+		sqlite3_finalize(stmt);
+		SET_ERROR(MPORT_ERR_FATAL, "Error allocating memory for audit entries");
+		return (NULL);
+	}
+	out.mport = mport;
 
-			unlink(path);
-			free(path);
-			path = NULL;
+	while (1) {
+		ret = sqlite3_step(stmt);
 
-			ucl_object_unref(root);
+		if (ret == SQLITE_ROW) {
+			pkg = (const char *)sqlite3_column_text(stmt, 0);
+			pkgversion = (const char *)sqlite3_column_text(stmt, 1);
+
+			if (sqlite3_column_type(stmt, 5) == SQLITE_NULL) {
+				audit_next(&out, &name, &version, pkg, pkgversion, dependOn);
+				audit_print(&out, (const char *)sqlite3_column_text(stmt, 2),
+				    (const char *)sqlite3_column_text(stmt, 3), (const char *)sqlite3_column_text(stmt, 4));
+				continue;
+			}
 
-			mport_pkgmeta_vec_free(packs);
-			packs = NULL;
+			/* not in the database, so no rows doesn't mean no CVEs */
+			if (audit_found_init(&found, pkgversion) != MPORT_OK) {
+				ret = mport_err_code();
+				break;
+			}
+			if (audit_remote(mport, (const char *)sqlite3_column_text(stmt, 5), &found) != MPORT_OK) {
+				mport_call_msg_cb(mport, "%s-%s is not in the vulnerability database and could not be checked: %s",
+				    pkg, pkgversion, mport_err_string());
+				mport_cve_free_vec(found.cves);
+				continue;
+			}
+			for (i = 0; i < found.count; i++) {
+				audit_next(&out, &name, &version, pkg, pkgversion, dependOn);
+				audit_print(&out, found.cves[i]->id, found.cves[i]->description, found.cves[i]->severity);
+			}
+			mport_cve_free_vec(found.cves);
+		} else if (ret == SQLITE_DONE) {
+			ret = MPORT_OK;
+			break;
+		} else {
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+			break;
 		}
+	}
 
+	sqlite3_finalize(stmt);
+
+	if (ret == MPORT_OK && name != NULL && dependOn &&
+	    mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", name) == MPORT_OK && packs != NULL) {
+		audit_print_depends(&out, *packs);
+		mport_pkgmeta_vec_free(packs);
+	}
+
+	free(name);
+	free(version);
+	fclose(out.fp);
+
+	if (ret != MPORT_OK) {
+		free(pkgAudit);
+		return (NULL);
 	}
+
 	return pkgAudit;
 }
 
-static char *readJsonFile(char *jsonFile)
+/* start the report of pkg, unless it is the one being reported on already */
+static void
+audit_next(struct audit_out *out, char **name, char **version, const char *pkg, const char *pkgversion,
+    bool dependOn)
 {
-		FILE *fp;
-		size_t size;
-		char *buffer;
+	mportPackageMeta **packs = NULL;
 
-		if (jsonFile == NULL) {
-			return (NULL);
-		}
-		
-		// Open the JSON file
-		fp = fopen(jsonFile, "rb");
-		if (!fp) {
-			SET_ERROR(MPORT_ERR_WARN, "could not open file");
-			return NULL;
-		}
+	if (*name != NULL && strcmp(*name, pkg) == 0)
+		return;
 
-		// Get the file size
-		fseek(fp, 0, SEEK_END);
-		size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-
-		// Allocate memory for the file contents
-		buffer = (char *)malloc(size);
-		if (!buffer) {
-			SET_ERROR(MPORT_ERR_WARN, "could not allocate memory");
-			fclose(fp);
-			return NULL;
-		}
+	if (*name != NULL) {
+		if (dependOn && mport_pkgmeta_search_master(out->mport, &packs, "pkg=%Q", *name) == MPORT_OK &&
+		    packs != NULL)
+			audit_print_depends(out, *packs);
+		mport_pkgmeta_vec_free(packs);
+		if (out->mport->verbosity != MPORT_VQUIET)
+			fprintf(out->fp, "\n");
+	}
+
+	free(*name);
+	free(*version);
+	*name = strdup(pkg);
+	*version = strdup(pkgversion);
+	out->name = *name;
+	out->version = *version;
+	out->first = true;
+	out->done = false;
+}
+
+static int
+audit_found_init(struct audit_cves *found, const char *version)
+{
+
+	found->version = version;
+	found->count = 0;
+	found->max = 8;
+	if ((found->cves = calloc(found->max + 1, sizeof(mportCVE *))) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	return (MPORT_OK);
+}
+
+/* true if the CVEs of the product of cpe were fetched into the local database */
+static bool
+audit_fetched(mportInstance *mport, const char *cpe)
+{
+	int count = 0;
+
+	return (mport_db_count(mport->db, &count,
+	    "SELECT count(*) FROM vuln.products WHERE product = mport_cpe_product(%Q)", cpe) == MPORT_OK && count > 0);
+}
+
+/*
+ * Collect the CVEs affecting a package, from the local database if it has
+ * the package's product, otherwise from the security site.
+ */
+static int
+audit_package(mportInstance *mport, mportPackageMeta *pack, struct audit_cves *found)
+{
+	int ret;
+
+	if (audit_found_init(found, pack->version) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
 
-		// Read the file into the buffer
-		if (fread(buffer, 1, size, fp) != size) {
-			SET_ERROR(MPORT_ERR_WARN, "could not read file");
-			fclose(fp);
-			free(buffer);
-			return NULL;
+	if (mport_vulndb_load(mport) == MPORT_OK && audit_fetched(mport, pack->cpe))
+		ret = audit_local(mport, pack, found);
+	else
+		ret = audit_remote(mport, pack->cpe, found);
+
+	if (ret != MPORT_OK) {
+		mport_cve_free_vec(found->cves);
+		found->cves = NULL;
+	}
+
+	return (ret);
+}
+
+static int
+audit_add(struct audit_cves *found, const char *id, const char *desc, const char *severity, double score,
+    const char *version)
+{
+	mportCVE **cves, *cve;
+
+	if (found->count == found->max) {
+		if ((cves = reallocarray(found->cves, found->max * 2 + 1, sizeof(mportCVE *))) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		found->cves = cves;
+		found->max *= 2;
+	}
+
+	if ((cve = calloc(1, sizeof(mportCVE))) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	cve->id = strdup(id);
+	cve->description = desc == NULL ? NULL : strdup(desc);
+	cve->severity = severity == NULL ? NULL : strdup(severity);
+	cve->version = version == NULL ? NULL : strdup(version);
+	cve->score = score;
+
+	found->cves[found->count++] = cve;
+	found->cves[found->count] = NULL;
+
+	if (cve->id == NULL || (desc != NULL && cve->description == NULL) ||
+	    (severity != NULL && cve->severity == NULL) || (version != NULL && cve->version == NULL))
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	return (MPORT_OK);
+}
+
+static int
+audit_local(mportInstance *mport, mportPackageMeta *pack, struct audit_cves *found)
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	/* the bare columns come from the row with the lowest affected version */
+	if (mport_db_prepare(mport->db, &stmt,
+	    "SELECT cve_id, description, severity, score, max_version, MIN(max_version_key) "
+	    "FROM vuln.vulnerabilities, (SELECT mport_version_key(%Q) AS k) "
+	    "WHERE product = mport_cpe_product(%Q) AND " MPORT_VULNDB_AFFECTS("", "k") " "
+	    "GROUP BY cve_id ORDER BY cve_id", pack->version, pack->cpe) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (audit_add(found, (const char *)sqlite3_column_text(stmt, 0),
+		    (const char *)sqlite3_column_text(stmt, 1), (const char *)sqlite3_column_text(stmt, 2),
+		    sqlite3_column_type(stmt, 3) == SQLITE_NULL ? -1 : sqlite3_column_double(stmt, 3),
+		    (const char *)sqlite3_column_text(stmt, 4)) != MPORT_OK) {
+			sqlite3_finalize(stmt);
+			RETURN_CURRENT_ERROR;
 		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_DONE)
+		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+
+	return (MPORT_OK);
+}
+
+static int
+audit_remote(mportInstance *mport, const char *cpe, struct audit_cves *found)
+{
+	FILE *fp;
+	int ret;
 
-		// Close the file
-		fclose(fp);
+	if ((fp = mport_fetch_cves(mport, cpe)) == NULL)
+		RETURN_CURRENT_ERROR;
 
-		return buffer;
+	ret = mport_cve_parse(fp, audit_cve_cb, found);
+
+	fclose(fp);
+
+	return (ret);
+}
+
+/* keep a CVE that affects the version being audited */
+static int
+audit_cve_cb(const struct mport_cve *cve, void *arg)
+{
+	struct audit_cves *found = arg;
+	size_t i;
+
+	for (i = 0; i < cve->nranges; i++) {
+		if (mport_cve_range_match(&cve->ranges[i], found->version))
+			return (audit_add(found, cve->id, cve->description, cve->severity, cve->score,
+			    cve->ranges[i].max));
 	}
+
+	return (MPORT_OK);
+}
+
+static void
+audit_print(struct audit_out *out, const char *id, const char *desc, const char *severity)
+{
+
+	if (out->done)
+		return;
+
+	if (out->mport->verbosity == MPORT_VQUIET) {
+		fprintf(out->fp, "%s-%s\n", out->name, out->version);
+		out->done = true;
+		return;
+	}
+
+	if (out->first) {
+		fprintf(out->fp, "%s-%s is vulnerable:\n\n", out->name, out->version);
+		out->first = false;
+	}
+
+	if (id == NULL)
+		return;
+
+	fprintf(out->fp, "%s\n", id);
+	if (desc != NULL)
+		fprintf(out->fp, "Description: %s\n", desc);
+	if (severity != NULL)
+		fprintf(out->fp, "Severity: %s\n", severity);
+	fprintf(out->fp, "\n");
+}
+
+static void
+audit_print_depends(struct audit_out *out, mportPackageMeta *pack)
+{
+	mportPackageMeta **depends, **depends_orig = NULL;
+
+	if (mport_pkgmeta_get_downdepends(out->mport, pack, &depends_orig) != MPORT_OK || depends_orig == NULL)
+		return;
+
+	fprintf(out->fp, "Packages that depend on %s:", pack->name);
+	for (depends = depends_orig; *depends != NULL; depends++)
+		fprintf(out->fp, " %s", (*depends)->name);
+	fprintf(out->fp, "\n");
+
+	mport_pkgmeta_vec_free(depends_orig);
+}
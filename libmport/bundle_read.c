@@ -33,7 +33,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <archive_entry.h>
+#include <zstd.h>
+
+/*
+ * Bundles compressed with a zstd dictionary, and the members of member
+ * bundles, are fed to libarchive through a bundle_source.  The data comes
+ * from a file or from the current entry of the container, and is decompressed
+ * here when it needs a dictionary, since libarchive can't use one.
+ */
+struct bundle_source {
+	int fd;				/* read from this file, or */
+	struct archive *upstream;	/* from the current entry of this archive */
+	const void *pending;		/* first block, already read to identify it */
+	size_t pending_len;
+	void *inbuf;			/* read buffer for fd */
+	size_t insize;
+	ZSTD_DCtx *dctx;		/* NULL unless dictionary compressed */
+	ZSTD_inBuffer in;
+	void *outbuf;
+	size_t outsize;
+	size_t frame_left;		/* non-zero while inside a zstd frame */
+};
+
+static int open_member(mportBundleRead *);
+static int extract_member_metafiles(mportBundleRead *);
+static struct bundle_source * source_new(void);
+static void source_free(struct bundle_source *);
+static bool source_is_zdict(const void *, size_t);
+static int source_load_zdict(struct bundle_source *, const void *, size_t, const char *);
+static int source_open(mportBundleRead *);
+static la_ssize_t source_read_raw(struct archive *, struct bundle_source *, const void **);
+static la_ssize_t source_read_cb(struct archive *, void *, const void **);
 
 /*
  * mport_bundle_read_new()
@@ -62,6 +95,36 @@ mport_bundle_read_init(mportBundleRead *bundle, const char *filename)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't dup filename");
 	}
 
+	if (mport_file_exists(filename)) {
+		struct bundle_source *src;
+		unsigned char head[18]; /* the longest zstd frame header */
+		ssize_t len;
+		int fd;
+
+		if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open %s: %s", filename, strerror(errno));
+
+		if ((len = pread(fd, head, sizeof(head), 0)) > 0 && source_is_zdict(head, len)) {
+			if ((src = source_new()) == NULL) {
+				close(fd);
+				RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			}
+			src->fd = fd;
+			bundle->source = src;
+
+			src->insize = ZSTD_DStreamInSize();
+			if ((src->inbuf = malloc(src->insize)) == NULL)
+				RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+			if (source_load_zdict(src, head, len, filename) != MPORT_OK)
+				RETURN_CURRENT_ERROR;
+
+			return (source_open(bundle));
+		}
+
+		close(fd);
+	}
+
 	if ((bundle->archive = archive_read_new()) == NULL) {
 		RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't initialize archive read");
 	}
@@ -107,6 +170,16 @@ mport_bundle_read_finish(mportInstance *mport, mportBundleRead *bundle)
 		}
 	}
 
+	source_free(bundle->source);
+
+	/* the member (if any) was read through the container, so close it last */
+	if (bundle->container != NULL) {
+		if (archive_read_free(bundle->container) != ARCHIVE_OK) {
+			mport_call_msg_cb(mport, "Unable to close pacakge.");
+			ret = SET_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->container));
+		}
+	}
+
 	if (bundle->stub_attached && (mport != NULL)) {
 		if (mport_detach_stub_db(mport->db) != MPORT_OK) {
 			mport_call_msg_cb(mport, "Stub database could not be detatched.");
@@ -120,6 +193,7 @@ mport_bundle_read_finish(mportInstance *mport, mportBundleRead *bundle)
 		}
 	}
 
+	free(bundle->member);
 	free(bundle->tmpdir);
 	free(bundle->filename);
 	free(bundle);
@@ -199,6 +273,10 @@ mport_bundle_read_skip_metafiles(mportBundleRead *bundle)
 		if (mport_bundle_read_next_entry(bundle, &entry) != MPORT_OK)
 			RETURN_CURRENT_ERROR;
 
+		/* a bundle with no data files */
+		if (entry == NULL)
+			break;
+
 		if (*(archive_entry_pathname(entry)) != '+') {
 			bundle->firstreal = entry;
 			break;
@@ -283,6 +361,7 @@ mport_bundle_read_prep_for_install(
 {
 	sqlite3_stmt *stmt;
 	int bundle_version;
+	int members = 0;
 	int ret;
 
 	if (mport_bundle_read_extract_metafiles(bundle, &(bundle->tmpdir)) != MPORT_OK) {
@@ -323,5 +402,348 @@ mport_bundle_read_prep_for_install(
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
 	}
 
+	if (bundle_version < MPORT_BUNDLE_VERSION_MEMBERS)
+		return (MPORT_OK);
+
+	if (mport_db_count(mport->db, &members,
+		"SELECT COUNT(*) FROM stub.sqlite_master WHERE type='table' AND name='members'") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (members > 0) {
+		/* 
+		 * A member bundle.  The package files live in the members, which are
+		 * opened one at a time by mport_bundle_read_select_member().  Until
+		 * then there is no data archive.
+		 */
+		bundle->container = bundle->archive;
+		bundle->container_next = bundle->firstreal;
+		bundle->archive = NULL;
+		bundle->firstreal = NULL;
+	}
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_bundle_read_select_member(mport, bundle, pkg)
+ *
+ * For member bundles, open the member holding pkg as the data archive and
+ * extract its metafiles into the bundle tmpdir.  Members are stored in
+ * install order, so normally this is the next entry in the container;
+ * anything before it is skipped, which is a seek as the container is not
+ * compressed.  This is a no-op for ordinary bundles.
+ */
+int
+mport_bundle_read_select_member(mportInstance *mport, mportBundleRead *bundle, mportPackageMeta *pkg)
+{
+	sqlite3_stmt *stmt;
+	struct archive_entry *entry;
+	char *member;
+	int ret;
+
+	if (bundle->container == NULL)
+		return (MPORT_OK);
+
+	if (mport_db_prepare(mport->db, &stmt, "SELECT member FROM stub.members WHERE pkg=%Q", pkg->name) != MPORT_OK) {
+		sqlite3_finalize(stmt);
+		RETURN_CURRENT_ERROR;
+	}
+
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		sqlite3_finalize(stmt);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s: no member holds %s", bundle->filename, pkg->name);
+	}
+
+	member = strdup((const char *)sqlite3_column_text(stmt, 0));
+	sqlite3_finalize(stmt);
+
+	if (member == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	/* we're done with the previous member */
+	if (bundle->archive != NULL) {
+		archive_read_free(bundle->archive);
+		bundle->archive = NULL;
+	}
+	source_free(bundle->source);
+	bundle->source = NULL;
+	free(bundle->member);
+	bundle->member = NULL;
+	bundle->firstreal = NULL;
+
+	while (1) {
+		if (bundle->container_next != NULL) {
+			entry = bundle->container_next;
+			bundle->container_next = NULL;
+		} else {
+			ret = archive_read_next_header(bundle->container, &entry);
+
+			if (ret == ARCHIVE_RETRY)
+				continue;
+
+			if (ret == ARCHIVE_EOF) {
+				SET_ERRORX(MPORT_ERR_FATAL, "%s: member %s not found", bundle->filename, member);
+				free(member);
+				RETURN_CURRENT_ERROR;
+			}
+
+			if (ret == ARCHIVE_FATAL) {
+				free(member);
+				RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->container));
+			}
+		}
+
+		if (strcmp(archive_entry_pathname(entry), member) == 0)
+			break;
+
+		if (archive_read_data_skip(bundle->container) != ARCHIVE_OK) {
+			free(member);
+			RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->container));
+		}
+	}
+
+	bundle->member = member;
+
+	if (open_member(bundle) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	return extract_member_metafiles(bundle);
+}
+
+/* open the current container entry as the data archive */
+static int
+open_member(mportBundleRead *bundle)
+{
+	struct bundle_source *src;
+	la_int64_t offset;
+	int ret;
+
+	if ((src = source_new()) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	src->upstream = bundle->container;
+	bundle->source = src;
+
+	/* look at the first block to see what the member is compressed with */
+	ret = archive_read_data_block(bundle->container, &src->pending, &src->pending_len, &offset);
+	if (ret == ARCHIVE_EOF)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s: member %s is empty", bundle->filename, bundle->member);
+	if (ret != ARCHIVE_OK)
+		RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->container));
+
+	if (source_is_zdict(src->pending, src->pending_len) &&
+	    source_load_zdict(src, src->pending, src->pending_len, bundle->member) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	return (source_open(bundle));
+}
+
+static struct bundle_source *
+source_new(void)
+{
+	struct bundle_source *src;
+
+	if ((src = calloc(1, sizeof(struct bundle_source))) != NULL)
+		src->fd = -1;
+
+	return (src);
+}
+
+static void
+source_free(struct bundle_source *src)
+{
+	if (src == NULL)
+		return;
+
+	if (src->fd != -1)
+		close(src->fd);
+	ZSTD_freeDCtx(src->dctx);
+	free(src->inbuf);
+	free(src->outbuf);
+	free(src);
+}
+
+/* is this the start of a zstd frame that needs a dictionary? */
+static bool
+source_is_zdict(const void *head, size_t len)
+{
+	const unsigned char *p = head;
+
+	/* the magic number is little endian */
+	if (len < 4 || p[0] != 0x28 || p[1] != 0xB5 || p[2] != 0x2F || p[3] != 0xFD)
+		return (false);
+
+	return (ZSTD_getDictID_fromFrame(head, len) != 0);
+}
+
+static int
+source_load_zdict(struct bundle_source *src, const void *head, size_t len, const char *name)
+{
+	unsigned int id = ZSTD_getDictID_fromFrame(head, len);
+	void *dict;
+	size_t dictsize, ret;
+
+	if ((dict = mport_zdict_load(id, &dictsize)) == NULL)
+		RETURN_WRAP_ERRORX(MPORT_ERR_FATAL, "%s: %s", name, mport_err_string());
+
+	if ((src->dctx = ZSTD_createDCtx()) == NULL) {
+		free(dict);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	ret = ZSTD_DCtx_loadDictionary(src->dctx, dict, dictsize);
+	free(dict);
+	if (ZSTD_isError(ret))
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s: dictionary %u: %s", name, id, ZSTD_getErrorName(ret));
+
+	src->outsize = ZSTD_DStreamOutSize();
+	if ((src->outbuf = malloc(src->outsize)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	return (MPORT_OK);
+}
+
+/* open bundle->archive on bundle->source */
+static int
+source_open(mportBundleRead *bundle)
+{
+	if ((bundle->archive = archive_read_new()) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't initialize archive read");
+
+	if (archive_read_support_format_tar(bundle->archive) != ARCHIVE_OK)
+		RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+	if (archive_read_support_filter_xz(bundle->archive) != ARCHIVE_OK)
+		RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+	if (archive_read_open(bundle->archive, bundle->source, NULL, source_read_cb, NULL) != ARCHIVE_OK)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s: unable to open %s: %s", bundle->filename,
+		    bundle->member != NULL ? bundle->member : "bundle", archive_error_string(bundle->archive));
+
+	return (MPORT_OK);
+}
+
+/* the next block of data, as stored */
+static la_ssize_t
+source_read_raw(struct archive *a, struct bundle_source *src, const void **buff)
+{
+	la_int64_t offset;
+	size_t size;
+	ssize_t len;
+	int ret;
+
+	if (src->pending != NULL) {
+		*buff = src->pending;
+		src->pending = NULL;
+		return ((la_ssize_t)src->pending_len);
+	}
+
+	if (src->upstream != NULL) {
+		ret = archive_read_data_block(src->upstream, buff, &size, &offset);
+
+		if (ret == ARCHIVE_EOF)
+			return (0);
+
+		if (ret != ARCHIVE_OK) {
+			archive_set_error(a, archive_errno(src->upstream), "%s",
+			    archive_error_string(src->upstream));
+			return (-1);
+		}
+
+		return ((la_ssize_t)size);
+	}
+
+	while ((len = read(src->fd, src->inbuf, src->insize)) < 0 && errno == EINTR)
+		;
+
+	if (len < 0) {
+		archive_set_error(a, errno, "%s", strerror(errno));
+		return (-1);
+	}
+
+	*buff = src->inbuf;
+
+	return (len);
+}
+
+static la_ssize_t
+source_read_cb(struct archive *a, void *client_data, const void **buff)
+{
+	struct bundle_source *src = client_data;
+	ZSTD_outBuffer out;
+	la_ssize_t len;
+	size_t ret;
+
+	if (src->dctx == NULL)
+		return (source_read_raw(a, src, buff));
+
+	out.dst = src->outbuf;
+	out.size = src->outsize;
+	out.pos = 0;
+
+	while (out.pos == 0) {
+		if (src->in.pos == src->in.size) {
+			if ((len = source_read_raw(a, src, &src->in.src)) < 0)
+				return (-1);
+
+			if (len == 0) {
+				if (src->frame_left != 0) {
+					archive_set_error(a, ARCHIVE_ERRNO_MISC, "Truncated zstd data");
+					return (-1);
+				}
+				return (0);
+			}
+
+			src->in.size = len;
+			src->in.pos = 0;
+		}
+
+		ret = ZSTD_decompressStream(src->dctx, &out, &src->in);
+		if (ZSTD_isError(ret)) {
+			archive_set_error(a, ARCHIVE_ERRNO_MISC, "%s", ZSTD_getErrorName(ret));
+			return (-1);
+		}
+		src->frame_left = ret;
+	}
+
+	*buff = src->outbuf;
+
+	return ((la_ssize_t)out.pos);
+}
+
+/*
+ * Each member is a complete bundle; its stub database is already merged into
+ * the container's, so skip it and extract the rest of the metafiles next to
+ * the merged one.
+ */
+static int
+extract_member_metafiles(mportBundleRead *bundle)
+{
+	char filepath[FILENAME_MAX];
+	const char *file;
+	struct archive_entry *entry;
+
+	while (1) {
+		if (mport_bundle_read_next_entry(bundle, &entry) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+
+		if (entry == NULL)
+			break;
+
+		file = archive_entry_pathname(entry);
+
+		if (strcmp(file, MPORT_STUB_DB_FILE) == 0) {
+			if (archive_read_data_skip(bundle->archive) != ARCHIVE_OK)
+				RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+		} else if (*file == '+') {
+			(void)snprintf(filepath, FILENAME_MAX, "%s/%s", bundle->tmpdir, file);
+			archive_entry_set_pathname(entry, filepath);
+
+			if (mport_bundle_read_extract_next_file(bundle, entry) != MPORT_OK)
+				RETURN_CURRENT_ERROR;
+		} else {
+			bundle->firstreal = entry;
+			break;
+		}
+	}
+
 	return (MPORT_OK);
 }
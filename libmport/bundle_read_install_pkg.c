@@ -83,6 +83,10 @@ static int copy_metafile(mportInstance *, mportBundleRead *, mportPackageMeta *,
 int
 mport_bundle_read_install_pkg(mportInstance *mport, mportBundleRead *bundle, mportPackageMeta *pkg)
 {
+	if (mport_bundle_read_select_member(mport, bundle, pkg) != MPORT_OK) {
+		RETURN_CURRENT_ERROR;
+	}
+
 	if (do_pre_install(mport, bundle, pkg) != MPORT_OK) {
 		RETURN_CURRENT_ERROR;
 	}
@@ -206,10 +210,10 @@ create_package_row(mportInstance *mport, mportPackageMeta *pkg)
 	/* Insert the package meta row into the packages table (We use pack here because things might have been twiddled) */
 	/* Note that this will be marked as dirty by default */
 	if (mport_db_do(mport->db,
-	                "INSERT INTO packages (pkg, version, origin, prefix, lang, options, comment, os_release, cpe, locked, deprecated, expiration_date, no_provide_shlib, flavor, automatic, install_date, flatsize) VALUES (%Q,%Q,%Q,%Q,%Q,%Q,%Q,%Q,%Q,0,%Q,%ld,%d,%Q,%d,%ld,%ld)",
+	                "INSERT INTO packages (pkg, version, origin, prefix, lang, options, comment, os_release, cpe, locked, deprecated, expiration_date, no_provide_shlib, flavor, automatic, install_date, flatsize, version_key) VALUES (%Q,%Q,%Q,%Q,%Q,%Q,%Q,%Q,%Q,0,%Q,%ld,%d,%Q,%d,%ld,%ld,mport_version_key(%Q))",
 	                pkg->name, pkg->version, pkg->origin, pkg->prefix, pkg->lang, pkg->options, pkg->comment,
 	                pkg->os_release, pkg->cpe, pkg->deprecated, pkg->expiration_date, pkg->no_provide_shlib,
-	                pkg->flavor, pkg->automatic, pkg->install_date, pkg->flatsize) != MPORT_OK)
+	                pkg->flavor, pkg->automatic, pkg->install_date, pkg->flatsize, pkg->version) != MPORT_OK)
 		RETURN_CURRENT_ERROR;
 
 	return MPORT_OK;
@@ -363,32 +367,22 @@ mport_bundle_read_get_assetlist(mportInstance *mport, mportPackageMeta *pkg, mpo
 				break; // we finalize below
 			}
 
-			e = (mportAssetListEntry *) calloc(1, sizeof(mportAssetListEntry));
-
-			if (e == NULL) {
-				err = "Out of memory";
-				result = MPORT_ERR_FATAL;
-				break; // we finalize below
-			}
-
-			e->type = (mportAssetListEntryType) sqlite3_column_int(stmt, 0);
+			mportAssetListEntryType type = (mportAssetListEntryType) sqlite3_column_int(stmt, 0);
 			const unsigned char *data = sqlite3_column_text(stmt, 1);
 			const unsigned char *checksum = sqlite3_column_text(stmt, 2);
 			const unsigned char *owner = sqlite3_column_text(stmt, 3);
 			const unsigned char *group = sqlite3_column_text(stmt, 4);
 			const unsigned char *mode = sqlite3_column_text(stmt, 5);
 
-			e->data = (data == NULL) ? NULL : strdup((char *) data);
-			if (checksum != NULL)
-				strlcpy(e->checksum, checksum, 65);
-			if (owner != NULL)
-				strlcpy(e->owner, owner, MAXLOGNAME);
-			if (group != NULL)
-				strlcpy(e->group, group, MAXLOGNAME * 2);
-			if (mode != NULL)
-				strlcpy(e->mode, mode, 5);
-
-			STAILQ_INSERT_TAIL(alist, e, next);
+			if ((e = mport_assetlist_append(alist, type, (const char *) data)) == NULL ||
+			    mport_asset_set_attrs(alist, e, (const char *) owner, (const char *) group,
+			    (const char *) mode) != MPORT_OK) {
+				err = "Out of memory";
+				result = MPORT_ERR_FATAL;
+				break; // we finalize below
+			}
+			/* a malformed checksum is treated as missing, as verify does */
+			(void) mport_asset_set_checksum(e, (const char *) checksum);
 		}
 
 		sqlite3_finalize(stmt);
@@ -416,7 +410,10 @@ do_actual_install(mportInstance *mport, mportBundleRead *bundle, mportPackageMet
 	char *mode = NULL;
 	char *mkdirp = NULL;
 	struct stat sb;
-	char file[FILENAME_MAX], cwd[FILENAME_MAX];
+	char file[FILENAME_MAX], cwd[FILENAME_MAX], target[FILENAME_MAX];
+	char checksum[MPORT_ASSET_CHECKSUM_HEXLEN];
+	char *copy_links = NULL;
+	bool copy_hardlinks;
 	sqlite3_stmt *insert = NULL;
 
 	/* sadly, we can't just use abs pathnames, because it will break hardlinks */
@@ -445,6 +442,10 @@ do_actual_install(mportInstance *mport, mportBundleRead *bundle, mportPackageMet
 	                     pkg->name) != MPORT_OK)
 		goto ERROR;
 
+	/* bundles created with dedup store repeated files as hardlinks */
+	copy_links = mport_setting_get(mport, MPORT_SETTING_COPY_HARDLINKS);
+	copy_hardlinks = copy_links != NULL && mport_check_answer_bool(copy_links);
+
 	(void) strlcpy(cwd, pkg->prefix, sizeof(cwd));
 
 	if (mport_chdir(mport, cwd) != MPORT_OK)
@@ -553,7 +554,17 @@ do_actual_install(mportInstance *mport, mportBundleRead *bundle, mportPackageMet
 
 				archive_entry_set_pathname(entry, file);
 
-				if (mport_bundle_read_extract_next_file(bundle, entry) != MPORT_OK)
+				if (copy_hardlinks && archive_entry_hardlink(entry) != NULL) {
+					/* the link target was extracted relative to the same cwd */
+					(void) snprintf(target, FILENAME_MAX, "%s%s/%s", mport->root, cwd,
+					    archive_entry_hardlink(entry));
+					if (mport_copy_file(target, file) != MPORT_OK)
+						goto ERROR;
+					if (archive_read_data_skip(bundle->archive) != ARCHIVE_OK) {
+						SET_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+						goto ERROR;
+					}
+				} else if (mport_bundle_read_extract_next_file(bundle, entry) != MPORT_OK)
 					goto ERROR;
 
 				if (lstat(file, &sb)) {
@@ -681,7 +692,8 @@ do_actual_install(mportInstance *mport, mportBundleRead *bundle, mportPackageMet
 				goto ERROR;
 			}
 
-			if (sqlite3_bind_text(insert, 3, e->checksum, -1, SQLITE_STATIC) != SQLITE_OK) {
+			if (sqlite3_bind_text(insert, 3, mport_asset_checksum(e, checksum), -1, SQLITE_TRANSIENT) !=
+			    SQLITE_OK) {
 				SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
 				goto ERROR;
 			}
@@ -924,13 +936,13 @@ run_postexec(mportInstance *mport, mportPackageMeta *pkg)
 				break;
 			case ASSET_GLIB_SCHEMAS:
 				if (mport_file_exists("/usr/local/bin/glib-compile-schemas") && 
-					mport_xsystem(mport, "/usr/local/bin/glib-compile-schemas %s/share/glib-2.0/schemas > /dev/null || true", e->data == NULL ? pkg->prefix : e->data) != MPORT_OK) {
+					mport_trigger(mport, "/usr/local/bin/glib-compile-schemas %s/share/glib-2.0/schemas > /dev/null || true", e->data == NULL ? pkg->prefix : e->data) != MPORT_OK) {
 					goto ERROR;
 				}
 				break;
 			case ASSET_INFO:
 				if (mport_file_exists("/usr/local/bin/indexinfo") && 
-					mport_xsystem(mport, "/usr/local/bin/indexinfo %s", e->data == NULL ? pkg->prefix : e->data) != MPORT_OK) {
+					mport_trigger(mport, "/usr/local/bin/indexinfo %s", e->data == NULL ? pkg->prefix : e->data) != MPORT_OK) {
 					goto ERROR;
 				}
 				break;
@@ -940,7 +952,7 @@ run_postexec(mportInstance *mport, mportPackageMeta *pkg)
 				}
 				break;
 			case ASSET_DESKTOP_FILE_UTILS:
-				if (mport_file_exists("/usr/local/bin/update-desktop-database") && mport_xsystem(mport, "/usr/local/bin/update-desktop-database -q > /dev/null || true") != MPORT_OK) {
+				if (mport_file_exists("/usr/local/bin/update-desktop-database") && mport_trigger(mport, "/usr/local/bin/update-desktop-database -q > /dev/null || true") != MPORT_OK) {
 					goto ERROR;
 				}
 				break;
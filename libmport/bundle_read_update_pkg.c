@@ -44,20 +44,16 @@ static int build_create_extras_depends(mportInstance *, mportPackageMeta *, mpor
 
 int mport_bundle_read_update_pkg(mportInstance *mport, mportBundleRead *bundle, mportPackageMeta *pkg)
 {
-	char tmpfile2[] = "/tmp/mport.XXXXXXXX";
-	int fd;
+	char *tmpfile2;
+	const char *txnbackup;
 
 	mport_pkgmeta_logevent(mport, pkg, "Begining update");
 
-	if ((fd = mkstemp(tmpfile2)) == -1) {
-		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't make tmp file: %s", strerror(errno));
-	}
-  
-	close(fd);
-
-	if (make_backup_bundle(mport, pkg, tmpfile2) != MPORT_OK) {
-		// attempt to clear the temp file
-		(void)mport_rmtree(tmpfile2);
+	/* a transaction has already backed the package up, and removes the backup itself */
+	if ((txnbackup = mport_txn_backup(mport, pkg->name)) != NULL) {
+		if ((tmpfile2 = strdup(txnbackup)) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	} else if (mport_bundle_backup_pkg(mport, pkg, &tmpfile2) != MPORT_OK) {
 		RETURN_CURRENT_ERROR;
 	}
 
@@ -68,18 +64,51 @@ int mport_bundle_read_update_pkg(mportInstance *mport, mportBundleRead *bundle,
 	) 
 	{
     		if (install_backup_bundle(mport, tmpfile2) == MPORT_OK) {
-			(void)mport_rmtree(tmpfile2);
+			if (txnbackup == NULL)
+				(void)mport_rmtree(tmpfile2);
 		} else {
 			mport_call_msg_cb(mport, "Error restoring backup package %s", pkg->name);
 		}
+		free(tmpfile2);
 		RETURN_CURRENT_ERROR;
 	}           
   
 	/* if we can't delete the tmpfile, just move on. */
-	(void)mport_rmtree(tmpfile2);
+	if (txnbackup == NULL)
+		(void)mport_rmtree(tmpfile2);
+	free(tmpfile2);
   
 	return (MPORT_OK);
 }
+
+/* Back up an installed package to a temporary bundle, restored with mport_install_primative(). */
+int
+mport_bundle_backup_pkg(mportInstance *mport, mportPackageMeta *pkg, char **backup)
+{
+	char tmpfile2[] = "/tmp/mport.XXXXXXXX";
+	int fd;
+
+	*backup = NULL;
+
+	if ((fd = mkstemp(tmpfile2)) == -1) {
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't make tmp file: %s", strerror(errno));
+	}
+  
+	close(fd);
+
+	if (make_backup_bundle(mport, pkg, tmpfile2) != MPORT_OK) {
+		// attempt to clear the temp file
+		(void)mport_rmtree(tmpfile2);
+		RETURN_CURRENT_ERROR;
+	}
+
+	if ((*backup = strdup(tmpfile2)) == NULL) {
+		(void)mport_rmtree(tmpfile2);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	return (MPORT_OK);
+}
   
   
 static int make_backup_bundle(mportInstance *mport, mportPackageMeta *pkg, char *tempfile)
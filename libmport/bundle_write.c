@@ -45,6 +45,8 @@
 #include <archive.h>
 #include <archive_entry.h>
 #include <assert.h>
+#include <unistd.h>
+#include <zstd.h>
 #include "mport.h"
 #include "mport_private.h"
 
@@ -58,6 +60,16 @@ struct links_table {
   struct link_node **buckets;
 };
 
+/* compresses the archive output with a zstd dictionary */
+struct zdict_writer {
+  int fd;
+  ZSTD_CCtx *cctx;
+  void *outbuf;
+  size_t outsize;
+};
+
+#define ZDICT_LEVEL 19
+
 struct link_node {
   int links;
   dev_t dev;
@@ -68,6 +80,11 @@ struct link_node {
 };
 
 
+static int bundle_write_open(mportBundleWrite *, const char *, bool);
+static la_ssize_t zdict_write_cb(struct archive *, void *, const void *, size_t);
+static int zdict_close_cb(struct archive *, void *);
+static int zdict_flush(struct archive *, struct zdict_writer *, ZSTD_inBuffer *, ZSTD_EndDirective);
+static void zdict_writer_free(struct zdict_writer *);
 static int lookup_hardlink(mportBundleWrite *, struct archive_entry *, const struct stat *);
 static void free_linktable(struct links_table *);
 
@@ -90,6 +107,147 @@ mportBundleWrite* mport_bundle_write_new(void)
  * filename.
  */
 int mport_bundle_write_init(mportBundleWrite *bundle, const char *filename)
+{
+  return bundle_write_open(bundle, filename, true);
+}
+
+/*
+ * mport_bundle_write_init_container(bundle, filename)
+ *
+ * set up an uncompressed bundle.  This is used for member bundles, where
+ * every member is an already compressed bundle that is stored as is.
+ */
+int mport_bundle_write_init_container(mportBundleWrite *bundle, const char *filename)
+{
+  return bundle_write_open(bundle, filename, false);
+}
+
+/*
+ * mport_bundle_write_init_zdict(bundle, filename, dictfile)
+ *
+ * set up a bundle compressed with zstd using the dictionary in dictfile.
+ * libarchive can't use a dictionary, so the archive is compressed here.
+ */
+int mport_bundle_write_init_zdict(mportBundleWrite *bundle, const char *filename, const char *dictfile)
+{
+  struct zdict_writer *zw;
+  void *dict;
+  size_t dictsize, ret;
+
+  if ((bundle->filename = strdup(filename)) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't dup filename");
+
+  if ((dict = mport_zdict_read_file(dictfile, &dictsize)) == NULL)
+    RETURN_CURRENT_ERROR;
+
+  if ((zw = calloc(1, sizeof(struct zdict_writer))) == NULL) {
+    free(dict);
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+  }
+  zw->fd = -1;
+  bundle->zwriter = zw;
+
+  zw->outsize = ZSTD_CStreamOutSize();
+  if ((zw->cctx = ZSTD_createCCtx()) == NULL || (zw->outbuf = malloc(zw->outsize)) == NULL) {
+    free(dict);
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+  }
+
+  /* the dictionary ID goes in the frame header, which is how readers find it */
+  ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_compressionLevel, ZDICT_LEVEL);
+  ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_checksumFlag, 1);
+  ret = ZSTD_CCtx_loadDictionary(zw->cctx, dict, dictsize);
+  free(dict);
+  if (ZSTD_isError(ret))
+    RETURN_ERRORX(MPORT_ERR_FATAL, "Invalid dictionary %s: %s", dictfile, ZSTD_getErrorName(ret));
+
+  if ((zw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+    RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open %s: %s", filename, strerror(errno));
+
+  if ((bundle->archive = archive_write_new()) == NULL) 
+    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate archive struct");
+
+  if (archive_write_set_format_pax(bundle->archive) != ARCHIVE_OK)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+  bundle->links = NULL;
+
+  if (archive_write_open(bundle->archive, zw, NULL, zdict_write_cb, zdict_close_cb) != ARCHIVE_OK)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+  return MPORT_OK;
+}
+
+static la_ssize_t zdict_write_cb(struct archive *a, void *client_data, const void *buff, size_t length)
+{
+  ZSTD_inBuffer in = { buff, length, 0 };
+
+  if (zdict_flush(a, client_data, &in, ZSTD_e_continue) != ARCHIVE_OK)
+    return -1;
+
+  return (la_ssize_t)length;
+}
+
+static int zdict_close_cb(struct archive *a, void *client_data)
+{
+  struct zdict_writer *zw = client_data;
+  ZSTD_inBuffer in = { NULL, 0, 0 };
+  int ret;
+
+  ret = zdict_flush(a, zw, &in, ZSTD_e_end);
+
+  if (close(zw->fd) != 0 && ret == ARCHIVE_OK) {
+    archive_set_error(a, errno, "%s", strerror(errno));
+    ret = ARCHIVE_FATAL;
+  }
+  zw->fd = -1;
+
+  return ret;
+}
+
+/* compress in, writing out whatever zstd produces; with ZSTD_e_end, finish the frame */
+static int zdict_flush(struct archive *a, struct zdict_writer *zw, ZSTD_inBuffer *in, ZSTD_EndDirective mode)
+{
+  ZSTD_outBuffer out;
+  size_t left;
+  ssize_t wrote;
+  char *ptr;
+
+  do {
+    out.dst = zw->outbuf;
+    out.size = zw->outsize;
+    out.pos = 0;
+
+    left = ZSTD_compressStream2(zw->cctx, &out, in, mode);
+    if (ZSTD_isError(left)) {
+      archive_set_error(a, ARCHIVE_ERRNO_MISC, "%s", ZSTD_getErrorName(left));
+      return ARCHIVE_FATAL;
+    }
+
+    for (ptr = zw->outbuf; out.pos > 0; ptr += wrote, out.pos -= wrote) {
+      if ((wrote = write(zw->fd, ptr, out.pos)) < 0) {
+        archive_set_error(a, errno, "%s", strerror(errno));
+        return ARCHIVE_FATAL;
+      }
+    }
+  } while (mode == ZSTD_e_end ? left != 0 : in->pos < in->size);
+
+  return ARCHIVE_OK;
+}
+
+static void zdict_writer_free(struct zdict_writer *zw)
+{
+  if (zw == NULL)
+    return;
+
+  if (zw->fd != -1)
+    close(zw->fd);
+  ZSTD_freeCCtx(zw->cctx);
+  free(zw->outbuf);
+  free(zw);
+}
+
+static int bundle_write_open(mportBundleWrite *bundle, const char *filename, bool compress)
 {
   if ((bundle->filename = strdup(filename)) == NULL)
     RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't dup filename");
@@ -97,7 +255,7 @@ int mport_bundle_write_init(mportBundleWrite *bundle, const char *filename)
   if ((bundle->archive = archive_write_new()) == NULL) 
     RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate archive struct");
 
-  if (archive_write_add_filter_xz(bundle->archive) != ARCHIVE_OK)
+  if (compress && archive_write_add_filter_xz(bundle->archive) != ARCHIVE_OK)
     RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
 
   if (archive_write_set_format_pax(bundle->archive) != ARCHIVE_OK)
@@ -129,6 +287,7 @@ int mport_bundle_write_finish(mportBundleWrite *bundle)
     ret = SET_ERROR(MPORT_ERR_FATAL, strdup(archive_error_string(bundle->archive)));
 
   free_linktable(bundle->links);
+  zdict_writer_free(bundle->zwriter);
  
   free(bundle->filename);
   free(bundle);
@@ -148,8 +307,7 @@ int mport_bundle_write_add_file(mportBundleWrite *bundle, const char *filename,
 	struct archive_entry *entry = NULL;
 	struct stat st;
 	int fd = -1, ret = MPORT_OK;
-	ssize_t len;
-	char buff[BUFF_SIZE];
+	bool sparse = false;
 
 	if (lstat(filename, &st) != 0) {
 		RETURN_ERRORX(MPORT_ERR_FATAL, "Unable to stat %s: %s", filename, strerror(errno));
@@ -190,20 +348,19 @@ int mport_bundle_write_add_file(mportBundleWrite *bundle, const char *filename,
   else if ((fd = open(filename, O_RDONLY)) == -1) {
    RETURN_ERROR(MPORT_ERR_FATAL, strerror(errno));
   }
+  /* files with holes become sparse entries, so the holes aren't stored */
+  else if (archive_entry_hardlink(entry) == NULL)
+    sparse = mport_archive_sparse_map(entry, fd, st.st_size);
    
   if (archive_write_header(bundle->archive, entry) != ARCHIVE_OK)
     RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
   
   /* write the data to the archive if there is data to write */
   if (archive_entry_size(entry) > 0 && fd > -1) {
-    len = read(fd, buff, sizeof(buff));
-    while (len > 0) {
-      if (archive_write_data(bundle->archive, buff, len) != len) {
-        ret = SET_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
-        break;
-      }
-      len = read(fd, buff, sizeof(buff));
-    }
+    if (sparse)
+      ret = mport_archive_write_sparse_fd(bundle->archive, entry, fd, archive_entry_size(entry));
+    else
+      ret = mport_archive_write_fd(bundle->archive, fd, archive_entry_size(entry));
   }
    
   archive_entry_free(entry);
@@ -215,6 +372,59 @@ int mport_bundle_write_add_file(mportBundleWrite *bundle, const char *filename,
 }
 
 
+/*
+ * mport_bundle_write_add_hardlink(bundle, filename, path, target)
+ *
+ * Add filename to the bundle as path, but as a hardlink to target, an
+ * earlier entry with the same content.  No data is stored.
+ */
+int mport_bundle_write_add_hardlink(mportBundleWrite *bundle, const char *filename, const char *path, const char *target)
+{
+  struct archive_entry *entry;
+  struct stat st;
+  int ret = MPORT_OK;
+
+  if (lstat(filename, &st) != 0)
+    RETURN_ERRORX(MPORT_ERR_FATAL, "Unable to stat %s: %s", filename, strerror(errno));
+
+  if ((entry = archive_entry_new()) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+  archive_entry_copy_stat(entry, &st);
+  archive_entry_set_pathname(entry, path);
+  archive_entry_copy_hardlink(entry, target);
+  archive_entry_set_size(entry, 0);
+
+  if (archive_write_header(bundle->archive, entry) != ARCHIVE_OK)
+    ret = SET_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+  archive_entry_free(entry);
+
+  return ret;
+}
+
+
+/* mport_bundle_write_add_buffer(bundle, entry, data)
+ *
+ * Add an entry whose data is already in memory.  data must hold
+ * archive_entry_size(entry) bytes.
+ */
+int mport_bundle_write_add_buffer(mportBundleWrite *bundle, struct archive_entry *entry, const void *data)
+{
+  la_int64_t size;
+
+  if (archive_write_header(bundle->archive, entry) != ARCHIVE_OK)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+  size = archive_entry_size(entry);
+
+  if (size > 0 && archive_write_data(bundle->archive, data, (size_t)size) != size)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+
+  return MPORT_OK;
+}
+
+
 /* mport_bundle_write_add_entry(bundle, readBundle, entry)
  * 
  * Add an entry from another archive to the bundle.  The archive struct must be a read 
@@ -222,26 +432,33 @@ int mport_bundle_write_add_file(mportBundleWrite *bundle, const char *filename,
  */
 int mport_bundle_write_add_entry(mportBundleWrite *bundle, mportBundleRead *inbundle, struct archive_entry *entry)
 {
-  char buff[BUFF_SIZE];
-  size_t size, bytes_to_write;
+  static const char zeros[BUFF_SIZE];
+  const void *block;
+  size_t len, fill;
+  la_int64_t offset, written = 0;
+  int ret;
 
   if (archive_write_header(bundle->archive, entry) != ARCHIVE_OK)
     RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
 
-  size = archive_entry_size(entry);
-
-  while (size > 0) {  
-    if (archive_read_data(inbundle->archive, buff, sizeof(buff)) < ARCHIVE_OK) 
-      RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(inbundle->archive));
-
-    /* don't write the whole buffer if it isn't full */
-    bytes_to_write = size < sizeof(buff) ? size : sizeof(buff);
+  /* hand the reader's blocks straight to the writer, rather than copying through a buffer */
+  while ((ret = archive_read_data_block(inbundle->archive, &block, &len, &offset)) == ARCHIVE_OK) {
+    /* holes in sparse entries come back as gaps between blocks */
+    while (written < offset) {
+      fill = offset - written > (la_int64_t)sizeof(zeros) ? sizeof(zeros) : (size_t)(offset - written);
+      if (archive_write_data(bundle->archive, zeros, fill) != (la_ssize_t)fill)
+        RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
+      written += fill;
+    }
 
-    if (archive_write_data(bundle->archive, buff, bytes_to_write) < 0)
+    if (len > 0 && archive_write_data(bundle->archive, block, len) != (la_ssize_t)len)
       RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(bundle->archive));
 
-    size -= bytes_to_write;
-  }  
+    written = offset + len;
+  }
+
+  if (ret != ARCHIVE_EOF)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(inbundle->archive));
   
   return MPORT_OK;
 }
@@ -230,8 +230,9 @@ static int check_depends(mportInstance *mport, mportPackageMeta *pack)
 {
 	sqlite3 *db = mport->db;
 	sqlite3_stmt *stmt, *lookup;
-	const char *depend_pkg, *depend_version, *inst_version;
+	const char *depend_pkg, *depend_version, *inst_version, *inst_key;
 	const char *os_release;
+	const mportVersionReq *req;
 	char *system_os_release;
 	int ret;
 
@@ -243,7 +244,7 @@ static int check_depends(mportInstance *mport, mportPackageMeta *pack)
 	}
 
 	/* package name on dependencies can contain the flavor prefix. native-binutils but there is no guarnatee we stored it as native-bintuils in master. check for binutils also. */
-	if (mport_db_prepare(db, &lookup, "SELECT version, os_release, flavor FROM packages WHERE (pkg=? or (flavor is not null and flavor != '' and pkg=substr(?, length(flavor) + 2) )) AND status='clean'") !=
+	if (mport_db_prepare(db, &lookup, "SELECT version, os_release, flavor, version_key FROM packages WHERE (pkg=? or (flavor is not null and flavor != '' and pkg=substr(?, length(flavor) + 2) )) AND status='clean'") !=
 	    MPORT_OK) {
 		sqlite3_finalize(stmt);
 		RETURN_CURRENT_ERROR;
@@ -294,7 +295,14 @@ static int check_depends(mportInstance *mport, mportPackageMeta *pack)
 						/* no minimum version */
 						break;
 
-					ok = mport_version_require_check(inst_version, depend_version);
+					/* the installed version is already parsed, as its key */
+					inst_key = sqlite3_column_text(lookup, 3);
+					if (inst_key == NULL)
+						ok = mport_version_require_check(inst_version, depend_version);
+					else if ((req = mport_version_req_cached(mport, depend_version)) == NULL)
+						ok = MPORT_ERR_FATAL;
+					else
+						ok = mport_version_req_match(req, inst_key) ? 0 : -1;
 
 					if (ok > 0) {
 						sqlite3_finalize(lookup);
@@ -361,7 +369,7 @@ check_if_older_installed(mportInstance *mport, mportPackageMeta *pkg)
 		return SET_ERROR(MPORT_ERR_FATAL, "Unable to determine OS release");
 
 	if (mport_db_prepare(mport->db, &stmt,
-	                     "SELECT os_release FROM packages WHERE pkg=%Q and ((mport_version_cmp(version, %Q) < 0 and os_release=%Q) or os_release != %Q)",
+	                     "SELECT os_release FROM packages WHERE pkg=%Q and ((version_key < mport_version_key(%Q) and os_release=%Q) or os_release != %Q)",
 	                     pkg->name, pkg->version, os_release, os_release) != MPORT_OK) {
 		free((char*)os_release);
 		sqlite3_finalize(stmt);
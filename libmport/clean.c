@@ -30,6 +30,8 @@
 #include "mport_private.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +39,8 @@
 #include <dirent.h>
 #include <unistd.h>
 
+static int clean_list(mportInstance *, const char *, bool);
+
 MPORT_PUBLIC_API int
 mport_clean_database(mportInstance *mport)
 {
@@ -52,135 +56,110 @@ mport_clean_database(mportInstance *mport)
 	return error_code;
 }
 
+/*
+ * Delete cached bundles that neither the index nor an installed package knows
+ * about, or that are empty (an interrupted download).  The directory is listed
+ * into a temporary table and matched against the index and the installed
+ * packages in one query; reading every bundle to check its hash is left to the
+ * clean_verify_hash setting.  A bundle of an installed package that has left
+ * the index has no hash to check against and is kept.
+ */
 MPORT_PUBLIC_API int
 mport_clean_oldpackages(mportInstance *mport)
 {
+	sqlite3_stmt *stmt;
+	char *path, *setting;
+	const char *name, *hash;
+	bool verify, installed;
 	int error_code = MPORT_OK;
+	int deleted = 0;
+	int ret;
 
+	MPORT_CHECK_FOR_INDEX(mport, "mport_clean_oldpackages()");
 
-	int deleted = 0;
-	struct dirent *de;
-	DIR *d = opendir(MPORT_FETCH_STAGING_DIR);
+	setting = mport_setting_get(mport, MPORT_SETTING_CLEAN_VERIFY_HASH);
+	verify = setting != NULL && mport_check_answer_bool(setting);
 
-	if (d == NULL) {
-		error_code = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't open directory %s: %s", MPORT_FETCH_STAGING_DIR,
-		                        strerror(errno));
-		return error_code;
-	}
+	if (clean_list(mport, MPORT_FETCH_STAGING_DIR, false) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
 
-	while ((de = readdir(d)) != NULL) {
-		mportIndexEntry **indexEntry;
-		char *path;
-		if (strcmp(".", de->d_name) == 0 || strcmp("..", de->d_name) == 0)
-			continue;
+	if (mport_db_prepare(mport->db, &stmt,
+	    "SELECT f.name, MIN(i.hash), f.size > 0 AND EXISTS (SELECT 1 FROM packages p "
+	    "WHERE p.pkg || '-' || p.version || '.mport' = f.name) AS installed "
+	    "FROM temp.clean_files f LEFT JOIN idx.packages i ON i.bundlefile = f.name "
+	    "GROUP BY f.name HAVING %s",
+	    verify ? "1" : "f.size = 0 OR (COUNT(i.bundlefile) = 0 AND NOT installed)") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		name = (const char *)sqlite3_column_text(stmt, 0);
+		hash = (const char *)sqlite3_column_text(stmt, 1);
+		installed = sqlite3_column_int(stmt, 2) != 0;
 
-		if (mport_index_search(mport, &indexEntry, "bundlefile=%Q", de->d_name) != MPORT_OK) {
-			mport_call_msg_cb(mport, "failed to search index %s: ", mport_err_string());
+		if (asprintf(&path, "%s/%s", MPORT_FETCH_STAGING_DIR, name) == -1)
 			continue;
-		}
 
-		asprintf(&path, "%s/%s", MPORT_FETCH_STAGING_DIR, de->d_name);
-		if (path == NULL) {
-			if (indexEntry != NULL) {
-				mport_index_entry_free_vec(indexEntry);
-				indexEntry = NULL;
-			}
+		/* when verifying, every bundle comes back; keep the good ones */
+		if (verify && (hash != NULL ? mport_verify_hash(path, hash) == 1 : installed)) {
+			free(path);
 			continue;
 		}
 
-		if (indexEntry == NULL || *indexEntry == NULL) {
-			if (unlink(path) < 0) {
-				error_code = SET_ERRORX(MPORT_ERR_FATAL, "Could not delete file %s: %s",
-				                        path, strerror(errno));
-				mport_call_msg_cb(mport, "%s\n", mport_err_string());
-			} else {
-				deleted++;
-			}
-		} else if (mport_verify_hash(path, (*indexEntry)->hash) == 0) {
-			if (unlink(path) < 0) {
-				error_code = SET_ERRORX(MPORT_ERR_FATAL, "Could not delete file %s: %s", path, strerror(errno));
-				mport_call_msg_cb(mport, "%s\n", mport_err_string());
-			} else {
-				deleted++;
-			}
-			mport_index_entry_free_vec(indexEntry);
-			indexEntry = NULL;
+		if (unlink(path) < 0) {
+			error_code = SET_ERRORX(MPORT_ERR_FATAL, "Could not delete file %s: %s", path, strerror(errno));
+			mport_call_msg_cb(mport, "%s\n", mport_err_string());
 		} else {
-			mport_index_entry_free_vec(indexEntry);
-			indexEntry = NULL;
+			deleted++;
 		}
 
 		free(path);
-		path = NULL;
 	}
 
-	closedir(d);
+	if (ret != SQLITE_DONE)
+		error_code = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+
+	sqlite3_finalize(stmt);
 
 	mport_call_msg_cb(mport, "Cleaned up %d packages.\n", deleted);
 
 	return error_code;
 }
 
+/* Delete the package infrastructure directories of packages no longer installed. */
 MPORT_PUBLIC_API int
 mport_clean_oldmtree(mportInstance *mport)
 {
+	sqlite3_stmt *stmt;
+	char *path;
 	int error_code = MPORT_OK;
-
 	int deleted = 0;
-	struct dirent *de;
-	DIR *d = opendir(MPORT_INST_INFRA_DIR);
-	
-	if (d == NULL) {
-		error_code = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't open directory %s: %s", MPORT_INST_INFRA_DIR,
-		                        strerror(errno));
-		return error_code;
-	}
-
-	while ((de = readdir(d)) != NULL) {
-		mportPackageMeta **packs;
-		char *path;
-		if (strcmp(".", de->d_name) == 0 || strcmp("..", de->d_name) == 0)
-			continue;
+	int ret;
 
-		char packageName[128];
-		strncpy(packageName, de->d_name, 127);
-		packageName[127] = '\0';
-		char *dash = strrchr(packageName, '-');
-		if (dash != NULL) {
-			*dash = '\0';
-		}
+	if (clean_list(mport, MPORT_INST_INFRA_DIR, true) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
 
-		if (mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", packageName) != MPORT_OK) {
-			mport_call_msg_cb(mport, "failed to search master database for %s: ", mport_err_string());
-			continue;
-		}
+	if (mport_db_prepare(mport->db, &stmt,
+	    "SELECT name FROM temp.clean_files f WHERE NOT EXISTS (SELECT 1 FROM packages p WHERE p.pkg = f.pkg)") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
 
-		asprintf(&path, "%s/%s", MPORT_INST_INFRA_DIR, de->d_name);
-		if (path == NULL) {
-			if (packs != NULL) {
-				mport_pkgmeta_vec_free(packs);
-				packs = NULL;
-			}
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (asprintf(&path, "%s/%s", MPORT_INST_INFRA_DIR, sqlite3_column_text(stmt, 0)) == -1)
 			continue;
-		}
 
-		if (packs == NULL || *packs == NULL) {
-			if (mport_rmtree(path) != MPORT_OK) {
-				error_code = SET_ERRORX(MPORT_ERR_FATAL, "Could not delete file %s: %s", path, strerror(errno));
-				mport_call_msg_cb(mport, "%s\n", mport_err_string());
-			} else {
-				deleted++;
-			}
+		if (mport_rmtree(path) != MPORT_OK) {
+			error_code = SET_ERRORX(MPORT_ERR_FATAL, "Could not delete file %s: %s", path, strerror(errno));
+			mport_call_msg_cb(mport, "%s\n", mport_err_string());
 		} else {
-			mport_pkgmeta_vec_free(packs);
-			packs = NULL;
+			deleted++;
 		}
 
 		free(path);
-		path = NULL;
 	}
 
-	closedir(d);
+	if (ret != SQLITE_DONE)
+		error_code = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+
+	sqlite3_finalize(stmt);
 
 	mport_call_msg_cb(mport, "Cleaned up %d mtrees.\n", deleted);
 
@@ -235,3 +214,71 @@ mport_clean_tempfiles(mportInstance *mport)
 
 	return error_code;
 }
+
+/*
+ * Load the entries of dir into temp.clean_files (name, pkg, size).  For
+ * infrastructure directories, named package-version, pkg is the package.
+ */
+static int
+clean_list(mportInstance *mport, const char *dir, bool infra)
+{
+	sqlite3_stmt *stmt;
+	struct dirent *de;
+	struct stat st;
+	char packageName[128], *dash;
+	DIR *d;
+	int ret = MPORT_OK;
+
+	if ((d = opendir(dir)) == NULL)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open directory %s: %s", dir, strerror(errno));
+
+	if (mport_db_do(mport->db,
+	    "CREATE TEMP TABLE IF NOT EXISTS clean_files (name text NOT NULL PRIMARY KEY, pkg text, size integer)") != MPORT_OK ||
+	    mport_db_do(mport->db, "DELETE FROM temp.clean_files") != MPORT_OK ||
+	    mport_db_prepare(mport->db, &stmt, "INSERT INTO temp.clean_files (name, pkg, size) VALUES (?, ?, ?)") != MPORT_OK) {
+		closedir(d);
+		RETURN_CURRENT_ERROR;
+	}
+
+	if (mport_db_do(mport->db, "BEGIN TRANSACTION") != MPORT_OK) {
+		sqlite3_finalize(stmt);
+		closedir(d);
+		RETURN_CURRENT_ERROR;
+	}
+
+	while (ret == MPORT_OK && (de = readdir(d)) != NULL) {
+		if (strcmp(".", de->d_name) == 0 || strcmp("..", de->d_name) == 0)
+			continue;
+
+		if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			continue;
+
+		sqlite3_bind_text(stmt, 1, de->d_name, -1, SQLITE_STATIC);
+		if (infra) {
+			strlcpy(packageName, de->d_name, sizeof(packageName));
+			if ((dash = strrchr(packageName, '-')) != NULL)
+				*dash = '\0';
+			sqlite3_bind_text(stmt, 2, packageName, -1, SQLITE_STATIC);
+		} else {
+			sqlite3_bind_null(stmt, 2);
+		}
+		sqlite3_bind_int64(stmt, 3, st.st_size);
+
+		if (sqlite3_step(stmt) != SQLITE_DONE)
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+		sqlite3_reset(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+	closedir(d);
+
+	if (ret != MPORT_OK) {
+		mport_db_do(mport->db, "ROLLBACK");
+		return (ret);
+	}
+
+	if (mport_db_do(mport->db, "COMMIT") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	return (MPORT_OK);
+}
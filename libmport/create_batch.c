@@ -0,0 +1,442 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucl.h>
+#include "mport.h"
+#include "mport_private.h"
+
+struct batch_task {
+	mportCreateJob *job;
+	const char *os_release;
+};
+
+static int batch_task(void *);
+static int batch_task_done(void *, int, const char *, void *);
+static int batch_build_job(mportCreateJob *, const char *);
+static int batch_job_from_ucl(mportCreateBatch *, const ucl_object_t *);
+static void batch_string(const ucl_object_t *, const char *, char **);
+static void batch_list(const ucl_object_t *, const char *, char ***, size_t *);
+
+MPORT_PUBLIC_API mportCreateBatch *
+mport_createbatch_new(void)
+{
+	return (mportCreateBatch *)calloc(1, sizeof(mportCreateBatch));
+}
+
+MPORT_PUBLIC_API void
+mport_createbatch_free(mportCreateBatch *batch)
+{
+	size_t i;
+
+	if (batch == NULL)
+		return;
+
+	for (i = 0; i < batch->jobs_count; i++) {
+		mport_pkgmeta_free(batch->jobs[i]->pack);
+		mport_createextras_free(batch->jobs[i]->extra);
+		free(batch->jobs[i]->plist);
+		free(batch->jobs[i]->errmsg);
+		free(batch->jobs[i]);
+	}
+
+	free(batch->jobs);
+	free(batch);
+}
+
+/*
+ * mport_createbatch_add(batch, pack, extra, plist)
+ *
+ * Queue a package for creation.  On success the batch owns pack and extra.
+ * The plist is not parsed until a worker picks the job up, so only one asset
+ * list per worker is ever held in memory.
+ */
+MPORT_PUBLIC_API int
+mport_createbatch_add(mportCreateBatch *batch, mportPackageMeta *pack, mportCreateExtras *extra, const char *plist)
+{
+	mportCreateJob **jobs;
+	mportCreateJob *job;
+
+	if (batch == NULL || pack == NULL || extra == NULL || plist == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Invalid batch create job.");
+
+	if ((job = (mportCreateJob *)calloc(1, sizeof(mportCreateJob))) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	if ((job->plist = strdup(plist)) == NULL) {
+		free(job);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	jobs = (mportCreateJob **)realloc(batch->jobs, (batch->jobs_count + 1) * sizeof(mportCreateJob *));
+	if (jobs == NULL) {
+		free(job->plist);
+		free(job);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	job->pack = pack;
+	job->extra = extra;
+	job->result = MPORT_OK;
+
+	batch->jobs = jobs;
+	batch->jobs[batch->jobs_count++] = job;
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_createbatch_load(batch, filename)
+ *
+ * Read a UCL package spec file and queue every package in it.  The file
+ * holds a "packages" array; each element uses the same fields as the
+ * mport.create arguments:
+ *
+ * packages [
+ *   {
+ *     name = "foo"; version = "1.0"; origin = "misc/foo"; prefix = "/usr/local";
+ *     categories = "misc"; sourcedir = "/tmp/stage"; plist = "/tmp/pkg-plist";
+ *     output = "/tmp/foo-1.0.mport"; depends = [ "bar:misc/bar:>=1.0" ];
+ *   }
+ * ]
+ */
+MPORT_PUBLIC_API int
+mport_createbatch_load(mportCreateBatch *batch, const char *filename)
+{
+	struct ucl_parser *parser;
+	ucl_object_t *obj;
+	const ucl_object_t *packages;
+	const ucl_object_t *cur;
+	ucl_object_iter_t it = NULL;
+	int ret = MPORT_OK;
+
+	if (batch == NULL || filename == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Invalid batch spec.");
+
+	parser = ucl_parser_new(0);
+	if (!ucl_parser_add_file(parser, filename)) {
+		SET_ERRORX(MPORT_ERR_FATAL, "Couldn't parse %s: %s", filename, ucl_parser_get_error(parser));
+		ucl_parser_free(parser);
+		RETURN_CURRENT_ERROR;
+	}
+
+	obj = ucl_parser_get_object(parser);
+	ucl_parser_free(parser);
+
+	packages = ucl_object_find_key(obj, "packages");
+	if (packages == NULL || ucl_object_type(packages) != UCL_ARRAY) {
+		ucl_object_unref(obj);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s: no packages array found", filename);
+	}
+
+	while ((cur = ucl_object_iterate(packages, &it, true)) != NULL) {
+		if ((ret = batch_job_from_ucl(batch, cur)) != MPORT_OK)
+			break;
+	}
+
+	ucl_object_unref(obj);
+
+	return (ret);
+}
+
+/*
+ * mport_createbatch_run(mport, batch)
+ *
+ * Build every queued package on the instance's worker pool.  The os release is
+ * looked up once here, so the workers never share the master database handle.
+ * Each job writes its own bundle, and results are reported in the order the
+ * jobs were queued, so the outcome does not depend on thread scheduling.
+ */
+MPORT_PUBLIC_API int
+mport_createbatch_run(mportInstance *mport, mportCreateBatch *batch)
+{
+	struct mport_taskgroup *tg;
+	struct batch_task *tasks;
+	mportCreateJob *job;
+	char *os_release;
+	size_t j;
+	size_t failed = 0;
+
+	if (batch == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Invalid batch.");
+
+	if (batch->jobs_count == 0)
+		return (MPORT_OK);
+
+	if ((os_release = mport_get_osrelease(mport)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "OS Release could not be determined");
+
+	tasks = (struct batch_task *)calloc(batch->jobs_count, sizeof(struct batch_task));
+	tg = mport_taskgroup_new(mport, 0, batch->workers > 0 ? (size_t)batch->workers : 0);
+	if (tasks == NULL || tg == NULL) {
+		mport_taskgroup_free(tg);
+		free(tasks);
+		free(os_release);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	for (j = 0; j < batch->jobs_count; j++) {
+		tasks[j].job = batch->jobs[j];
+		tasks[j].os_release = os_release;
+		if (mport_taskgroup_add(tg, batch_task, &tasks[j]) != MPORT_OK) {
+			mport_taskgroup_free(tg);
+			free(tasks);
+			free(os_release);
+			RETURN_CURRENT_ERROR;
+		}
+	}
+
+	/* failures are collected per job below, so the group's result isn't needed */
+	(void) mport_taskgroup_wait(tg, batch_task_done, NULL);
+	mport_taskgroup_free(tg);
+	free(tasks);
+	free(os_release);
+
+	for (j = 0; j < batch->jobs_count; j++) {
+		job = batch->jobs[j];
+
+		if (job->result == MPORT_OK) {
+			if (mport->verbosity == MPORT_VVERBOSE)
+				mport_call_msg_cb(mport, "Created %s", job->extra->pkg_filename);
+			continue;
+		}
+
+		failed++;
+		mport_call_msg_cb(mport, "Unable to create %s-%s: %s", job->pack->name, job->pack->version,
+		    job->errmsg == NULL ? "unknown error" : job->errmsg);
+	}
+
+	if (failed > 0)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%zu of %zu packages could not be created", failed, batch->jobs_count);
+
+	return (MPORT_OK);
+}
+
+static int
+batch_task(void *arg)
+{
+	struct batch_task *task = arg;
+
+	return (batch_build_job(task->job, task->os_release));
+}
+
+static int
+batch_task_done(void *arg, int result, const char *errmsg, void *cbarg)
+{
+	struct batch_task *task = arg;
+
+	task->job->result = result;
+	if (result != MPORT_OK && errmsg != NULL)
+		task->job->errmsg = strdup(errmsg);
+
+	return (MPORT_OK);
+}
+
+static int
+batch_build_job(mportCreateJob *job, const char *os_release)
+{
+	mportAssetList *assetlist;
+	FILE *fp;
+	int ret;
+
+	if ((fp = fopen(job->plist, "re")) == NULL)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open plist %s: %s", job->plist, strerror(errno));
+
+	if ((assetlist = mport_assetlist_new()) == NULL) {
+		fclose(fp);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	ret = mport_parse_plistfile(fp, assetlist);
+	fclose(fp);
+
+	if (ret == MPORT_OK)
+		ret = mport_create_primative_release(assetlist, job->pack, job->extra, os_release);
+
+	mport_assetlist_free(assetlist);
+
+	return (ret);
+}
+
+static int
+batch_job_from_ucl(mportCreateBatch *batch, const ucl_object_t *obj)
+{
+	mportPackageMeta *pack;
+	mportCreateExtras *extra;
+	const ucl_object_t *val;
+	char *plist = NULL;
+	char *value = NULL;
+	struct tm expDate;
+	int ret;
+
+	if (ucl_object_type(obj) != UCL_OBJECT)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Batch package entries must be objects.");
+
+	pack = mport_pkgmeta_new();
+	extra = mport_createextras_new();
+	if (pack == NULL || extra == NULL) {
+		mport_pkgmeta_free(pack);
+		mport_createextras_free(extra);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+
+	batch_string(obj, "name", &pack->name);
+	batch_string(obj, "version", &pack->version);
+	batch_string(obj, "origin", &pack->origin);
+	batch_string(obj, "prefix", &pack->prefix);
+	batch_string(obj, "comment", &pack->comment);
+	batch_string(obj, "desc", &pack->desc);
+	batch_string(obj, "lang", &pack->lang);
+	batch_string(obj, "cpe", &pack->cpe);
+	batch_string(obj, "flavor", &pack->flavor);
+	batch_string(obj, "deprecated", &pack->deprecated);
+	batch_list(obj, "categories", &pack->categories, &pack->categories_count);
+
+	batch_string(obj, "mtree", &extra->mtree);
+	batch_string(obj, "pkginstall", &extra->pkginstall);
+	batch_string(obj, "pkgdeinstall", &extra->pkgdeinstall);
+	batch_string(obj, "pkgmessage", &extra->pkgmessage);
+	batch_string(obj, "dictionary", &extra->dictionary);
+	batch_list(obj, "depends", &extra->depends, &extra->depends_count);
+	batch_list(obj, "conflicts", &extra->conflicts, &extra->conflicts_count);
+
+	batch_string(obj, "output", &value);
+	if (value != NULL)
+		strlcpy(extra->pkg_filename, value, sizeof(extra->pkg_filename));
+	free(value);
+	value = NULL;
+
+	batch_string(obj, "sourcedir", &value);
+	if (value != NULL)
+		strlcpy(extra->sourcedir, value, sizeof(extra->sourcedir));
+	free(value);
+	value = NULL;
+
+	batch_string(obj, "expiration_date", &value);
+	if (value != NULL) {
+		memset(&expDate, 0, sizeof(expDate));
+		if (strptime(value, "%Y-%m-%d", &expDate) != NULL)
+			pack->expiration_date = mktime(&expDate);
+	}
+	free(value);
+	value = NULL;
+
+	val = ucl_object_find_key(obj, "no_provide_shlib");
+	if (val != NULL)
+		pack->no_provide_shlib = ucl_object_toboolean(val) ? 1 : 0;
+
+	val = ucl_object_find_key(obj, "dedup");
+	if (val != NULL)
+		extra->dedup = ucl_object_toboolean(val);
+
+	batch_string(obj, "plist", &plist);
+
+	if (pack->name == NULL || pack->version == NULL || pack->origin == NULL || pack->prefix == NULL ||
+	    pack->categories == NULL || plist == NULL || extra->pkg_filename[0] == '\0' ||
+	    extra->sourcedir[0] == '\0') {
+		SET_ERRORX(MPORT_ERR_FATAL,
+		    "Batch package %s is missing one of name, version, origin, prefix, categories, plist, output or sourcedir",
+		    pack->name == NULL ? "(unnamed)" : pack->name);
+		mport_pkgmeta_free(pack);
+		mport_createextras_free(extra);
+		free(plist);
+		RETURN_CURRENT_ERROR;
+	}
+
+	pack->type = MPORT_TYPE_APP;
+
+	ret = mport_createbatch_add(batch, pack, extra, plist);
+	if (ret != MPORT_OK) {
+		mport_pkgmeta_free(pack);
+		mport_createextras_free(extra);
+	}
+	free(plist);
+
+	return (ret);
+}
+
+/* copy the string value of key into *dest, replacing what was there */
+static void
+batch_string(const ucl_object_t *obj, const char *key, char **dest)
+{
+	const ucl_object_t *val = ucl_object_find_key(obj, key);
+
+	if (val == NULL || ucl_object_type(val) != UCL_STRING)
+		return;
+
+	free(*dest);
+	*dest = strdup(ucl_object_tostring(val));
+}
+
+/* lists may be given as a whitespace separated string or as an array of strings */
+static void
+batch_list(const ucl_object_t *obj, const char *key, char ***list, size_t *list_size)
+{
+	const ucl_object_t *val = ucl_object_find_key(obj, key);
+	const ucl_object_t *cur;
+	ucl_object_iter_t it = NULL;
+	char *copy;
+	size_t i = 0;
+
+	if (val == NULL)
+		return;
+
+	if (ucl_object_type(val) == UCL_STRING) {
+		if ((copy = strdup(ucl_object_tostring(val))) == NULL)
+			return;
+		mport_parselist(copy, list, list_size);
+		free(copy);
+		return;
+	}
+
+	if (ucl_object_type(val) != UCL_ARRAY)
+		return;
+
+	while (ucl_object_iterate(val, &it, true) != NULL)
+		i++;
+
+	if (i == 0 || (*list = (char **)calloc(i + 1, sizeof(char *))) == NULL)
+		return;
+
+	*list_size = i;
+	i = 0;
+	it = NULL;
+	while ((cur = ucl_object_iterate(val, &it, true)) != NULL) {
+		if (ucl_object_type(cur) == UCL_STRING && i < *list_size)
+			(*list)[i++] = strdup(ucl_object_tostring(cur));
+	}
+	(*list)[i] = NULL;
+}
@@ -40,14 +40,15 @@
 #include <archive.h>
 #include <archive_entry.h>
 #include <assert.h>
+#include <search.h>
 #include "mport.h"
 #include "mport_private.h"
 
-static int create_stub_db(mportInstance *, sqlite3 **, const char *);
+static int create_stub_db(sqlite3 **, const char *, const char *);
 
 static int insert_assetlist(sqlite3 *, mportAssetList *, mportPackageMeta *, mportCreateExtras *);
 
-static int insert_meta(mportInstance *, sqlite3 *, mportPackageMeta *, mportCreateExtras *);
+static int insert_meta(sqlite3 *, mportPackageMeta *, mportCreateExtras *, const char *);
 
 static int insert_depends(sqlite3 *, mportPackageMeta *, mportCreateExtras *);
 
@@ -65,6 +66,29 @@ static int clean_up(const char *);
 
 MPORT_PUBLIC_API int
 mport_create_primative(mportInstance *mport, mportAssetList *assetlist, mportPackageMeta *pack, mportCreateExtras *extra)
+{
+	int error_code;
+	char *os_release = mport_get_osrelease(mport);
+
+	if (os_release == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "OS Release could not be determined");
+
+	error_code = mport_create_primative_release(assetlist, pack, extra, os_release);
+	free(os_release);
+
+	return error_code;
+}
+
+/*
+ * mport_create_primative_release(assetlist, pack, extra, os_release)
+ *
+ * Does the real work of mport_create_primative() with the os release already
+ * determined.  The master database is never used here, so batch creation can
+ * run this from several threads at once.
+ */
+int
+mport_create_primative_release(mportAssetList *assetlist, mportPackageMeta *pack, mportCreateExtras *extra,
+    const char *os_release)
 {
 	int error_code = MPORT_OK;
 
@@ -75,16 +99,16 @@ mport_create_primative(mportInstance *mport, mportAssetList *assetlist, mportPac
 
 	if (tmpdir == NULL) {
 		error_code = SET_ERROR(MPORT_ERR_FATAL, strerror(errno));
-		goto CLEANUP;
+		return error_code;
 	}
 
-	if ((error_code = create_stub_db(mport, &db, tmpdir)) != MPORT_OK)
+	if ((error_code = create_stub_db(&db, tmpdir, os_release)) != MPORT_OK)
 		goto CLEANUP;
 
 	if ((error_code = insert_assetlist(db, assetlist, pack, extra)) != MPORT_OK)
 		goto CLEANUP;
 
-	if ((error_code = insert_meta(mport, db, pack, extra)) != MPORT_OK)
+	if ((error_code = insert_meta(db, pack, extra, os_release)) != MPORT_OK)
 		goto CLEANUP;
 
 	if (sqlite3_close(db) != SQLITE_OK) {
@@ -102,7 +126,7 @@ mport_create_primative(mportInstance *mport, mportAssetList *assetlist, mportPac
 
 
 static int
-create_stub_db(mportInstance *mport, sqlite3 **db, const char *tmpdir)
+create_stub_db(sqlite3 **db, const char *tmpdir, const char *os_release)
 {
 	int error_code = MPORT_OK;
 
@@ -117,7 +141,7 @@ create_stub_db(mportInstance *mport, sqlite3 **db, const char *tmpdir)
 		return error_code;
 
 	/* create tables */
-	return mport_generate_stub_schema(mport, *db);
+	return mport_generate_stub_schema_release(*db, os_release);
 }
 
 static int
@@ -203,12 +227,16 @@ insert_assetlist(sqlite3 *db, mportAssetList *assetlist, mportPackageMeta *pack,
 			if (S_ISREG(st.st_mode)) {
 				if (SHA256_File(file, hash) == NULL)
 					RETURN_ERRORX(MPORT_ERR_FATAL, "File not found: %s", file);
+				/* kept for archive_assetlistfiles() to find duplicates with */
+				if (mport_asset_set_checksum(e, hash) != MPORT_OK)
+					RETURN_CURRENT_ERROR;
 
 				if (sqlite3_bind_text(stmnt, 4, hash, -1, SQLITE_STATIC) != SQLITE_OK)
 					RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
 				pack->flatsize += st.st_size;
 			} else {
+				(void) mport_asset_set_checksum(e, NULL);
 				sqlite3_bind_null(stmnt, 4);
 			}
 		} else {
@@ -232,7 +260,7 @@ insert_assetlist(sqlite3 *db, mportAssetList *assetlist, mportPackageMeta *pack,
 }
 
 static int
-insert_meta(mportInstance *mport, sqlite3 *db, mportPackageMeta *pack, mportCreateExtras *extra)
+insert_meta(sqlite3 *db, mportPackageMeta *pack, mportCreateExtras *extra, const char *os_release)
 {
 	int error_code = MPORT_OK;
 
@@ -240,7 +268,6 @@ insert_meta(mportInstance *mport, sqlite3 *db, mportPackageMeta *pack, mportCrea
 	const char *rest = 0;
 	char sql[] = "INSERT INTO packages (pkg, version, origin, lang, prefix, comment, os_release, cpe, deprecated, expiration_date, no_provide_shlib, flavor, type, flatsize) VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?)";
 
-	char *os_release = mport_get_osrelease(mport);
 	if (pack->cpe == NULL) {
 		pack->cpe = malloc(1 * sizeof(char));
 		pack->cpe[0] = '\0';
@@ -283,7 +310,6 @@ insert_meta(mportInstance *mport, sqlite3 *db, mportPackageMeta *pack, mportCrea
 		return error_code;
 	}
 	if (sqlite3_bind_text(stmnt, 7, os_release, -1, SQLITE_STATIC) != SQLITE_OK) {
-		free(os_release);
 		error_code = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 		return error_code;
 	}
@@ -321,7 +347,6 @@ insert_meta(mportInstance *mport, sqlite3 *db, mportPackageMeta *pack, mportCrea
 	}
 
 	sqlite3_finalize(stmnt);
-	free(os_release);
 
 	if (error_code != MPORT_OK)
 		return error_code;
@@ -521,7 +546,10 @@ archive_files(mportAssetList *assetlist, mportPackageMeta *pack, mportCreateExtr
 
 	bundle = mport_bundle_write_new();
 
-	if (mport_bundle_write_init(bundle, extra->pkg_filename) != MPORT_OK)
+	if (extra->dictionary != NULL) {
+		if (mport_bundle_write_init_zdict(bundle, extra->pkg_filename, extra->dictionary) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	} else if (mport_bundle_write_init(bundle, extra->pkg_filename) != MPORT_OK)
 		RETURN_CURRENT_ERROR;
 
 	/* First step - +CONTENTS.db ALWAYS GOES FIRST!!! */
@@ -578,18 +606,59 @@ archive_metafiles(mportBundleWrite *bundle, mportPackageMeta *pack, mportCreateE
 	return MPORT_OK;
 }
 
+/*
+ * With extra->dedup, a plain file whose content matches an earlier one is
+ * stored as a hardlink to it.  Linked files share their owner and mode, and
+ * the link is resolved relative to the @cwd, so only files with the same
+ * @cwd, @mode, @owner and @group are candidates.  Files without those
+ * keywords install with their staged mode and ownership, so those have to
+ * match as well.
+ */
+struct dedup_node {
+	char *key;
+	const char *path;
+};
+
+static int
+dedup_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct dedup_node *)a)->key, ((const struct dedup_node *)b)->key);
+}
+
 static int
 archive_assetlistfiles(mportBundleWrite *bundle, mportPackageMeta *pack, mportCreateExtras *extra,
                        mportAssetList *assetlist)
 {
 	mportAssetListEntry *e = NULL;
 	char filename[FILENAME_MAX];
+	char checksum[MPORT_ASSET_CHECKSUM_HEXLEN];
 	char *cwd = pack->prefix;
+	const char *mode = "", *owner = "", *group = "";
+	struct dedup_node *nodes = NULL, *node, **found;
+	void *tree = NULL;
+	struct stat st;
+	size_t nnodes = 0, i;
+	int ret = MPORT_OK;
+
+	if (extra->dedup) {
+		STAILQ_FOREACH(e, assetlist, next)
+			if (e->type == ASSET_FILE)
+				nnodes++;
+		if (nnodes > 0 && (nodes = calloc(nnodes, sizeof(struct dedup_node))) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		nnodes = 0;
+	}
 
 	STAILQ_FOREACH(e, assetlist, next)
 	{
 		if (e->type == ASSET_CWD)
 			cwd = e->data == NULL ? pack->prefix : e->data;
+		else if (e->type == ASSET_CHMOD)
+			mode = e->data == NULL ? "" : e->data;
+		else if (e->type == ASSET_CHOWN)
+			owner = e->data == NULL ? "" : e->data;
+		else if (e->type == ASSET_CHGRP)
+			group = e->data == NULL ? "" : e->data;
 
 		if (e->type != ASSET_FILE && e->type != ASSET_SAMPLE && e->type != ASSET_SAMPLE_OWNER_MODE &&
 		    e->type != ASSET_SHELL && e->type != ASSET_FILE_OWNER_MODE) {
@@ -615,11 +684,48 @@ archive_assetlistfiles(mportBundleWrite *bundle, mportPackageMeta *pack, mportCr
 			}
 		}
 
-		if (mport_bundle_write_add_file(bundle, filename, e->data) != MPORT_OK)
-			RETURN_CURRENT_ERROR;
+		if (nodes != NULL && e->type == ASSET_FILE && e->checksum_len != 0 && *(e->data) != '/') {
+			node = &nodes[nnodes];
+			if (lstat(filename, &st) != 0) {
+				ret = SET_ERRORX(MPORT_ERR_FATAL, "Could not stat %s: %s", filename, strerror(errno));
+				break;
+			}
+			if (asprintf(&node->key, "%s:%s:%s:%s:%s:%o:%u:%u", mport_asset_checksum(e, checksum), cwd, mode,
+			    owner, group, (unsigned int)st.st_mode, (unsigned int)st.st_uid,
+			    (unsigned int)st.st_gid) == -1) {
+				ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+				break;
+			}
+
+			if ((found = tsearch(node, &tree, dedup_cmp)) == NULL) {
+				free(node->key);
+				ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+				break;
+			}
+
+			if (*found != node) {
+				free(node->key);
+				node->key = NULL;
+				if ((ret = mport_bundle_write_add_hardlink(bundle, filename, e->data, (*found)->path)) != MPORT_OK)
+					break;
+				continue;
+			}
+
+			node->path = e->data;
+			nnodes++;
+		}
+
+		if ((ret = mport_bundle_write_add_file(bundle, filename, e->data)) != MPORT_OK)
+			break;
 	}
 
-	return MPORT_OK;
+	for (i = 0; i < nnodes; i++) {
+		(void)tdelete(&nodes[i], &tree, dedup_cmp);
+		free(nodes[i].key);
+	}
+	free(nodes);
+
+	return ret;
 }
 
 
@@ -0,0 +1,630 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A streaming reader for the security site's CVE lists.
+ *
+ * The response is a JSON array of CVE objects and may run to megabytes for
+ * a product with a long history, so rather than building a tree of it this
+ * pulls the few fields we use out of the stream as it goes by.  Memory use is
+ * bounded by the largest CVE, and each string is capped besides.
+ */
+
+#include "mport.h"
+#include "mport_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CVE_STRING_MAX		(64 * 1024)
+#define CVE_KEY_MAX		32
+#define CVE_RANGES_MAX		1024
+/* the strings of all of a CVE's ranges together */
+#define CVE_RANGE_STRINGS_MAX	(256 * 1024)
+#define CVE_DEPTH_MAX		64
+#define CVE_NONE		((size_t)-1)
+
+struct cve_buf {
+	char *s;
+	size_t len;
+	size_t size;
+	size_t max;		/* longest string kept */
+	bool fixed;
+	bool truncated;		/* a byte was dropped for want of room */
+};
+
+/* a range as read, with its strings as offsets into the reader's buffer */
+struct cve_range_at {
+	size_t min;
+	size_t max;
+	size_t purl;
+	bool min_excluded;
+	bool max_excluded;
+};
+
+struct cve_reader {
+	FILE *fp;
+	struct cve_buf id;
+	struct cve_buf description;
+	struct cve_buf severity;
+	struct cve_buf strings;		/* NUL separated */
+	struct cve_range_at at[CVE_RANGES_MAX];
+	struct mport_cve_range ranges[CVE_RANGES_MAX];
+	size_t nranges;
+	double score;
+	bool nomem;
+};
+
+static const char *score_keys[] = { "score", "baseScore", "cvssScore", NULL };
+
+static int cve_getc(struct cve_reader *);
+static int cve_peek(struct cve_reader *);
+static bool cve_expect(struct cve_reader *, int);
+static bool cve_putc(struct cve_reader *, struct cve_buf *, int);
+static bool cve_string(struct cve_reader *, struct cve_buf *);
+static bool cve_key(struct cve_reader *, char *, size_t);
+static bool cve_number(struct cve_reader *, double *);
+static bool cve_skip(struct cve_reader *, int);
+static bool cve_products(struct cve_reader *);
+static bool cve_object(struct cve_reader *);
+static bool cve_is_score(const char *);
+static size_t *cve_range_field(struct cve_range_at *, const char *);
+static const char *cve_bound(struct cve_reader *, size_t);
+
+/* mport_cve_parse(fp, cb, arg)
+ *
+ * Parse a CVE list from the security site as it is read from fp, calling cb
+ * for each CVE in it.  The strings handed to cb are only good until it returns.
+ */
+int
+mport_cve_parse(FILE *fp, mport_cve_cb cb, void *arg)
+{
+	struct cve_reader *r;
+	struct mport_cve cve;
+	size_t i;
+	int c, ret = MPORT_OK;
+
+	if ((r = calloc(1, sizeof(struct cve_reader))) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	r->fp = fp;
+	r->id.max = r->description.max = r->severity.max = CVE_STRING_MAX;
+	r->strings.max = CVE_RANGE_STRINGS_MAX;
+
+	if (!cve_expect(r, '['))
+		goto BAD;
+
+	if (cve_peek(r) == ']') {
+		(void)cve_getc(r);
+		goto DONE;
+	}
+
+	while (ret == MPORT_OK) {
+		r->id.len = r->description.len = r->severity.len = r->strings.len = 0;
+		r->nranges = 0;
+		r->score = -1;
+
+		if (cve_peek(r) != '{') {
+			if (!cve_skip(r, 0))
+				goto BAD;
+		} else {
+			if (!cve_object(r))
+				goto BAD;
+
+			if (r->id.len > 0) {
+				memset(&cve, 0, sizeof(cve));
+				cve.id = r->id.s;
+				cve.description = r->description.len > 0 ? r->description.s : NULL;
+				cve.severity = r->severity.len > 0 ? r->severity.s : NULL;
+				cve.score = r->score;
+				for (i = 0; i < r->nranges; i++) {
+					r->ranges[i].min = cve_bound(r, r->at[i].min);
+					r->ranges[i].max = cve_bound(r, r->at[i].max);
+					r->ranges[i].min_excluded = r->at[i].min_excluded;
+					r->ranges[i].max_excluded = r->at[i].max_excluded;
+					r->ranges[i].purl = r->at[i].purl == CVE_NONE ? NULL :
+					    r->strings.s + r->at[i].purl;
+				}
+				cve.ranges = r->ranges;
+				cve.nranges = r->nranges;
+
+				ret = cb(&cve, arg);
+			}
+		}
+
+		if ((c = cve_getc(r)) == ']')
+			break;
+		if (c != ',')
+			goto BAD;
+	}
+
+	goto DONE;
+
+BAD:
+	if (r->nomem)
+		ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	else if (ferror(fp))
+		ret = SET_ERROR(MPORT_ERR_FATAL, "Error reading CVE list");
+	else
+		ret = SET_ERROR(MPORT_ERR_FATAL, "Malformed CVE list");
+
+DONE:
+	free(r->id.s);
+	free(r->description.s);
+	free(r->severity.s);
+	free(r->strings.s);
+	free(r);
+
+	return (ret);
+}
+
+/* read one CVE; fields we don't use are skipped without being stored */
+static bool
+cve_object(struct cve_reader *r)
+{
+	char key[CVE_KEY_MAX];
+	int c;
+
+	if (!cve_expect(r, '{'))
+		return (false);
+
+	if (cve_peek(r) == '}')
+		return (cve_getc(r) == '}');
+
+	do {
+		if (!cve_key(r, key, sizeof(key)))
+			return (false);
+
+		c = cve_peek(r);
+		if (c == '"' && strcmp(key, "cveId") == 0) {
+			r->id.len = 0;
+			if (!cve_string(r, &r->id))
+				return (false);
+		} else if (c == '"' && strcmp(key, "description") == 0) {
+			r->description.len = 0;
+			if (!cve_string(r, &r->description))
+				return (false);
+		} else if (c == '"' && strcmp(key, "severity") == 0) {
+			r->severity.len = 0;
+			if (!cve_string(r, &r->severity))
+				return (false);
+		} else if (c == '[' && strcmp(key, "products") == 0) {
+			if (!cve_products(r))
+				return (false);
+		} else if ((c == '-' || (c >= '0' && c <= '9')) && cve_is_score(key)) {
+			if (!cve_number(r, &r->score))
+				return (false);
+		} else if (!cve_skip(r, 1)) {
+			return (false);
+		}
+	} while ((c = cve_getc(r)) == ',');
+
+	return (c == '}');
+}
+
+/*
+ * Collect the affected range of each product entry: "version" is the highest
+ * affected version ("*" for all), or the range is given by the
+ * versionStart/versionEnd Including/Excluding bounds.  Entries without any
+ * of these are ignored.  So is an entry whose strings don't all fit in what
+ * is left of the range strings buffer: a cut short bound would read as
+ * missing, turning the range into an open one that every version falls in.
+ */
+static bool
+cve_products(struct cve_reader *r)
+{
+	char key[CVE_KEY_MAX];
+	struct cve_range_at *at, scratch;
+	size_t *field, start;
+	int c;
+
+	if (!cve_expect(r, '['))
+		return (false);
+
+	if (cve_peek(r) == ']')
+		return (cve_getc(r) == ']');
+
+	do {
+		if (cve_peek(r) != '{') {
+			if (!cve_skip(r, 2))
+				return (false);
+			continue;
+		}
+		(void)cve_getc(r);
+
+		if (cve_peek(r) == '}') {
+			(void)cve_getc(r);
+			continue;
+		}
+
+		/* past the limit, the rest are skipped over */
+		at = r->nranges < CVE_RANGES_MAX ? &r->at[r->nranges] : &scratch;
+		*at = (struct cve_range_at){ .min = CVE_NONE, .max = CVE_NONE, .purl = CVE_NONE };
+		start = r->strings.len;
+		r->strings.truncated = false;
+
+		do {
+			if (!cve_key(r, key, sizeof(key)))
+				return (false);
+
+			if (at != &scratch && cve_peek(r) == '"' && (field = cve_range_field(at, key)) != NULL) {
+				*field = r->strings.len;
+				if (!cve_string(r, &r->strings) || !cve_putc(r, &r->strings, '\0'))
+					return (false);
+			} else if (!cve_skip(r, 3)) {
+				return (false);
+			}
+		} while ((c = cve_getc(r)) == ',');
+
+		if (c != '}')
+			return (false);
+
+		if (r->strings.truncated) {
+			r->strings.len = start;
+			continue;
+		}
+
+		if ((at->min != CVE_NONE || at->max != CVE_NONE) && at != &scratch)
+			r->nranges++;
+	} while ((c = cve_getc(r)) == ',');
+
+	return (c == ']');
+}
+
+/* where the value of a product entry's key goes, or NULL if it isn't kept */
+static size_t *
+cve_range_field(struct cve_range_at *at, const char *key)
+{
+
+	if (strcmp(key, "version") == 0 || strcmp(key, "versionEndIncluding") == 0) {
+		at->max_excluded = false;
+		return (&at->max);
+	}
+	if (strcmp(key, "versionEndExcluding") == 0) {
+		at->max_excluded = true;
+		return (&at->max);
+	}
+	if (strcmp(key, "versionStartIncluding") == 0) {
+		at->min_excluded = false;
+		return (&at->min);
+	}
+	if (strcmp(key, "versionStartExcluding") == 0) {
+		at->min_excluded = true;
+		return (&at->min);
+	}
+	if (strcmp(key, "purl") == 0)
+		return (&at->purl);
+
+	return (NULL);
+}
+
+/* a range bound, or NULL if it is missing, empty or "*" */
+static const char *
+cve_bound(struct cve_reader *r, size_t offset)
+{
+	const char *s;
+
+	if (offset == CVE_NONE)
+		return (NULL);
+
+	s = r->strings.s + offset;
+
+	return (s[0] == '\0' || s[0] == '*' ? NULL : s);
+}
+
+/* mport_cve_range_match(range, version)
+ *
+ * True if version falls within the affected range.
+ */
+bool
+mport_cve_range_match(const struct mport_cve_range *range, const char *version)
+{
+	int cmp;
+
+	if (range->min != NULL) {
+		cmp = mport_version_cmp(version, range->min);
+		if (cmp < 0 || (cmp == 0 && range->min_excluded))
+			return (false);
+	}
+
+	if (range->max != NULL) {
+		cmp = mport_version_cmp(version, range->max);
+		if (cmp > 0 || (cmp == 0 && range->max_excluded))
+			return (false);
+	}
+
+	return (true);
+}
+
+static bool
+cve_is_score(const char *key)
+{
+	const char **k;
+
+	for (k = score_keys; *k != NULL; k++)
+		if (strcasecmp(key, *k) == 0)
+			return (true);
+
+	return (false);
+}
+
+/* read an object key and the colon after it, truncating long keys */
+static bool
+cve_key(struct cve_reader *r, char *key, size_t size)
+{
+	struct cve_buf b = { .s = key, .size = size, .fixed = true };
+
+	key[0] = '\0';
+	if (cve_peek(r) != '"' || !cve_string(r, &b))
+		return (false);
+
+	return (cve_expect(r, ':'));
+}
+
+/*
+ * Read a string into b, or past it if b is NULL.  Anything past b->max is
+ * dropped and b->truncated set.  The result is NUL terminated but the
+ * terminator isn't counted in b->len.
+ */
+static bool
+cve_string(struct cve_reader *r, struct cve_buf *b)
+{
+	unsigned int cp, lo;
+	int c, i, d;
+
+	if (!cve_expect(r, '"'))
+		return (false);
+
+	while ((c = getc_unlocked(r->fp)) != '"') {
+		if (c == EOF || (c >= 0 && c < 0x20))
+			return (false);
+
+		if (c != '\\') {
+			if (b != NULL && !cve_putc(r, b, c))
+				return (false);
+			continue;
+		}
+
+		switch (c = getc_unlocked(r->fp)) {
+		case '"':
+		case '\\':
+		case '/':
+			break;
+		case 'b':
+			c = '\b';
+			break;
+		case 'f':
+			c = '\f';
+			break;
+		case 'n':
+			c = '\n';
+			break;
+		case 'r':
+			c = '\r';
+			break;
+		case 't':
+			c = '\t';
+			break;
+		case 'u':
+			for (cp = 0, i = 0; i < 4; i++) {
+				if ((d = getc_unlocked(r->fp)) == EOF)
+					return (false);
+				if (d >= '0' && d <= '9')
+					cp = cp << 4 | (d - '0');
+				else if (d >= 'a' && d <= 'f')
+					cp = cp << 4 | (d - 'a' + 10);
+				else if (d >= 'A' && d <= 'F')
+					cp = cp << 4 | (d - 'A' + 10);
+				else
+					return (false);
+			}
+
+			/* a surrogate pair is two escapes */
+			if (cp >= 0xd800 && cp <= 0xdbff) {
+				if (getc_unlocked(r->fp) != '\\' || getc_unlocked(r->fp) != 'u')
+					return (false);
+				for (lo = 0, i = 0; i < 4; i++) {
+					if ((d = getc_unlocked(r->fp)) == EOF)
+						return (false);
+					if (d >= '0' && d <= '9')
+						lo = lo << 4 | (d - '0');
+					else if (d >= 'a' && d <= 'f')
+						lo = lo << 4 | (d - 'a' + 10);
+					else if (d >= 'A' && d <= 'F')
+						lo = lo << 4 | (d - 'A' + 10);
+					else
+						return (false);
+				}
+				if (lo < 0xdc00 || lo > 0xdfff)
+					return (false);
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			}
+
+			if (b == NULL)
+				continue;
+
+			if (cp < 0x80) {
+				if (!cve_putc(r, b, cp))
+					return (false);
+			} else if (cp < 0x800) {
+				if (!cve_putc(r, b, 0xc0 | cp >> 6) ||
+				    !cve_putc(r, b, 0x80 | (cp & 0x3f)))
+					return (false);
+			} else if (cp < 0x10000) {
+				if (!cve_putc(r, b, 0xe0 | cp >> 12) ||
+				    !cve_putc(r, b, 0x80 | (cp >> 6 & 0x3f)) ||
+				    !cve_putc(r, b, 0x80 | (cp & 0x3f)))
+					return (false);
+			} else {
+				if (!cve_putc(r, b, 0xf0 | cp >> 18) ||
+				    !cve_putc(r, b, 0x80 | (cp >> 12 & 0x3f)) ||
+				    !cve_putc(r, b, 0x80 | (cp >> 6 & 0x3f)) ||
+				    !cve_putc(r, b, 0x80 | (cp & 0x3f)))
+					return (false);
+			}
+			continue;
+		default:
+			return (false);
+		}
+
+		if (b != NULL && !cve_putc(r, b, c))
+			return (false);
+	}
+
+	if (b != NULL && b->s != NULL)
+		b->s[b->len] = '\0';
+
+	return (true);
+}
+
+/*
+ * Append a byte, leaving room for a terminator.  A buffer that's full
+ * drops it and is marked truncated; only running out of memory is an error.
+ */
+static bool
+cve_putc(struct cve_reader *r, struct cve_buf *b, int c)
+{
+	size_t size;
+	char *s;
+
+	if (b->len + 1 >= b->size) {
+		if (b->fixed || b->size > b->max) {
+			b->truncated = true;
+			return (true);
+		}
+		size = b->size == 0 ? 64 : b->size * 2;
+		if (size > b->max + 1)
+			size = b->max + 1;
+		if ((s = realloc(b->s, size)) == NULL) {
+			r->nomem = true;
+			return (false);
+		}
+		b->s = s;
+		b->size = size;
+	}
+
+	b->s[b->len++] = (char)c;
+	b->s[b->len] = '\0';
+
+	return (true);
+}
+
+static bool
+cve_number(struct cve_reader *r, double *value)
+{
+	char num[64], *end;
+	size_t len = 0;
+	int c;
+
+	(void)cve_peek(r);
+	while ((c = getc_unlocked(r->fp)) != EOF) {
+		if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+			ungetc(c, r->fp);
+			break;
+		}
+		if (len == sizeof(num) - 1)
+			return (false);
+		num[len++] = (char)c;
+	}
+	num[len] = '\0';
+
+	*value = strtod(num, &end);
+
+	return (len > 0 && *end == '\0');
+}
+
+/* step over a value of any type */
+static bool
+cve_skip(struct cve_reader *r, int depth)
+{
+	double d;
+	int c, close;
+
+	if (depth > CVE_DEPTH_MAX)
+		return (false);
+
+	switch (c = cve_peek(r)) {
+	case '"':
+		return (cve_string(r, NULL));
+	case '{':
+	case '[':
+		(void)cve_getc(r);
+		close = c == '{' ? '}' : ']';
+		if (cve_peek(r) == close)
+			return (cve_getc(r) == close);
+		do {
+			if (close == '}') {
+				if (cve_peek(r) != '"' || !cve_string(r, NULL) || !cve_expect(r, ':'))
+					return (false);
+			}
+			if (!cve_skip(r, depth + 1))
+				return (false);
+		} while ((c = cve_getc(r)) == ',');
+		return (c == close);
+	case 't':
+	case 'f':
+	case 'n':
+		while ((c = getc_unlocked(r->fp)) >= 'a' && c <= 'z')
+			;
+		if (c != EOF)
+			ungetc(c, r->fp);
+		return (true);
+	default:
+		return (cve_number(r, &d));
+	}
+}
+
+/* the next character that isn't white space */
+static int
+cve_getc(struct cve_reader *r)
+{
+	int c;
+
+	while ((c = getc_unlocked(r->fp)) == ' ' || c == '\t' || c == '\n' || c == '\r')
+		;
+
+	return (c);
+}
+
+static int
+cve_peek(struct cve_reader *r)
+{
+	int c;
+
+	if ((c = cve_getc(r)) != EOF)
+		ungetc(c, r->fp);
+
+	return (c);
+}
+
+static bool
+cve_expect(struct cve_reader *r, int c)
+{
+
+	return (cve_getc(r) == c);
+}
@@ -43,6 +43,7 @@ static int mport_upgrade_master_schema_8to9(sqlite3 *);
 static int mport_upgrade_master_schema_9to10(sqlite3 *);
 static int mport_upgrade_master_schema_10to11(sqlite3 *);
 static int mport_upgrade_master_schema_11to12(sqlite3 *);
+static int mport_upgrade_master_schema_12to13(sqlite3 *);
 
 /* mport_db_do(sqlite3 *db, const char *sql, ...)
  * 
@@ -250,16 +251,34 @@ int
 mport_generate_stub_schema(mportInstance *mport, sqlite3 *db)
 {
 	char *ptr = NULL;
-	char *sql = NULL;
+	int ret;
 
 	ptr = mport_get_osrelease(mport);
 	if (ptr == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "OS Release could not be determined");
-	asprintf(&sql, "INSERT INTO meta VALUES (\"os_release\", \"%s\")", ptr);
+
+	ret = mport_generate_stub_schema_release(db, ptr);
+	free(ptr);
+
+	return (ret);
+}
+
+/* mport_generate_stub_schema_release(sqlite3 *db, const char *os_release)
+ *
+ * Like mport_generate_stub_schema(), but takes the os release instead of looking
+ * it up through the instance.  This never touches the master database, so it is
+ * safe to call from the batch create workers.
+ */
+int
+mport_generate_stub_schema_release(sqlite3 *db, const char *os_release)
+{
+	if (os_release == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "OS Release could not be determined");
 
 	RUN_SQL(db, "CREATE TABLE meta (field text NOT NULL, value text NOT NULL)");
-	RUN_SQL(db, "INSERT INTO meta VALUES (\"bundle_format_version\", " MPORT_BUNDLE_VERSION_STR ")");
-	RUN_SQL(db, sql);
+	RUN_SQL(db, "INSERT INTO meta VALUES (\"bundle_format_version\", " MPORT_BUNDLE_VERSION_PLAIN_STR ")");
+	if (mport_db_do(db, "INSERT INTO meta VALUES (\"os_release\", %Q)", os_release) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
 	RUN_SQL(db,
 	        "CREATE TABLE assets (pkg text not NULL, type int NOT NULL, data text, checksum text, owner text, grp text, mode text)");
 	RUN_SQL(db,
@@ -291,6 +310,7 @@ mport_upgrade_master_schema(sqlite3 *db, int databaseVersion)
 			mport_upgrade_master_schema_9to10(db);
 			mport_upgrade_master_schema_10to11(db);
 			mport_upgrade_master_schema_11to12(db);
+			mport_upgrade_master_schema_12to13(db);
 			mport_set_database_version(db);
 			break;
 		case 2:
@@ -322,8 +342,11 @@ mport_upgrade_master_schema(sqlite3 *db, int databaseVersion)
 		case 11:
 			/* falls through */
             mport_upgrade_master_schema_11to12(db);
-            mport_set_database_version(db);
 		case 12:
+			/* falls through */
+			mport_upgrade_master_schema_12to13(db);
+			mport_set_database_version(db);
+		case 13:
 		    break;
 		default:
 			RETURN_ERROR(MPORT_ERR_FATAL, "Invalid master database version");
@@ -436,13 +459,25 @@ mport_upgrade_master_schema_11to12(sqlite3 *db)
 	return (MPORT_OK);
 }
 
+static int
+mport_upgrade_master_schema_12to13(sqlite3 *db)
+{
+	RUN_SQL(db, "ALTER TABLE packages ADD COLUMN version_key text");
+
+	RUN_SQL(db, "update packages set version_key = mport_version_key(version)");
+	RUN_SQL(db, "CREATE INDEX IF NOT EXISTS packages_version_key ON packages (pkg, version_key)");
+
+	return (MPORT_OK);
+}
+
 int
 mport_generate_master_schema(sqlite3 *db)
 {
 
 	RUN_SQL(db,
-	        "CREATE TABLE IF NOT EXISTS packages (pkg text NOT NULL, version text NOT NULL, origin text NOT NULL, prefix text NOT NULL, lang text, options text, status text default 'dirty', comment text, os_release text NOT NULL default '1.0', cpe text, locked int NOT NULL default '0', deprecated text default '', expiration_date int64 NOT NULL default '0', no_provide_shlib int default '0', flavor text default '', automatic int default '0', install_date int64 NOT NULL default '0', type int NOT NULL default '0', flatsize int64 NOT NULL default '0')");
+	        "CREATE TABLE IF NOT EXISTS packages (pkg text NOT NULL, version text NOT NULL, origin text NOT NULL, prefix text NOT NULL, lang text, options text, status text default 'dirty', comment text, os_release text NOT NULL default '1.0', cpe text, locked int NOT NULL default '0', deprecated text default '', expiration_date int64 NOT NULL default '0', no_provide_shlib int default '0', flavor text default '', automatic int default '0', install_date int64 NOT NULL default '0', type int NOT NULL default '0', flatsize int64 NOT NULL default '0', version_key text)");
 	RUN_SQL(db, "CREATE UNIQUE INDEX IF NOT EXISTS packages_pkg ON packages (pkg)");
+	RUN_SQL(db, "CREATE INDEX IF NOT EXISTS packages_version_key ON packages (pkg, version_key)");
 	RUN_SQL(db, "CREATE INDEX IF NOT EXISTS packages_origin ON packages (origin)");
 
 	RUN_SQL(db,
@@ -28,10 +28,13 @@
 
 #include <sys/cdefs.h>
 
+#include <signal.h>
 #include <stdio.h>
 #include <termios.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include "mport.h"
 #include "mport_private.h"
@@ -106,38 +109,110 @@ void mport_default_progress_init_cb(const char *title)
 #define UP   ESC "[A"
 #define DEL  ESC "[2K"
 
-void mport_default_progress_step_cb(int current, int total, const char *msg)
+/* redraw the bar at most this often, besides the first and last step */
+#define PROGRESS_INTERVAL_NS  (100 * 1000 * 1000)
+#define PROGRESS_BAR_MAX      512
+
+/*
+ * The progress callback runs for every file extracted and every chunk
+ * fetched, so what the terminal can do is worked out once, and again only
+ * when it is resized, and the bar is redrawn, or a line printed when stdout
+ * is not a terminal, at most ten times a second.
+ */
+static struct {
+  bool probed;
+  bool tty;
+  bool color;
+  int width;
+  int last_percent;
+  struct timespec last;
+  char bar[PROGRESS_BAR_MAX];
+} progress;
+
+static volatile sig_atomic_t progress_resized;
+
+static void
+progress_winch(int sig)
+{
+  progress_resized = 1;
+}
+
+static void
+progress_probe(void)
 {
   struct termios term;
   struct winsize win;
+  struct sigaction sa, old;
+  const char *termenv = getenv("TERM");
+
+  if (!progress.probed) {
+    progress.last_percent = -1;
+
+    /* leave a handler the application installed alone */
+    sa.sa_handler = progress_winch;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+      (void)sigaction(SIGWINCH, &sa, NULL);
+  }
+
+  progress.probed = true;
+  progress_resized = 0;
+
+  progress.tty = isatty(fileno(stdout)) && termenv != NULL && tcgetattr(STDIN_FILENO, &term) == 0 &&
+      ioctl(STDIN_FILENO, TIOCGWINSZ, &win) == 0 && getenv("MAGUS") == NULL;
+  if (!progress.tty)
+    return;
+
+  progress.color = strncmp(termenv, "xterm", 5) == 0;
+  progress.width = win.ws_col;
+  if (progress.width >= PROGRESS_BAR_MAX)
+    progress.width = PROGRESS_BAR_MAX - 1;
+}
+
+void mport_default_progress_step_cb(int current, int total, const char *msg)
+{
+  struct timespec now;
   int width, bar_width, bar_on, bar_off;
   double percent;
-  char *bar = NULL;
+  char *bar = progress.bar;
 
   if (current > total)
     current = total;
 
-  if (!isatty(fileno(stdout)) || getenv("TERM") == NULL || (tcgetattr(STDIN_FILENO, &term) < 0) || (ioctl(STDIN_FILENO, TIOCGWINSZ, &win) < 0) || getenv("MAGUS") != NULL) {
+  if (!progress.probed || progress_resized)
+    progress_probe();
+
+  percent = total > 0 ? (double)current / (double)total : 1.0;
+
+  /*
+   * the first step of a run, the last, or a changed percentage no sooner than
+   * the interval; a log gets no more lines than a terminal gets redraws
+   */
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  if (current > 1 && current < total) {
+    if ((int)(percent * 100) == progress.last_percent)
+      return;
+    if ((now.tv_sec - progress.last.tv_sec) * 1000000000L + (now.tv_nsec - progress.last.tv_nsec) <
+        PROGRESS_INTERVAL_NS)
+      return;
+  }
+  progress.last = now;
+  progress.last_percent = (int)(percent * 100);
+
+  if (!progress.tty) {
     /* not a terminal or couldn't get terminal width*/
     (void)printf("%s\n", msg);
     return;
   }
 
-  width = win.ws_col;
+  width = progress.width;
   if (width > 10) {
     bar_width = width - 10;
   } else {
     bar_width = 10;
   }
 
-  if ((bar = (char *)calloc(width, sizeof(char))) == NULL) {
-    /* no memory, we're outa here */
-    (void)printf("%s\n", msg);
-    return;
-  }
-
-  percent = (double)current / (double)total;
-  
   bar_on = (int)(percent * (bar_width - 2));
   bar_off = bar_width - 2 - bar_on;
 
@@ -148,20 +223,17 @@ void mport_default_progress_step_cb(int current, int total, const char *msg)
   bar[2 + bar_on + bar_off] = 0;
   
   (void)printf(BACK DEL, width);
-//  (void)printf("%s\n", msg);
-  if( !strncmp( getenv("TERM"), "xterm", 5 ) && isatty(fileno(stdout)) ) {
+  if (progress.color) {
     (void)printf("%s%s %3i/100%%%s", KCYN, bar, (int)(percent * 100), KNRM);
   } else {
     (void)printf("%s %3i/100%%", bar, (int)(percent * 100));
   }
   (void)fflush(stdout);
-  
-  free(bar);
-  bar = NULL;
 }
 
 void mport_default_progress_free_cb(void) 
 {
+  progress.last_percent = -1;
   (void)printf("\n");
   (void)fflush(stdout);
 }
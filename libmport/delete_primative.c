@@ -483,7 +483,7 @@ run_special_unexec(mportInstance *mport, mportPackageMeta *pkg)
 		switch (type) {
 		case ASSET_GLIB_SCHEMAS:
 			if (mport_file_exists("/usr/local/bin/glib-compile-schemas") &&
-			    mport_xsystem(mport,
+			    mport_trigger(mport,
 				"/usr/local/bin/glib-compile-schemas %s/share/glib-2.0/schemas > /dev/null || true",
 				data == NULL ? pkg->prefix : data) != MPORT_OK) {
 				goto SPECIAL_ERROR;
@@ -491,7 +491,7 @@ run_special_unexec(mportInstance *mport, mportPackageMeta *pkg)
 			break;
 		case ASSET_INFO:
 			if (mport_file_exists("/usr/local/bin/indexinfo") &&
-			    mport_xsystem(mport, "/usr/local/bin/indexinfo %s",
+			    mport_trigger(mport, "/usr/local/bin/indexinfo %s",
 				data == NULL ? pkg->prefix : data) != MPORT_OK) {
 				goto SPECIAL_ERROR;
 			}
@@ -510,7 +510,7 @@ run_special_unexec(mportInstance *mport, mportPackageMeta *pkg)
 			break;
 		case ASSET_DESKTOP_FILE_UTILS:
 			if (mport_file_exists("/usr/local/bin/update-desktop-database") &&
-			    mport_xsystem(mport,
+			    mport_trigger(mport,
 				"/usr/local/bin/update-desktop-database -q > /dev/null || true") !=
 				MPORT_OK) {
 				goto SPECIAL_ERROR;
@@ -28,20 +28,42 @@
 
 #include "mport.h"
 #include "mport_private.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 
-static int mport_err;
-static char err_msg[256];
+/*
+ * Error state is kept per thread, so libmport may be used from several
+ * threads at once.  The current error is the head of a short chain: an error
+ * set with mport_wrap_errx() keeps the one it replaces as its cause.
+ */
+
+/* wrapping in a loop must not grow the chain without bound */
+#define ERR_CHAIN_MAX 16
+
+struct err_frame {
+	struct err_frame *cause;
+	char msg[];
+};
+
+static _Thread_local int mport_err;
+static _Thread_local struct err_frame *err_head;
+
+static pthread_key_t err_key;
+static pthread_once_t err_once = PTHREAD_ONCE_INIT;
 
 /* This goes with the error codes in mport.h */
 static char default_error_msg[] = "An error occurred.";
 
+static void err_key_init(void);
+static void err_chain_free(void *);
+static int err_vpush(int, bool, const char *, va_list);
+
 
 /* mport_err_code()
  *
- * Return the current numeric error code. 
+ * Return the current numeric error code for the calling thread.
  */
 MPORT_PUBLIC_API int
 mport_err_code(void) {
@@ -50,11 +72,74 @@ mport_err_code(void) {
 
 /* mport_err_string()
  *
- * Return the current error string (if any).  Do not free this memory, it is static. 
+ * Return the current error string for the calling thread, "" if there is none.
+ * Do not free this memory; it is valid until the thread's next error.
  */
 MPORT_PUBLIC_API const char *
 mport_err_string(void) {
-    return err_msg;
+    if (err_head != NULL)
+        return err_head->msg;
+    return mport_err == MPORT_OK ? "" : default_error_msg;
+}
+
+/* mport_err_cause(n)
+ *
+ * Return the message n steps down the current error's cause chain, where 0 is
+ * the error itself, or NULL if the chain is shorter than that.
+ */
+MPORT_PUBLIC_API const char *
+mport_err_cause(unsigned int n) {
+    struct err_frame *f;
+
+    for (f = err_head; f != NULL && n > 0; f = f->cause)
+        n--;
+
+    return f == NULL ? NULL : f->msg;
+}
+
+/* mport_err_clear()
+ *
+ * Clear the calling thread's error state and release its memory.
+ */
+MPORT_PUBLIC_API void
+mport_err_clear(void) {
+    mport_set_err(MPORT_OK, NULL);
+}
+
+
+/* mport_err_save(code)
+ *
+ * Take the calling thread's error state, leaving it clear, so that code run
+ * on this thread can set and clear errors of its own.  Put it back with
+ * mport_err_restore().
+ */
+void *
+mport_err_save(int *code) {
+    struct err_frame *f = err_head;
+
+    (void) pthread_once(&err_once, err_key_init);
+
+    *code = mport_err;
+    mport_err = MPORT_OK;
+    err_head = NULL;
+    (void) pthread_setspecific(err_key, NULL);
+
+    return f;
+}
+
+/* mport_err_restore(code, saved)
+ *
+ * Replace the calling thread's error state with one from mport_err_save().
+ */
+void
+mport_err_restore(int code, void *saved) {
+
+    (void) pthread_once(&err_once, err_key_init);
+
+    err_chain_free(err_head);
+    mport_err = code;
+    err_head = saved;
+    (void) pthread_setspecific(err_key, saved);
 }
 
 
@@ -67,18 +152,7 @@ mport_err_string(void) {
  */
 int
 mport_set_err(int code, const char *msg) {
-    mport_err = code;
-
-    if (code == MPORT_OK) {
-        bzero(err_msg, sizeof(err_msg));
-    } else {
-        if (msg != NULL) {
-            strlcpy(err_msg, msg, sizeof(err_msg));
-        } else {
-            strlcpy(err_msg, default_error_msg, sizeof(err_msg));
-        }
-    }
-    return code;
+    return mport_set_errx(code, "%s", msg == NULL ? default_error_msg : msg);
 }
 
 
@@ -91,18 +165,89 @@ mport_set_err(int code, const char *msg) {
 int
 mport_set_errx(int code, const char *fmt, ...) {
     va_list args;
-    char *err;
     int ret;
 
     va_start(args, fmt);
-    if (vasprintf(&err, fmt, args) == -1) {
-        fprintf(stderr, "fatal error: mport_set_errx can't format the string.\n");
-        exit(255);
-    }
-    ret = mport_set_err(code, err);
-    free(err);
+    ret = err_vpush(code, false, fmt, args);
+    va_end(args);
+
+    return ret;
+}
+
+
+/* mport_wrap_errx(code, fmt, arg1, arg2, ...)
+ *
+ * Like mport_set_errx, but the error being replaced is kept as the cause of
+ * the new one.
+ */
+int
+mport_wrap_errx(int code, const char *fmt, ...) {
+    va_list args;
+    int ret;
 
+    va_start(args, fmt);
+    ret = err_vpush(code, true, fmt, args);
     va_end(args);
 
     return ret;
 }
+
+
+static int
+err_vpush(int code, bool wrap, const char *fmt, va_list args) {
+    struct err_frame *f = NULL, *cause = NULL, *c;
+    va_list copy;
+    int len, depth;
+
+    /* the key frees a thread's chain when it exits */
+    (void) pthread_once(&err_once, err_key_init);
+
+    /* format first: the arguments may point into the current chain */
+    if (code != MPORT_OK) {
+        va_copy(copy, args);
+        len = vsnprintf(NULL, 0, fmt, copy);
+        va_end(copy);
+
+        /* on failure mport_err_string() falls back to the default message */
+        if (len >= 0 && (f = malloc(sizeof(*f) + len + 1)) != NULL)
+            (void) vsnprintf(f->msg, len + 1, fmt, args);
+    }
+
+    if (f != NULL && wrap && mport_err != MPORT_OK)
+        cause = err_head;
+    else
+        err_chain_free(err_head);
+
+    if (f != NULL) {
+        f->cause = cause;
+        /* drop the oldest causes past the limit */
+        for (c = cause, depth = 1; c != NULL; c = c->cause, depth++) {
+            if (depth == ERR_CHAIN_MAX - 1) {
+                err_chain_free(c->cause);
+                c->cause = NULL;
+                break;
+            }
+        }
+    }
+
+    mport_err = code;
+    err_head = f;
+    (void) pthread_setspecific(err_key, f);
+
+    return code;
+}
+
+static void
+err_key_init(void) {
+    (void) pthread_key_create(&err_key, err_chain_free);
+}
+
+static void
+err_chain_free(void *head) {
+    struct err_frame *f = head, *next;
+
+    for (; f != NULL; f = next) {
+        next = f->cause;
+        free(f);
+    }
+}
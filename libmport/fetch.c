@@ -104,7 +104,7 @@ mport_fetch_index(mportInstance *mport)
 		free(mirrors[mi]);
 
 	free(mirrors);
-	RETURN_ERRORX(MPORT_ERR_FATAL, "Unable to fetch index file: %s", mport_err_string());
+	RETURN_WRAP_ERRORX(MPORT_ERR_FATAL, "Unable to fetch index file: %s", mport_err_string());
 }
 
 
@@ -134,6 +134,53 @@ mport_fetch_bootstrap_index(mportInstance *mport)
 	return result;
 }
 
+/* mport_fetch_vulndb(mport, dest)
+ *
+ * Fetch the vulnerability database published next to the index on the
+ * mirrors, or the bootstrap site, and decompress it to dest.
+ */
+int
+mport_fetch_vulndb(mportInstance *mport, const char *dest)
+{
+	char **mirrors = NULL;
+	char *url = NULL;
+	char *osrel;
+	int mirrorCount = 0, mi, result = MPORT_ERR_FATAL;
+
+	MPORT_CHECK_FOR_INDEX(mport, "mport_fetch_vulndb()");
+
+	if (mport_index_get_mirror_list(mport, &mirrors, &mirrorCount) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	osrel = mport_get_osrelease(mport);
+
+	for (mi = 0; mi <= mirrorCount && result != MPORT_OK; mi++) {
+		/* the bootstrap site is the last resort */
+		asprintf(&url, "%s/%s/%s/%s", mi < mirrorCount ? mirrors[mi] : MPORT_BOOTSTRAP_INDEX_URL,
+		    MPORT_ARCH, osrel, MPORT_VULNDB_FILE_SOURCE);
+		if (url == NULL) {
+			result = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			break;
+		}
+
+		result = fetch(mport, url, MPORT_VULNDB_FILE_BZ2);
+		free(url);
+	}
+
+	for (mi = 0; mi < mirrorCount; mi++)
+		free(mirrors[mi]);
+	free(mirrors);
+	free(osrel);
+
+	if (result != MPORT_OK)
+		RETURN_WRAP_ERRORX(MPORT_ERR_FATAL, "Unable to fetch vulnerability database: %s", mport_err_string());
+
+	result = mport_decompress_bzip2(MPORT_VULNDB_FILE_BZ2, dest);
+	unlink(MPORT_VULNDB_FILE_BZ2);
+
+	return (result);
+}
+
 /* mport_fetch_bundle(mport, filename)
  *
  * Fetch a given bundle from a remote.	If there is no loaded index, then
@@ -196,33 +243,43 @@ mport_fetch_bundle(mportInstance *mport, const char *directory, const char *file
 }
 
 
-char *
-mport_fetch_cves(mportInstance *mport, char *cpe)
+/*
+ * Open the security site's CVE list for a CPE.  The response is read
+ * straight from the connection, see mport_cve_parse(); close it with fclose().
+ */
+FILE *
+mport_fetch_cves(mportInstance *mport, const char *cpe)
 {
-	int result;
+	FILE *remote;
 	char *url;
 
-	char tmpfile2[] = "/tmp/mport.cve.XXXXXXXX";
-	int fd;
-
-	if ((fd = mkstemp(tmpfile2)) == -1) {
-		SET_ERRORX(MPORT_ERR_FATAL, "Couldn't make tmp file: %s", strerror(errno));
+	if (asprintf(&url, "%s/api/cpe/partial-match?includeVersion=true&cpe=%s&startDate=2006-02-28",
+	    MPORT_SECURITY_URL, cpe) == -1) {
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
 	}
-  
-	asprintf(&url, "%s/api/cpe/partial-match?includeVersion=true&cpe=%s&startDate=2006-02-28", MPORT_SECURITY_URL, cpe);
-	result = fetch_to_file(mport, url, fdopen(fd, "w"), false);
+
+	if ((remote = fetchGetURL(url, "p")) == NULL)
+		SET_ERRORX(MPORT_ERR_FATAL, "Fetch error: %s: %s", url, fetchLastErrString);
+
 	free(url);
 
-    if (result!= MPORT_OK) {
-       return NULL;
-    }
-	return strdup(tmpfile2); // return the file path
+	return (remote);
 }
 
 static int
 fetch(mportInstance *mport, const char *url, const char *dest) 
 {
 	FILE *local = NULL;
+
+	/* a local mirror; let the kernel copy it rather than streaming it through libfetch */
+	if (strncmp(url, "file:///", 8) == 0 && strchr(url, '%') == NULL) {
+		if (mport_copy_file(url + 7, dest) != MPORT_OK) {
+			unlink(dest);
+			RETURN_CURRENT_ERROR;
+		}
+		return (MPORT_OK);
+	}
 	
 	if ((local = fopen(dest, "w")) == NULL) {
 		RETURN_ERRORX(MPORT_ERR_FATAL, "Unable to open %s: %s", dest, strerror(errno));
@@ -266,6 +323,14 @@ fetch_to_file(mportInstance *mport, const char *url, FILE *local, bool progress)
 	double dlpercent = 0.0;
 	
 	while (1) {
+		if (mport_cancelled(mport)) {
+			fclose(local);
+			fclose(remote);
+			if (progress)
+				(mport->progress_free_cb)();
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Download of %s cancelled.", pkg);
+		}
+
 		size = fread(buffer, 1, BUFFSIZE, remote);
 		
 		if (size < BUFFSIZE) {
@@ -45,11 +45,14 @@ static int index_last_checked_recentish(mportInstance *);
 static int index_update_last_checked(mportInstance *);
 
 static int lookup_alias(mportInstance *, const char *, char **);
+static int index_versions(mportInstance *);
 static int lookup_alias_inverse(mportInstance *, const char *, char **);
 
 static int attach_index_db(sqlite3 *db);
 
-static void populate_row(sqlite3_stmt *stmt, mportIndexEntry *e);
+static void populate_row(sqlite3_stmt *stmt, mportIndexEntry *e, struct mport_arena *arena);
+static int populate_vec(mportInstance *, sqlite3_stmt *, mportIndexEntry **);
+static void view_row(sqlite3_stmt *stmt, mportIndexEntry *e);
 
 
 char *
@@ -138,6 +141,17 @@ attach_index_db(sqlite3 *db)
 		RETURN_CURRENT_ERROR;
 	}
 
+	/* built again from the new index by index_versions() when needed */
+	if (mport_db_do(db, "DROP TABLE IF EXISTS temp.index_versions") != MPORT_OK) {
+		RETURN_CURRENT_ERROR;
+	}
+
+	/*
+	 * Not fatal: the index is usable without its dictionaries, and any
+	 * bundle that needs a missing one says so when it is opened.
+	 */
+	(void)mport_zdict_sync(db);
+
 	return (MPORT_OK);
 }
 
@@ -189,8 +203,8 @@ mport_index_get(mportInstance *mport)
 
 MPORT_PUBLIC_API int
 mport_index_check(mportInstance *mport, mportPackageMeta *pack) {
-	mportIndexEntry **indexEntries, **indexEntries_orig;
-	int ret = 0;
+	char *lookup = NULL;
+	int count = 0;
 
 	if (mport == NULL) {
 		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
@@ -199,30 +213,129 @@ mport_index_check(mportInstance *mport, mportPackageMeta *pack) {
 	if (pack == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "pack not defined");
 
-	if (mport_index_lookup_pkgname(mport, pack->name, &indexEntries_orig) != MPORT_OK) {
+	if (pack->version == NULL)
+		return (0);
+
+	if (index_versions(mport) != MPORT_OK || lookup_alias(mport, pack->name, &lookup) != MPORT_OK) {
 		SET_ERRORX(MPORT_ERR_WARN, "Error Looking up package name %s", pack->name); /* TODO: is this needed. */
 		return (0);
 	}
 
-	if (indexEntries_orig != NULL) {
-		indexEntries = indexEntries_orig;
-		while (*indexEntries != NULL) {
-			int osflag = mport_check_preconditions(mport, pack, MPORT_PRECHECK_OS);
-			if ((*indexEntries)->version != NULL && pack->version != NULL && (mport_version_cmp(pack->version, (*indexEntries)->version) < 0 ||
-			                                         (mport_version_cmp(pack->version, (*indexEntries)->version) == 0 && osflag == MPORT_OK))) {
-				ret = 1;
-				break;
-			}
-			indexEntries++;
+	/* a newer version, or the same one built for a newer os release */
+	if (mport_db_count(mport->db, &count,
+	    "SELECT count(*) FROM temp.index_versions WHERE pkg GLOB %Q AND version_key > mport_version_key(%Q)",
+	    lookup, pack->version) == MPORT_OK && count == 0 &&
+	    mport_db_count(mport->db, &count,
+	    "SELECT count(*) FROM temp.index_versions WHERE pkg GLOB %Q AND version_key = mport_version_key(%Q)",
+	    lookup, pack->version) == MPORT_OK && count > 0 &&
+	    mport_check_preconditions(mport, pack, MPORT_PRECHECK_OS) != MPORT_OK)
+		count = 0;
+
+	free(lookup);
+
+	return (count > 0);
+}
+
+/*
+ * mport_index_newer_versions(mport, pkgname, version, all, versions, count)
+ *
+ * Set *versions to a NULL terminated vector of the index versions of pkgname
+ * newer than version, or of all of them when all is set, and *count to how
+ * many versions of pkgname the index has at all.  Versions are compared by
+ * key, as in mport_index_check().  The caller frees each version and the
+ * vector; on error *versions is left NULL.
+ */
+int
+mport_index_newer_versions(mportInstance *mport, const char *pkgname, const char *version, bool all, char ***versions,
+    int *count)
+{
+	sqlite3_stmt *stmt;
+	char *lookup = NULL;
+	char **v;
+	int i = 0, ret = MPORT_OK;
+
+	*versions = NULL;
+	*count = 0;
+
+	if (index_versions(mport) != MPORT_OK || lookup_alias(mport, pkgname, &lookup) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (mport_db_count(mport->db, count, "SELECT count(*) FROM temp.index_versions WHERE pkg GLOB %Q", lookup) !=
+	    MPORT_OK) {
+		free(lookup);
+		RETURN_CURRENT_ERROR;
+	}
+
+	if ((v = calloc((size_t)*count + 1, sizeof(char *))) == NULL) {
+		free(lookup);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+	*versions = v;
+
+	if (*count == 0) {
+		free(lookup);
+		return (MPORT_OK);
+	}
+
+	ret = mport_db_prepare(mport->db, &stmt,
+	    "SELECT version FROM temp.index_versions WHERE pkg GLOB %Q AND (%d OR version_key > mport_version_key(%Q))",
+	    lookup, all ? 1 : 0, version);
+	free(lookup);
+	if (ret != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while (i < *count) {
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_DONE) {
+			ret = MPORT_OK;
+			break;
+		}
+		if (ret != SQLITE_ROW) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+			break;
 		}
-		mport_index_entry_free_vec(indexEntries_orig);
-		indexEntries_orig = NULL;
-		indexEntries = NULL;
+		if ((v[i++] = strdup((const char *)sqlite3_column_text(stmt, 0))) == NULL) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			break;
+		}
+		ret = MPORT_OK;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (ret != MPORT_OK) {
+		while (i > 0)
+			free(v[--i]);
+		free(v);
+		*versions = NULL;
 	}
 
 	return (ret);
 }
 
+/*
+ * Version keys of the index packages, kept in a temp table next to the
+ * attached index so upgrade checks are indexed comparisons instead of a
+ * mport_version_cmp() call per row.  The index can't carry them itself, as
+ * it is downloaded as is.
+ */
+static int
+index_versions(mportInstance *mport)
+{
+
+	MPORT_CHECK_FOR_INDEX(mport, "index_versions()")
+
+	if (mport_db_do(mport->db,
+	    "CREATE TEMP TABLE IF NOT EXISTS index_versions AS SELECT pkg, version, mport_version_key(version) AS version_key FROM idx.packages") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (mport_db_do(mport->db,
+	    "CREATE INDEX IF NOT EXISTS temp.index_versions_pkg ON index_versions (pkg, version_key)") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	return (MPORT_OK);
+}
+
 
 /* return 1 if the index is younger than the max age, 0 otherwise */
 static int
@@ -441,7 +554,6 @@ mport_index_lookup_pkgname(mportInstance *mport, const char *pkgname, mportIndex
 {
 	char *lookup = NULL;
 	int count;
-	int i = 0, step;
 	sqlite3_stmt *stmt;
 	int ret = MPORT_OK;
 	mportIndexEntry **e = NULL;
@@ -479,32 +591,7 @@ mport_index_lookup_pkgname(mportInstance *mport, const char *pkgname, mportIndex
 		goto DONE;
 	}
 
-	while (1) {
-		step = sqlite3_step(stmt);
-
-		if (step == SQLITE_ROW) {
-			if ((e[i] = (mportIndexEntry *) calloc(1, sizeof(mportIndexEntry))) == NULL) {
-				ret = MPORT_ERR_FATAL;
-				goto DONE;
-			}
-
-			populate_row(stmt, e[i]);
-
-			if (e[i]->pkgname == NULL || e[i]->version == NULL || e[i]->comment == NULL || e[i]->license == NULL ||
-			    e[i]->bundlefile == NULL) {
-				ret = MPORT_ERR_FATAL;
-				goto DONE;
-			}
-
-			i++;
-		} else if (step == SQLITE_DONE) {
-			e[i] = NULL;
-			goto DONE;
-		} else {
-			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
-			goto DONE;
-		}
-	}
+	ret = populate_vec(mport, stmt, e);
 
 	DONE:
 	free(lookup);
@@ -525,7 +612,6 @@ mport_index_search_term(mportInstance *mport, mportIndexEntry ***entry_vec, char
 	sqlite3_stmt *stmt;
 	int ret = MPORT_OK;
 	int len;
-	int i = 0, step;
 	mportIndexEntry **e;
 
 
@@ -554,32 +640,7 @@ mport_index_search_term(mportInstance *mport, mportIndexEntry ***entry_vec, char
 		RETURN_CURRENT_ERROR;
 	}
 
-	while (1) {
-		step = sqlite3_step(stmt);
-
-		if (step == SQLITE_ROW) {
-			if ((e[i] = (mportIndexEntry *) calloc(1, sizeof(mportIndexEntry))) == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
-
-			populate_row(stmt, e[i]);
-
-			if (e[i]->pkgname == NULL || e[i]->version == NULL || e[i]->comment == NULL || e[i]->license == NULL ||
-			    e[i]->bundlefile == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
-
-			i++;
-		} else if (step == SQLITE_DONE) {
-			e[i] = NULL;
-			break;
-		} else {
-			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
-			break;
-		}
-	}
+	ret = populate_vec(mport, stmt, e);
 
 	sqlite3_finalize(stmt);
 
@@ -604,7 +665,6 @@ mport_index_search(mportInstance *mport, mportIndexEntry ***entry_vec, const cha
 	sqlite3_stmt *stmt;
 	int ret = MPORT_OK;
 	int len;
-	int i = 0, step;
 	char *where;
 	mportIndexEntry **e;
 
@@ -646,47 +706,80 @@ mport_index_search(mportInstance *mport, mportIndexEntry ***entry_vec, const cha
 		RETURN_CURRENT_ERROR;
 	}
 
-	while (1) {
-		step = sqlite3_step(stmt);
+	ret = populate_vec(mport, stmt, e);
 
-		if (step == SQLITE_ROW) {
-			if ((e[i] = (mportIndexEntry *) calloc(1, sizeof(mportIndexEntry))) == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
+	sqlite3_free(where);
+	sqlite3_finalize(stmt);
 
-			populate_row(stmt, e[i]);
+	return ret;
+}
 
-			if (e[i]->pkgname == NULL || e[i]->version == NULL || e[i]->comment == NULL || e[i]->license == NULL ||
-			    e[i]->bundlefile == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
+/* mport_index_foreach(mportInstance *mport, mport_index_cb cb, void *arg, const char *where, ...)
+ *
+ * Call cb for each index entry matching the where clause, built as for
+ * mport_index_search(), or for every entry if it is NULL, in name order.
+ *
+ * Like mport_pkgmeta_foreach(), the entry is a view of the current row that
+ * is only good until cb returns, and a cb returning anything but MPORT_OK
+ * stops the iteration and is returned.
+ */
+MPORT_PUBLIC_API int
+mport_index_foreach(mportInstance *mport, mport_index_cb cb, void *arg, const char *fmt, ...)
+{
+	va_list args;
+	sqlite3_stmt *stmt;
+	mportIndexEntry e;
+	char *where = NULL;
+	int ret = MPORT_OK, step;
 
-			i++;
+	if (mport == NULL) {
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+	}
+
+	MPORT_CHECK_FOR_INDEX(mport, "mport_index_foreach()");
+
+	if (fmt != NULL) {
+		va_start(args, fmt);
+		where = sqlite3_vmprintf(fmt, args);
+		va_end(args);
+
+		if (where == NULL) {
+			RETURN_ERROR(MPORT_ERR_FATAL, "Could not build where clause");
+		}
+	}
+
+	if (mport_db_prepare(mport->db, &stmt,
+	                     "SELECT pkg, version, comment, bundlefile, license, hash, type FROM idx.packages WHERE %s ORDER BY pkg",
+	                     where == NULL ? "1" : where) != MPORT_OK) {
+		sqlite3_free(where);
+		RETURN_CURRENT_ERROR;
+	}
+	sqlite3_free(where);
+
+	while (ret == MPORT_OK) {
+		step = sqlite3_step(stmt);
+
+		if (step == SQLITE_ROW) {
+			view_row(stmt, &e);
+			ret = cb(&e, arg);
 		} else if (step == SQLITE_DONE) {
-			e[i] = NULL;
 			break;
 		} else {
 			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
-			break;
 		}
 	}
 
-	sqlite3_free(where);
 	sqlite3_finalize(stmt);
 
 	return ret;
 }
 
-
 MPORT_PUBLIC_API int
 mport_index_list(mportInstance *mport, mportIndexEntry ***entry_vec)
 {
 	sqlite3_stmt *stmt;
 	int ret = MPORT_OK;
 	int len;
-	int i = 0, step;
 	sqlite3 *db = mport->db;
 	mportIndexEntry **e;
 
@@ -706,32 +799,7 @@ mport_index_list(mportInstance *mport, mportIndexEntry ***entry_vec)
 		RETURN_CURRENT_ERROR;
 	}
 
-	while (1) {
-		step = sqlite3_step(stmt);
-
-		if (step == SQLITE_ROW) {
-			if ((e[i] = (mportIndexEntry *) calloc(1, sizeof(mportIndexEntry))) == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
-
-			populate_row(stmt, e[i]);
-
-			if (e[i]->pkgname == NULL || e[i]->version == NULL || e[i]->comment == NULL || e[i]->license == NULL ||
-			    e[i]->bundlefile == NULL) {
-				ret = MPORT_ERR_FATAL;
-				break;
-			}
-
-			i++;
-		} else if (step == SQLITE_DONE) {
-			e[i] = NULL;
-			break;
-		} else {
-			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
-			break;
-		}
-	}
+	ret = populate_vec(mport, stmt, e);
 
 	sqlite3_finalize(stmt);
 
@@ -817,22 +885,88 @@ mport_moved_lookup(mportInstance *mport, const char *origin, mportIndexMovedEntr
 	return ret;
 }
 
+/*
+ * Fill e, which has room for every row of stmt and a terminator.  The
+ * entries and their strings all come from one arena, released by
+ * mport_index_entry_free_vec().
+ */
+static int
+populate_vec(mportInstance *mport, sqlite3_stmt *stmt, mportIndexEntry **e)
+{
+	struct mport_arena *arena;
+	int i = 0, step;
+
+	if ((arena = mport_arena_new()) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	while (1) {
+		step = sqlite3_step(stmt);
+
+		if (step == SQLITE_ROW) {
+			if ((e[i] = mport_arena_alloc(arena, sizeof(mportIndexEntry))) == NULL)
+				break;
+			e[i]->arena = arena;
+
+			populate_row(stmt, e[i], arena);
+
+			if (e[i]->pkgname == NULL || e[i]->version == NULL || e[i]->comment == NULL || e[i]->license == NULL ||
+			    e[i]->bundlefile == NULL)
+				break;
+
+			i++;
+		} else if (step == SQLITE_DONE) {
+			e[i] = NULL;
+			if (i == 0)
+				mport_arena_free(arena);
+			return MPORT_OK;
+		} else {
+			SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+			mport_arena_free(arena);
+			e[0] = NULL;
+			return MPORT_ERR_FATAL;
+		}
+	}
+
+	mport_arena_free(arena);
+	e[0] = NULL;
+
+	RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+}
+
 static void
-populate_row(sqlite3_stmt *stmt, mportIndexEntry *e)
+populate_row(sqlite3_stmt *stmt, mportIndexEntry *e, struct mport_arena *arena)
 {
 
-	e->pkgname = strdup((const char *) sqlite3_column_text(stmt, 0));
-	e->version = strdup((const char *) sqlite3_column_text(stmt, 1));
-	e->comment = strdup((const char *) sqlite3_column_text(stmt, 2));
-	e->bundlefile = strdup((const char *) sqlite3_column_text(stmt, 3));
-	e->license = strdup((const char *) sqlite3_column_text(stmt, 4));
-	e->hash = strdup((const char *) sqlite3_column_text(stmt, 5));
+	e->pkgname = mport_arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 0));
+	e->version = mport_arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 1));
+	e->comment = mport_arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 2));
+	e->bundlefile = mport_arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 3));
+	e->license = mport_arena_intern(arena, (const char *) sqlite3_column_text(stmt, 4));
+	e->hash = mport_arena_strdup(arena, (const char *) sqlite3_column_text(stmt, 5));
 
 	if (sqlite3_column_type(stmt, 6) == SQLITE_INTEGER) {
         e->type = sqlite3_column_int(stmt, 6);
 	}
 }
 
+#define VIEW_COLUMN(stmt, i) \
+	(sqlite3_column_text((stmt), (i)) == NULL ? "" : (char *) sqlite3_column_text((stmt), (i)))
+
+/* like populate_row(), but pointing into the row rather than copying it */
+static void
+view_row(sqlite3_stmt *stmt, mportIndexEntry *e)
+{
+
+	e->pkgname = VIEW_COLUMN(stmt, 0);
+	e->version = VIEW_COLUMN(stmt, 1);
+	e->comment = VIEW_COLUMN(stmt, 2);
+	e->bundlefile = VIEW_COLUMN(stmt, 3);
+	e->license = VIEW_COLUMN(stmt, 4);
+	e->hash = VIEW_COLUMN(stmt, 5);
+	e->type = sqlite3_column_int(stmt, 6);
+	e->arena = NULL;
+}
+
 static int
 lookup_alias_inverse(mportInstance *mport, const char *query, char **result)
 {
@@ -897,6 +1031,13 @@ mport_index_entry_free_vec(mportIndexEntry **e)
 		return;
 	}
 
+	/* entries from a query share an arena */
+	if (*e != NULL && (*e)->arena != NULL) {
+		mport_arena_free((*e)->arena);
+		free(e_orig);
+		return;
+	}
+
 	while (*e != NULL) {
 		mport_index_entry_free(*e);
 		e++;
@@ -912,7 +1053,8 @@ MPORT_PUBLIC_API void
 mport_index_entry_free(mportIndexEntry *e)
 {
 
-	if (e == NULL) {
+	/* part of a vector; freed with it */
+	if (e == NULL || e->arena != NULL) {
 		return;
 	}
 
@@ -41,6 +41,10 @@ mport_install(mportInstance *mport, const char *pkgname, const char *version, co
   int e_loc = 0;
 
   MPORT_CHECK_FOR_INDEX(mport, "mport_install()");
+
+  /* safe point: nothing of this package has been touched yet */
+  if (mport_cancelled(mport))
+    RETURN_ERRORX(MPORT_ERR_FATAL, "Install of %s cancelled.", pkgname);
   
   if (mport_index_lookup_pkgname(mport, pkgname, &e) != MPORT_OK) {
   	RETURN_CURRENT_ERROR;
@@ -125,70 +129,32 @@ mport_install(mportInstance *mport, const char *pkgname, const char *version, co
   return ret;
 }
 
-/* recursive function */
+/*
+ * Install a package and whatever it needs, or bring it up to date if it is
+ * already installed.  The solver plans the whole tree before anything is
+ * fetched, so a request that cannot be met fails without downloading.
+ */
 int
 mport_install_depends(mportInstance *mport, const char *packageName, const char *version, mportAutomatic automatic) {
-	mportPackageMeta **packs = NULL;
-	mportDependsEntry **depends = NULL;
-	mportDependsEntry **depends_orig = NULL;
+	mportTransaction *txn;
+	int ret = MPORT_OK;
 
 	if (packageName == NULL || version == NULL) {
 		RETURN_ERROR(MPORT_ERR_WARN, "Dependency name or version is null");
 	}
 
-	mport_index_depends_list(mport, packageName, version, &depends_orig);
-	depends = depends_orig;
- 
-	if (mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", packageName) != MPORT_OK) {
+	if ((txn = mport_txn_begin(mport)) == NULL) {
 		mport_call_msg_cb(mport, "%s", mport_err_string());
 		return mport_err_code();
 	}
 
-	if (packs == NULL && depends == NULL) {
-		/* Package is not installed and there are no dependencies */
-		if (mport_install(mport, packageName, version, NULL, automatic) != MPORT_OK) {
-			mport_call_msg_cb(mport, "%s", mport_err_string());
-			return mport_err_code();
-		}
-	} else if (packs == NULL) {
-		/* Package is not installed */
-		while (*depends != NULL) {
-			if (mport_install_depends(mport, (*depends)->d_pkgname, (*depends)->d_version, MPORT_AUTOMATIC) != MPORT_OK) {
-     			mport_call_msg_cb(mport, "%s", mport_err_string());
-     			mport_index_depends_free_vec(depends_orig);
-          depends_orig = NULL;
-				return mport_err_code();
-			}
-			depends++;
-		}
-		if (mport_install(mport, packageName, version, NULL, automatic) != MPORT_OK) {
-			mport_call_msg_cb(mport, "%s", mport_err_string());
-			mport_index_depends_free_vec(depends_orig);
-      depends_orig = NULL;
-      depends = NULL;
-			return mport_err_code();
-		}
-		mport_index_depends_free_vec(depends_orig);
-    depends_orig = NULL;
-    depends = NULL;
-	} else {
-		/* already installed, double check we are on the latest */
-		mport_index_depends_free_vec(depends_orig);
-    depends_orig = NULL;
-    depends = NULL;
-
-		if (mport_check_preconditions(mport, packs[0], MPORT_PRECHECK_UPGRADEABLE) == MPORT_OK) {
-			if (mport_update(mport, packageName) != MPORT_OK) {
-				mport_call_msg_cb(mport, "%s", mport_err_string());
-				mport_pkgmeta_vec_free(packs);
-        packs = NULL;
-				return mport_err_code();
-			}
-		}
-
-        // TODO: fix crash on nested calls
-		//mport_pkgmeta_vec_free(packs);
+	if (mport_txn_add_install(txn, packageName, version, automatic) != MPORT_OK ||
+	    mport_txn_commit(txn) != MPORT_OK) {
+		mport_call_msg_cb(mport, "%s", mport_err_string());
+		ret = mport_err_code();
 	}
 
-	return (MPORT_OK);
-}
\ No newline at end of file
+	mport_txn_free(txn);
+
+	return (ret);
+}
@@ -96,6 +96,18 @@ mport_instance_init(mportInstance *mport, const char *root, const char *outputPa
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
 	}
 
+	if (sqlite3_create_function(mport->db, "mport_version_key", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+								&mport_version_key_sqlite, NULL, NULL) != SQLITE_OK) {
+		sqlite3_close(mport->db);
+		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+	}
+
+	if (sqlite3_create_function(mport->db, "mport_cpe_product", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+								&mport_cpe_product_sqlite, NULL, NULL) != SQLITE_OK) {
+		sqlite3_close(mport->db);
+		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+	}
+
 
 	/* set the default UI callbacks */
 	mport->msg_cb = &mport_default_msg_cb;
@@ -219,6 +231,14 @@ mport_call_progress_init_cb(mportInstance *mport, const char *fmt, ...) {
 
 MPORT_PUBLIC_API int
 mport_instance_free(mportInstance *mport) {
+	mport_txn_free(mport->txn);
+
+	/* the workers may still be using the database */
+	mport_pool_free(mport->pool);
+	mport->pool = NULL;
+	mport_reqcache_free(mport->reqs);
+	mport->reqs = NULL;
+
 	if (sqlite3_close(mport->db) != SQLITE_OK) {
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
 	}
@@ -0,0 +1,325 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * Bulk file I/O.  File to file copies use copy_file_range(2), so the data
+ * never leaves the kernel (and with ZFS block cloning isn't copied at all),
+ * falling back to read(2)/write(2) when that isn't available.  Files fed to
+ * libarchive are read in large blocks with pread(2).
+ * Files with holes are archived as sparse entries, so only their data
+ * regions are read and compressed.
+ */
+
+#define IO_BUFF_SIZE	(BUFSIZ * 16)
+/* reads feeding libarchive; large, so big files take few system calls */
+#define IO_READ_SIZE	(256 * 1024)
+
+static int copy_fd_rw(int, int);
+static int archive_write_range(struct archive *, int, off_t, off_t);
+static int archive_write_fd_rw(struct archive *, int, off_t, off_t);
+static int archive_write_zeros(struct archive *, off_t);
+
+/*
+ * mport_copy_fd(from, to)
+ *
+ * Copy everything from the current offset of from to the current offset of to.
+ */
+int
+mport_copy_fd(int from, int to)
+{
+#ifdef SYS_copy_file_range
+	ssize_t len;
+
+	while (1) {
+		len = copy_file_range(from, NULL, to, NULL, SSIZE_MAX, 0);
+
+		if (len == 0)
+			return (MPORT_OK);
+		if (len > 0)
+			continue;
+		if (errno == EINTR)
+			continue;
+
+		/* not supported for this pair of files; offsets are still right */
+		if (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+		    errno == EOPNOTSUPP || errno == EBADF)
+			break;
+
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Copy failed: %s", strerror(errno));
+	}
+#endif
+
+	return (copy_fd_rw(from, to));
+}
+
+static int
+copy_fd_rw(int from, int to)
+{
+	char buf[IO_BUFF_SIZE];
+	ssize_t len, wrote;
+	char *ptr;
+
+	while (1) {
+		len = read(from, buf, sizeof(buf));
+
+		if (len == 0)
+			return (MPORT_OK);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Read failed: %s", strerror(errno));
+		}
+
+		for (ptr = buf; len > 0; ptr += wrote, len -= wrote) {
+			wrote = write(to, ptr, len);
+			if (wrote < 0) {
+				if (errno == EINTR) {
+					wrote = 0;
+					continue;
+				}
+				RETURN_ERRORX(MPORT_ERR_FATAL, "Write failed: %s", strerror(errno));
+			}
+		}
+	}
+}
+
+/*
+ * mport_copy_file(fromName, toName)
+ *
+ * Copy file fromname to toname
+ */
+int
+mport_copy_file(const char *fromName, const char *toName)
+{
+	int from, to, ret;
+
+	if ((from = open(fromName, O_RDONLY | O_CLOEXEC)) == -1)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open source file for copying %s: %s",
+		    fromName, strerror(errno));
+
+	if ((to = open(toName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1) {
+		close(from);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open destination file for copying %s: %s",
+		    toName, strerror(errno));
+	}
+
+	ret = mport_copy_fd(from, to);
+
+	close(from);
+	if (close(to) != 0 && ret == MPORT_OK)
+		ret = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't write %s: %s", toName, strerror(errno));
+
+	return (ret);
+}
+
+/*
+ * mport_archive_sparse_map(entry, fd, size)
+ *
+ * If the first size bytes of fd contain holes, record its data regions in
+ * the sparse map of entry and return true.  The entry must then be written
+ * with mport_archive_write_sparse_fd().
+ */
+bool
+mport_archive_sparse_map(struct archive_entry *entry, int fd, off_t size)
+{
+#ifdef SEEK_HOLE
+	struct stat st;
+	off_t data, hole;
+	bool dense = false;
+
+	/* a file using as many blocks as its size can't have holes */
+	if (fstat(fd, &st) != 0 || st.st_blocks * S_BLKSIZE >= size)
+		return (false);
+
+	archive_entry_sparse_clear(entry);
+
+	for (data = 0; data < size; data = hole) {
+		if ((data = lseek(fd, data, SEEK_DATA)) == -1) {
+			/* ENXIO: nothing but a hole from here to the end */
+			if (errno == ENXIO)
+				break;
+			archive_entry_sparse_clear(entry);
+			return (false);
+		}
+		if (data >= size)
+			break;
+		if ((hole = lseek(fd, data, SEEK_HOLE)) == -1) {
+			archive_entry_sparse_clear(entry);
+			return (false);
+		}
+		if (hole > size)
+			hole = size;
+		dense = data == 0 && hole == size;
+		archive_entry_sparse_add_entry(entry, data, hole - data);
+	}
+
+	/* the file system doesn't report holes, or there weren't any after all */
+	if (dense) {
+		archive_entry_sparse_clear(entry);
+		return (false);
+	}
+
+	/* an all hole file still needs a map; record an empty region at its end */
+	if (archive_entry_sparse_count(entry) == 0)
+		archive_entry_sparse_add_entry(entry, size, 0);
+
+	return (true);
+#else
+	return (false);
+#endif
+}
+
+/*
+ * mport_archive_write_fd(a, fd, size)
+ *
+ * Write the first size bytes of fd as the data of the current entry of a.
+ * The file must not shrink meanwhile; if it is found shorter than size,
+ * MPORT_ERR_FATAL is returned.
+ */
+int
+mport_archive_write_fd(struct archive *a, int fd, off_t size)
+{
+
+	return (archive_write_range(a, fd, 0, size));
+}
+
+/*
+ * mport_archive_write_sparse_fd(a, entry, fd, size)
+ *
+ * Like mport_archive_write_fd(), for an entry mapped with
+ * mport_archive_sparse_map().  Holes are never read; libarchive drops the
+ * zeros we feed it for them, so the archive only holds the data regions.
+ */
+int
+mport_archive_write_sparse_fd(struct archive *a, struct archive_entry *entry, int fd, off_t size)
+{
+	la_int64_t offset, len;
+	off_t pos = 0;
+
+	archive_entry_sparse_reset(entry);
+
+	while (archive_entry_sparse_next(entry, &offset, &len) == ARCHIVE_OK) {
+		if (archive_write_zeros(a, offset - pos) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		if (archive_write_range(a, fd, offset, offset + len) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		pos = offset + len;
+	}
+
+	return (archive_write_zeros(a, size - pos));
+}
+
+/*
+ * Files are read rather than mapped.  A mapping of a file that something
+ * else truncates raises SIGBUS when the missing pages are touched, and
+ * there is no check that closes that window; pread(2) just comes up short.
+ */
+static int
+archive_write_range(struct archive *a, int fd, off_t offset, off_t end)
+{
+
+	(void)posix_fadvise(fd, offset, end - offset, POSIX_FADV_SEQUENTIAL);
+
+	return (archive_write_fd_rw(a, fd, offset, end));
+}
+
+static int
+archive_write_zeros(struct archive *a, off_t len)
+{
+	static const char zeros[IO_BUFF_SIZE];
+	size_t fill;
+
+	while (len > 0) {
+		fill = len > (off_t)sizeof(zeros) ? sizeof(zeros) : (size_t)len;
+		if (archive_write_data(a, zeros, fill) != (la_ssize_t)fill)
+			RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
+		len -= fill;
+	}
+
+	return (MPORT_OK);
+}
+
+static int
+archive_write_fd_rw(struct archive *a, int fd, off_t offset, off_t size)
+{
+	char stackbuf[IO_BUFF_SIZE];
+	char *buf = stackbuf;
+	size_t bufsize = sizeof(stackbuf);
+	ssize_t len;
+	int ret = MPORT_OK;
+
+	/* small files fit the stack buffer; larger ones get a bigger one if it's there */
+	if (size - offset > (off_t)bufsize && (buf = malloc(IO_READ_SIZE)) != NULL)
+		bufsize = IO_READ_SIZE;
+	else
+		buf = stackbuf;
+
+	while (offset < size) {
+		len = pread(fd, buf, size - offset > (off_t)bufsize ? bufsize : (size_t)(size - offset), offset);
+
+		if (len == 0) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, "File shrank while being archived.");
+			break;
+		}
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = SET_ERRORX(MPORT_ERR_FATAL, "Read failed: %s", strerror(errno));
+			break;
+		}
+
+		if (archive_write_data(a, buf, len) != len) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
+			break;
+		}
+
+		offset += len;
+	}
+
+	if (buf != stackbuf)
+		free(buf);
+
+	return (ret);
+}
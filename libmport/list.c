@@ -36,117 +36,135 @@
 #include <err.h>
 #include <unistd.h>
 
+struct list_print {
+	mportInstance *mport;
+	mportListPrint *print;
+	char *os_release;
+	int count;
+};
+
+static int list_print_pkg(const mportPackageMeta *, void *);
+
 MPORT_PUBLIC_API int
 mport_list_print(mportInstance *mport, mportListPrint *print) 
 {
+	struct list_print l;
+	int ret;
 
-	mportPackageMeta **packs = NULL;
-	mportIndexEntry **indexEntries = NULL;
-	mportIndexEntry **iestart = NULL;
-	mportIndexMovedEntry **movedEntries = NULL;
-	char *comment = NULL;
-	char *os_release = NULL;
-	char name_version[30];
+	l.mport = mport;
+	l.print = print;
+	l.count = 0;
 
-	if (mport_pkgmeta_list(mport, &packs) != MPORT_OK) {
-		mport_pkgmeta_vec_free(packs);
-		RETURN_CURRENT_ERROR;
+	l.os_release = mport_get_osrelease(mport);
+	if (l.os_release == NULL) {
+		RETURN_ERROR(MPORT_ERR_WARN, "Unable to determine the OS release.");
 	}
 
-	if (packs == NULL) {
+	/* packages are printed straight from the database rather than listed first */
+	ret = mport_pkgmeta_foreach(mport, list_print_pkg, &l, NULL);
+	free(l.os_release);
+
+	if (ret != MPORT_OK)
+		return (ret);
+
+	if (l.count == 0) {
 		RETURN_ERROR(MPORT_ERR_WARN, "No packages installed matching.");
 	}
 
-	os_release = mport_get_osrelease(mport);
-	if (os_release == NULL) {
-		RETURN_ERROR(MPORT_ERR_WARN, "Unable to determine the OS release.");
-	}
+	(mport->progress_free_cb)();
+
+	return (MPORT_OK);
+}
+
+static int
+list_print_pkg(const mportPackageMeta *pack, void *arg)
+{
+	struct list_print *l = arg;
+	mportIndexMovedEntry **movedEntries = NULL;
+	char **versions = NULL;
+	char *comment = NULL;
+	char name_version[30];
+	bool os_outdated;
+	int known, i;
+
+	l->count++;
 
-	while (*packs != NULL) {
-		if (print->update) {
-			if (mport_index_lookup_pkgname(mport, (*packs)->name, &indexEntries) != MPORT_OK) {
-				RETURN_ERRORX(MPORT_ERR_FATAL, "Error looking up package name %s: %d %s", (*packs)->name, mport_err_code(), mport_err_string());
+	if (l->print->update) {
+		/* built for an older os release, every index version is an update */
+		os_outdated = pack->version != NULL && mport_version_cmp(pack->os_release, l->os_release) < 0;
+
+		if (mport_index_newer_versions(l->mport, pack->name, pack->version, os_outdated, &versions, &known) != MPORT_OK) {
+			RETURN_WRAP_ERRORX(MPORT_ERR_FATAL, "Error looking up package name %s: %d %s", pack->name, mport_err_code(), mport_err_string());
+		}
+
+		if (known == 0) {
+			free(versions);
+			versions = NULL;
+
+			if (mport_moved_lookup(l->mport, pack->origin, &movedEntries) != MPORT_OK) {
+				mport_call_msg_cb(l->mport,"%-25s %8s is not part of the package repository.", pack->name, pack->version);
+				return (MPORT_OK);
 			}
 
-			if (indexEntries == NULL || *indexEntries == NULL) {
-				if (mport_moved_lookup(mport, (*packs)->origin, &movedEntries) != MPORT_OK) {
-					mport_call_msg_cb(mport,"%-25s %8s is not part of the package repository.", (*packs)->name, (*packs)->version);
-					packs++;
-					continue;
-				}
-
-				if (movedEntries == NULL || *movedEntries == NULL) {
-					mport_call_msg_cb(mport,"%-15s %8s is not part of the package repository.", (*packs)->name, (*packs)->version);
-					packs++;
-					continue;
-				}
-
-				if ((*movedEntries)->moved_to[0]!= '\0') {
-					mport_call_msg_cb(mport,"%-25s %8s was moved to %s", (*packs)->name, (*packs)->version, (*movedEntries)->moved_to);
-					free(movedEntries);
-					movedEntries = NULL;
-					packs++;
-					continue;
-				}
-
-				if ((*movedEntries)->date[0]!= '\0') {
-					mport_call_msg_cb(mport,"%-25s %8s expired on %s", (*packs)->name, (*packs)->version, (*movedEntries)->date);
-					free(movedEntries);
-					movedEntries = NULL;
-					packs++;
-					continue;
-				}
+			if (movedEntries == NULL || *movedEntries == NULL) {
+				mport_call_msg_cb(l->mport,"%-15s %8s is not part of the package repository.", pack->name, pack->version);
+				return (MPORT_OK);
+			}
 
+			if ((*movedEntries)->moved_to[0]!= '\0') {
+				mport_call_msg_cb(l->mport,"%-25s %8s was moved to %s", pack->name, pack->version, (*movedEntries)->moved_to);
 				free(movedEntries);
 				movedEntries = NULL;
+				return (MPORT_OK);
 			}
-	
-			iestart = indexEntries;		
-			while (indexEntries != NULL && *indexEntries != NULL) {
-				if (((*indexEntries)->version != NULL && mport_version_cmp((*packs)->version, (*indexEntries)->version) < 0) 
-					|| ((*packs)->version != NULL && mport_version_cmp((*packs)->os_release, os_release) < 0)) {
-
-					if (mport->verbosity == MPORT_VVERBOSE) {
-						mport_call_msg_cb(mport,"%-25s %8s (%s)  <  %-s", (*packs)->name, (*packs)->version, (*packs)->os_release, (*indexEntries)->version);
-					} else {
-						mport_call_msg_cb(mport,"%-25s %8s  <  %-8s", (*packs)->name, (*packs)->version, (*indexEntries)->version);
-					}
-				}
-				indexEntries++;
+
+			if ((*movedEntries)->date[0]!= '\0') {
+				mport_call_msg_cb(l->mport,"%-25s %8s expired on %s", pack->name, pack->version, (*movedEntries)->date);
+				free(movedEntries);
+				movedEntries = NULL;
+				return (MPORT_OK);
 			}
-				
-			mport_index_entry_free_vec(iestart);
-			iestart = NULL;
-			indexEntries = NULL;
-		} else if (mport->verbosity == MPORT_VBRIEF) {
-			mport_call_msg_cb(mport, "%s-%s", (*packs)->name, (*packs)->version);
-		} else if (mport->verbosity == MPORT_VVERBOSE || print->verbose) {
-			comment = mport_str_remove((*packs)->comment, '\\');
-			snprintf(name_version, 30, "%s-%s", (*packs)->name, (*packs)->version);
-			
-			mport_call_msg_cb(mport,"%-30s\t%6s\t%s", name_version, (*packs)->os_release, comment);
-			free(comment);
-			comment = NULL;
-		} else if (print->prime && (*packs)->automatic == 0) {
-			mport_call_msg_cb(mport,"%s", (*packs)->name);
-		} else if (mport->verbosity == MPORT_VQUIET && !print->origin) {
-			mport_call_msg_cb(mport,"%s", (*packs)->name);
-		} else if (mport->verbosity == MPORT_VQUIET && print->origin) {
-			mport_call_msg_cb(mport,"%s", (*packs)->origin);
-		} else if (print->origin) {
-			mport_call_msg_cb(mport,"Information for %s-%s:\n\nOrigin:\n%s\n",
-						  (*packs)->name, (*packs)->version, (*packs)->origin);
-		} else if (print->locks) {
-			if ((*packs)->locked == 1)
-				mport_call_msg_cb(mport,"%s-%s", (*packs)->name, (*packs)->version);
-
-		} else {
-			mport_call_msg_cb(mport, "%s-%s", (*packs)->name, (*packs)->version);
+
+			free(movedEntries);
+			movedEntries = NULL;
 		}
-		packs++;
-	}
 
-	(mport->progress_free_cb)();
+		/* only the newer versions are returned, compared by version key */
+		for (i = 0; versions != NULL && versions[i] != NULL; i++) {
+			if (l->mport->verbosity == MPORT_VVERBOSE) {
+				mport_call_msg_cb(l->mport,"%-25s %8s (%s)  <  %-s", pack->name, pack->version, pack->os_release, versions[i]);
+			} else {
+				mport_call_msg_cb(l->mport,"%-25s %8s  <  %-8s", pack->name, pack->version, versions[i]);
+			}
+			free(versions[i]);
+		}
+		free(versions);
+		versions = NULL;
+	} else if (l->mport->verbosity == MPORT_VBRIEF) {
+		mport_call_msg_cb(l->mport, "%s-%s", pack->name, pack->version);
+	} else if (l->mport->verbosity == MPORT_VVERBOSE || l->print->verbose) {
+		comment = mport_str_remove(pack->comment, '\\');
+		snprintf(name_version, 30, "%s-%s", pack->name, pack->version);
+		
+		mport_call_msg_cb(l->mport,"%-30s\t%6s\t%s", name_version, pack->os_release, comment);
+		free(comment);
+		comment = NULL;
+	} else if (l->print->prime && pack->automatic == 0) {
+		mport_call_msg_cb(l->mport,"%s", pack->name);
+	} else if (l->mport->verbosity == MPORT_VQUIET && !l->print->origin) {
+		mport_call_msg_cb(l->mport,"%s", pack->name);
+	} else if (l->mport->verbosity == MPORT_VQUIET && l->print->origin) {
+		mport_call_msg_cb(l->mport,"%s", pack->origin);
+	} else if (l->print->origin) {
+		mport_call_msg_cb(l->mport,"Information for %s-%s:\n\nOrigin:\n%s\n",
+					  pack->name, pack->version, pack->origin);
+	} else if (l->print->locks) {
+		if (pack->locked == 1)
+			mport_call_msg_cb(l->mport,"%s-%s", pack->name, pack->version);
+
+	} else {
+		mport_call_msg_cb(l->mport, "%s-%s", pack->name, pack->version);
+	}
 
 	return (MPORT_OK);
 }
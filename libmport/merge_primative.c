@@ -26,6 +26,7 @@
  * SUCH DAMAGE.
  */
 
+
 #include <sys/cdefs.h>
 
 #include <archive.h>
@@ -37,28 +38,61 @@
 #include "mport.h"
 #include "mport_private.h"
 
-/* build a hashtable with pkgname keys, values are a struct with fields for
- * filename, and boolean is_in_db */
+/*
+ * Every input bundle is read once.  The stub database and the metafiles at the
+ * head of each bundle are read into memory while the merged stub is built;
+ * the data files can then be streamed straight into the output once the
+ * install order is known.  To bound memory and descriptors, only the first
+ * MERGE_MAX_OPEN inputs are kept open between the two steps, the others are
+ * reopened (skipping their head) when their files are needed.
+ */
+#define MERGE_MAX_OPEN 32
+
+struct merge_meta {
+  struct archive_entry *entry;
+  void *data;
+};
+
+struct merge_input {
+  const char *file;
+  mportBundleRead *bundle;	/* positioned at the first data file, or NULL */
+  struct merge_meta *meta;
+  size_t meta_count;
+  int pkgs;			/* packages whose files are still to be copied */
+  short meta_written;
+};
+
+/* hashtable with pkgname keys, values are the input bundle holding the package */
 struct table_entry {
-  char *file;
-  short is_in_db;
   char *name;
+  struct merge_input *input;
   struct table_entry *next;
 };
 
-#define TABLE_SIZE 128
+struct merge_table {
+  size_t nbuckets;
+  size_t nentries;
+  struct table_entry **buckets;
+};
 
-static int build_stub_db(mportInstance *, sqlite3 **, const char *, const char *, const char **, struct table_entry **);
-static int archive_metafiles(mportBundleWrite *, sqlite3 *, struct table_entry **);
-static int archive_package_files(mportBundleWrite *, sqlite3 *, struct table_entry **);
-static int extract_stub_db(const char *, const char *);
+#define TABLE_SIZE 128
 
-static struct table_entry * find_in_table(struct table_entry **, const char *);
-static int insert_into_table(struct table_entry **, const char *, const char *);
+static int merge(mportInstance *, const char **, const char *, int);
+static int build_stub_db(mportInstance *, sqlite3 **, const char *, struct merge_input *, size_t, struct merge_table *, int);
+static int read_input_head(sqlite3 *, struct merge_input *, int, int);
+static int attach_stub_db(sqlite3 *, struct merge_input *);
+static int read_entry_data(struct archive *, struct archive_entry *, void **);
+static int archive_members(mportBundleWrite *, sqlite3 *, struct merge_table *);
+static int archive_metafiles(mportBundleWrite *, sqlite3 *, struct merge_table *);
+static int archive_package_files(mportBundleWrite *, sqlite3 *, struct merge_table *);
+static void free_inputs(struct merge_input *, size_t);
+
+static int init_table(struct merge_table *);
+static void free_table(struct merge_table *);
+static struct table_entry * find_in_table(struct merge_table *, const char *);
+static int insert_into_table(struct merge_table *, const char *, struct merge_input *);
 static uint32_t SuperFastHash(const char *);
 
-#include <err.h>
-
 /*
  * mport_merge_primative(filenames, outfile)
  *
@@ -69,114 +103,189 @@ static uint32_t SuperFastHash(const char *);
  */ 
 MPORT_PUBLIC_API int
 mport_merge_primative(mportInstance *mport, const char **filenames, const char *outfile)
+{
+  return merge(mport, filenames, outfile, 0);
+}
+
+/*
+ * mport_merge_members_primative(filenames, outfile)
+ *
+ * Like mport_merge_primative(), but the input bundles are stored whole as
+ * members of an uncompressed container rather than being unpacked and
+ * recompressed into one stream.  Building is just a copy, and the installer
+ * only has to decompress the member it is installing.  Each input bundle
+ * must hold exactly one package.
+ */
+MPORT_PUBLIC_API int
+mport_merge_members_primative(mportInstance *mport, const char **filenames, const char *outfile)
+{
+  return merge(mport, filenames, outfile, 1);
+}
+
+static int
+merge(mportInstance *mport, const char **filenames, const char *outfile, int members)
 {
   sqlite3 *db = NULL;
   mportBundleWrite *bundle = NULL;
-  struct table_entry **table = NULL;
+  struct merge_table table;
+  struct merge_input *inputs = NULL;
+  size_t count, i;
   char tmpdir[] = "/tmp/mport.XXXXXXXX";
   char *dbfile = NULL;
-  
-  if ((table = (struct table_entry **)calloc(TABLE_SIZE, sizeof(struct table_entry *))) == NULL)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate hash table.");
+  int ret = MPORT_OK;
   
   DIAG("mport_merge_primative(%p, %s)", filenames, outfile)
+
+  for (count = 0; filenames[count] != NULL; count++)
+    ;
+
+  if ((inputs = calloc(count, sizeof(struct merge_input))) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate input list.");
+  for (i = 0; i < count; i++)
+    inputs[i].file = filenames[i];
+
+  if (init_table(&table) != MPORT_OK) {
+    free(inputs);
+    RETURN_CURRENT_ERROR;
+  }
   
-  if (mkdtemp(tmpdir) == NULL)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't make temp directory.");
-  if (asprintf(&dbfile, "%s/%s", tmpdir, "merged.db") == -1)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't build merge database name.");
+  if (mkdtemp(tmpdir) == NULL) {
+    ret = SET_ERROR(MPORT_ERR_FATAL, "Couldn't make temp directory.");
+    goto CLEANUP;
+  }
+  if (asprintf(&dbfile, "%s/%s", tmpdir, "merged.db") == -1) {
+    ret = SET_ERROR(MPORT_ERR_FATAL, "Couldn't build merge database name.");
+    goto CLEANUP;
+  }
   
   DIAG("Building stub")
 
   /* this function merges the stub databases into one db. */      
-  if (build_stub_db(mport, &db, tmpdir, dbfile, filenames, table) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
+  if ((ret = build_stub_db(mport, &db, dbfile, inputs, count, &table, members)) != MPORT_OK)
+    goto CLEANUP;
   
   DIAG("Stub complete: %s", dbfile)
     
   /* set up the bundle, and add our new stub database to it. */
-  if ((bundle = mport_bundle_write_new()) == NULL)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't alloca bundle struct.");
-  if (mport_bundle_write_init(bundle, outfile) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
+  if ((bundle = mport_bundle_write_new()) == NULL) {
+    ret = SET_ERROR(MPORT_ERR_FATAL, "Couldn't alloca bundle struct.");
+    goto CLEANUP;
+  }
+  if (members)
+    ret = mport_bundle_write_init_container(bundle, outfile);
+  else
+    ret = mport_bundle_write_init(bundle, outfile);
+  if (ret != MPORT_OK)
+    goto CLEANUP;
    
   DIAG("Adding %s", dbfile)
     
-  if (mport_bundle_write_add_file(bundle, dbfile, MPORT_STUB_DB_FILE) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
-  
-  DIAG("Adding metafiles")
-  /* add all the meta files in the correct order */
-  if (archive_metafiles(bundle, db, table) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
+  if ((ret = mport_bundle_write_add_file(bundle, dbfile, MPORT_STUB_DB_FILE)) != MPORT_OK)
+    goto CLEANUP;
 
-  DIAG("Adding realfiles")
-  /* add all the other files */     
-  if (archive_package_files(bundle, db, table) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
+  if (members) {
+    DIAG("Adding members")
+    if ((ret = archive_members(bundle, db, &table)) != MPORT_OK)
+      goto CLEANUP;
+  } else {
+    DIAG("Adding metafiles")
+    /* add all the meta files in the correct order */
+    if ((ret = archive_metafiles(bundle, db, &table)) != MPORT_OK)
+      goto CLEANUP;
 
-  DIAG("Realfiles complete")
+    DIAG("Adding realfiles")
+    /* add all the other files */     
+    if ((ret = archive_package_files(bundle, db, &table)) != MPORT_OK)
+      goto CLEANUP;
+
+    DIAG("Realfiles complete")
+  }
   
-  if (mport_bundle_write_finish(bundle) != MPORT_OK)
-    RETURN_CURRENT_ERROR;
- 
- /*if (mport_rmtree(tmpdir) != MPORT_OK)
-   RETURN_CURRENT_ERROR; */
- 
- return MPORT_OK;
+  ret = mport_bundle_write_finish(bundle);
+  bundle = NULL;
+
+CLEANUP:
+  if (bundle != NULL)
+    mport_bundle_write_finish(bundle);
+  if (db != NULL)
+    sqlite3_close(db);
+  free_inputs(inputs, count);
+  free_table(&table);
+  if (dbfile != NULL) {
+    (void)mport_rmtree(tmpdir);
+    free(dbfile);
+  }
+
+  return ret;
 }
 
 
-/* This function goes through each file, and builds up the merged database as
- * filename `dbfile`.  It also builds up the hashtable of package -> filename pairs.
+/* This function goes through each input, and builds up the merged database as
+ * filename `dbfile`.  It also builds up the hashtable of package -> input pairs.
  * When this function is done, db points to a readonly sqlite object representing
  * the merged db.
  */
-static int build_stub_db(mportInstance *mport, sqlite3 **db,  const char *tmpdir,  const char *dbfile,  const char **filenames, struct table_entry **table)
+static int build_stub_db(mportInstance *mport, sqlite3 **db, const char *dbfile, struct merge_input *inputs, size_t count, struct merge_table *table, int members)
 {
-  char *tmpdbfile;
-  const char *name;
-  const char *file = NULL;
-  int made_table = 0, ret;
+  struct merge_input *input;
+  const char *name, *dup;
+  int made_table = 0, ret, nrows;
+  size_t i;
   sqlite3_stmt *stmt;
   
-  if (asprintf(&tmpdbfile, "%s/%s", tmpdir, "pkg.db") == -1)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't make stub db tempfile.");
-  
   if (sqlite3_open(dbfile, db) != SQLITE_OK)
     RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(*db));
   
   if (mport_generate_stub_schema(mport, *db) != MPORT_OK)
     RETURN_CURRENT_ERROR;
     
-  for (file = *filenames; file != NULL; file = *(++filenames)) {
-    DIAG("Visiting %s", file)
-    if (extract_stub_db(file, tmpdbfile) != MPORT_OK)
+  for (i = 0; i < count; i++) {
+    input = &inputs[i];
+    DIAG("Visiting %s", input->file)
+
+    /* attaches the input's stub db as subbundle */
+    if (read_input_head(*db, input, members, i < MERGE_MAX_OPEN) != MPORT_OK)
       RETURN_CURRENT_ERROR;
 
-    if (mport_db_do(*db, "ATTACH %Q AS subbundle", tmpdbfile) != MPORT_OK)
+    /* the files of a member bundle are inside its members; it can't be merged again */
+    if (mport_db_count(*db, &nrows, "SELECT COUNT(*) FROM subbundle.sqlite_master WHERE type='table' AND name='members'") != MPORT_OK)
       RETURN_CURRENT_ERROR;
+    if (nrows != 0)
+      RETURN_ERRORX(MPORT_ERR_FATAL, "%s: member bundles can not be merged", input->file);
+
+    if (members) {
+      if (mport_db_count(*db, &nrows, "SELECT COUNT(*) FROM subbundle.packages") != MPORT_OK)
+        RETURN_CURRENT_ERROR;
+      if (nrows != 1)
+        RETURN_ERRORX(MPORT_ERR_FATAL, "%s: holds %i packages, members must hold one", input->file, nrows);
+    }
     
     if (mport_db_do(*db, "BEGIN TRANSACTION") != MPORT_OK)
       RETURN_CURRENT_ERROR;
       
+    /*
+     * The first bundle with a package wins, so rows of packages already
+     * merged are left out; unsorted holds every package merged so far.
+     */
+    dup = made_table ? " WHERE pkg NOT IN (SELECT pkg FROM unsorted)" : "";
+
+    if (mport_db_do(*db, "INSERT INTO assets SELECT * FROM subbundle.assets%s", dup) != MPORT_OK) 
+      RETURN_CURRENT_ERROR;
+    if (mport_db_do(*db, "INSERT INTO conflicts SELECT * FROM subbundle.conflicts%s", dup) != MPORT_OK) 
+      RETURN_CURRENT_ERROR;
+    if (mport_db_do(*db, "INSERT INTO depends SELECT * FROM subbundle.depends%s", dup) != MPORT_OK) 
+      RETURN_CURRENT_ERROR;
+
     if (made_table == 0) { 
       made_table++;
       if (mport_db_do(*db, "CREATE TABLE unsorted AS SELECT * FROM subbundle.packages") != MPORT_OK)
         RETURN_CURRENT_ERROR;
     } else {
-      if (mport_db_do(*db, "INSERT INTO unsorted SELECT * FROM subbundle.packages") != MPORT_OK)
+      if (mport_db_do(*db, "INSERT INTO unsorted SELECT * FROM subbundle.packages%s", dup) != MPORT_OK)
         RETURN_CURRENT_ERROR;
     }
-    
-    if (mport_db_do(*db, "INSERT INTO assets SELECT * FROM subbundle.assets") != MPORT_OK) 
-      RETURN_CURRENT_ERROR;
-    if (mport_db_do(*db, "INSERT INTO conflicts SELECT * FROM subbundle.conflicts") != MPORT_OK) 
-      RETURN_CURRENT_ERROR;
-    if (mport_db_do(*db, "INSERT INTO depends SELECT * FROM subbundle.depends") != MPORT_OK) 
-      RETURN_CURRENT_ERROR;
 
-    /* build our hashtable (pkgname => metadata) up */      
+    /* build our hashtable (pkgname => input) up */      
     if (mport_db_prepare(*db, &stmt, "SELECT pkg FROM subbundle.packages") != MPORT_OK) {
       sqlite3_finalize(stmt);
       RETURN_CURRENT_ERROR;
@@ -187,10 +296,14 @@ static int build_stub_db(mportInstance *mport, sqlite3 **db,  const char *tmpdir
       
       if (ret == SQLITE_ROW) {
         name = sqlite3_column_text(stmt, 0);
-        if (insert_into_table(table, name, file) != MPORT_OK) {
+        /* the first bundle with a package wins */
+        if (find_in_table(table, name) != NULL)
+          continue;
+        if (insert_into_table(table, name, input) != MPORT_OK) {
           sqlite3_finalize(stmt);
           RETURN_CURRENT_ERROR;
         }
+        input->pkgs++;
       } else if (ret == SQLITE_DONE) {
         break;
       } else {
@@ -246,6 +359,16 @@ static int build_stub_db(mportInstance *mport, sqlite3 **db,  const char *tmpdir
   
   if (pkgs != unsort) 
     RETURN_ERRORX(MPORT_ERR_FATAL, "Sorted (%i) and unsorted (%i) counts do no match.", pkgs, unsort);
+
+  /* members are stored in install order, so the installer only ever reads forward */
+  if (members) {
+    if (mport_db_do(*db, "CREATE TABLE members (pkg text NOT NULL, version text NOT NULL, member text NOT NULL)") != MPORT_OK)
+      RETURN_CURRENT_ERROR;
+    if (mport_db_do(*db, "INSERT INTO members SELECT pkg, version, pkg || '-' || version || '.mport' FROM packages ORDER BY rowid") != MPORT_OK)
+      RETURN_CURRENT_ERROR;
+    if (mport_db_do(*db, "UPDATE meta SET value=%i WHERE field='bundle_format_version'", MPORT_BUNDLE_VERSION_MEMBERS) != MPORT_OK)
+      RETURN_CURRENT_ERROR;
+  }
     
       
   /* Close the stub database handle, and reopen as read only to ensure that we don't
@@ -260,15 +383,184 @@ static int build_stub_db(mportInstance *mport, sqlite3 **db,  const char *tmpdir
 }
 
 
-static int archive_metafiles(mportBundleWrite *bundle, sqlite3 *db, struct table_entry **table) 
+/*
+ * Open an input bundle, attach its stub database to db as subbundle and, unless
+ * we're only collecting members, read its metafiles into memory.  The bundle is
+ * left positioned at the first data file, or closed if too many are open.
+ */
+static int read_input_head(sqlite3 *db, struct merge_input *input, int members, int keep_open)
+{
+  struct archive_entry *entry;
+  struct merge_meta *meta;
+  size_t nalloc = 0;
+
+  if ((input->bundle = mport_bundle_read_new()) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+  if (mport_bundle_read_init(input->bundle, input->file) != MPORT_OK)
+    RETURN_CURRENT_ERROR;
+
+  if (attach_stub_db(db, input) != MPORT_OK)
+    RETURN_CURRENT_ERROR;
+
+  while (!members) {
+    if (mport_bundle_read_next_entry(input->bundle, &entry) != MPORT_OK)
+      RETURN_CURRENT_ERROR;
+
+    if (entry == NULL)
+      break;
+
+    if (*(archive_entry_pathname(entry)) != '+') {
+      input->bundle->firstreal = entry;
+      break;
+    }
+
+    if (input->meta_count == nalloc) {
+      nalloc = nalloc == 0 ? 4 : nalloc * 2;
+      if ((meta = reallocarray(input->meta, nalloc, sizeof(struct merge_meta))) == NULL)
+        RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+      input->meta = meta;
+    }
+
+    meta = &input->meta[input->meta_count];
+    meta->data = NULL;
+    if ((meta->entry = archive_entry_clone(entry)) == NULL)
+      RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+    input->meta_count++;
+
+    if (read_entry_data(input->bundle->archive, entry, &meta->data) != MPORT_OK)
+      RETURN_CURRENT_ERROR;
+  }
+
+  if (members || !keep_open) {
+    if (mport_bundle_read_finish(NULL, input->bundle) != MPORT_OK) {
+      input->bundle = NULL;
+      RETURN_CURRENT_ERROR;
+    }
+    input->bundle = NULL;
+  }
+
+  return MPORT_OK;
+}
+
+
+/* Read the stub database at the head of input into memory and attach it as subbundle. */
+static int attach_stub_db(sqlite3 *db, struct merge_input *input)
+{
+  struct archive_entry *entry;
+  unsigned char *data;
+  la_int64_t size;
+
+  if (mport_bundle_read_next_entry(input->bundle, &entry) != MPORT_OK)
+    RETURN_CURRENT_ERROR;
+
+  if (entry == NULL || strcmp(archive_entry_pathname(entry), MPORT_STUB_DB_FILE) != 0)
+    RETURN_ERRORX(MPORT_ERR_FATAL, "%s: Invalid bundle file: stub database is not the first file", input->file);
+
+  size = archive_entry_size(entry);
+
+  if (size <= 0)
+    RETURN_ERRORX(MPORT_ERR_FATAL, "%s: empty stub database", input->file);
+
+  /* sqlite owns this buffer once it is deserialized */
+  if ((data = sqlite3_malloc64((sqlite3_uint64)size)) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+  if (archive_read_data(input->bundle->archive, data, (size_t)size) != size) {
+    sqlite3_free(data);
+    RETURN_ERRORX(MPORT_ERR_FATAL, "Unable to read %s: %s", input->file, archive_error_string(input->bundle->archive));
+  }
+
+  if (mport_db_do(db, "ATTACH ':memory:' AS subbundle") != MPORT_OK) {
+    sqlite3_free(data);
+    RETURN_CURRENT_ERROR;
+  }
+
+  if (sqlite3_deserialize(db, "subbundle", data, size, size,
+      SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_READONLY) != SQLITE_OK)
+    RETURN_ERRORX(MPORT_ERR_FATAL, "%s: unable to load stub database: %s", input->file, sqlite3_errmsg(db));
+
+  return MPORT_OK;
+}
+
+
+/* read the data of the current entry of a into a newly allocated buffer. */
+static int read_entry_data(struct archive *a, struct archive_entry *entry, void **datap)
+{
+  la_int64_t size = archive_entry_size(entry);
+
+  *datap = NULL;
+
+  if (size <= 0)
+    return MPORT_OK;
+
+  if ((*datap = malloc((size_t)size)) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+  if (archive_read_data(a, *datap, (size_t)size) != size)
+    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
+
+  return MPORT_OK;
+}
+
+
+/* add each input bundle to the container as is, in install order. */
+static int archive_members(mportBundleWrite *bundle, sqlite3 *db, struct merge_table *table)
+{
+  sqlite3_stmt *stmt;
+  const char *pkgname;
+  const char *member;
+  struct table_entry *match;
+  int ret;
+
+  if (mport_db_prepare(db, &stmt, "SELECT pkg, member FROM members ORDER BY rowid") != MPORT_OK) {
+    sqlite3_finalize(stmt);
+    RETURN_CURRENT_ERROR;
+  }
+
+  while (1) {
+    ret = sqlite3_step(stmt);
+
+    if (ret == SQLITE_DONE)
+      break;
+
+    if (ret != SQLITE_ROW) {
+      SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+      sqlite3_finalize(stmt);
+      RETURN_CURRENT_ERROR;
+    }
+
+    pkgname = sqlite3_column_text(stmt, 0);
+    member  = sqlite3_column_text(stmt, 1);
+
+    if ((match = find_in_table(table, pkgname)) == NULL) {
+      sqlite3_finalize(stmt);
+      RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't find package '%s' in filename table.", pkgname);
+    }
+
+    DIAG("Adding member %s", member)
+
+    if (mport_bundle_write_add_file(bundle, match->input->file, member) != MPORT_OK) {
+      sqlite3_finalize(stmt);
+      RETURN_CURRENT_ERROR;
+    }
+  }
+
+  sqlite3_finalize(stmt);
+
+  return MPORT_OK;
+}
+
+
+/* write the metafiles held in memory, in install order, once per input. */
+static int archive_metafiles(mportBundleWrite *bundle, sqlite3 *db, struct merge_table *table) 
 {
   sqlite3_stmt *stmt;
   int ret, sret;
-  char *filename;
   const char *pkgname;
   struct table_entry *match = NULL;
-  mportBundleRead *inbundle= NULL;
-  struct archive_entry *entry;
+  struct merge_input *input;
+  size_t i;
   
   ret = MPORT_OK;
         
@@ -296,51 +588,24 @@ static int archive_metafiles(mportBundleWrite *bundle, sqlite3 *db, struct table
       goto DONE;
     }
     
-    filename = match->file;
-    
-    if ((inbundle = mport_bundle_read_new()) == NULL) {
-      SET_ERROR(MPORT_ERR_FATAL, "Couldn't allocate bundle");
-      goto DONE;
-    }
+    input = match->input;
 
-    
-    if (mport_bundle_read_init(inbundle, filename) != MPORT_OK) {
-      ret = mport_bundle_read_finish(NULL, inbundle);
-      goto DONE;
-    }
+    if (input->meta_written)
+      continue;
+    input->meta_written = 1;
 
-    
-    /* skip the sub db */
-    if (mport_bundle_read_next_entry(inbundle, &entry) != MPORT_OK) {
-      ret = mport_bundle_read_finish(NULL, inbundle);
-      goto DONE;
-    }
-    if (archive_read_data_skip(inbundle->archive) != ARCHIVE_OK) {
-      ret = mport_bundle_read_finish(NULL, inbundle);
-      ret = SET_ERRORX(MPORT_ERR_FATAL, "Unable to read %s: %s", filename, archive_error_string(inbundle->archive));
-      goto DONE;
-    }
-    
-    
-    while (1) {
-      if (mport_bundle_read_next_entry(inbundle, &entry) != MPORT_OK) {
-        ret = mport_bundle_read_finish(NULL, inbundle);
-        goto DONE;
-      } 
-      
-      if (*(archive_entry_pathname(entry)) != '+')
-        break;
-      
-      DIAG("Adding %s", archive_entry_pathname(entry))
-      
-      if ((ret = mport_bundle_write_add_entry(bundle, inbundle, entry)) != MPORT_OK) {
-        DIAG("bundle add entry failed")
-        ret = mport_bundle_read_finish(NULL, inbundle);
+    for (i = 0; i < input->meta_count; i++) {
+      DIAG("Adding %s", archive_entry_pathname(input->meta[i].entry))
+
+      if ((ret = mport_bundle_write_add_buffer(bundle, input->meta[i].entry, input->meta[i].data)) != MPORT_OK)
         goto DONE;
-      }
-    }
 
-    ret = mport_bundle_read_finish(NULL, inbundle);    
+      /* nothing needs it after this */
+      archive_entry_free(input->meta[i].entry);
+      free(input->meta[i].data);
+      input->meta[i].entry = NULL;
+      input->meta[i].data = NULL;
+    }
   }
   
   DONE:
@@ -350,11 +615,12 @@ static int archive_metafiles(mportBundleWrite *bundle, sqlite3 *db, struct table
 
 
 
-static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct table_entry **table)
+static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct merge_table *table)
 {
   sqlite3_stmt *stmt, *files;
   int ret;
   struct table_entry *cur;
+  struct merge_input *input;
   const char *pkgname;
   const char *file;
   mportBundleRead *inbundle;
@@ -385,25 +651,25 @@ static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct t
       RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't find package '%s' in bundle hash table", pkgname);
     }
     
-    file = cur->file;
-        
-    if ((inbundle = mport_bundle_read_new()) == NULL)
-      RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
-        
-    
-    if (mport_bundle_read_init(inbundle, file) != MPORT_OK) {
-      mport_bundle_read_finish(NULL, inbundle);
-      RETURN_CURRENT_ERROR;
-    }
-    
-    if (mport_bundle_read_skip_metafiles(inbundle) != MPORT_OK) {
-      mport_bundle_read_finish(NULL, inbundle);
-      sqlite3_finalize(stmt);
-      RETURN_CURRENT_ERROR;
+    input = cur->input;
+
+    /* this input was closed to save descriptors, reopen it */
+    if (input->bundle == NULL) {
+      if ((input->bundle = mport_bundle_read_new()) == NULL) {
+        sqlite3_finalize(stmt);
+        RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+      }
+
+      if (mport_bundle_read_init(input->bundle, input->file) != MPORT_OK ||
+          mport_bundle_read_skip_metafiles(input->bundle) != MPORT_OK) {
+        sqlite3_finalize(stmt);
+        RETURN_CURRENT_ERROR;
+      }
     }
 
+    inbundle = input->bundle;
+
     if (mport_db_prepare(db, &files, "SELECT data FROM assets WHERE pkg=%Q AND (type=%i or type=%i or type=%i)", pkgname, ASSET_FILE, ASSET_SAMPLE, ASSET_SAMPLE_OWNER_MODE) != MPORT_OK) {
-      mport_bundle_read_finish(NULL, inbundle);
       sqlite3_finalize(stmt);
       RETURN_CURRENT_ERROR;
     }
@@ -412,28 +678,24 @@ static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct t
       int fret = sqlite3_step(files);
 
       if (fret == SQLITE_DONE) {
-        sqlite3_finalize(files);
         break;
       } else if (fret != SQLITE_ROW) {
         SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
         sqlite3_finalize(stmt);
         sqlite3_finalize(files);
-        mport_bundle_read_finish(NULL, inbundle);
         RETURN_CURRENT_ERROR;
       }
       
       file = sqlite3_column_text(files, 0);
       
       if (mport_bundle_read_next_entry(inbundle, &entry) != MPORT_OK) {
-        mport_bundle_read_finish(NULL, inbundle);
         sqlite3_finalize(stmt);
         sqlite3_finalize(files);
         RETURN_CURRENT_ERROR;
       } 
       
-      if (strcmp(file, archive_entry_pathname(entry)) != 0) {
-        SET_ERRORX(MPORT_ERR_FATAL, "Plist to archive mismatch in package %s: found '%s', expected '%s'", pkgname, archive_entry_pathname(entry), file);
-        mport_bundle_read_finish(NULL, inbundle);
+      if (entry == NULL || strcmp(file, archive_entry_pathname(entry)) != 0) {
+        SET_ERRORX(MPORT_ERR_FATAL, "Plist to archive mismatch in package %s: found '%s', expected '%s'", pkgname, entry == NULL ? "end of archive" : archive_entry_pathname(entry), file);
         sqlite3_finalize(stmt);
         sqlite3_finalize(files);
         RETURN_CURRENT_ERROR;
@@ -442,7 +704,6 @@ static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct t
       DIAG("Adding realfile: %s", archive_entry_pathname(entry));
   
       if (mport_bundle_write_add_entry(bundle, inbundle, entry) != MPORT_OK) {
-        mport_bundle_read_finish(NULL, inbundle);
         sqlite3_finalize(stmt);
         sqlite3_finalize(files);
         RETURN_CURRENT_ERROR;
@@ -451,7 +712,14 @@ static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct t
   
     /* we're done with this package, onto the next one */
     sqlite3_finalize(files);
-    mport_bundle_read_finish(NULL, inbundle);
+
+    if (--input->pkgs == 0) {
+      input->bundle = NULL;
+      if (mport_bundle_read_finish(NULL, inbundle) != MPORT_OK) {
+        sqlite3_finalize(stmt);
+        RETURN_CURRENT_ERROR;
+      }
+    }
   } 
   
   sqlite3_finalize(stmt);
@@ -460,87 +728,107 @@ static int archive_package_files(mportBundleWrite *bundle, sqlite3 *db, struct t
 }
 
 
-
-/* get the stub database file out of filename and place it at destfile */
-static int extract_stub_db(const char *filename, const char *destfile)
+static void free_inputs(struct merge_input *inputs, size_t count)
 {
-  struct archive *a = archive_read_new();
-  struct archive_entry *entry;
-  
-  if (a == NULL)
-    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate read archive struct");
+  size_t i, j;
 
-  if (archive_read_support_format_tar(a) != ARCHIVE_OK)
-    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
-  if (archive_read_support_filter_xz(a))
-    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
-    
-  if (archive_read_open_filename(a, filename, 10240) != ARCHIVE_OK) {
-    SET_ERRORX(MPORT_ERR_FATAL, "Could not open %s: %s", filename, archive_error_string(a));
-    archive_read_free(a);
-    RETURN_CURRENT_ERROR;
-  }
-  
-  if (archive_read_next_header(a, &entry) != ARCHIVE_OK) {
-    SET_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
-    archive_read_free(a);
-    RETURN_CURRENT_ERROR;
-  }
-  
-  if (strcmp(archive_entry_pathname(entry), MPORT_STUB_DB_FILE) != 0) {
-    archive_read_free(a);
-    RETURN_ERROR(MPORT_ERR_FATAL, "Invalid bundle file: stub database is not the first file");
-  }
-    
-  archive_entry_set_pathname(entry, destfile);
-  
-  if (archive_read_extract(a, entry, 0) != ARCHIVE_OK) {
-    SET_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
-    archive_read_free(a);
-    RETURN_CURRENT_ERROR;
+  for (i = 0; i < count; i++) {
+    if (inputs[i].bundle != NULL)
+      mport_bundle_read_finish(NULL, inputs[i].bundle);
+
+    for (j = 0; j < inputs[i].meta_count; j++) {
+      if (inputs[i].meta[j].entry != NULL)
+        archive_entry_free(inputs[i].meta[j].entry);
+      free(inputs[i].meta[j].data);
+    }
+    free(inputs[i].meta);
   }
-  
-  if (archive_read_free(a) != ARCHIVE_OK)
-    RETURN_ERROR(MPORT_ERR_FATAL, archive_error_string(a));
-    
+
+  free(inputs);
+}
+
+
+static int init_table(struct merge_table *table)
+{
+  table->nbuckets = TABLE_SIZE;
+  table->nentries = 0;
+
+  if ((table->buckets = calloc(table->nbuckets, sizeof(table->buckets[0]))) == NULL)
+    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate hash table.");
+
   return MPORT_OK;
 }
 
 
-/* insert into a name => file pair into the given hash table. */
-static int insert_into_table(struct table_entry **table, const char *name, const char *file)
+static void free_table(struct merge_table *table)
 {
-  struct table_entry *node, *cur;
-  int hash = SuperFastHash(name) % TABLE_SIZE;
+  struct table_entry *e, *next;
+  size_t i;
+
+  for (i = 0; i < table->nbuckets; i++) {
+    for (e = table->buckets[i]; e != NULL; e = next) {
+      next = e->next;
+      free(e->name);
+      free(e);
+    }
+  }
+
+  free(table->buckets);
+}
+
+
+/* insert into a name => input pair into the given hash table. */
+static int insert_into_table(struct merge_table *table, const char *name, struct merge_input *input)
+{
+  struct table_entry *node, *next, **new_buckets;
+  size_t i, new_size, hash;
+
+  /* keep the chains short; double the table when it averages two entries a bucket */
+  if (table->nentries > table->nbuckets * 2) {
+    new_size = table->nbuckets * 2;
+
+    if ((new_buckets = calloc(new_size, sizeof(table->buckets[0]))) == NULL)
+      RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't expand hash table.");
+
+    for (i = 0; i < table->nbuckets; i++) {
+      for (node = table->buckets[i]; node != NULL; node = next) {
+        next = node->next;
+        hash = SuperFastHash(node->name) % new_size;
+        node->next = new_buckets[hash];
+        new_buckets[hash] = node;
+      }
+    }
+
+    free(table->buckets);
+    table->buckets  = new_buckets;
+    table->nbuckets = new_size;
+  }
+
+  hash = SuperFastHash(name) % table->nbuckets;
   
   if ((node = (struct table_entry *)calloc(1, sizeof(struct table_entry))) == NULL)
     RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate table entry");
 
-  node->name     = strdup(name);
-  node->file     = strdup(file);
-  node->is_in_db = 0;
-  node->next     = NULL;
-   
-  if (table[hash] == NULL) {     
-    table[hash] = node;   
-  } else {
-    cur = table[hash];
-    while (cur->next != NULL) 
-      cur = cur->next;
-  
-    cur->next = node;
+  if ((node->name = strdup(name)) == NULL) {
+    free(node);
+    RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate table entry");
   }
+
+  node->input = input;
+  node->next  = table->buckets[hash];
+  table->buckets[hash] = node;
+  table->nentries++;
   
   return MPORT_OK;
 }
 
 
-static struct table_entry * find_in_table(struct table_entry **table, const char *name)
+static struct table_entry * find_in_table(struct merge_table *table, const char *name)
 {
-  int hash = SuperFastHash(name) % TABLE_SIZE;
+  size_t hash = SuperFastHash(name) % table->nbuckets;
   struct table_entry *e = NULL;
   
-  e = table[hash];  
+  e = table->buckets[hash];  
   while (e != NULL) {
     if (strcmp(e->name, name) == 0)
       return e;
@@ -550,9 +838,8 @@ static struct table_entry * find_in_table(struct table_entry **table, const char
   
   return e;
 }
-      
-      
-    
+
+
       
 /* Paul Hsieh's fast hash function, from http://www.azillionmonkeys.com/qed/hash.html */
 /* This function has been modified to only work with C strings */
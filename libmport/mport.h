@@ -48,6 +48,7 @@ typedef int (*mport_confirm_cb)(const char *, const char *, const char *, int);
 
 /* Mport Instance (an installed copy of the mport system) */
 #define MPORT_INST_HAVE_INDEX 1
+#define MPORT_INST_HAVE_VULNDB 2
 #define MPORT_LOCAL_PKG_PATH "/var/db/mport/downloads"
 
 enum _Verbosity{
@@ -59,6 +60,11 @@ enum _Verbosity{
 typedef enum _Verbosity mportVerbosity;
 mportVerbosity mport_verbosity(bool quiet, bool verbose, bool brief);
 
+struct mport_pool;
+struct mport_op;
+struct mport_txn;
+struct mport_reqcache;
+
 typedef struct {
   int flags;
   sqlite3 *db;
@@ -73,6 +79,10 @@ typedef struct {
   mport_progress_step_cb progress_step_cb;
   mport_progress_free_cb progress_free_cb;
   mport_confirm_cb confirm_cb;
+  struct mport_pool *pool; /* worker threads, started on first use */
+  struct mport_op *op; /* asynchronous operation in progress */
+  struct mport_txn *txn; /* open transaction */
+  struct mport_reqcache *reqs; /* compiled version requirements */
 } mportInstance;
 
 mportInstance * mport_instance_new(void);
@@ -107,24 +117,41 @@ enum _AssetListEntryType {
 
 typedef enum _AssetListEntryType mportAssetListEntryType;
 
-struct _AssetListEntry {
-	mportAssetListEntryType type;
-	char checksum[65];
-	char owner[MAXLOGNAME];
-	char group[MAXLOGNAME * 2]; /* no standard for this, just guess */
-	char mode[5];
-	char *data;
+struct mport_arena;
 
+/*
+ * Entries and their strings live in the owning list's arena.  owner, group
+ * and mode are interned and never NULL ("" when unset); the checksum is kept
+ * as a raw digest, see mport_asset_checksum() for the hex form.
+ */
+struct _AssetListEntry {
 	STAILQ_ENTRY(_AssetListEntry) next;
+	char *data;
+	const char *owner;
+	const char *group;
+	const char *mode;
+	unsigned char checksum[32];
+	unsigned char checksum_len;	/* 0 if there is none */
+	unsigned char type;	/* mportAssetListEntryType */
 };
 
-STAILQ_HEAD(_AssetList, _AssetListEntry);
+struct _AssetList {
+	struct _AssetListEntry *stqh_first;	/* STAILQ_HEAD compatible */
+	struct _AssetListEntry **stqh_last;
+	struct mport_arena *arena;
+};
 
 typedef struct _AssetList mportAssetList;
 typedef struct _AssetListEntry mportAssetListEntry;
 
+#define MPORT_ASSET_CHECKSUM_HEXLEN 65
+
 mportAssetList* mport_assetlist_new(void);
 void mport_assetlist_free(mportAssetList *);
+mportAssetListEntry * mport_assetlist_append(mportAssetList *, mportAssetListEntryType, const char *);
+int mport_asset_set_attrs(mportAssetList *, mportAssetListEntry *, const char *, const char *, const char *);
+int mport_asset_set_checksum(mportAssetListEntry *, const char *);
+char * mport_asset_checksum(const mportAssetListEntry *, char *);
 int mport_parse_plistfile(FILE *, mportAssetList *);
 
 enum _Automatic{
@@ -173,6 +200,7 @@ typedef struct {
     mportAction action; // not populated from package table
     mportType type;
     int64_t flatsize;
+    struct mport_arena *arena; /* owner of the strings when part of a query result */
 } __attribute__ ((aligned (16)))  mportPackageMeta;
 
 int mport_asset_get_assetlist(mportInstance *, mportPackageMeta *, mportAssetList **);
@@ -184,6 +212,8 @@ void mport_pkgmeta_vec_free(mportPackageMeta **);
 int mport_pkgmeta_search_master(mportInstance *, mportPackageMeta ***, const char *, ...);
 int mport_pkgmeta_list(mportInstance *mport, mportPackageMeta ***ref);
 int mport_pkgmeta_list_locked(mportInstance *mport, mportPackageMeta ***ref);
+typedef int (*mport_pkgmeta_cb)(const mportPackageMeta *, void *);
+int mport_pkgmeta_foreach(mportInstance *, mport_pkgmeta_cb, void *, const char *, ...);
 int mport_pkgmeta_get_downdepends(mportInstance *, mportPackageMeta *, mportPackageMeta ***);
 int mport_pkgmeta_get_updepends(mportInstance *, mportPackageMeta *, mportPackageMeta ***);
 
@@ -197,6 +227,7 @@ typedef struct {
   char *license;
   char *hash;
   mportType type;
+  struct mport_arena *arena; /* owner of the strings when part of a query result */
 } mportIndexEntry;
 
 typedef struct {
@@ -222,6 +253,8 @@ int mport_index_lookup_pkgname(mportInstance *, const char *, mportIndexEntry **
 int mport_index_search(mportInstance *, mportIndexEntry ***, const char *, ...);
 int mport_index_search_term(mportInstance *, mportIndexEntry ***, char *);
 void mport_index_entry_free_vec(mportIndexEntry **);
+typedef int (*mport_index_cb)(const mportIndexEntry *, void *);
+int mport_index_foreach(mportInstance *, mport_index_cb, void *, const char *, ...);
 void mport_index_entry_free(mportIndexEntry *);
 
 int mport_index_print_mirror_list(mportInstance *);
@@ -275,6 +308,8 @@ typedef struct {
   char *pkginstall;
   char *pkgdeinstall;
   char *pkgmessage;
+  char *dictionary;	/* zstd dictionary to compress with, or NULL for xz */
+  bool dedup;		/* store files with identical content as hardlinks */
   bool is_backup;
 } mportCreateExtras;  
 
@@ -283,8 +318,33 @@ void mport_createextras_free(mportCreateExtras *);
 
 int mport_create_primative(mportInstance *, mportAssetList *, mportPackageMeta *, mportCreateExtras *);
 
+/* Batch package creation */
+typedef struct {
+  mportPackageMeta *pack;
+  mportCreateExtras *extra;
+  char *plist; /* parsed by the worker that builds the package */
+  int result;
+  char *errmsg;
+} mportCreateJob;
+
+typedef struct {
+  mportCreateJob **jobs;
+  size_t jobs_count;
+  int workers; /* most jobs run at once, 0 means as many as the pool has */
+} mportCreateBatch;
+
+mportCreateBatch * mport_createbatch_new(void);
+void mport_createbatch_free(mportCreateBatch *);
+int mport_createbatch_add(mportCreateBatch *, mportPackageMeta *, mportCreateExtras *, const char *);
+int mport_createbatch_load(mportCreateBatch *, const char *);
+int mport_createbatch_run(mportInstance *, mportCreateBatch *);
+
 /* Merge primative */
 int mport_merge_primative(mportInstance *mport, const char **, const char *);
+int mport_merge_members_primative(mportInstance *mport, const char **, const char *);
+
+/* zstd dictionaries */
+int mport_zdict_train(const char **, const char *, size_t, unsigned int *);
 
 /* Package installation */
 int mport_install(mportInstance *, const char *, const char *, const char *, mportAutomatic);
@@ -297,6 +357,52 @@ int mport_update_primative(mportInstance *, const char *);
 /* package upgrade */
 int mport_upgrade(mportInstance *);
 
+/* Asynchronous operations */
+typedef struct mport_op mportOperation;
+
+typedef enum {
+	MPORT_EVENT_MSG,
+	MPORT_EVENT_PROGRESS_INIT,
+	MPORT_EVENT_PROGRESS_STEP,
+	MPORT_EVENT_PROGRESS_FREE,
+	MPORT_EVENT_CONFIRM,	/* answer with mport_op_confirm() */
+	MPORT_EVENT_DONE	/* always the last event */
+} mportEventType;
+
+typedef struct {
+	mportEventType type;
+	char *msg;	/* message, progress title or question; error message when done */
+	char *yes;	/* confirm */
+	char *no;
+	int def;
+	int current;	/* progress step */
+	int total;
+	int result;	/* done */
+} mportEvent;
+
+mportOperation * mport_op_install(mportInstance *, const char *, const char *, mportAutomatic);
+mportOperation * mport_op_update(mportInstance *, const char *);
+mportOperation * mport_op_upgrade(mportInstance *);
+mportOperation * mport_op_fetch_index(mportInstance *);
+int mport_op_fd(mportOperation *);
+mportEvent * mport_op_next_event(mportOperation *);
+void mport_event_free(mportEvent *);
+int mport_op_confirm(mportOperation *, bool);
+void mport_op_cancel(mportOperation *);
+bool mport_op_done(mportOperation *);
+int mport_op_wait(mportOperation *);
+void mport_op_free(mportOperation *);
+
+/* Transactions */
+typedef struct mport_txn mportTransaction;
+
+mportTransaction * mport_txn_begin(mportInstance *);
+int mport_txn_add_install(mportTransaction *, const char *, const char *, mportAutomatic);
+int mport_txn_add_delete(mportTransaction *, const char *);
+int mport_txn_add_upgrade(mportTransaction *, const char *);
+int mport_txn_commit(mportTransaction *);
+void mport_txn_free(mportTransaction *);
+
 /* Package deletion */
 int mport_delete_primative(mportInstance *, mportPackageMeta *, int);
 
@@ -307,17 +413,39 @@ int mport_verify_package(mportInstance *, mportPackageMeta *);
 
 /* version comparing */
 int mport_version_cmp(const char *, const char *);
+char * mport_version_key(const char *);
+
+typedef struct _mportVersionReq mportVersionReq;
+mportVersionReq * mport_version_req_compile(const char *);
+bool mport_version_req_match(const mportVersionReq *, const char *);
+void mport_version_req_free(mportVersionReq *);
 
 /* fetch XXX: This should become private */
 int mport_fetch_bundle(mportInstance *, const char *, const char *);
 int mport_download(mportInstance *, const char *, bool, bool, char **);
 
 /* Auditing for CVEs */
+typedef struct {
+  char *id;
+  char *description;
+  char *severity;
+  double score;		/* CVSS base score, or -1 if unknown */
+  char *version;	/* an affected version at or above the installed one, NULL for all */
+} mportCVE;
+
 char * mport_audit(mportInstance *, const char *, bool);
+int mport_audit_cves(mportInstance *, const char *, mportCVE ***);
+void mport_cve_free_vec(mportCVE **);
+char * mport_audit_installed(mportInstance *, bool);
+int mport_vulndb_load(mportInstance *);
+int mport_vulndb_update(mportInstance *);
+int mport_vulndb_generate(mportInstance *);
 
 /* Errors */
 int mport_err_code(void);
 const char * mport_err_string(void);
+const char * mport_err_cause(unsigned int);
+void mport_err_clear(void);
 
 
 #define MPORT_OK			    0
@@ -45,12 +45,17 @@
 #include <sqlite3.h>
 #include <ucl.h>
 #include "bzlib.h"
+#include "mport_test.h"
 
 #define MPORT_PUBLIC_API 
 
-#define MPORT_MASTER_VERSION 12
-#define MPORT_BUNDLE_VERSION 6
-#define MPORT_BUNDLE_VERSION_STR "6"
+#define MPORT_MASTER_VERSION 13
+#define MPORT_BUNDLE_VERSION 7
+#define MPORT_BUNDLE_VERSION_STR "7"
+/* Single package bundles don't use anything from version 7, so keep marking
+ * them as version 6 for older readers.  Member bundles are version 7. */
+#define MPORT_BUNDLE_VERSION_PLAIN_STR "6"
+#define MPORT_BUNDLE_VERSION_MEMBERS 7
 #define MPORT_VERSION "2.6.6"
 
 #define MPORT_SETTING_MIRROR_REGION "mirror_region"
@@ -73,6 +78,7 @@ int mport_check_preconditions(mportInstance *, mportPackageMeta *, long);
 /* schema */
 int mport_generate_master_schema(sqlite3 *);
 int mport_generate_stub_schema(mportInstance *, sqlite3 *);
+int mport_generate_stub_schema_release(sqlite3 *, const char *);
 int mport_upgrade_master_schema(sqlite3 *, int);
 
 /* instance */
@@ -97,10 +103,24 @@ typedef enum {
 } service_action_t;
 int mport_start_stop_service(mportInstance *mport, mportPackageMeta *pack, service_action_t action);
 
+/* I/O */
+int mport_copy_fd(int, int);
+int mport_copy_file(const char *, const char *);
+int mport_archive_write_fd(struct archive *, int, off_t);
+bool mport_archive_sparse_map(struct archive_entry *, int, off_t);
+int mport_archive_write_sparse_fd(struct archive *, struct archive_entry *, int, off_t);
+
+/* zstd dictionaries */
+void * mport_zdict_read_file(const char *, size_t *);
+void * mport_zdict_load(unsigned int, size_t *);
+int mport_zdict_sync(sqlite3 *);
+
 /* Utils */
 bool mport_starts_with(const char *, const char *);
+void * mport_ohash_calloc(size_t, size_t, void *);
+void mport_ohash_free(void *, void *);
+void * mport_ohash_alloc(size_t, void *);
 char* mport_hash_file(const char *);
-int mport_copy_file(const char *, const char *);
 uid_t mport_get_uid(const char *);
 gid_t mport_get_gid(const char *);
 char* mport_directory(const char *path);
@@ -121,10 +141,14 @@ time_t mport_get_time(void);
 bool mport_check_answer_bool(char *answer);
 
 /* Mport Bundle (a file containing packages) */
+struct zdict_writer;
+struct bundle_source;
+
 typedef struct {
   struct archive *archive;
   char *filename;
   struct links_table *links;
+  struct zdict_writer *zwriter; /* set when compressing with a zstd dictionary */
 } mportBundleWrite;
 
 
@@ -134,13 +158,21 @@ typedef struct {
   char *tmpdir;
   struct archive_entry *firstreal;
   short stub_attached;
+  struct archive *container; /* outer archive of a member bundle */
+  struct archive_entry *container_next;
+  char *member; /* member currently open as archive */
+  struct bundle_source *source; /* feeds archive when libarchive can't read the file itself */
 } mportBundleRead;
 
 
 mportBundleWrite* mport_bundle_write_new(void);
 int mport_bundle_write_init(mportBundleWrite *, const char *);
+int mport_bundle_write_init_container(mportBundleWrite *, const char *);
+int mport_bundle_write_init_zdict(mportBundleWrite *, const char *, const char *);
 int mport_bundle_write_finish(mportBundleWrite *);
 int mport_bundle_write_add_file(mportBundleWrite *, const char *, const char *);
+int mport_bundle_write_add_hardlink(mportBundleWrite *, const char *, const char *, const char *);
+int mport_bundle_write_add_buffer(mportBundleWrite *, struct archive_entry *, const void *);
 int mport_bundle_write_add_entry(mportBundleWrite *, mportBundleRead *, struct archive_entry *);
 
 
@@ -152,15 +184,23 @@ int mport_bundle_read_extract_metafiles(mportBundleRead *, char **);
 int mport_bundle_read_skip_metafiles(mportBundleRead *);
 int mport_bundle_read_next_entry(mportBundleRead *, struct archive_entry **);
 int mport_bundle_read_extract_next_file(mportBundleRead *, struct archive_entry *);
+int mport_bundle_read_select_member(mportInstance *, mportBundleRead *, mportPackageMeta *);
 int mport_bundle_read_install_pkg(mportInstance *, mportBundleRead *, mportPackageMeta *);
 int mport_bundle_read_update_pkg(mportInstance *, mportBundleRead *, mportPackageMeta *);
+int mport_bundle_backup_pkg(mportInstance *, mportPackageMeta *, char **);
+
+/* package creation */
+int mport_create_primative_release(mportAssetList *, mportPackageMeta *, mportCreateExtras *, const char *);
 
 int mport_install_depends(mportInstance *, const char *, const char *, mportAutomatic);
 int mport_update_down(mportInstance *, mportPackageMeta *, struct ohash_info *, struct ohash *);
 
 /* version compare functions */
 void mport_version_cmp_sqlite(sqlite3_context *, int, sqlite3_value **);
+void mport_version_key_sqlite(sqlite3_context *, int, sqlite3_value **);
 int mport_version_require_check(const char *, const char *);
+const mportVersionReq * mport_version_req_cached(mportInstance *, const char *);
+void mport_reqcache_free(struct mport_reqcache *);
 
 int mport_pkg_message_display(mportInstance *, mportPackageMeta *);
 int mport_pkg_message_load(mportInstance *, mportPackageMeta *, mportPackageMessage *);
@@ -171,8 +211,14 @@ mportPackageMessage* mport_pkg_message_from_ucl(mportInstance *, const ucl_objec
 #define SET_ERROR(code, msg) mport_set_errx((code), "Error at %s:(%d): %s", __FILE__, __LINE__, (msg))
 #define RETURN_ERRORX(code, fmt, ...) return mport_set_errx((code), "Error at %s:(%d): " fmt, __FILE__, __LINE__, __VA_ARGS__)
 #define SET_ERRORX(code, fmt, ...) mport_set_errx((code), "Error at %s:(%d): " fmt, __FILE__, __LINE__, __VA_ARGS__)
+/* like the above, but keep the current error as the cause of the new one */
+#define RETURN_WRAP_ERRORX(code, fmt, ...) return mport_wrap_errx((code), "Error at %s:(%d): " fmt, __FILE__, __LINE__, __VA_ARGS__)
+#define WRAP_ERRORX(code, fmt, ...) mport_wrap_errx((code), "Error at %s:(%d): " fmt, __FILE__, __LINE__, __VA_ARGS__)
 int mport_set_err(int, const char *);
 int mport_set_errx(int , const char *, ...);
+int mport_wrap_errx(int, const char *, ...);
+void * mport_err_save(int *);
+void mport_err_restore(int, void *);
 
 
 /* Infrastructure files */
@@ -192,6 +238,7 @@ int mport_set_errx(int , const char *, ...);
 #define MPORT_INDEX_FILE_BZ2	"/var/db/mport/index.db.bz2"
 #define MPORT_INDEX_FILE_HASH	"/var/db/mport/index.db.bz2.md5"
 #define MPORT_FETCH_STAGING_DIR "/var/db/mport/downloads"
+#define MPORT_ZDICT_DIR		"/var/db/mport/dictionaries"
 
 
 #if defined(__i386__)
@@ -228,11 +275,68 @@ int mport_set_errx(int , const char *, ...);
 
 int mport_fetch_index(mportInstance *);
 int mport_fetch_bootstrap_index(mportInstance *);
-char * mport_fetch_cves(mportInstance *mport, char *cpe);
+FILE * mport_fetch_cves(mportInstance *, const char *);
+int mport_fetch_vulndb(mportInstance *, const char *);
+
+/* vulnerability data */
+#define MPORT_VULNDB_FILE		"/var/db/mport/vulnerabilities.db"
+#define MPORT_VULNDB_FILE_BZ2		"/var/db/mport/vulnerabilities.db.bz2"
+#define MPORT_VULNDB_FILE_SOURCE	"vulnerabilities.db.bz2"
+/* schema version, kept in the database's user_version */
+#define MPORT_VULNDB_VERSION		2
+/* SQL: the version key k is in the range of the vulnerabilities row prefixed p */
+#define MPORT_VULNDB_AFFECTS(p, k) \
+	"(" p "min_version_key IS NULL OR " k " > " p "min_version_key OR " \
+	"(" p "min_inclusive AND " k " = " p "min_version_key)) AND " \
+	"(" p "max_version_key IS NULL OR " k " < " p "max_version_key OR " \
+	"(" p "max_inclusive AND " k " = " p "max_version_key))"
+
+/* CPE products; the CVE list reader (cve.c) is declared in mport_test.h */
+char * mport_cpe_product(const char *);
+void mport_cpe_product_sqlite(sqlite3_context *, int, sqlite3_value **);
+
+/* region allocation for query results */
+struct mport_arena * mport_arena_new(void);
+void * mport_arena_alloc(struct mport_arena *, size_t);
+char * mport_arena_strdup(struct mport_arena *, const char *);
+char * mport_arena_intern(struct mport_arena *, const char *);
+void mport_arena_free(struct mport_arena *);
+
+/* safe points for cancelling asynchronous operations */
+bool mport_cancelled(mportInstance *);
+
+/* dependency and conflict solver */
+struct mport_solver;
+typedef enum {
+	MPORT_SOLVE_NONE,
+	MPORT_SOLVE_DELETE,
+	MPORT_SOLVE_UPGRADE,
+	MPORT_SOLVE_INSTALL
+} mportSolveAction;
+typedef struct {
+	mportSolveAction action;
+	mportAutomatic automatic;
+	const char *name;
+	const char *version;		/* to install, NULL for a delete */
+	const char *bundlefile;
+	const char *hash;
+} mportSolveStep;
+struct mport_solver * mport_solver_new(mportInstance *);
+int mport_solver_add(struct mport_solver *, mportSolveAction, const char *, const char *, mportAutomatic);
+int mport_solver_solve(struct mport_solver *, mportSolveStep **, size_t *);
+void mport_solver_free(struct mport_solver *);
+
+/* transactions; cache rebuild triggers are deferred while one executes */
+int mport_trigger(mportInstance *, const char *, ...);
+const char * mport_txn_backup(mportInstance *, const char *);
+
+/* worker pool owned by the instance; the task group API is in mport_test.h */
+void mport_pool_free(struct mport_pool *);
 
 /* a few index things */
 int mport_index_get_mirror_list(mportInstance *, char ***, int *);
 char * mport_index_file_path(void);
+int mport_index_newer_versions(mportInstance *, const char *, const char *, bool, char ***, int *);
 
 #define MPORT_CHECK_FOR_INDEX(mport, func) if (!(mport->flags & MPORT_INST_HAVE_INDEX)) RETURN_ERRORX(MPORT_ERR_FATAL, "Attempt to use %s before loading index.", (func));
 #define MPORT_DAY (3600 * 24)
@@ -240,6 +344,9 @@ char * mport_index_file_path(void);
 #define MPORT_SETTING_INDEX_LAST_CHECKED "index_last_check"
 #define MPORT_SETTING_REPO_AUTOUPDATE "index_autoupdate"
 #define MPORT_SETTING_HANDLE_RC_SCRIPTS "handle_rc_scripts"
+#define MPORT_SETTING_COPY_HARDLINKS "copy_hardlinks"
+#define MPORT_SETTING_CLEAN_VERIFY_HASH "clean_verify_hash"
+#define MPORT_SETTING_WORKERS "workers"
 
 /* Binaries we use */
 #define MPORT_MTREE_BIN		"/usr/sbin/mtree"
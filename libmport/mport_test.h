@@ -0,0 +1,90 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Internal interfaces that the test and benchmark programs in libexec are
+ * allowed to use.  This header is not installed and nothing here is part of
+ * the public API; it may change with any release of libmport.
+ */
+
+#ifndef _MPORT_TEST_H_
+#define _MPORT_TEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mport.h"
+
+/*
+ * Task groups run on the worker pool owned by an instance (pool.c).  Tasks
+ * start in the order they are added, at most limit at a time (0 for no
+ * limit), and the done callback sees their results in the same order.  A
+ * waiting thread runs tasks itself, so groups may be nested.
+ */
+struct mport_taskgroup;
+typedef int (*mport_task_fn)(void *);
+typedef int (*mport_task_done_cb)(void *, int, const char *, void *);
+#define MPORT_TASKGROUP_FAILFAST	0x01
+int mport_pool_workers(mportInstance *);
+struct mport_taskgroup * mport_taskgroup_new(mportInstance *, int, size_t);
+int mport_taskgroup_add(struct mport_taskgroup *, mport_task_fn, void *);
+void mport_taskgroup_cancel(struct mport_taskgroup *);
+bool mport_taskgroup_cancelled(struct mport_taskgroup *);
+int mport_taskgroup_wait(struct mport_taskgroup *, mport_task_done_cb, void *);
+void mport_taskgroup_free(struct mport_taskgroup *);
+
+/* tasks report failure the way the library does */
+int mport_set_errx(int, const char *, ...);
+
+/*
+ * The streaming reader for the security site's CVE lists (cve.c), behind
+ * audits and the generated vulnerability database.
+ */
+struct mport_cve_range {
+	const char *min;	/* lowest affected version, or NULL if unbounded */
+	const char *max;	/* highest affected version, or NULL if unbounded */
+	bool min_excluded;	/* min itself is not affected */
+	bool max_excluded;	/* max itself is not affected */
+	const char *purl;	/* package URL the range is given for, or NULL */
+};
+
+struct mport_cve {
+	const char *id;
+	const char *description;
+	const char *severity;
+	double score;		/* CVSS base score, or -1 */
+	const struct mport_cve_range *ranges;
+	size_t nranges;
+};
+
+typedef int (*mport_cve_cb)(const struct mport_cve *, void *);
+int mport_cve_parse(FILE *, mport_cve_cb, void *);
+bool mport_cve_range_match(const struct mport_cve_range *, const char *);
+
+#endif /* ! defined _MPORT_TEST_H_ */
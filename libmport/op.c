@@ -0,0 +1,600 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/queue.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * Asynchronous operations.  An operation runs one of the blocking entry
+ * points on its own thread, with the instance's callbacks replaced by ones
+ * that queue events.  The frontend reads events with mport_op_next_event(),
+ * either by polling or when mport_op_fd() becomes readable, so nothing is
+ * ever called back on the frontend's thread.
+ *
+ * Callbacks have no context argument, so the queueing callbacks find their
+ * operation through a thread local set on the operation's thread.
+ *
+ * An instance's op pointer and callbacks are switched on one thread and read
+ * on others (mport_cancelled() runs on the operation's thread and its pool
+ * workers), so they are only touched under op_instance_lock.
+ */
+
+struct op_event {
+	mportEvent ev;		/* first, so events can be freed through it */
+	STAILQ_ENTRY(op_event) link;
+};
+
+struct mport_op {
+	mportInstance *mport;
+	int (*run)(struct mport_op *);
+	char *name;
+	char *version;
+	mportAutomatic automatic;
+
+	pthread_t thread;
+	bool joined;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* a confirm was answered, or the operation finished */
+	STAILQ_HEAD(, op_event) events;
+	int fds[2];			/* readable while events are queued */
+	bool readable;
+
+	bool cancelled;
+	bool confirm_pending;
+	int confirm_answer;
+	bool done;
+	int result;
+	char *errmsg;
+	struct op_event *done_event;	/* allocated up front, so the end is always reported */
+
+	/* the instance's own callbacks, put back when the operation ends */
+	mport_msg_cb msg_cb;
+	mport_progress_init_cb progress_init_cb;
+	mport_progress_step_cb progress_step_cb;
+	mport_progress_free_cb progress_free_cb;
+	mport_confirm_cb confirm_cb;
+};
+
+static _Thread_local mportOperation *op_current;
+static pthread_mutex_t op_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mportOperation *op_start(mportInstance *, int (*)(mportOperation *), const char *, const char *,
+    mportAutomatic);
+static void *op_thread(void *);
+static void op_free_args(mportOperation *);
+static struct op_event *op_post(mportOperation *, mportEventType, const char *);
+static void op_queue(mportOperation *, struct op_event *);
+static void op_msg_cb(const char *);
+static void op_progress_init_cb(const char *);
+static void op_progress_step_cb(int, int, const char *);
+static void op_progress_free_cb(void);
+static int op_confirm_cb(const char *, const char *, const char *, int);
+static int op_run_install(mportOperation *);
+static int op_run_update(mportOperation *);
+static int op_run_upgrade(mportOperation *);
+static int op_run_index(mportOperation *);
+
+MPORT_PUBLIC_API mportOperation *
+mport_op_install(mportInstance *mport, const char *pkgname, const char *version, mportAutomatic automatic)
+{
+
+	return (op_start(mport, op_run_install, pkgname, version, automatic));
+}
+
+MPORT_PUBLIC_API mportOperation *
+mport_op_update(mportInstance *mport, const char *pkgname)
+{
+
+	return (op_start(mport, op_run_update, pkgname, NULL, MPORT_EXPLICIT));
+}
+
+MPORT_PUBLIC_API mportOperation *
+mport_op_upgrade(mportInstance *mport)
+{
+
+	return (op_start(mport, op_run_upgrade, NULL, NULL, MPORT_EXPLICIT));
+}
+
+MPORT_PUBLIC_API mportOperation *
+mport_op_fetch_index(mportInstance *mport)
+{
+
+	return (op_start(mport, op_run_index, NULL, NULL, MPORT_EXPLICIT));
+}
+
+static int
+op_run_install(mportOperation *op)
+{
+
+	return (mport_install_depends(op->mport, op->name, op->version, op->automatic));
+}
+
+static int
+op_run_update(mportOperation *op)
+{
+
+	return (mport_update(op->mport, op->name));
+}
+
+static int
+op_run_upgrade(mportOperation *op)
+{
+
+	return (mport_upgrade(op->mport));
+}
+
+static int
+op_run_index(mportOperation *op)
+{
+
+	return (mport_index_get(op->mport));
+}
+
+static mportOperation *
+op_start(mportInstance *mport, int (*run)(mportOperation *), const char *name, const char *version,
+    mportAutomatic automatic)
+{
+	mportOperation *op;
+
+	if ((op = calloc(1, sizeof(mportOperation))) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
+	}
+
+	op->mport = mport;
+	op->run = run;
+	op->automatic = automatic;
+	op->fds[0] = op->fds[1] = -1;
+	STAILQ_INIT(&op->events);
+
+	if ((name != NULL && (op->name = strdup(name)) == NULL) ||
+	    (version != NULL && (op->version = strdup(version)) == NULL) ||
+	    (op->done_event = calloc(1, sizeof(struct op_event))) == NULL) {
+		op_free_args(op);
+		free(op);
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
+	}
+
+	if (pipe2(op->fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+		op_free_args(op);
+		free(op);
+		SET_ERRORX(MPORT_ERR_FATAL, "Could not create event pipe: %s", strerror(errno));
+		return (NULL);
+	}
+
+	op->done_event->ev.type = MPORT_EVENT_DONE;
+
+	pthread_mutex_lock(&op_instance_lock);
+	if (mport->op != NULL) {
+		pthread_mutex_unlock(&op_instance_lock);
+		close(op->fds[0]);
+		close(op->fds[1]);
+		op_free_args(op);
+		free(op);
+		SET_ERROR(MPORT_ERR_FATAL, "Another operation is running on this instance.");
+		return (NULL);
+	}
+
+	pthread_mutex_init(&op->lock, NULL);
+	pthread_cond_init(&op->cond, NULL);
+
+	op->msg_cb = mport->msg_cb;
+	op->progress_init_cb = mport->progress_init_cb;
+	op->progress_step_cb = mport->progress_step_cb;
+	op->progress_free_cb = mport->progress_free_cb;
+	op->confirm_cb = mport->confirm_cb;
+
+	mport->msg_cb = op_msg_cb;
+	mport->progress_init_cb = op_progress_init_cb;
+	mport->progress_step_cb = op_progress_step_cb;
+	mport->progress_free_cb = op_progress_free_cb;
+	mport->confirm_cb = op_confirm_cb;
+	mport->op = op;
+	pthread_mutex_unlock(&op_instance_lock);
+
+	if (pthread_create(&op->thread, NULL, op_thread, op) != 0) {
+		op->joined = true;
+		op_thread(op);
+	}
+
+	return (op);
+}
+
+static void *
+op_thread(void *arg)
+{
+	mportOperation *op = arg;
+	mportInstance *mport = op->mport;
+	char *errmsg = NULL;
+	struct op_event *e;
+	int result;
+
+	op_current = op;
+	result = (op->run)(op);
+	if (result != MPORT_OK)
+		errmsg = strdup(mport_err_string());
+	mport_err_clear();
+	op_current = NULL;
+
+	pthread_mutex_lock(&op_instance_lock);
+	mport->msg_cb = op->msg_cb;
+	mport->progress_init_cb = op->progress_init_cb;
+	mport->progress_step_cb = op->progress_step_cb;
+	mport->progress_free_cb = op->progress_free_cb;
+	mport->confirm_cb = op->confirm_cb;
+	mport->op = NULL;
+	pthread_mutex_unlock(&op_instance_lock);
+
+	pthread_mutex_lock(&op->lock);
+	op->result = result;
+	op->errmsg = errmsg;
+	op->done = true;
+	e = op->done_event;
+	op->done_event = NULL;
+	e->ev.result = result;
+	/* without the message the result still gets through */
+	if (errmsg != NULL)
+		e->ev.msg = strdup(errmsg);
+	op_queue(op, e);
+	pthread_cond_broadcast(&op->cond);
+	pthread_mutex_unlock(&op->lock);
+
+	return (NULL);
+}
+
+/*
+ * mport_op_fd(op)
+ *
+ * A descriptor that is readable while the operation has events queued, for
+ * poll(2) or kqueue(2).  Do not read from or close it.
+ */
+MPORT_PUBLIC_API int
+mport_op_fd(mportOperation *op)
+{
+
+	return (op->fds[0]);
+}
+
+/*
+ * mport_op_next_event(op)
+ *
+ * Return the next queued event, or NULL if there is none.  Free it with
+ * mport_event_free().  The last event of every operation is
+ * MPORT_EVENT_DONE.
+ */
+MPORT_PUBLIC_API mportEvent *
+mport_op_next_event(mportOperation *op)
+{
+	struct op_event *e;
+	char buf[16];
+
+	pthread_mutex_lock(&op->lock);
+	if ((e = STAILQ_FIRST(&op->events)) != NULL)
+		STAILQ_REMOVE_HEAD(&op->events, link);
+	if (STAILQ_EMPTY(&op->events) && op->readable) {
+		while (read(op->fds[0], buf, sizeof(buf)) > 0)
+			;
+		op->readable = false;
+	}
+	pthread_mutex_unlock(&op->lock);
+
+	return (e == NULL ? NULL : &e->ev);
+}
+
+MPORT_PUBLIC_API void
+mport_event_free(mportEvent *ev)
+{
+
+	if (ev == NULL)
+		return;
+
+	free(ev->msg);
+	free(ev->yes);
+	free(ev->no);
+	free(ev);
+}
+
+/*
+ * mport_op_confirm(op, yes)
+ *
+ * Answer the question of the last MPORT_EVENT_CONFIRM.  The operation waits
+ * for the answer.
+ */
+MPORT_PUBLIC_API int
+mport_op_confirm(mportOperation *op, bool yes)
+{
+
+	pthread_mutex_lock(&op->lock);
+	if (!op->confirm_pending) {
+		pthread_mutex_unlock(&op->lock);
+		RETURN_ERROR(MPORT_ERR_WARN, "No question is waiting for an answer.");
+	}
+	op->confirm_pending = false;
+	op->confirm_answer = yes ? MPORT_OK : -1;
+	pthread_cond_broadcast(&op->cond);
+	pthread_mutex_unlock(&op->lock);
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_op_cancel(op)
+ *
+ * Ask the operation to stop.  It does so at the next safe point, between
+ * packages or downloaded blocks, and finishes with an error.  A question
+ * waiting for an answer is answered no.
+ */
+MPORT_PUBLIC_API void
+mport_op_cancel(mportOperation *op)
+{
+
+	pthread_mutex_lock(&op->lock);
+	op->cancelled = true;
+	pthread_cond_broadcast(&op->cond);
+	pthread_mutex_unlock(&op->lock);
+}
+
+MPORT_PUBLIC_API bool
+mport_op_done(mportOperation *op)
+{
+	bool done;
+
+	pthread_mutex_lock(&op->lock);
+	done = op->done;
+	pthread_mutex_unlock(&op->lock);
+
+	return (done);
+}
+
+/*
+ * mport_op_wait(op)
+ *
+ * Block until the operation finishes, and return its result with its error
+ * message set on the calling thread.  Events stay queued.
+ */
+MPORT_PUBLIC_API int
+mport_op_wait(mportOperation *op)
+{
+
+	pthread_mutex_lock(&op->lock);
+	while (!op->done)
+		pthread_cond_wait(&op->cond, &op->lock);
+	pthread_mutex_unlock(&op->lock);
+
+	if (!op->joined) {
+		pthread_join(op->thread, NULL);
+		op->joined = true;
+	}
+
+	if (op->result != MPORT_OK)
+		return (mport_set_err(op->result, op->errmsg));
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_op_free(op)
+ *
+ * Cancel the operation if it is still running, wait for it, and free it
+ * along with any events not read.
+ */
+MPORT_PUBLIC_API void
+mport_op_free(mportOperation *op)
+{
+	struct op_event *e;
+
+	if (op == NULL)
+		return;
+
+	mport_op_cancel(op);
+	(void) mport_op_wait(op);
+
+	while ((e = STAILQ_FIRST(&op->events)) != NULL) {
+		STAILQ_REMOVE_HEAD(&op->events, link);
+		mport_event_free(&e->ev);
+	}
+
+	close(op->fds[0]);
+	close(op->fds[1]);
+	pthread_cond_destroy(&op->cond);
+	pthread_mutex_destroy(&op->lock);
+	op_free_args(op);
+	free(op->errmsg);
+	free(op);
+}
+
+/*
+ * mport_cancelled(mport)
+ *
+ * True if the instance is running an operation that has been cancelled.
+ * Long running code checks this at points where stopping is safe.
+ */
+bool
+mport_cancelled(mportInstance *mport)
+{
+	mportOperation *op;
+	bool cancelled = false;
+
+	pthread_mutex_lock(&op_instance_lock);
+	if ((op = mport->op) != NULL) {
+		pthread_mutex_lock(&op->lock);
+		cancelled = op->cancelled;
+		pthread_mutex_unlock(&op->lock);
+	}
+	pthread_mutex_unlock(&op_instance_lock);
+
+	return (cancelled);
+}
+
+static void
+op_free_args(mportOperation *op)
+{
+
+	free(op->name);
+	free(op->version);
+	free(op->done_event);
+}
+
+/* queue an event; called locked */
+static struct op_event *
+op_post(mportOperation *op, mportEventType type, const char *msg)
+{
+	struct op_event *e;
+
+	if ((e = calloc(1, sizeof(struct op_event))) == NULL)
+		return (NULL);
+
+	e->ev.type = type;
+	if (msg != NULL && (e->ev.msg = strdup(msg)) == NULL) {
+		free(e);
+		return (NULL);
+	}
+
+	op_queue(op, e);
+
+	return (e);
+}
+
+/* append an event and make the descriptor readable; called locked */
+static void
+op_queue(mportOperation *op, struct op_event *e)
+{
+
+	STAILQ_INSERT_TAIL(&op->events, e, link);
+
+	if (!op->readable) {
+		(void) write(op->fds[1], "", 1);
+		op->readable = true;
+	}
+}
+
+static void
+op_msg_cb(const char *msg)
+{
+	mportOperation *op = op_current;
+
+	/* not on the operation's thread, e.g. a pool worker; there is nowhere to send it */
+	if (op == NULL)
+		return;
+
+	pthread_mutex_lock(&op->lock);
+	(void) op_post(op, MPORT_EVENT_MSG, msg);
+	pthread_mutex_unlock(&op->lock);
+}
+
+static void
+op_progress_init_cb(const char *title)
+{
+	mportOperation *op = op_current;
+
+	if (op == NULL)
+		return;
+
+	pthread_mutex_lock(&op->lock);
+	(void) op_post(op, MPORT_EVENT_PROGRESS_INIT, title);
+	pthread_mutex_unlock(&op->lock);
+}
+
+static void
+op_progress_step_cb(int current, int total, const char *msg)
+{
+	mportOperation *op = op_current;
+	struct op_event *e;
+	char *copy;
+
+	if (op == NULL)
+		return;
+
+	pthread_mutex_lock(&op->lock);
+	/* steps come per file or block; a frontend only wants the latest */
+	e = STAILQ_LAST(&op->events, op_event, link);
+	if (e != NULL && e->ev.type == MPORT_EVENT_PROGRESS_STEP) {
+		if (msg != NULL && (copy = strdup(msg)) != NULL) {
+			free(e->ev.msg);
+			e->ev.msg = copy;
+		}
+	} else {
+		e = op_post(op, MPORT_EVENT_PROGRESS_STEP, msg);
+	}
+	if (e != NULL) {
+		e->ev.current = current;
+		e->ev.total = total;
+	}
+	pthread_mutex_unlock(&op->lock);
+}
+
+static void
+op_progress_free_cb(void)
+{
+	mportOperation *op = op_current;
+
+	if (op == NULL)
+		return;
+
+	pthread_mutex_lock(&op->lock);
+	(void) op_post(op, MPORT_EVENT_PROGRESS_FREE, NULL);
+	pthread_mutex_unlock(&op->lock);
+}
+
+static int
+op_confirm_cb(const char *msg, const char *yes, const char *no, int def)
+{
+	mportOperation *op = op_current;
+	struct op_event *e;
+	int answer;
+
+	if (op == NULL)
+		return (def == 1 ? MPORT_OK : -1);
+
+	pthread_mutex_lock(&op->lock);
+	if (op->cancelled || (e = op_post(op, MPORT_EVENT_CONFIRM, msg)) == NULL) {
+		pthread_mutex_unlock(&op->lock);
+		return (-1);
+	}
+	e->ev.yes = yes == NULL ? NULL : strdup(yes);
+	e->ev.no = no == NULL ? NULL : strdup(no);
+	e->ev.def = def;
+
+	op->confirm_pending = true;
+	while (op->confirm_pending && !op->cancelled)
+		pthread_cond_wait(&op->cond, &op->lock);
+	answer = op->confirm_pending ? -1 : op->confirm_answer;
+	op->confirm_pending = false;
+	pthread_mutex_unlock(&op->lock);
+
+	return (answer);
+}
@@ -38,9 +38,12 @@
 
 enum count_type { ALL, LOCKED, WHERE };
 
-static int populate_meta_from_stmt(mportPackageMeta *, sqlite3 *, sqlite3_stmt *);
-static int populate_vec_from_stmt(mportPackageMeta ***, int, sqlite3 *, sqlite3_stmt *);
+static int populate_meta_from_stmt(mportPackageMeta *, sqlite3 *, sqlite3_stmt *, struct mport_arena *);
+static int populate_vec_from_stmt(mportPackageMeta ***, int, sqlite3 *, sqlite3_stmt *, bool);
+static char *meta_strdup(struct mport_arena *, const char *);
+static char *meta_intern(struct mport_arena *, const char *);
 static int mport_pkgmeta_count(mportInstance *mport, enum count_type type, char *where);
+static int view_meta_from_stmt(mportPackageMeta *, sqlite3 *, sqlite3_stmt *);
 
 /* Package meta-data creation and destruction */
 MPORT_PUBLIC_API mportPackageMeta *
@@ -69,7 +72,8 @@ mport_pkgmeta_free(mportPackageMeta *pack)
 {
 	int i;
 
-	if (pack == NULL) {
+	/* part of a vector; freed with it */
+	if (pack == NULL || pack->arena != NULL) {
 		return;
 	}
 
@@ -128,6 +132,13 @@ mport_pkgmeta_vec_free(mportPackageMeta **vec)
 	if (vec == NULL)
 		return;
 
+	/* packages from a query share an arena */
+	if (*vec != NULL && (*vec)->arena != NULL) {
+		mport_arena_free((*vec)->arena);
+		free(vec);
+		return;
+	}
+
 	while (*pkgmetas != NULL) {
 		mport_pkgmeta_free(*pkgmetas);
 		pkgmetas++;
@@ -188,7 +199,7 @@ mport_pkgmeta_read_stub(mportInstance *mport, mportPackageMeta ***ref)
 		}
 	}
 
-	ret = populate_vec_from_stmt(ref, len, db, stmt);
+	ret = populate_vec_from_stmt(ref, len, db, stmt, false);
 
 	sqlite3_finalize(stmt);
 
@@ -247,7 +258,7 @@ mport_pkgmeta_search_master(mportInstance *mport, mportPackageMeta ***ref, const
 		RETURN_CURRENT_ERROR;
 	}
 
-	ret = populate_vec_from_stmt(ref, len, db, stmt);
+	ret = populate_vec_from_stmt(ref, len, db, stmt, true);
 
 	sqlite3_free(where);
 	sqlite3_finalize(stmt);
@@ -326,7 +337,64 @@ mport_pkgmeta_list(mportInstance *mport, mportPackageMeta ***ref)
 		RETURN_CURRENT_ERROR;
 	}
 
-	ret = populate_vec_from_stmt(ref, len, db, stmt);
+	ret = populate_vec_from_stmt(ref, len, db, stmt, true);
+
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+/* mport_pkgmeta_foreach(mport, cb, arg, where, ...)
+ *
+ * Call cb for each installed package matching the where clause, built as for
+ * mport_pkgmeta_search_master(), or for every package if it is NULL, in
+ * name and version order.
+ *
+ * The package handed to cb is a view of the current row: nothing is copied,
+ * and it is only good until cb returns.  Iteration stops at the first cb
+ * that returns something other than MPORT_OK, and that is returned.
+ */
+MPORT_PUBLIC_API int
+mport_pkgmeta_foreach(mportInstance *mport, mport_pkgmeta_cb cb, void *arg, const char *fmt, ...)
+{
+	va_list args;
+	sqlite3_stmt *stmt;
+	mportPackageMeta pack;
+	char *where = NULL;
+	int ret = MPORT_OK, step;
+
+	if (mport == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+
+	if (fmt != NULL) {
+		va_start(args, fmt);
+		where = sqlite3_vmprintf(fmt, args);
+		va_end(args);
+
+		if (where == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Could not build where clause");
+	}
+
+	if (mport_db_prepare(mport->db, &stmt,
+		"SELECT pkg, version, origin, lang, prefix, comment, os_release, cpe, locked, deprecated, expiration_date, no_provide_shlib, flavor, automatic, install_date, type, flatsize FROM packages WHERE %s ORDER BY pkg, version",
+		where == NULL ? "1" : where) != MPORT_OK) {
+		sqlite3_free(where);
+		RETURN_CURRENT_ERROR;
+	}
+	sqlite3_free(where);
+
+	while (ret == MPORT_OK) {
+		step = sqlite3_step(stmt);
+
+		if (step == SQLITE_ROW) {
+			if ((ret = view_meta_from_stmt(&pack, mport->db, stmt)) == MPORT_OK)
+				ret = cb(&pack, arg);
+		} else if (step == SQLITE_DONE) {
+			break;
+		} else {
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(mport->db));
+		}
+	}
 
 	sqlite3_finalize(stmt);
 
@@ -358,7 +426,7 @@ mport_pkgmeta_list_locked(mportInstance *mport, mportPackageMeta ***ref)
 		RETURN_CURRENT_ERROR;
 	}
 
-	ret = populate_vec_from_stmt(ref, len, db, stmt);
+	ret = populate_vec_from_stmt(ref, len, db, stmt, true);
 
 	sqlite3_finalize(stmt);
 
@@ -408,7 +476,7 @@ mport_pkgmeta_get_downdepends(
 		RETURN_CURRENT_ERROR;
 	}
 
-	ret = populate_vec_from_stmt(pkg_vec_p, count, mport->db, stmt);
+	ret = populate_vec_from_stmt(pkg_vec_p, count, mport->db, stmt, true);
 
 	sqlite3_finalize(stmt);
 	return ret;
@@ -457,7 +525,7 @@ mport_pkgmeta_get_updepends(
 		RETURN_CURRENT_ERROR;
 	}
 
-	ret = populate_vec_from_stmt(pkg_vec_p, count, mport->db, stmt);
+	ret = populate_vec_from_stmt(pkg_vec_p, count, mport->db, stmt, true);
 
 	sqlite3_finalize(stmt);
 	return ret;
@@ -490,22 +558,42 @@ mport_pkgmeta_logevent(mportInstance *mport, mportPackageMeta *pkg, const char *
 	    pkg->version, now.tv_sec, msg);
 }
 
+/*
+ * With use_arena, the packages and their strings come from one arena that
+ * mport_pkgmeta_vec_free() releases in one go.  Without it each package is
+ * allocated on its own, so that its fields can be replaced; the install
+ * code does this with packages read from a stub.
+ */
 static int
-populate_vec_from_stmt(mportPackageMeta ***ref, int len, sqlite3 *db, sqlite3_stmt *stmt)
+populate_vec_from_stmt(mportPackageMeta ***ref, int len, sqlite3 *db, sqlite3_stmt *stmt, bool use_arena)
 {
+	struct mport_arena *arena = NULL;
 	mportPackageMeta **vec = NULL;
 	int done = 0;
 	vec = (mportPackageMeta **)calloc((1 + len), sizeof(mportPackageMeta *));
 	*ref = vec;
 
+	if (vec == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	if (use_arena && (arena = mport_arena_new()) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
 	while (!done) {
 		switch (sqlite3_step(stmt)) {
 		case SQLITE_ROW:
-			*vec = mport_pkgmeta_new();
+			if (arena == NULL) {
+				*vec = mport_pkgmeta_new();
+			} else if ((*vec = mport_arena_alloc(arena, sizeof(mportPackageMeta))) != NULL) {
+				(*vec)->action = MPORT_ACTION_UNKNOWN;
+				(*vec)->arena = arena;
+			}
 			if (*vec == NULL) {
+				if (vec == *ref)
+					mport_arena_free(arena);
 				RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate meta.");
 			}
-			if (populate_meta_from_stmt(*vec, db, stmt) != MPORT_OK) {
+			if (populate_meta_from_stmt(*vec, db, stmt, arena) != MPORT_OK) {
 				RETURN_CURRENT_ERROR;
 			}
 			vec++;
@@ -513,9 +601,13 @@ populate_vec_from_stmt(mportPackageMeta ***ref, int len, sqlite3 *db, sqlite3_st
 		case SQLITE_DONE:
 			/* set the last cell in the array to null */
 			*vec = NULL;
+			if (vec == *ref)
+				mport_arena_free(arena);
 			done++;
 			break;
 		default:
+			if (vec == *ref)
+				mport_arena_free(arena);
 			RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 			break; /* not reached */
 		}
@@ -526,7 +618,7 @@ populate_vec_from_stmt(mportPackageMeta ***ref, int len, sqlite3 *db, sqlite3_st
 }
 
 static int
-populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
+populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt, struct mport_arena *arena)
 {
 	const char *tmp = 0;
 
@@ -534,52 +626,52 @@ populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
 	if ((tmp = sqlite3_column_text(stmt, 0)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
-	if ((pack->name = strdup(tmp)) == NULL)
+	if ((pack->name = meta_strdup(arena, tmp)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	/* Copy version to pack->version */
 	if ((tmp = sqlite3_column_text(stmt, 1)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
-	if ((pack->version = strdup(tmp)) == NULL)
+	if ((pack->version = meta_strdup(arena, tmp)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	/* Copy origin to pack->origin */
 	if ((tmp = sqlite3_column_text(stmt, 2)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
-	if ((pack->origin = strdup(tmp)) == NULL)
+	if ((pack->origin = meta_intern(arena, tmp)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	/* Copy lang to pack->lang */
 	if ((tmp = sqlite3_column_text(stmt, 3)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
-	if ((pack->lang = strdup(tmp)) == NULL)
+	if ((pack->lang = meta_intern(arena, tmp)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	/* Copy prefix to pack->prefix */
 	if ((tmp = sqlite3_column_text(stmt, 4)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
 
-	if ((pack->prefix = strdup(tmp)) == NULL)
+	if ((pack->prefix = meta_intern(arena, tmp)) == NULL)
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	/* Copy comment to pack->comment */
 	if ((tmp = sqlite3_column_text(stmt, 5)) == NULL) {
-		if ((pack->comment = strdup("")) == NULL)
+		if ((pack->comment = meta_intern(arena, "")) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	} else {
-		if ((pack->comment = strdup(tmp)) == NULL)
+		if ((pack->comment = meta_strdup(arena, tmp)) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	}
 
 	/* os_release */
 	if ((tmp = sqlite3_column_text(stmt, 6)) == NULL) {
-		if ((pack->os_release = strdup(MPORT_OSVERSION)) == NULL)
+		if ((pack->os_release = meta_intern(arena, MPORT_OSVERSION)) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	} else {
-		if ((pack->os_release = strdup(tmp)) == NULL)
+		if ((pack->os_release = meta_intern(arena, tmp)) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	}
 
@@ -587,19 +679,19 @@ populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
 
 	/* CPE */
 	if ((tmp = sqlite3_column_text(stmt, 7)) == NULL) {
-		if ((pack->cpe = strdup("")) == NULL)
+		if ((pack->cpe = meta_intern(arena, "")) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	} else {
-		if ((pack->cpe = strdup(tmp)) == NULL)
+		if ((pack->cpe = meta_intern(arena, tmp)) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	}
 
 	/* deprecated */
 	if ((tmp = sqlite3_column_text(stmt, 9)) == NULL) {
-		if ((pack->deprecated = strdup("")) == NULL)
+		if ((pack->deprecated = meta_intern(arena, "")) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	} else {
-		if ((pack->deprecated = strdup(tmp)) == NULL)
+		if ((pack->deprecated = meta_intern(arena, tmp)) == NULL)
 			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	}
 
@@ -617,8 +709,8 @@ populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
 
 	/* flavor */
 	if ((tmp = sqlite3_column_text(stmt, 12)) == NULL) {
-		pack->flavor = strdup("");
-	} else if ((pack->flavor = strdup(tmp)) == NULL) {
+		pack->flavor = meta_intern(arena, "");
+	} else if ((pack->flavor = meta_intern(arena, tmp)) == NULL) {
 		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 	}
 
@@ -649,3 +741,51 @@ populate_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
 
 	return MPORT_OK;
 }
+
+static char *
+meta_strdup(struct mport_arena *arena, const char *s)
+{
+
+	return (arena == NULL ? strdup(s) : mport_arena_strdup(arena, s));
+}
+
+/* for the values that repeat across packages, such as prefix and OS release */
+static char *
+meta_intern(struct mport_arena *arena, const char *s)
+{
+
+	return (arena == NULL ? strdup(s) : mport_arena_intern(arena, s));
+}
+
+/* like populate_meta_from_stmt(), but pointing into the row rather than copying it */
+static int
+view_meta_from_stmt(mportPackageMeta *pack, sqlite3 *db, sqlite3_stmt *stmt)
+{
+	const char *tmp;
+
+	memset(pack, 0, sizeof(mportPackageMeta));
+
+	if ((pack->name = (char *)sqlite3_column_text(stmt, 0)) == NULL ||
+	    (pack->version = (char *)sqlite3_column_text(stmt, 1)) == NULL ||
+	    (pack->origin = (char *)sqlite3_column_text(stmt, 2)) == NULL ||
+	    (pack->lang = (char *)sqlite3_column_text(stmt, 3)) == NULL ||
+	    (pack->prefix = (char *)sqlite3_column_text(stmt, 4)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+
+	pack->comment = (tmp = (const char *)sqlite3_column_text(stmt, 5)) == NULL ? "" : (char *)tmp;
+	pack->os_release = (tmp = (const char *)sqlite3_column_text(stmt, 6)) == NULL ? MPORT_OSVERSION : (char *)tmp;
+	pack->cpe = (tmp = (const char *)sqlite3_column_text(stmt, 7)) == NULL ? "" : (char *)tmp;
+	pack->locked = sqlite3_column_int(stmt, 8);
+	pack->deprecated = (tmp = (const char *)sqlite3_column_text(stmt, 9)) == NULL ? "" : (char *)tmp;
+	pack->flavor = (tmp = (const char *)sqlite3_column_text(stmt, 12)) == NULL ? "" : (char *)tmp;
+
+	/* sqlite3_column_int64() and friends give 0 for NULL */
+	pack->expiration_date = sqlite3_column_int64(stmt, 10);
+	pack->no_provide_shlib = sqlite3_column_int(stmt, 11);
+	pack->automatic = sqlite3_column_int(stmt, 13);
+	pack->install_date = sqlite3_column_int(stmt, 14);
+	pack->type = sqlite3_column_int(stmt, 15);
+	pack->flatsize = sqlite3_column_int64(stmt, 16);
+
+	return MPORT_OK;
+}
@@ -26,6 +26,9 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,10 +38,17 @@
 #include "mport_private.h"
 
 #define CMND_MAGIC_COOKIE '@'
-#define STRING_EQ(r, l) (strcmp((r),(l)) == 0)
+#define PLIST_BUFF_SIZE (BUFSIZ * 16)
 
-static mportAssetListEntryType parse_command(const char *);
-static int parse_file_owner_mode(mportAssetListEntry **, char *);
+#define CMND_EQ(s, len, lit) ((len) == sizeof(lit) - 1 && memcmp((s), (lit), sizeof(lit) - 1) == 0)
+#define CMND_PREFIX(s, len, lit) ((len) >= sizeof(lit) - 1 && memcmp((s), (lit), sizeof(lit) - 1) == 0)
+
+static mportAssetListEntry *assetlist_append(mportAssetList *, mportAssetListEntryType, const char *, size_t);
+static int parse_plist(mportAssetList *, const char *, size_t);
+static mportAssetListEntryType parse_command(const char *, size_t);
+static int parse_file_owner_mode(mportAssetList *, mportAssetListEntry *, const char *, size_t);
+static int read_stream(FILE *, size_t, char **, size_t *);
+static int hexval(int);
 
 /* Do everything needed to set up a new plist.  Always use this to create a plist,
  * don't go off and do it yourself.
@@ -47,146 +57,319 @@ MPORT_PUBLIC_API mportAssetList *
 mport_assetlist_new(void) {
 
     mportAssetList *list = (mportAssetList *) calloc(1, sizeof(mportAssetList));
-    assert(list != NULL);
+    if (list == NULL)
+        return NULL;
     STAILQ_INIT(list);
+    if ((list->arena = mport_arena_new()) == NULL) {
+        free(list);
+        return NULL;
+    }
     return list;
 }
 
 
-/* free all the entries in the list, and then the list itself. */
+/* free all the entries in the list, and then the list itself.  Entries and their
+ * strings are owned by the list's arena, so this is a single release. */
 MPORT_PUBLIC_API void
 mport_assetlist_free(mportAssetList *list) {
-	mportAssetListEntry *n = NULL;
-	mportAssetList *list_orig;
-	list_orig = list;
 
 	if (list == NULL)
 		return;
 
-	while (!STAILQ_EMPTY(list)) {
-		n = STAILQ_FIRST(list);
-		if (n == NULL)
-			continue;
+	mport_arena_free(list->arena);
+	free(list);
+}
+
+
+/*
+ * Append a new entry of the given type to the list.  data is copied into the
+ * list's arena and may be NULL.  Returns NULL if memory is exhausted.
+ */
+MPORT_PUBLIC_API mportAssetListEntry *
+mport_assetlist_append(mportAssetList *list, mportAssetListEntryType type, const char *data)
+{
+
+	return (assetlist_append(list, type, data, data == NULL ? 0 : strlen(data)));
+}
+
 
-		free(n->data);
-		n->data = NULL;
+static mportAssetListEntry *
+assetlist_append(mportAssetList *list, mportAssetListEntryType type, const char *data, size_t len)
+{
+	mportAssetListEntry *e;
 
-		STAILQ_REMOVE_HEAD(list, next);
-		free(n);
-        n = NULL;
+	if ((e = mport_arena_alloc(list->arena, sizeof(mportAssetListEntry))) == NULL)
+		return (NULL);
+
+	if (data != NULL) {
+		/* arena memory is zeroed, so this is terminated */
+		if ((e->data = mport_arena_alloc(list->arena, len + 1)) == NULL)
+			return (NULL);
+		memcpy(e->data, data, len);
 	}
 
-	free(list_orig);
-    list_orig = NULL;
-	list = NULL;
+	e->type = type;
+	e->owner = e->group = e->mode = "";
+	STAILQ_INSERT_TAIL(list, e, next);
+
+	return (e);
+}
+
+
+/*
+ * Set the owner, group and mode of an entry.  NULL leaves a field unchanged.
+ * The strings are interned, so the handful of distinct values in a plist are
+ * stored once.
+ */
+MPORT_PUBLIC_API int
+mport_asset_set_attrs(mportAssetList *list, mportAssetListEntry *e, const char *owner, const char *group,
+    const char *mode)
+{
+
+	if (owner != NULL && (e->owner = mport_arena_intern(list->arena, owner)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	if (group != NULL && (e->group = mport_arena_intern(list->arena, group)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	if (mode != NULL && (e->mode = mport_arena_intern(list->arena, mode)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	return (MPORT_OK);
+}
+
+
+static int
+hexval(int c)
+{
+
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	return (-1);
+}
+
+
+/*
+ * Store a hex encoded checksum on the entry.  This is normally SHA-256, but
+ * packages built by older releases carry shorter MD5 sums which are kept as
+ * is.  A NULL or empty string clears the checksum; anything that is not an
+ * even number of hex digits, at most 64, is rejected and also leaves the
+ * entry without one.
+ */
+MPORT_PUBLIC_API int
+mport_asset_set_checksum(mportAssetListEntry *e, const char *hex)
+{
+	size_t len;
+	int hi, lo;
+
+	e->checksum_len = 0;
+	if (hex == NULL || *hex == '\0')
+		return (MPORT_OK);
+
+	len = strlen(hex);
+	if (len % 2 != 0 || len > sizeof(e->checksum) * 2)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Invalid checksum: %s", hex);
+
+	for (size_t i = 0; i < len / 2; i++) {
+		if ((hi = hexval(hex[i * 2])) == -1 || (lo = hexval(hex[i * 2 + 1])) == -1)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Invalid checksum: %s", hex);
+		e->checksum[i] = (unsigned char)(hi << 4 | lo);
+	}
+	e->checksum_len = len / 2;
+
+	return (MPORT_OK);
+}
+
+
+/*
+ * Format the entry's checksum as lower case hex into buf, which must hold
+ * MPORT_ASSET_CHECKSUM_HEXLEN bytes.  Entries without a checksum yield "".
+ */
+MPORT_PUBLIC_API char *
+mport_asset_checksum(const mportAssetListEntry *e, char *buf)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	buf[0] = '\0';
+	for (size_t i = 0; i < e->checksum_len; i++) {
+		buf[i * 2] = digits[e->checksum[i] >> 4];
+		buf[i * 2 + 1] = digits[e->checksum[i] & 0xf];
+	}
+	buf[e->checksum_len * 2] = '\0';
+
+	return (buf);
 }
 
 
 /**
- * Parses the contents of the given plistfile pointer.  
+ * Parses the contents of the given plistfile pointer, from its current offset
+ * to the end.  The rest of the stream is read into one buffer first, sized
+ * from the file when it is a regular file.
  * Returns MPORT_OK on success, 
  * an error code on failure.
  */
 MPORT_PUBLIC_API int
 mport_parse_plistfile(FILE *fp, mportAssetList *list) {
-    size_t length;
-    size_t entrylen;
-    char *line = NULL;
+    struct stat st;
+    off_t offset;
+    char *buf = NULL;
+    size_t len = 0, hint = 0;
+    int ret;
 
     assert(fp != NULL);
 
-    while ((line = fgetln(fp, &length)) != NULL) {
-        if (feof(fp)) {
-            /* File didn't end in \n, get an exta byte so that the next step doesn't
-               wack the last char in the string. */
-            length++;
-            if ((line = realloc(line, length)) == NULL) {
-                RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
-            }
-        }
+    offset = ftello(fp);
+    if (offset != -1 && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > offset)
+        hint = (size_t)(st.st_size - offset);
 
-        if (length == 1)
-            /* This is almost certainly a blank line. skip it */
-            continue;
+    if (read_stream(fp, hint, &buf, &len) != MPORT_OK)
+        RETURN_CURRENT_ERROR;
 
+    ret = parse_plist(list, buf, len);
+    free(buf);
 
-        /* change the last \n to \0 */
-        *(line + length - 1) = '\0';
+    return ret;
+}
 
-        mportAssetListEntry *entry = (mportAssetListEntry *) calloc(1, sizeof(mportAssetListEntry));
 
-        if (entry == NULL) {
-            RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
-        }
+/*
+ * Read the rest of a stream.  hint is the number of bytes expected, 0 if
+ * unknown (a pipe); a file that grows meanwhile is still read to the end.
+ */
+static int
+read_stream(FILE *fp, size_t hint, char **buf_p, size_t *len_p)
+{
+	char *buf = NULL, *nbuf;
+	size_t len = 0, size = 0, got;
+
+	do {
+		if (size - len < PLIST_BUFF_SIZE) {
+			size = size == 0 ? hint + PLIST_BUFF_SIZE : size * 2;
+			if ((nbuf = realloc(buf, size)) == NULL) {
+				free(buf);
+				RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			}
+			buf = nbuf;
+		}
+		got = fread(buf + len, 1, size - len, fp);
+		len += got;
+	} while (got > 0);
 
-        if (*line == CMND_MAGIC_COOKIE) {
-            line++;
-            char *cmnd = strsep(&line, " \t");
+	if (ferror(fp)) {
+		free(buf);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Could not read plist: %s", strerror(errno));
+	}
+
+	*buf_p = buf;
+	*len_p = len;
+
+	return (MPORT_OK);
+}
+
+
+/*
+ * Split buf into lines and append an entry for each.  buf is not modified
+ * and need not be terminated; entry strings are copied into the list's arena.
+ *
+ * A line is either a file, or @command followed by a space or tab and its
+ * argument.  Trailing white space is dropped, blank lines are skipped.
+ */
+static int
+parse_plist(mportAssetList *list, const char *buf, size_t len)
+{
+	const char *end = buf + len;
+	const char *line, *eol, *nul, *cmnd, *data;
+	size_t cmndlen;
+	mportAssetListEntryType type;
+	mportAssetListEntry *entry;
+
+	for (line = buf; line < end; line = eol + 1) {
+		if ((eol = memchr(line, '\n', end - line)) == NULL)
+			eol = end;
+
+		if (eol == line)
+			/* This is almost certainly a blank line. skip it */
+			continue;
 
-            if (cmnd == NULL)
-                RETURN_ERROR(MPORT_ERR_FATAL, "Malformed plist file.");
+		/* the line based reader stopped at an embedded NUL as well */
+		if ((nul = memchr(line, '\0', eol - line)) != NULL)
+			data = nul;
+		else
+			data = eol;
 
-		entry->checksum[0] = '\0'; /* checksum is only used by bundle read install */
-		entry->type = parse_command(cmnd);
-		if (entry->type == ASSET_FILE_OWNER_MODE)
-			parse_file_owner_mode(&entry, cmnd);
-		if (entry->type == ASSET_DIR_OWNER_MODE) {
-			parse_file_owner_mode(&entry, &cmnd[3]);
+		cmnd = NULL;
+		cmndlen = 0;
+		type = ASSET_FILE;
+
+		if (*line == CMND_MAGIC_COOKIE) {
+			const char *sep;
+
+			cmnd = line + 1;
+			for (sep = cmnd; sep < data && *sep != ' ' && *sep != '\t'; sep++)
+				;
+			cmndlen = sep - cmnd;
+			type = parse_command(cmnd, cmndlen);
+
+			/* line was just a directive, no data */
+			line = sep < data ? sep + 1 : NULL;
 		}
-		if (entry->type == ASSET_SAMPLE_OWNER_MODE)
-			parse_file_owner_mode(&entry, &cmnd[6]);
-        } else {
-            entry->type = ASSET_FILE;
-        }
-
-
-        if (line == NULL) {
-            /* line was just a directive, no data */
-            entry->data = NULL;
-        } else {
-            if (entry->type == ASSET_COMMENT) {
-                if (!strncmp(line, "ORIGIN:", 7)) {
-                    line += 7;
-                    entry->type = ASSET_ORIGIN;
-                } else if (!strncmp(line, "DEPORIGIN:", 10)) {
-                    line += 10;
-                    entry->type = ASSET_DEPORIGIN;
-                }
-            }
-
-            entrylen = strlen(line) + 1;
-            entry->data = (char *) calloc(entrylen, sizeof(char));
-            if (entry->data == NULL) {
-                RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
-            }
-
-
-            char *pos = line + strlen(line) - 1;
-
-            while (isspace(*pos)) {
-                *pos = 0;
-                pos--;
-            }
-
-            strlcpy(entry->data, line, entrylen);
-        }
-
-        STAILQ_INSERT_TAIL(list, entry, next);
-    }
 
-    return MPORT_OK;
+		if (line != NULL) {
+			if (type == ASSET_COMMENT) {
+				if (CMND_PREFIX(line, (size_t)(data - line), "ORIGIN:")) {
+					line += 7;
+					type = ASSET_ORIGIN;
+				} else if (CMND_PREFIX(line, (size_t)(data - line), "DEPORIGIN:")) {
+					line += 10;
+					type = ASSET_DEPORIGIN;
+				}
+			}
+
+			while (data > line && isspace((unsigned char)data[-1]))
+				data--;
+		}
+
+		if ((entry = assetlist_append(list, type, line, line == NULL ? 0 : (size_t)(data - line))) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+		switch (type) {
+			case ASSET_FILE_OWNER_MODE:
+				break;
+			case ASSET_DIR_OWNER_MODE:
+				cmnd += 3;
+				cmndlen -= 3;
+				break;
+			case ASSET_SAMPLE_OWNER_MODE:
+				cmnd += 6;
+				cmndlen -= 6;
+				break;
+			default:
+				continue;
+		}
+
+		if (parse_file_owner_mode(list, entry, cmnd, cmndlen) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	}
+
+	return (MPORT_OK);
 }
 
 /**
  * Parse the file owner, group and mode.
  */
 static int 
-parse_file_owner_mode(mportAssetListEntry **entry, char *cmdLine) {
+parse_file_owner_mode(mportAssetList *list, mportAssetListEntry *entry, const char *cmdLine, size_t len) {
 	char *start = NULL;
-	char *op = start = strdup(cmdLine);
+	char *op;
 	char *permissions[3] = {NULL, NULL, NULL};
 	char *tok = NULL;
 	int i = 0;
+	int ret;
+
+	if ((op = start = strndup(cmdLine, len)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
 
 	while((tok = strsep(&op, "(,)")) != NULL) {
 		if (i == 3)
@@ -195,126 +378,137 @@ parse_file_owner_mode(mportAssetListEntry **entry, char *cmdLine) {
 		i++;
 	}
 
-	if (permissions[0] != NULL) {
-#ifdef DEBUG
-		fprintf(stderr, "owner %s -", permissions[0]);
-#endif
-		strlcpy((*entry)->owner, permissions[0], MAXLOGNAME);
-	}
-	if (permissions[1] != NULL) {
 #ifdef DEBUG
-		fprintf(stderr, "; group %s -", permissions[1]);
+	fprintf(stderr, "owner %s - group %s - mode %s\n", permissions[0] ? permissions[0] : "",
+	    permissions[1] ? permissions[1] : "", permissions[2] ? permissions[2] : "");
 #endif
-		strlcpy((*entry)->group, permissions[1], MAXLOGNAME * 2);
-	}
-	if (permissions[2] != NULL) {
-#ifdef DEBUG
-		fprintf(stderr, "; mode %s -", permissions[2]);
-#endif
-		strlcpy((*entry)->mode, permissions[2], 5);
-	}
 
+	ret = mport_asset_set_attrs(list, entry, permissions[0], permissions[1], permissions[2]);
 	free(start);
 
-	return MPORT_OK;
+	return ret;
 }
 
 
 
+/*
+ * Classify a command by its first character, then compare only the handful of
+ * commands sharing it.  s is not terminated.
+ */
 static mportAssetListEntryType
-parse_command(const char *s) {
-
-    /* This is in a rough frequency order */
-
-    if (STRING_EQ(s, "comment"))
-        return ASSET_COMMENT;
-
-    if (STRING_EQ(s, "preexec"))
-        return ASSET_PREEXEC;
-    if (STRING_EQ(s, "preunexec"))
-        return ASSET_PREUNEXEC;
-    if (STRING_EQ(s, "postexec"))
-        return ASSET_POSTEXEC;
-    if (STRING_EQ(s, "postunexec"))
-        return ASSET_POSTUNEXEC;
-
-    /* EXEC and UNEXEC are deprecated in favor of their pre/post variants */
-    if (STRING_EQ(s, "exec"))
-        return ASSET_EXEC;
-    if (STRING_EQ(s, "unexec"))
-        return ASSET_UNEXEC;
-
-    /* dir is preferred to dirrm and dirrmtry */
-    if (STRING_EQ(s, "dir"))
-        return ASSET_DIR;
-    if (strncmp(s, "dir(", 4) == 0)
-        return ASSET_DIR_OWNER_MODE;
-    if (STRING_EQ(s, "dirrm"))
-        return ASSET_DIRRM;
-    if (STRING_EQ(s, "dirrmtry"))
-        return ASSET_DIRRMTRY;
-    if (STRING_EQ(s, "cwd") || STRING_EQ(s, "cd"))
-        return ASSET_CWD;
-
-    if (STRING_EQ(s, "srcdir"))
-        return ASSET_SRC;
-    if (STRING_EQ(s, "mode"))
-        return ASSET_CHMOD;
-    if (STRING_EQ(s, "owner"))
-        return ASSET_CHOWN;
-    if (STRING_EQ(s, "group"))
-        return ASSET_CHGRP;
-    if (STRING_EQ(s, "noinst"))
-        return ASSET_NOINST;
-    if (STRING_EQ(s, "ignore"))
-        return ASSET_IGNORE;
-    if (STRING_EQ(s, "ignore_inst"))
-        return ASSET_IGNORE_INST;
-    if (STRING_EQ(s, "info"))
-        return ASSET_INFO;
-    if (STRING_EQ(s, "name"))
-        return ASSET_NAME;
-    if (STRING_EQ(s, "display"))
-        return ASSET_DISPLAY;
-    if (STRING_EQ(s, "pkgdep"))
-        return ASSET_PKGDEP;
-    if (STRING_EQ(s, "conflicts"))
-        return ASSET_CONFLICTS;
-    if (STRING_EQ(s, "mtree"))
-        return ASSET_MTREE;
-    if (STRING_EQ(s, "option"))
-        return ASSET_OPTION;
-    if (STRING_EQ(s, "sample"))
-        return ASSET_SAMPLE;
-    if (strncmp(s, "sample(", 7) == 0)
-		return ASSET_SAMPLE_OWNER_MODE;
-    if (STRING_EQ(s, "shell"))
-        return ASSET_SHELL;
-    if (STRING_EQ(s, "ldconfig-linux")) {
-    	return ASSET_LDCONFIG_LINUX;
-    }
-    if (STRING_EQ(s, "ldconfig")) {
-    	return ASSET_LDCONFIG;
-    }
-    if (STRING_EQ(s, "rmempty")) {
-    	return ASSET_RMEMPTY;
-    }
-    if (STRING_EQ(s, "glib-schemas")) {
-        return ASSET_GLIB_SCHEMAS;
-    }
-    if (STRING_EQ(s, "kld")) {
-        return ASSET_KLD;
-    }
-    if (STRING_EQ(s, "desktop-file-utils")) {
-        return ASSET_DESKTOP_FILE_UTILS;
-    }
-    if (STRING_EQ(s, "touch")) {
-        return ASSET_TOUCH;
-    }
-
-    /* special case, starts with ( as in @(root,wheel,0755) */
-    if (s[0] == '(') {
-		return ASSET_FILE_OWNER_MODE;
+parse_command(const char *s, size_t len) {
+
+    if (len == 0)
+        return ASSET_INVALID;
+
+    switch (s[0]) {
+        case 'c':
+            if (CMND_EQ(s, len, "comment"))
+                return ASSET_COMMENT;
+            if (CMND_EQ(s, len, "cwd") || CMND_EQ(s, len, "cd"))
+                return ASSET_CWD;
+            if (CMND_EQ(s, len, "conflicts"))
+                return ASSET_CONFLICTS;
+            break;
+        case 'd':
+            /* dir is preferred to dirrm and dirrmtry */
+            if (CMND_EQ(s, len, "dir"))
+                return ASSET_DIR;
+            if (CMND_PREFIX(s, len, "dir("))
+                return ASSET_DIR_OWNER_MODE;
+            if (CMND_EQ(s, len, "dirrm"))
+                return ASSET_DIRRM;
+            if (CMND_EQ(s, len, "dirrmtry"))
+                return ASSET_DIRRMTRY;
+            if (CMND_EQ(s, len, "display"))
+                return ASSET_DISPLAY;
+            if (CMND_EQ(s, len, "desktop-file-utils"))
+                return ASSET_DESKTOP_FILE_UTILS;
+            break;
+        case 'e':
+            /* EXEC and UNEXEC are deprecated in favor of their pre/post variants */
+            if (CMND_EQ(s, len, "exec"))
+                return ASSET_EXEC;
+            break;
+        case 'g':
+            if (CMND_EQ(s, len, "group"))
+                return ASSET_CHGRP;
+            if (CMND_EQ(s, len, "glib-schemas"))
+                return ASSET_GLIB_SCHEMAS;
+            break;
+        case 'i':
+            if (CMND_EQ(s, len, "ignore"))
+                return ASSET_IGNORE;
+            if (CMND_EQ(s, len, "ignore_inst"))
+                return ASSET_IGNORE_INST;
+            if (CMND_EQ(s, len, "info"))
+                return ASSET_INFO;
+            break;
+        case 'k':
+            if (CMND_EQ(s, len, "kld"))
+                return ASSET_KLD;
+            break;
+        case 'l':
+            if (CMND_EQ(s, len, "ldconfig"))
+                return ASSET_LDCONFIG;
+            if (CMND_EQ(s, len, "ldconfig-linux"))
+                return ASSET_LDCONFIG_LINUX;
+            break;
+        case 'm':
+            if (CMND_EQ(s, len, "mode"))
+                return ASSET_CHMOD;
+            if (CMND_EQ(s, len, "mtree"))
+                return ASSET_MTREE;
+            break;
+        case 'n':
+            if (CMND_EQ(s, len, "noinst"))
+                return ASSET_NOINST;
+            if (CMND_EQ(s, len, "name"))
+                return ASSET_NAME;
+            break;
+        case 'o':
+            if (CMND_EQ(s, len, "owner"))
+                return ASSET_CHOWN;
+            if (CMND_EQ(s, len, "option"))
+                return ASSET_OPTION;
+            break;
+        case 'p':
+            if (CMND_EQ(s, len, "preexec"))
+                return ASSET_PREEXEC;
+            if (CMND_EQ(s, len, "preunexec"))
+                return ASSET_PREUNEXEC;
+            if (CMND_EQ(s, len, "postexec"))
+                return ASSET_POSTEXEC;
+            if (CMND_EQ(s, len, "postunexec"))
+                return ASSET_POSTUNEXEC;
+            if (CMND_EQ(s, len, "pkgdep"))
+                return ASSET_PKGDEP;
+            break;
+        case 'r':
+            if (CMND_EQ(s, len, "rmempty"))
+                return ASSET_RMEMPTY;
+            break;
+        case 's':
+            if (CMND_EQ(s, len, "sample"))
+                return ASSET_SAMPLE;
+            if (CMND_PREFIX(s, len, "sample("))
+                return ASSET_SAMPLE_OWNER_MODE;
+            if (CMND_EQ(s, len, "srcdir"))
+                return ASSET_SRC;
+            if (CMND_EQ(s, len, "shell"))
+                return ASSET_SHELL;
+            break;
+        case 't':
+            if (CMND_EQ(s, len, "touch"))
+                return ASSET_TOUCH;
+            break;
+        case 'u':
+            if (CMND_EQ(s, len, "unexec"))
+                return ASSET_UNEXEC;
+            break;
+        case '(':
+            /* special case, as in @(root,wheel,0755) */
+            return ASSET_FILE_OWNER_MODE;
     }
 
     return ASSET_INVALID;
@@ -0,0 +1,481 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/queue.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * A pool of worker threads owned by the instance, started on first use.
+ *
+ * Work is submitted as a task group: an ordered array of tasks that is
+ * waited on as a unit.  Workers take the next task of the oldest group with
+ * work left, and a thread waiting on a group runs its tasks too, so groups
+ * may be nested inside tasks and a pool without threads just runs everything
+ * on the caller.  Each task's result and error message are kept with it and
+ * handed back in submission order, so output does not depend on scheduling.
+ */
+
+#define MPORT_POOL_MAX_WORKERS 64
+#define MPORT_POOL_ENV_WORKERS "MPORT_WORKERS"
+
+struct mport_task {
+	mport_task_fn fn;
+	void *arg;
+	int result;
+	char *errmsg;
+	bool done;
+	bool cancelled;
+};
+
+struct mport_taskgroup {
+	struct mport_pool *pool;
+	struct mport_task *tasks;
+	size_t ntasks;
+	size_t size;
+	size_t next;		/* first task not yet started */
+	size_t running;
+	size_t limit;		/* most tasks running at once, 0 for no limit */
+	int flags;
+	bool queued;
+	bool cancelled;
+	pthread_cond_t done;	/* a task finished */
+	TAILQ_ENTRY(mport_taskgroup) link;
+};
+
+struct mport_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* a task can be started, or shutting down */
+	TAILQ_HEAD(, mport_taskgroup) groups;
+	pthread_t *threads;
+	int nthreads;
+	bool shutdown;
+};
+
+static struct mport_pool *pool_get(mportInstance *);
+static void *pool_worker(void *);
+static struct mport_taskgroup *pool_next_group(struct mport_pool *);
+static bool group_can_start(struct mport_taskgroup *);
+static void group_run_one(struct mport_taskgroup *);
+static void group_cancel(struct mport_taskgroup *);
+static int group_drain(struct mport_taskgroup *, mport_task_done_cb, void *, struct mport_task **);
+
+/*
+ * mport_pool_workers(mport)
+ *
+ * The number of worker threads to use: the MPORT_WORKERS environment variable,
+ * else the workers setting, else one per online cpu.  1 runs tasks serially
+ * on the waiting thread.
+ */
+int
+mport_pool_workers(mportInstance *mport)
+{
+	const char *env;
+	char *setting = NULL;
+	long workers = 0;
+
+	if ((env = getenv(MPORT_POOL_ENV_WORKERS)) != NULL && *env != '\0') {
+		workers = strtol(env, NULL, 10);
+	} else if (mport->db != NULL &&
+	    (setting = mport_setting_get(mport, MPORT_SETTING_WORKERS)) != NULL) {
+		workers = strtol(setting, NULL, 10);
+		free(setting);
+	}
+
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers <= 0)
+		workers = 1;
+	if (workers > MPORT_POOL_MAX_WORKERS)
+		workers = MPORT_POOL_MAX_WORKERS;
+
+	return ((int)workers);
+}
+
+static struct mport_pool *
+pool_get(mportInstance *mport)
+{
+	struct mport_pool *pool;
+	int workers;
+
+	if (mport->pool != NULL)
+		return (mport->pool);
+
+	if ((pool = calloc(1, sizeof(struct mport_pool))) == NULL)
+		return (NULL);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	TAILQ_INIT(&pool->groups);
+
+	workers = mport_pool_workers(mport);
+	if (workers > 1 && (pool->threads = calloc(workers, sizeof(pthread_t))) != NULL) {
+		/* fewer threads than asked for still works, the waiter helps */
+		for (; pool->nthreads < workers; pool->nthreads++) {
+			if (pthread_create(&pool->threads[pool->nthreads], NULL, pool_worker, pool) != 0)
+				break;
+		}
+	}
+
+	mport->pool = pool;
+
+	return (pool);
+}
+
+/*
+ * mport_pool_free(pool)
+ *
+ * Stop the workers and release the pool.  Every task group must have been
+ * freed already.
+ */
+void
+mport_pool_free(struct mport_pool *pool)
+{
+	int i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+static void *
+pool_worker(void *arg)
+{
+	struct mport_pool *pool = arg;
+	struct mport_taskgroup *tg;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->shutdown && (tg = pool_next_group(pool)) == NULL)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->shutdown)
+			break;
+		group_run_one(tg);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return (NULL);
+}
+
+/* the oldest group with a task that may start now; called locked */
+static struct mport_taskgroup *
+pool_next_group(struct mport_pool *pool)
+{
+	struct mport_taskgroup *tg;
+
+	TAILQ_FOREACH(tg, &pool->groups, link) {
+		if (group_can_start(tg))
+			return (tg);
+	}
+
+	return (NULL);
+}
+
+/*
+ * mport_taskgroup_new(mport, flags, limit)
+ *
+ * Create an empty task group on the instance's pool.  At most limit of its
+ * tasks run at once, or any number if limit is 0.  With
+ * MPORT_TASKGROUP_FAILFAST, the first failing task cancels the ones not yet
+ * started.
+ */
+struct mport_taskgroup *
+mport_taskgroup_new(mportInstance *mport, int flags, size_t limit)
+{
+	struct mport_taskgroup *tg;
+	struct mport_pool *pool;
+
+	if ((pool = pool_get(mport)) == NULL)
+		return (NULL);
+
+	if ((tg = calloc(1, sizeof(struct mport_taskgroup))) == NULL)
+		return (NULL);
+
+	tg->pool = pool;
+	tg->flags = flags;
+	tg->limit = limit;
+	pthread_cond_init(&tg->done, NULL);
+
+	return (tg);
+}
+
+/*
+ * mport_taskgroup_add(tg, fn, arg)
+ *
+ * Queue fn(arg).  It may start at once, on any thread.  fn returns MPORT_OK or
+ * an error code with the error set as usual.  Tasks may not be added once
+ * the group is being waited on.
+ */
+int
+mport_taskgroup_add(struct mport_taskgroup *tg, mport_task_fn fn, void *arg)
+{
+	struct mport_pool *pool = tg->pool;
+	struct mport_task *tasks;
+	size_t size;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (tg->ntasks == tg->size) {
+		size = tg->size == 0 ? 16 : tg->size * 2;
+		if ((tasks = realloc(tg->tasks, size * sizeof(struct mport_task))) == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		}
+		tg->tasks = tasks;
+		tg->size = size;
+	}
+
+	tg->tasks[tg->ntasks++] = (struct mport_task){ .fn = fn, .arg = arg };
+
+	if (tg->cancelled) {
+		group_cancel(tg);
+	} else if (!tg->queued) {
+		TAILQ_INSERT_TAIL(&pool->groups, tg, link);
+		tg->queued = true;
+	}
+	pthread_cond_signal(&pool->work);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_taskgroup_cancel(tg)
+ *
+ * Cancel the tasks that have not started.  Running tasks are left to finish,
+ * and may poll mport_taskgroup_cancelled() to stop early.
+ */
+void
+mport_taskgroup_cancel(struct mport_taskgroup *tg)
+{
+
+	pthread_mutex_lock(&tg->pool->lock);
+	group_cancel(tg);
+	pthread_mutex_unlock(&tg->pool->lock);
+}
+
+bool
+mport_taskgroup_cancelled(struct mport_taskgroup *tg)
+{
+	bool cancelled;
+
+	pthread_mutex_lock(&tg->pool->lock);
+	cancelled = tg->cancelled;
+	pthread_mutex_unlock(&tg->pool->lock);
+
+	return (cancelled);
+}
+
+/*
+ * mport_taskgroup_wait(tg, cb, arg)
+ *
+ * Wait for every task in the group, helping to run them.  If cb is not NULL
+ * it is called on this thread for each task in the order they were added, as
+ * soon as that task and all before it are done, with the task's argument,
+ * result and error message.  A cb returning anything but MPORT_OK cancels the
+ * remaining tasks and its result is returned.  Otherwise the result of the
+ * first failed task is returned, with its error message set on this thread.
+ */
+int
+mport_taskgroup_wait(struct mport_taskgroup *tg, mport_task_done_cb cb, void *arg)
+{
+	struct mport_task *failed = NULL;
+	int ret;
+
+	if ((ret = group_drain(tg, cb, arg, &failed)) != MPORT_OK)
+		return (ret);
+
+	if (failed != NULL) {
+		if (failed->cancelled)
+			RETURN_ERROR(failed->result, "Cancelled.");
+		return (mport_set_err(failed->result, failed->errmsg));
+	}
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_taskgroup_free(tg)
+ *
+ * Free a task group, first cancelling and waiting for any tasks still
+ * outstanding.
+ */
+void
+mport_taskgroup_free(struct mport_taskgroup *tg)
+{
+	size_t i;
+
+	if (tg == NULL)
+		return;
+
+	mport_taskgroup_cancel(tg);
+	(void) group_drain(tg, NULL, NULL, NULL);
+
+	for (i = 0; i < tg->ntasks; i++)
+		free(tg->tasks[i].errmsg);
+	pthread_cond_destroy(&tg->done);
+	free(tg->tasks);
+	free(tg);
+}
+
+static int
+group_drain(struct mport_taskgroup *tg, mport_task_done_cb cb, void *arg, struct mport_task **failed)
+{
+	struct mport_pool *pool = tg->pool;
+	struct mport_task *t;
+	int ret = MPORT_OK;
+	int cbret;
+	size_t i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < tg->ntasks; i++) {
+		while (!tg->tasks[i].done) {
+			if (group_can_start(tg))
+				group_run_one(tg);
+			else
+				pthread_cond_wait(&tg->done, &pool->lock);
+		}
+
+		t = &tg->tasks[i];
+		if (t->result != MPORT_OK && failed != NULL && *failed == NULL)
+			*failed = t;
+
+		if (cb == NULL || ret != MPORT_OK)
+			continue;
+
+		pthread_mutex_unlock(&pool->lock);
+		cbret = (cb)(t->arg, t->result, t->cancelled ? "Cancelled." : t->errmsg, arg);
+		pthread_mutex_lock(&pool->lock);
+
+		if (cbret != MPORT_OK) {
+			ret = cbret;
+			group_cancel(tg);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return (ret);
+}
+
+/* called locked */
+static bool
+group_can_start(struct mport_taskgroup *tg)
+{
+
+	return (tg->next < tg->ntasks && (tg->limit == 0 || tg->running < tg->limit));
+}
+
+/*
+ * Run the group's next task on this thread.  Called locked, and the lock is
+ * dropped while the task runs; tasks may be reallocated meanwhile, so they
+ * are only touched by index.
+ */
+static void
+group_run_one(struct mport_taskgroup *tg)
+{
+	struct mport_pool *pool = tg->pool;
+	struct mport_task *t;
+	mport_task_fn fn;
+	void *arg;
+	char *errmsg = NULL;
+	void *saved;
+	size_t i;
+	int result, savedcode;
+
+	i = tg->next++;
+	if (tg->next == tg->ntasks && tg->queued) {
+		TAILQ_REMOVE(&pool->groups, tg, link);
+		tg->queued = false;
+	}
+	tg->running++;
+	fn = tg->tasks[i].fn;
+	arg = tg->tasks[i].arg;
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the task starts clean; a waiting caller gets its own error state back */
+	saved = mport_err_save(&savedcode);
+	if ((result = (fn)(arg)) != MPORT_OK)
+		errmsg = strdup(mport_err_string());
+	mport_err_restore(savedcode, saved);
+
+	pthread_mutex_lock(&pool->lock);
+	t = &tg->tasks[i];
+	t->result = result;
+	t->errmsg = errmsg;
+	t->done = true;
+	tg->running--;
+
+	if (result != MPORT_OK && (tg->flags & MPORT_TASKGROUP_FAILFAST))
+		group_cancel(tg);
+
+	pthread_cond_broadcast(&tg->done);
+	/* a limited group may have room for another task now */
+	if (tg->limit != 0 && group_can_start(tg))
+		pthread_cond_signal(&pool->work);
+}
+
+/* mark the tasks that haven't started as cancelled; called locked */
+static void
+group_cancel(struct mport_taskgroup *tg)
+{
+	struct mport_task *t;
+
+	tg->cancelled = true;
+
+	for (; tg->next < tg->ntasks; tg->next++) {
+		t = &tg->tasks[tg->next];
+		t->result = MPORT_ERR_FATAL;
+		t->cancelled = true;
+		t->done = true;
+	}
+
+	if (tg->queued) {
+		TAILQ_REMOVE(&tg->pool->groups, tg, link);
+		tg->queued = false;
+	}
+
+	pthread_cond_broadcast(&tg->done);
+}
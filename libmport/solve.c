@@ -0,0 +1,868 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <fnmatch.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ohash.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * Dependency and conflict solver.  The installed packages, with their
+ * dependencies and conflicts, and the part of the index reachable from the
+ * requested packages are loaded into memory with a handful of queries.
+ * Versions, flavors, moved packages, locks and conflicts are then resolved
+ * without going back to the database, and the whole plan is known before
+ * anything is downloaded.
+ *
+ * Everything the solver allocates lives in its arena; the tables only hold
+ * pointers into it.
+ */
+
+#define SV_DEPTH_MAX	64
+
+struct sv_dep {				/* dependency of an index entry */
+	const char *name;
+	const char *version;		/* the exact version the index wants */
+	struct sv_dep *next;
+};
+
+struct sv_cand {			/* index entry */
+	const char *version;
+	const char *key;
+	const char *bundlefile;
+	const char *hash;
+	struct sv_dep *depends;
+	struct sv_cand *next;
+};
+
+struct sv_user {			/* installed package depending on an installed one */
+	struct sv_pkg *pkg;
+	const char *require;
+	struct sv_user *next;
+};
+
+struct sv_conflict {			/* conflict declared by an installed package */
+	struct sv_pkg *owner;
+	const char *pkg;
+	const char *version;
+	struct sv_conflict *next;
+};
+
+enum sv_state { SV_UNSEEN, SV_VISITING, SV_DONE };
+
+struct sv_pkg {
+	/* installed state */
+	bool installed;
+	bool locked;
+	const char *inst_version;
+	const char *inst_key;
+	const char *origin;
+	const char *os_release;
+	mportAutomatic inst_automatic;
+	struct sv_user *users;
+
+	/* index */
+	struct sv_cand *cands;
+
+	/* solution */
+	enum sv_state state;
+	mportSolveAction action;
+	mportAutomatic automatic;
+	bool replaced;			/* deleted because it moved */
+	struct sv_cand *chosen;
+	struct sv_pkg *next;		/* plan order */
+	char name[];
+};
+
+struct sv_flavored {			/* flavor-name of an installed flavored package */
+	struct sv_pkg *pkg;
+	char name[];
+};
+
+struct sv_root {
+	struct sv_pkg *pkg;
+	const char *version;
+	mportAutomatic automatic;
+	struct sv_root *next;
+};
+
+struct mport_solver {
+	mportInstance *mport;
+	struct mport_arena *arena;
+	bool nomem;
+	char *os_release;
+	struct ohash pkgs;
+	struct ohash flavored;
+	struct sv_conflict *conflicts;
+	struct sv_root *roots, **roots_tail;
+	struct sv_pkg *deletes, **deletes_tail;
+	struct sv_pkg *plan, **plan_tail;
+	bool loaded;
+};
+
+static struct ohash_info sv_pkgs_info = {
+	offsetof(struct sv_pkg, name), NULL, mport_ohash_calloc, mport_ohash_free, mport_ohash_alloc
+};
+static struct ohash_info sv_flavored_info = {
+	offsetof(struct sv_flavored, name), NULL, mport_ohash_calloc, mport_ohash_free, mport_ohash_alloc
+};
+
+static const char * sv_dup(struct mport_solver *, const unsigned char *);
+static struct sv_pkg * sv_pkg(struct mport_solver *, const char *, bool);
+static struct sv_pkg * sv_installed(struct mport_solver *, const char *);
+static int sv_load_installed(struct mport_solver *);
+static int sv_load_index(struct mport_solver *);
+static int sv_add_root(struct mport_solver *, const char *, const char *, mportAutomatic);
+static struct sv_cand * sv_choose(struct sv_pkg *, const char *);
+static bool sv_newer(struct mport_solver *, struct sv_pkg *, struct sv_cand *);
+static int sv_satisfies(struct mport_solver *, const char *, const char *, bool *);
+static int sv_visit(struct mport_solver *, struct sv_pkg *, const char *, mportAutomatic, const char *, int);
+static void sv_order_deletes(struct mport_solver *);
+static int sv_check(struct mport_solver *);
+
+struct mport_solver *
+mport_solver_new(mportInstance *mport)
+{
+	struct mport_solver *sv;
+
+	if ((sv = calloc(1, sizeof(*sv))) == NULL || (sv->arena = mport_arena_new()) == NULL) {
+		free(sv);
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
+	}
+
+	sv->mport = mport;
+	sv->roots_tail = &sv->roots;
+	sv->deletes_tail = &sv->deletes;
+	sv->plan_tail = &sv->plan;
+	ohash_init(&sv->pkgs, 10, &sv_pkgs_info);
+	ohash_init(&sv->flavored, 4, &sv_flavored_info);
+
+	return (sv);
+}
+
+void
+mport_solver_free(struct mport_solver *sv)
+{
+
+	if (sv == NULL)
+		return;
+
+	ohash_delete(&sv->flavored);
+	ohash_delete(&sv->pkgs);
+	mport_arena_free(sv->arena);
+	free(sv->os_release);
+	free(sv);
+}
+
+/*
+ * Add a request.  Installs and upgrades become roots of the index subgraph;
+ * a package that is already installed and current is left alone.
+ */
+int
+mport_solver_add(struct mport_solver *sv, mportSolveAction action, const char *name, const char *version,
+    mportAutomatic automatic)
+{
+	mportInstance *mport = sv->mport;
+	mportIndexEntry **ie = NULL, **e;
+	sqlite3_stmt *stmt;
+	struct sv_pkg *p;
+	const char *moved_to, *date;
+	int ret;
+
+	if (!sv->loaded) {
+		if (sv_load_installed(sv) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		sv->loaded = true;
+	}
+
+	if (action == MPORT_SOLVE_INSTALL) {
+		MPORT_CHECK_FOR_INDEX(mport, "mport_solver_add()");
+
+		/* the name may be an alias or a glob, as for mport_install() */
+		if (mport_index_lookup_pkgname(mport, name, &ie) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+
+		if (ie == NULL || *ie == NULL) {
+			mport_index_entry_free_vec(ie);
+			if (sv_installed(sv, name) != NULL)
+				return (MPORT_OK);
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Package %s not found in the index.", name);
+		}
+
+		e = ie;
+		if (ie[1] != NULL) {
+			while (version != NULL && *e != NULL && strcmp((*e)->version, version) != 0)
+				e++;
+			if (version == NULL || *e == NULL) {
+				mport_index_entry_free_vec(ie);
+				if (version == NULL)
+					RETURN_ERRORX(MPORT_ERR_FATAL, "Could not resolve '%s' to a single package.", name);
+				RETURN_ERRORX(MPORT_ERR_FATAL, "Could not resolve '%s-%s'.", name, version);
+			}
+		}
+
+		ret = sv_add_root(sv, (*e)->pkgname, version, automatic);
+		mport_index_entry_free_vec(ie);
+
+		return (ret);
+	}
+
+	if ((p = sv_installed(sv, name)) == NULL)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s is not installed.", name);
+	if (p->locked)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s is locked.", p->name);
+
+	if (action == MPORT_SOLVE_DELETE) {
+		if (p->action != MPORT_SOLVE_DELETE) {
+			p->action = MPORT_SOLVE_DELETE;
+			*sv->deletes_tail = p;
+			sv->deletes_tail = &p->next;
+		}
+		return (MPORT_OK);
+	}
+
+	MPORT_CHECK_FOR_INDEX(mport, "mport_solver_add()");
+
+	/* an upgrade of a package that has moved replaces it, as mport_upgrade() does */
+	if (p->origin != NULL) {
+		if (mport_db_prepare(mport->db, &stmt, "SELECT moved_to, date FROM idx.moved WHERE port=%Q",
+		    p->origin) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			moved_to = (const char *)sqlite3_column_text(stmt, 0);
+			date = (const char *)sqlite3_column_text(stmt, 1);
+
+			if (moved_to != NULL && moved_to[0] != '\0') {
+				mport_call_msg_cb(mport, "Package %s has moved to %s.", p->name, moved_to);
+				p->action = MPORT_SOLVE_DELETE;
+				p->replaced = true;
+				*sv->deletes_tail = p;
+				sv->deletes_tail = &p->next;
+				ret = mport_solver_add(sv, MPORT_SOLVE_INSTALL, moved_to, NULL, p->inst_automatic);
+				sqlite3_finalize(stmt);
+				return (ret);
+			}
+
+			if (date != NULL && date[0] != '\0')
+				mport_call_msg_cb(mport, "Package %s is deprecated with expiration date %s.", p->name,
+				    date);
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	return (sv_add_root(sv, p->name, NULL, p->inst_automatic));
+}
+
+/*
+ * Resolve every request.  On success *steps holds the plan: deletes first,
+ * dependents before their dependencies, then upgrades and installs with
+ * dependencies first.  The steps belong to the solver.
+ */
+int
+mport_solver_solve(struct mport_solver *sv, mportSolveStep **steps, size_t *count)
+{
+	struct sv_root *r;
+	struct sv_pkg *p;
+	mportSolveStep *s;
+	size_t n = 0;
+
+	*steps = NULL;
+	*count = 0;
+
+	if (sv->roots != NULL && sv_load_index(sv) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	for (r = sv->roots; r != NULL; r = r->next) {
+		if (sv_visit(sv, r->pkg, r->version, r->automatic, NULL, 0) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	}
+
+	sv_order_deletes(sv);
+
+	if (sv_check(sv) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	for (p = sv->deletes; p != NULL; p = p->next)
+		n++;
+	for (p = sv->plan; p != NULL; p = p->next)
+		n++;
+	if (n == 0)
+		return (MPORT_OK);
+
+	if ((s = mport_arena_alloc(sv->arena, n * sizeof(*s))) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	*steps = s;
+	*count = n;
+
+	for (p = sv->deletes; p != NULL; p = p->next, s++) {
+		s->action = MPORT_SOLVE_DELETE;
+		s->automatic = p->inst_automatic;
+		s->name = p->name;
+	}
+	for (p = sv->plan; p != NULL; p = p->next, s++) {
+		s->action = p->action;
+		s->automatic = p->automatic;
+		s->name = p->name;
+		s->version = p->chosen->version;
+		s->bundlefile = p->chosen->bundlefile;
+		s->hash = p->chosen->hash;
+	}
+
+	return (MPORT_OK);
+}
+
+static const char *
+sv_dup(struct mport_solver *sv, const unsigned char *s)
+{
+	char *p;
+
+	if (s == NULL)
+		return (NULL);
+	if ((p = mport_arena_strdup(sv->arena, (const char *)s)) == NULL)
+		sv->nomem = true;
+
+	return (p);
+}
+
+static struct sv_pkg *
+sv_pkg(struct mport_solver *sv, const char *name, bool create)
+{
+	struct sv_pkg *p;
+	unsigned int slot;
+	size_t len;
+
+	slot = ohash_qlookup(&sv->pkgs, name);
+	if ((p = ohash_find(&sv->pkgs, slot)) != NULL || !create)
+		return (p);
+
+	len = strlen(name) + 1;
+	if ((p = mport_arena_alloc(sv->arena, sizeof(*p) + len)) == NULL) {
+		sv->nomem = true;
+		return (NULL);
+	}
+	memcpy(p->name, name, len);
+	ohash_insert(&sv->pkgs, slot, p);
+
+	return (p);
+}
+
+/* The installed package a dependency on name is met by, looking through flavors. */
+static struct sv_pkg *
+sv_installed(struct mport_solver *sv, const char *name)
+{
+	struct sv_pkg *p;
+	struct sv_flavored *f;
+
+	if ((p = sv_pkg(sv, name, false)) != NULL && p->installed)
+		return (p);
+
+	f = ohash_find(&sv->flavored, ohash_qlookup(&sv->flavored, name));
+
+	return (f == NULL ? NULL : f->pkg);
+}
+
+static int
+sv_load_installed(struct mport_solver *sv)
+{
+	sqlite3 *db = sv->mport->db;
+	sqlite3_stmt *stmt;
+	struct sv_pkg *p, *dep;
+	struct sv_flavored *f;
+	struct sv_user *u;
+	struct sv_conflict *c;
+	const char *name, *flavor;
+	char *key;
+	unsigned int slot;
+	size_t len;
+	int ret;
+
+	if ((sv->os_release = mport_get_osrelease(sv->mport)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Unable to determine OS release");
+
+	if (mport_db_prepare(db, &stmt,
+	    "SELECT pkg, version, version_key, origin, flavor, os_release, locked, automatic FROM packages") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		name = (const char *)sqlite3_column_text(stmt, 0);
+		if ((p = sv_pkg(sv, name, true)) == NULL)
+			break;
+		p->installed = true;
+		p->inst_version = sv_dup(sv, sqlite3_column_text(stmt, 1));
+		if (sqlite3_column_type(stmt, 2) != SQLITE_NULL)
+			p->inst_key = sv_dup(sv, sqlite3_column_text(stmt, 2));
+		else if (p->inst_version != NULL && (key = mport_version_key(p->inst_version)) != NULL) {
+			p->inst_key = sv_dup(sv, (const unsigned char *)key);
+			free(key);
+		}
+		p->origin = sv_dup(sv, sqlite3_column_text(stmt, 3));
+		p->os_release = mport_arena_intern(sv->arena, (const char *)sqlite3_column_text(stmt, 5));
+		p->locked = sqlite3_column_int(stmt, 6) != 0;
+		p->inst_automatic = sqlite3_column_int(stmt, 7) ? MPORT_AUTOMATIC : MPORT_EXPLICIT;
+
+		/* dependencies may name the package with its flavor in front */
+		flavor = (const char *)sqlite3_column_text(stmt, 4);
+		if (flavor == NULL || flavor[0] == '\0' || mport_starts_with(flavor, name))
+			continue;
+		len = strlen(flavor) + strlen(name) + 2;
+		if ((f = mport_arena_alloc(sv->arena, sizeof(*f) + len)) == NULL) {
+			sv->nomem = true;
+			break;
+		}
+		f->pkg = p;
+		(void)snprintf(f->name, len, "%s-%s", flavor, name);
+		slot = ohash_qlookup(&sv->flavored, f->name);
+		if (ohash_find(&sv->flavored, slot) == NULL)
+			ohash_insert(&sv->flavored, slot, f);
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		RETURN_CURRENT_ERROR;
+	if (sv->nomem)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	if (mport_db_prepare(db, &stmt, "SELECT pkg, depend_pkgname, depend_pkgversion FROM depends") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if ((p = sv_pkg(sv, (const char *)sqlite3_column_text(stmt, 0), false)) == NULL ||
+		    (dep = sv_installed(sv, (const char *)sqlite3_column_text(stmt, 1))) == NULL)
+			continue;
+		if ((u = mport_arena_alloc(sv->arena, sizeof(*u))) == NULL) {
+			sv->nomem = true;
+			break;
+		}
+		u->pkg = p;
+		u->require = sv_dup(sv, sqlite3_column_text(stmt, 2));
+		u->next = dep->users;
+		dep->users = u;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		RETURN_CURRENT_ERROR;
+	if (sv->nomem)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	if (mport_db_prepare(db, &stmt, "SELECT pkg, conflict_pkg, conflict_version FROM conflicts") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if ((p = sv_pkg(sv, (const char *)sqlite3_column_text(stmt, 0), false)) == NULL)
+			continue;
+		if ((c = mport_arena_alloc(sv->arena, sizeof(*c))) == NULL) {
+			sv->nomem = true;
+			break;
+		}
+		c->owner = p;
+		c->pkg = sv_dup(sv, sqlite3_column_text(stmt, 1));
+		c->version = sv_dup(sv, sqlite3_column_text(stmt, 2));
+		c->next = sv->conflicts;
+		sv->conflicts = c;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		RETURN_CURRENT_ERROR;
+	if (sv->nomem)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	return (MPORT_OK);
+}
+
+/*
+ * Load the index entries reachable from the roots, and their dependencies.
+ * The closure is worked out by sqlite, so this is three queries however deep
+ * the tree is.
+ */
+static int
+sv_load_index(struct mport_solver *sv)
+{
+	sqlite3 *db = sv->mport->db;
+	sqlite3_stmt *stmt;
+	struct sv_root *r;
+	struct sv_pkg *p;
+	struct sv_cand *c;
+	struct sv_dep *d;
+	const char *version;
+	int ret;
+
+	if (mport_db_do(db, "CREATE TEMP TABLE IF NOT EXISTS solve_roots (pkg text NOT NULL)") != MPORT_OK ||
+	    mport_db_do(db, "DELETE FROM temp.solve_roots") != MPORT_OK ||
+	    mport_db_do(db, "DROP TABLE IF EXISTS temp.solve_closure") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	for (r = sv->roots; r != NULL; r = r->next) {
+		if (mport_db_do(db, "INSERT INTO temp.solve_roots (pkg) VALUES (%Q)", r->pkg->name) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	}
+
+	if (mport_db_do(db,
+	    "CREATE TEMP TABLE solve_closure AS WITH RECURSIVE closure(pkg) AS "
+	    "(SELECT pkg FROM temp.solve_roots UNION "
+	    "SELECT idx.depends.d_pkg FROM idx.depends JOIN closure ON idx.depends.pkg = closure.pkg) "
+	    "SELECT pkg FROM closure") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (mport_db_prepare(db, &stmt,
+	    "SELECT pkg, version, mport_version_key(version), bundlefile, hash FROM idx.packages "
+	    "WHERE pkg IN (SELECT pkg FROM temp.solve_closure)") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if ((p = sv_pkg(sv, (const char *)sqlite3_column_text(stmt, 0), true)) == NULL)
+			break;
+		if ((c = mport_arena_alloc(sv->arena, sizeof(*c))) == NULL) {
+			sv->nomem = true;
+			break;
+		}
+		c->version = sv_dup(sv, sqlite3_column_text(stmt, 1));
+		c->key = sv_dup(sv, sqlite3_column_text(stmt, 2));
+		c->bundlefile = sv_dup(sv, sqlite3_column_text(stmt, 3));
+		c->hash = sv_dup(sv, sqlite3_column_text(stmt, 4));
+		c->next = p->cands;
+		p->cands = c;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		RETURN_CURRENT_ERROR;
+	if (sv->nomem)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	if (mport_db_prepare(db, &stmt,
+	    "SELECT pkg, version, d_pkg, d_version FROM idx.depends "
+	    "WHERE pkg IN (SELECT pkg FROM temp.solve_closure)") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if ((p = sv_pkg(sv, (const char *)sqlite3_column_text(stmt, 0), false)) == NULL)
+			continue;
+		version = (const char *)sqlite3_column_text(stmt, 1);
+		for (c = p->cands; c != NULL; c = c->next)
+			if (version != NULL && c->version != NULL && strcmp(c->version, version) == 0)
+				break;
+		if (c == NULL)
+			continue;
+		if ((d = mport_arena_alloc(sv->arena, sizeof(*d))) == NULL) {
+			sv->nomem = true;
+			break;
+		}
+		d->name = sv_dup(sv, sqlite3_column_text(stmt, 2));
+		d->version = sv_dup(sv, sqlite3_column_text(stmt, 3));
+		d->next = c->depends;
+		c->depends = d;
+	}
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
+		RETURN_CURRENT_ERROR;
+	if (sv->nomem)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+
+	(void)mport_db_do(db, "DROP TABLE IF EXISTS temp.solve_closure");
+
+	return (MPORT_OK);
+}
+
+static int
+sv_add_root(struct mport_solver *sv, const char *name, const char *version, mportAutomatic automatic)
+{
+	struct sv_root *r;
+
+	if ((r = mport_arena_alloc(sv->arena, sizeof(*r))) == NULL ||
+	    (r->pkg = sv_pkg(sv, name, true)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	r->version = version == NULL ? NULL : sv_dup(sv, (const unsigned char *)version);
+	r->automatic = automatic;
+	*sv->roots_tail = r;
+	sv->roots_tail = &r->next;
+
+	return (MPORT_OK);
+}
+
+/* The entry for version if the index has it, otherwise the newest. */
+static struct sv_cand *
+sv_choose(struct sv_pkg *p, const char *version)
+{
+	struct sv_cand *c, *best = NULL;
+
+	for (c = p->cands; c != NULL; c = c->next) {
+		if (version != NULL && c->version != NULL && strcmp(c->version, version) == 0)
+			return (c);
+		if (c->key != NULL && (best == NULL || strcmp(c->key, best->key) > 0))
+			best = c;
+	}
+
+	return (best);
+}
+
+/* Whether c should replace the installed p, as mport_index_check() decides. */
+static bool
+sv_newer(struct mport_solver *sv, struct sv_pkg *p, struct sv_cand *c)
+{
+	int cmp;
+
+	if (c->key == NULL || p->inst_key == NULL)
+		return (false);
+
+	if ((cmp = strcmp(c->key, p->inst_key)) != 0)
+		return (cmp > 0);
+
+	/* the same version built for a newer os release */
+	return (p->os_release != NULL && strcmp(p->os_release, sv->os_release) != 0);
+}
+
+/*
+ * Whether the version with the given key meets a dependency on version, which
+ * is either a requirement such as >=1.2 or a bare version taken as the minimum.
+ */
+static int
+sv_satisfies(struct mport_solver *sv, const char *key, const char *version, bool *ok)
+{
+	const mportVersionReq *req;
+	char *min;
+
+	*ok = true;
+	if (version == NULL || version[0] == '\0' || key == NULL)
+		return (MPORT_OK);
+
+	if (strpbrk(version, "<>=") != NULL) {
+		if ((req = mport_version_req_cached(sv->mport, version)) == NULL)
+			RETURN_CURRENT_ERROR;
+		*ok = mport_version_req_match(req, key);
+		return (MPORT_OK);
+	}
+
+	if ((min = mport_version_key(version)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	*ok = strcmp(key, min) >= 0;
+	free(min);
+
+	return (MPORT_OK);
+}
+
+/*
+ * Plan p after everything it depends on.  An installed package asked for by
+ * name is brought up to date; one that is only depended on is left alone
+ * unless it is older than version or built for another OS release.
+ */
+static int
+sv_visit(struct mport_solver *sv, struct sv_pkg *p, const char *version, mportAutomatic automatic,
+    const char *needed_by, int depth)
+{
+	struct sv_pkg *inst, *dp;
+	struct sv_cand *c;
+	struct sv_dep *d;
+	bool ok, stale;
+
+	if (p->action == MPORT_SOLVE_DELETE)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "%s is needed by %s but is being deleted.", p->name,
+		    needed_by == NULL ? "the transaction" : needed_by);
+
+	if (p->state != SV_UNSEEN) {
+		/* planned already, or further up a dependency cycle */
+		if (automatic == MPORT_EXPLICIT && p->action == MPORT_SOLVE_INSTALL)
+			p->automatic = MPORT_EXPLICIT;
+		return (MPORT_OK);
+	}
+
+	if (depth > SV_DEPTH_MAX)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Dependencies of %s are nested too deeply.", p->name);
+
+	p->state = SV_VISITING;
+	c = sv_choose(p, version);
+
+	if ((inst = sv_installed(sv, p->name)) != NULL) {
+		if (inst->action == MPORT_SOLVE_DELETE)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "%s is needed by %s but is being deleted.", inst->name,
+			    needed_by == NULL ? "the transaction" : needed_by);
+
+		/* a flavored package met under its other name is left as it is */
+		if (inst != p) {
+			p->state = SV_DONE;
+			return (MPORT_OK);
+		}
+
+		if (needed_by == NULL) {
+			/* asked for by name: bring it up to date unless it is locked */
+			if (p->locked || c == NULL || !sv_newer(sv, p, c)) {
+				p->state = SV_DONE;
+				return (MPORT_OK);
+			}
+		} else {
+			/* a dependency is only replaced when it no longer meets the need */
+			if (sv_satisfies(sv, p->inst_key, version, &ok) != MPORT_OK)
+				RETURN_CURRENT_ERROR;
+			stale = p->os_release != NULL && strcmp(p->os_release, sv->os_release) != 0;
+			if (ok && !stale) {
+				p->state = SV_DONE;
+				return (MPORT_OK);
+			}
+
+			if (p->locked && !ok)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s is locked, but %s needs version %s.", p->name,
+				    needed_by, version);
+			if (p->locked)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s is locked, but %s needs it built for %s.", p->name,
+				    needed_by, sv->os_release);
+			if (c == NULL || !sv_newer(sv, p, c))
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s needs %s %s, but the index has nothing newer than %s.",
+				    needed_by, p->name, ok ? "built for this OS release" : version, p->inst_version);
+			if (sv_satisfies(sv, c->key, version, &ok) != MPORT_OK)
+				RETURN_CURRENT_ERROR;
+			if (!ok)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s needs %s version %s, but the index has %s.",
+				    needed_by, p->name, version, c->version);
+		}
+
+		/* an upgrade keeps the package's own flag */
+		p->action = MPORT_SOLVE_UPGRADE;
+		p->automatic = p->inst_automatic;
+	} else {
+		if (c == NULL) {
+			if (needed_by != NULL)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s, needed by %s, is not in the index.", p->name,
+				    needed_by);
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Package %s not found in the index.", p->name);
+		}
+		if (c->bundlefile == NULL)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Package %s does not contain a bundle file.", p->name);
+		p->action = MPORT_SOLVE_INSTALL;
+		p->automatic = automatic;
+	}
+	p->chosen = c;
+
+	for (d = c->depends; d != NULL; d = d->next) {
+		if ((dp = sv_pkg(sv, d->name, true)) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		if (sv_visit(sv, dp, d->version, MPORT_AUTOMATIC, p->name, depth + 1) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	}
+
+	p->state = SV_DONE;
+	*sv->plan_tail = p;
+	sv->plan_tail = &p->next;
+
+	return (MPORT_OK);
+}
+
+/* Put every delete after the packages being deleted that depend on it. */
+static void
+sv_order_deletes(struct mport_solver *sv)
+{
+	struct sv_pkg *pending, **pp, *p, *q, *ordered = NULL, **tail = &ordered;
+	struct sv_user *u;
+	bool ready;
+
+	pending = sv->deletes;
+	while (pending != NULL) {
+		for (pp = &pending; (p = *pp) != NULL; pp = &p->next) {
+			ready = true;
+			for (u = p->users; ready && u != NULL; u = u->next) {
+				if (u->pkg->action != MPORT_SOLVE_DELETE)
+					continue;
+				/* wait for dependents that are still pending */
+				for (q = pending; ready && q != NULL; q = q->next)
+					if (q == u->pkg && q != p)
+						ready = false;
+			}
+			if (ready)
+				break;
+		}
+		/* a cycle is broken in request order */
+		if (p == NULL) {
+			pp = &pending;
+			p = pending;
+		}
+		*pp = p->next;
+		p->next = NULL;
+		*tail = p;
+		tail = &p->next;
+	}
+
+	sv->deletes = ordered;
+	sv->deletes_tail = tail;
+}
+
+/* Check the plan against the installed packages that it leaves in place. */
+static int
+sv_check(struct mport_solver *sv)
+{
+	const mportVersionReq *req;
+	struct sv_conflict *c;
+	struct sv_user *u;
+	struct sv_pkg *p;
+
+	for (p = sv->deletes; p != NULL; p = p->next) {
+		if (p->replaced)
+			continue;
+		for (u = p->users; u != NULL; u = u->next) {
+			if (u->pkg->action != MPORT_SOLVE_DELETE)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "%s is required by %s.", p->name, u->pkg->name);
+		}
+	}
+
+	for (p = sv->plan; p != NULL; p = p->next) {
+		if (p->action == MPORT_SOLVE_UPGRADE) {
+			for (u = p->users; u != NULL; u = u->next) {
+				if (u->require == NULL || u->pkg->action != MPORT_SOLVE_NONE)
+					continue;
+				if ((req = mport_version_req_cached(sv->mport, u->require)) == NULL)
+					RETURN_CURRENT_ERROR;
+				if (!mport_version_req_match(req, p->chosen->key))
+					RETURN_ERRORX(MPORT_ERR_FATAL,
+					    "Upgrading %s to %s would break %s, which requires version %s.",
+					    p->name, p->chosen->version, u->pkg->name, u->require);
+			}
+		}
+
+		for (c = sv->conflicts; c != NULL; c = c->next) {
+			if (c->owner == p || c->owner->action == MPORT_SOLVE_DELETE ||
+			    c->pkg == NULL || c->version == NULL)
+				continue;
+			if (fnmatch(c->pkg, p->name, 0) == 0 && fnmatch(c->version, p->chosen->version, 0) == 0)
+				RETURN_ERRORX(MPORT_ERR_FATAL, "Installed package %s-%s conflicts with %s-%s.",
+				    c->owner->name, c->owner->inst_version, p->name, p->chosen->version);
+		}
+	}
+
+	return (MPORT_OK);
+}
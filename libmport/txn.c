@@ -0,0 +1,537 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/queue.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * Transactions.  The caller queues installs, deletes and upgrades, and
+ * mport_txn_commit() plans the whole change set before touching anything:
+ * the solver resolves every request at once, and every bundle is fetched and
+ * verified up front.  The plan then runs deletes first (dependents before
+ * their dependencies), followed by upgrades and installs in dependency order.
+ *
+ * Cache rebuilds such as glib-compile-schemas and indexinfo are queued while
+ * the plan runs and each distinct command is run once at the end; ldconfig and
+ * kldxref still run per package, so later install scripts see the libraries
+ * and modules of their dependencies.  Deleted and upgraded packages are backed
+ * up to temporary bundles first; if a step fails, the completed steps
+ * are undone newest first, so the set of installed packages is what it was
+ * before the commit.
+ */
+
+struct txn_request {
+	mportSolveAction action;
+	mportAutomatic automatic;
+	char *version;
+	STAILQ_ENTRY(txn_request) link;
+	char name[];
+};
+
+struct txn_step {
+	mportSolveAction action;
+	mportAutomatic automatic;
+	bool started;
+	const char *name;		/* these belong to the solver */
+	const char *bundlefile;
+	const char *hash;
+	char *bundle;			/* verified local bundle, install and upgrade */
+	char *backup;			/* backup bundle, delete and upgrade */
+	mportPackageMeta **installed;	/* the installed package, delete and upgrade */
+	TAILQ_ENTRY(txn_step) link;
+};
+
+struct txn_trigger {
+	STAILQ_ENTRY(txn_trigger) link;
+	char cmd[];
+};
+
+struct mport_txn {
+	mportInstance *mport;
+	STAILQ_HEAD(, txn_request) requests;
+	struct mport_solver *solver;
+	TAILQ_HEAD(txn_steps, txn_step) plan;
+	STAILQ_HEAD(, txn_trigger) triggers;
+	bool executing;
+	bool committed;
+};
+
+static int txn_request(mportTransaction *, mportSolveAction, const char *, const char *, mportAutomatic);
+static struct txn_step * txn_step_new(const mportSolveStep *);
+static void txn_step_free(struct txn_step *);
+static int txn_plan(mportTransaction *);
+static int txn_fetch(mportTransaction *);
+static int txn_apply(mportTransaction *, struct txn_step *);
+static void txn_rollback(mportTransaction *);
+static int txn_undo(mportTransaction *, struct txn_step *);
+static int txn_run_triggers(mportTransaction *);
+
+MPORT_PUBLIC_API mportTransaction *
+mport_txn_begin(mportInstance *mport)
+{
+	mportTransaction *txn;
+
+	if (mport == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+		return (NULL);
+	}
+
+	if (mport->txn != NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "A transaction is already open.");
+		return (NULL);
+	}
+
+	if ((txn = calloc(1, sizeof(mportTransaction))) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
+	}
+
+	txn->mport = mport;
+	STAILQ_INIT(&txn->requests);
+	TAILQ_INIT(&txn->plan);
+	STAILQ_INIT(&txn->triggers);
+	mport->txn = txn;
+
+	return (txn);
+}
+
+MPORT_PUBLIC_API int
+mport_txn_add_install(mportTransaction *txn, const char *pkgname, const char *version, mportAutomatic automatic)
+{
+
+	return (txn_request(txn, MPORT_SOLVE_INSTALL, pkgname, version, automatic));
+}
+
+MPORT_PUBLIC_API int
+mport_txn_add_delete(mportTransaction *txn, const char *pkgname)
+{
+
+	return (txn_request(txn, MPORT_SOLVE_DELETE, pkgname, NULL, MPORT_EXPLICIT));
+}
+
+MPORT_PUBLIC_API int
+mport_txn_add_upgrade(mportTransaction *txn, const char *pkgname)
+{
+
+	return (txn_request(txn, MPORT_SOLVE_UPGRADE, pkgname, NULL, MPORT_EXPLICIT));
+}
+
+static int
+txn_request(mportTransaction *txn, mportSolveAction action, const char *pkgname, const char *version,
+    mportAutomatic automatic)
+{
+	struct txn_request *r;
+	size_t len;
+
+	if (txn == NULL || pkgname == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Invalid transaction request.");
+
+	if (txn->committed)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Transaction has already been committed.");
+
+	STAILQ_FOREACH(r, &txn->requests, link) {
+		if (strcmp(r->name, pkgname) == 0)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "%s is already part of the transaction.", pkgname);
+	}
+
+	len = strlen(pkgname) + 1;
+	if ((r = calloc(1, sizeof(*r) + len)) == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	memcpy(r->name, pkgname, len);
+	r->action = action;
+	r->automatic = automatic;
+	if (version != NULL && (r->version = strdup(version)) == NULL) {
+		free(r);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+	STAILQ_INSERT_TAIL(&txn->requests, r, link);
+
+	return (MPORT_OK);
+}
+
+MPORT_PUBLIC_API int
+mport_txn_commit(mportTransaction *txn)
+{
+	mportInstance *mport;
+	struct txn_step *s;
+	char *errmsg;
+	int errcode, ret;
+
+	if (txn == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Invalid transaction.");
+
+	if (txn->committed)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Transaction has already been committed.");
+	txn->committed = true;
+	mport = txn->mport;
+
+	/* plan: nothing is changed until every request resolves and every bundle is here */
+	if (txn_plan(txn) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (txn_fetch(txn) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	/* execute */
+	txn->executing = true;
+	TAILQ_FOREACH(s, &txn->plan, link) {
+		if (mport_cancelled(mport)) {
+			SET_ERROR(MPORT_ERR_FATAL, "Transaction cancelled.");
+			break;
+		}
+
+		if (txn_apply(txn, s) != MPORT_OK)
+			break;
+	}
+
+	if (s == NULL) {
+		txn->executing = false;
+		return (txn_run_triggers(txn));
+	}
+
+	/* the undo steps report errors of their own, keep the one that stopped us */
+	errcode = mport_err_code();
+	errmsg = strdup(mport_err_string());
+
+	mport_call_msg_cb(mport, "Transaction failed at %s: %s", s->name, mport_err_string());
+	txn_rollback(txn);
+	txn->executing = false;
+	(void)txn_run_triggers(txn);
+
+	ret = mport_set_err(errcode, errmsg == NULL ? "Transaction failed." : errmsg);
+	free(errmsg);
+
+	return (ret);
+}
+
+MPORT_PUBLIC_API void
+mport_txn_free(mportTransaction *txn)
+{
+	struct txn_request *r;
+	struct txn_step *s;
+	struct txn_trigger *t;
+
+	if (txn == NULL)
+		return;
+
+	while ((r = STAILQ_FIRST(&txn->requests)) != NULL) {
+		STAILQ_REMOVE_HEAD(&txn->requests, link);
+		free(r->version);
+		free(r);
+	}
+
+	while ((s = TAILQ_FIRST(&txn->plan)) != NULL) {
+		TAILQ_REMOVE(&txn->plan, s, link);
+		txn_step_free(s);
+	}
+	mport_solver_free(txn->solver);
+
+	while ((t = STAILQ_FIRST(&txn->triggers)) != NULL) {
+		STAILQ_REMOVE_HEAD(&txn->triggers, link);
+		free(t);
+	}
+
+	if (txn->mport != NULL && txn->mport->txn == txn)
+		txn->mport->txn = NULL;
+
+	free(txn);
+}
+
+/*
+ * Run a system trigger, or queue it while a transaction is executing.
+ * Queued commands are run once each, in the order first seen.  Only
+ * idempotent cache rebuilds belong here: ldconfig and kldxref must run
+ * before a later package's @postexec, so those go through mport_xsystem().
+ */
+int
+mport_trigger(mportInstance *mport, const char *fmt, ...)
+{
+	mportTransaction *txn = mport->txn;
+	struct txn_trigger *t;
+	va_list args;
+	char *cmd = NULL;
+	size_t len;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vasprintf(&cmd, fmt, args);
+	va_end(args);
+	if (ret == -1)
+		RETURN_ERROR(MPORT_ERR_FATAL, "Couldn't allocate trigger command.");
+
+	if (txn == NULL || !txn->executing) {
+		ret = mport_xsystem(mport, "%s", cmd);
+		free(cmd);
+		return (ret);
+	}
+
+	STAILQ_FOREACH(t, &txn->triggers, link) {
+		if (strcmp(t->cmd, cmd) == 0) {
+			free(cmd);
+			return (MPORT_OK);
+		}
+	}
+
+	len = strlen(cmd) + 1;
+	if ((t = malloc(sizeof(*t) + len)) == NULL) {
+		free(cmd);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+	}
+	memcpy(t->cmd, cmd, len);
+	free(cmd);
+	STAILQ_INSERT_TAIL(&txn->triggers, t, link);
+
+	return (MPORT_OK);
+}
+
+/* The backup taken for pkgname by the transaction being executed, if any. */
+const char *
+mport_txn_backup(mportInstance *mport, const char *pkgname)
+{
+	struct txn_step *s;
+
+	if (mport->txn == NULL || !mport->txn->executing)
+		return (NULL);
+
+	TAILQ_FOREACH(s, &mport->txn->plan, link) {
+		if (strcmp(s->name, pkgname) == 0)
+			return (s->backup);
+	}
+
+	return (NULL);
+}
+
+static struct txn_step *
+txn_step_new(const mportSolveStep *step)
+{
+	struct txn_step *s;
+
+	if ((s = calloc(1, sizeof(*s))) == NULL)
+		return (NULL);
+	s->action = step->action;
+	s->automatic = step->automatic;
+	s->name = step->name;
+	s->bundlefile = step->bundlefile;
+	s->hash = step->hash;
+
+	return (s);
+}
+
+static void
+txn_step_free(struct txn_step *s)
+{
+
+	free(s->bundle);
+	if (s->backup != NULL) {
+		(void)unlink(s->backup);
+		free(s->backup);
+	}
+	mport_pkgmeta_vec_free(s->installed);
+	free(s);
+}
+
+/*
+ * Resolve the requests with the solver and look up the installed packages
+ * the plan deletes or upgrades, which are backed up before they are touched.
+ */
+static int
+txn_plan(mportTransaction *txn)
+{
+	mportInstance *mport = txn->mport;
+	struct txn_request *r;
+	struct txn_step *s;
+	mportSolveStep *steps;
+	size_t count, i;
+
+	if ((txn->solver = mport_solver_new(mport)) == NULL)
+		RETURN_CURRENT_ERROR;
+
+	STAILQ_FOREACH(r, &txn->requests, link) {
+		if (mport_solver_add(txn->solver, r->action, r->name, r->version, r->automatic) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+	}
+
+	if (mport_solver_solve(txn->solver, &steps, &count) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	for (i = 0; i < count; i++) {
+		if ((s = txn_step_new(&steps[i])) == NULL)
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		TAILQ_INSERT_TAIL(&txn->plan, s, link);
+
+		if (s->action == MPORT_SOLVE_INSTALL)
+			continue;
+		if (mport_pkgmeta_search_master(mport, &s->installed, "pkg=%Q", s->name) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		if (s->installed == NULL)
+			RETURN_ERRORX(MPORT_ERR_FATAL, "%s is not installed.", s->name);
+	}
+
+	return (MPORT_OK);
+}
+
+/* Fetch and verify every bundle the plan needs. */
+static int
+txn_fetch(mportTransaction *txn)
+{
+	mportInstance *mport = txn->mport;
+	struct txn_step *s;
+
+	TAILQ_FOREACH(s, &txn->plan, link) {
+		if (s->bundlefile == NULL)
+			continue;
+
+		if (asprintf(&s->bundle, "%s/%s", mport->outputPath, s->bundlefile) == -1) {
+			s->bundle = NULL;
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		}
+
+		if (!mport_file_exists(s->bundle) &&
+		    mport_fetch_bundle(mport, mport->outputPath, s->bundlefile) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+
+		if (s->hash != NULL && mport_verify_hash(s->bundle, s->hash) == 0) {
+			(void)unlink(s->bundle);
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Package %s failed hash verification and was removed.",
+			    s->name);
+		}
+	}
+
+	return (MPORT_OK);
+}
+
+/*
+ * A step only counts as started, and so gets rolled back, once its backup
+ * exists: a failed backup has not touched the installed package.
+ */
+static int
+txn_apply(mportTransaction *txn, struct txn_step *s)
+{
+	mportInstance *mport = txn->mport;
+
+	switch (s->action) {
+	case MPORT_SOLVE_DELETE:
+		if (mport_bundle_backup_pkg(mport, s->installed[0], &s->backup) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		s->started = true;
+		/* the solver has checked nothing left behind depends on it */
+		s->installed[0]->action = MPORT_ACTION_DELETE;
+		return (mport_delete_primative(mport, s->installed[0], 1));
+	case MPORT_SOLVE_UPGRADE:
+		/* the update reuses this backup rather than taking its own */
+		if (mport_bundle_backup_pkg(mport, s->installed[0], &s->backup) != MPORT_OK)
+			RETURN_CURRENT_ERROR;
+		s->started = true;
+		return (mport_update_primative(mport, s->bundle));
+	case MPORT_SOLVE_INSTALL:
+		s->started = true;
+		return (mport_install_primative(mport, s->bundle, NULL, s->automatic));
+	case MPORT_SOLVE_NONE:
+		break;
+	}
+
+	return (MPORT_OK);
+}
+
+/* Undo every step that was started, newest first. */
+static void
+txn_rollback(mportTransaction *txn)
+{
+	struct txn_step *s;
+
+	TAILQ_FOREACH_REVERSE(s, &txn->plan, txn_steps, link) {
+		if (!s->started)
+			continue;
+		mport_call_msg_cb(txn->mport, "Rolling back %s", s->name);
+		if (txn_undo(txn, s) != MPORT_OK)
+			mport_call_msg_cb(txn->mport, "Could not roll back %s: %s", s->name, mport_err_string());
+	}
+}
+
+/*
+ * Remove whatever the step left installed, then put back the backup.  This
+ * also covers a step that failed part way; an update that fails restores its
+ * backup itself, so there is nothing left to remove.
+ */
+static int
+txn_undo(mportTransaction *txn, struct txn_step *s)
+{
+	mportInstance *mport = txn->mport;
+	mportPackageMeta **packs = NULL;
+	int ret;
+
+	if (mport_pkgmeta_search_master(mport, &packs, "pkg=%Q", s->name) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (packs != NULL) {
+		if (s->action == MPORT_SOLVE_DELETE || s->backup == NULL ||
+		    strcmp(packs[0]->version, s->installed[0]->version) != 0) {
+			packs[0]->action = MPORT_ACTION_DELETE;
+			ret = mport_delete_primative(mport, packs[0], 1);
+			mport_pkgmeta_vec_free(packs);
+			if (ret != MPORT_OK)
+				RETURN_CURRENT_ERROR;
+		} else {
+			/* the old version is still, or again, in place */
+			mport_pkgmeta_vec_free(packs);
+			return (MPORT_OK);
+		}
+	}
+
+	if (s->backup == NULL)
+		return (MPORT_OK);
+
+	return (mport_install_primative(mport, s->backup, NULL, s->installed[0]->automatic));
+}
+
+/* Run the queued triggers once each; a failure is reported but does not undo anything. */
+static int
+txn_run_triggers(mportTransaction *txn)
+{
+	mportInstance *mport = txn->mport;
+	struct txn_trigger *t;
+	int ret = MPORT_OK;
+
+	while ((t = STAILQ_FIRST(&txn->triggers)) != NULL) {
+		STAILQ_REMOVE_HEAD(&txn->triggers, link);
+		if (mport_xsystem(mport, "%s", t->cmd) != MPORT_OK) {
+			mport_call_msg_cb(mport, "Could not run %s: %s", t->cmd, mport_err_string());
+			ret = mport_err_code();
+		}
+		free(t);
+	}
+
+	return (ret);
+}
@@ -42,6 +42,9 @@ mport_update(mportInstance *mport, const char *packageName) {
 		return (MPORT_ERR_WARN);
 	}
 
+	if (mport_cancelled(mport))
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Update of %s cancelled.", packageName);
+
 	int result = mport_download(mport, packageName, false, false, &path);
 	if (result != MPORT_OK)
 		return result;
@@ -130,6 +130,8 @@ mport_upgrade(mportInstance *mport) {
     // update packages that haven't moved already
 	packs = packs_orig;
 	while (*packs != NULL) {
+		if (mport_cancelled(mport))
+			break;
 
 		slot = ohash_qlookup(&h, (*packs)->name);
 		key = ohash_find(&h, slot);
@@ -148,6 +150,8 @@ mport_upgrade(mportInstance *mport) {
 	ohash_delete(&h);
 
 	mport_call_msg_cb(mport, "Packages updated: %d\nTotal: %d\n", updated, total);
+	if (mport_cancelled(mport))
+		RETURN_ERROR(MPORT_ERR_FATAL, "Upgrade cancelled.");
 	return (MPORT_OK);
 }
 
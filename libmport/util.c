@@ -69,6 +69,8 @@ mport_createextras_new(void)
 	extra->pkginstall = NULL;
 	extra->pkgdeinstall = NULL;
 	extra->pkgmessage = NULL;
+	extra->dictionary = NULL;
+	extra->dedup = false;
 	extra->conflicts = NULL;
 	extra->depends = NULL;
 
@@ -91,6 +93,8 @@ mport_createextras_free(mportCreateExtras *extra)
 	extra->pkgdeinstall = NULL;
 	free(extra->pkgmessage);
 	extra->pkgmessage = NULL;
+	free(extra->dictionary);
+	extra->dictionary = NULL;
 
 	if (extra->conflicts_count > 0 && extra->conflicts != NULL) {
 		for (i = 0; i < extra->conflicts_count; i++) {
@@ -146,6 +150,28 @@ mport_starts_with(const char *pre, const char *str)
 	return strncmp(pre, str, strlen(pre)) == 0;
 }
 
+/* allocation hooks for ohash tables, see ohash_init(3) */
+void *
+mport_ohash_calloc(size_t n, size_t s, void *data)
+{
+
+	return (calloc(n, s));
+}
+
+void
+mport_ohash_free(void *p, void *data)
+{
+
+	free(p);
+}
+
+void *
+mport_ohash_alloc(size_t s, void *data)
+{
+
+	return (malloc(s));
+}
+
 /* mport_hash_file(const char * filename)
  *
  * Return a SHA256 hash of a file.  Must free result
@@ -238,37 +264,6 @@ mport_rmtree(const char *filename)
 	return MPORT_OK;
 }
 
-/*
- * Copy file fromname to toname
- */
-int
-mport_copy_file(const char *fromName, const char *toName)
-{
-	char buf[BUFSIZ];
-	size_t size;
-
-	FILE *fsrc = fopen(fromName, "re");
-	if (fsrc == NULL)
-		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open source file for copying %s: %s",
-		    fromName, strerror(errno));
-
-	FILE *fdest = fopen(toName, "we");
-	if (fdest == NULL) {
-		fclose(fsrc);
-		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't open destination file for copying %s: %s",
-		    toName, strerror(errno));
-	}
-
-	while ((size = fread(buf, 1, BUFSIZ, fsrc)) > 0) {
-		fwrite(buf, 1, size, fdest);
-	}
-
-	fclose(fsrc);
-	fclose(fdest);
-
-	return (MPORT_OK);
-}
-
 /*
  * create a directory with mode 755.  Do not fail if the
  * directory exists already.
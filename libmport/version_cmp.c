@@ -28,6 +28,7 @@
 
 #include <sys/cdefs.h>
 
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -86,206 +87,395 @@ mport_version_cmp(const char *astr, const char *bstr)
 void
 mport_version_cmp_sqlite(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
-    char *a = NULL;
-	char *b = NULL;
+	const char *a, *b;
 
-    assert(argc == 2);
+	assert(argc == 2);
 
-    a = strdup(sqlite3_value_text(argv[0]));
-    b = strdup(sqlite3_value_text(argv[1]));
+	a = (const char *)sqlite3_value_text(argv[0]);
+	b = (const char *)sqlite3_value_text(argv[1]);
 
-    assert(a != NULL);
-    assert(b != NULL);
+	if (a == NULL || b == NULL) {
+		sqlite3_result_null(context);
+		return;
+	}
 
-    sqlite3_result_int(context, mport_version_cmp(a, b));
+	sqlite3_result_int(context, mport_version_cmp(a, b));
+}
 
-    free(a);
-	a = NULL;
-    free(b);
-	b = NULL;
-}  
 
+/*
+ * Version keys.  Each number in a key is written as one character giving
+ * its count of digits followed by the digits, so longer numbers sort
+ * after shorter ones.  A key is the epoch, then every component of the
+ * version (a run of digits, or the code of any other character) with
+ * trailing zero components dropped, then a '-' and the revision.  '-' sorts
+ * before any digit count, so a version that runs out of components sorts
+ * before one that carries on, as mport_version_cmp() pads with zeros.
+ */
+static const char key_digits[] = "0123456789ABCDEFGHIJK";
 
-/* Returns 0 if baseline meets the given requirement, -1 if the requirement
- * was not met, and a value greater than 0 on error.  some examples:
+static char *
+key_append_num(char *p, long n)
+{
+	char num[24];
+	int len;
+
+	if (n < 0)
+		n = 0;
+
+	len = snprintf(num, sizeof(num), "%ld", n);
+	*p++ = key_digits[len];
+	memcpy(p, num, len);
+
+	return (p + len);
+}
+
+/* mport_version_key(version)
  *
- * mport_version_require_check("0.2.1", ">=2.0") == 0
- * mport_version_require_check("4.1.2", ">5.1")  == -1
- * mport_version_require_check("3.1.4", "|")     > 0
- * multi example:
- * mport_version_require_check("0.2.1", ">=1.4.0<1.5")
+ * Return a key for version, allocated with malloc(3), such that comparing
+ * the keys of two versions with strcmp(3), or as text in sqlite, orders
+ * them the same as mport_version_cmp() does.  Returns NULL if out of memory.
  */
-int
-mport_version_require_check(const char *baseline, const char *require)
+MPORT_PUBLIC_API char *
+mport_version_key(const char *str)
 {
-    int ret = 0;
-
-    bool multi = false;
-    int greater[2] = {-1,-1} ;
-    int less[2] = {-1,-1};
-    int equal[2] = {-1,-1};
-    size_t version_size = strlen(require);
+	struct version v;
+	char *key, *p, *end, *s;
+	long sub;
+
+	parse_version(str, &v);
+	if (v.version == NULL)
+		return (NULL);
+
+	/* a component is at most a count and the digits of one input char */
+	if ((key = malloc(strlen(v.version) * 4 + 64)) == NULL) {
+		free(v.version);
+		return (NULL);
+	}
 
-    if (version_size < 2) {
-    	return 1; // impossible to validate
-    }
+	p = key_append_num(key, v.epoch);
+	end = p;
 
-	for (size_t i = 0; i < version_size; i++) {
-		if (require[i] == '>') {
-			if (greater[0] == -1) {
-				greater[0] = i;
-			} else {
-				greater[1] = i;
-			}
-		} else if (require[i] == '<') {
-			if (less[0] == -1) {
-				less[0] = i;
-			} else {
-				less[1] = i;
-			}
-		} else if (require[i] == '=') {
-			if (equal[0] == -1) {
-				equal[0] = i;
-			} else {
-				equal[1] = i;
-			}
+	for (s = v.version; *s != '\0';) {
+		if (*s == '.' || *s == '+') {
+			s++;
+			continue;
 		}
+
+		if (isdigit((unsigned char)*s))
+			sub = strtol(s, &s, 10);
+		else
+			sub = (unsigned char)*s++;
+
+		p = key_append_num(p, sub);
+		if (sub != 0)
+			end = p;
 	}
 
-#ifdef DEBUG
-	printf(" g0 %d g1 %d l0 %d l1 %d eq0 %d\n", greater[0], greater[1], less[0], less[1], equal[0]);
-#endif
+	p = end;
+	*p++ = '-';
+	p = key_append_num(p, v.revision);
+	*p = '\0';
+
+	free(v.version);
+
+	return (key);
+}
+
+
+/* version of mport_version_key() that is bound to the sqlite3 database. */
+void
+mport_version_key_sqlite(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	const char *version;
+	char *key;
 
-	if (greater[0] == -1 && less[0] == -1 && equal[0] == -1) {
-		RETURN_ERRORX(MPORT_ERR_FATAL, "Malformed version requirement: %s", require);
+	assert(argc == 1);
+
+	if ((version = (const char *)sqlite3_value_text(argv[0])) == NULL) {
+		sqlite3_result_null(context);
+		return;
 	}
 
-	if (greater[1] > -1 || less[1] > -1 || equal[1] > -1 || (greater[0] > -1 && less[0] > -1)) {
-		multi = true;
-#ifdef DEBUG
-		printf("multi enabled\n");
-#endif
+	if ((key = mport_version_key(version)) == NULL) {
+		sqlite3_result_error_nomem(context);
+		return;
 	}
 
-	if (!multi) {
-		if (require[0] == '<') {
-			if (require[1] == '=') {
-				ret = (mport_version_cmp(baseline, &require[2]) <= 0) ? 0 : -1;
-			} else {
-				ret = (mport_version_cmp(baseline, &require[1]) < 0) ? 0 : -1;
-			}
-		} else if (require[0] == '>') {
-			if (require[1] == '=') {
-				ret = (mport_version_cmp(baseline, &require[2]) >= 0) ? 0 : -1;
-			} else {
-				ret = (mport_version_cmp(baseline, &require[1]) > 0) ? 0 : -1;
-			}
-		} else {
-			RETURN_ERRORX(MPORT_ERR_FATAL, "Malformed version requirement: %s", require);
+	sqlite3_result_text(context, key, -1, free);
+}
+
+
+/*
+ * Compiled version requirements.  A requirement is a list of clauses, each
+ * an operator (<, <=, >, >=, =) and a version, all of which must hold:
+ * ">=1.4.0<1.5", or ">=1.2,<2" (a comma followed by a version is an epoch,
+ * followed by an operator it separates clauses).  The versions are kept as
+ * version keys, so matching is a strcmp() per clause and never allocates.
+ */
+enum req_op {
+	REQ_LT, REQ_LE, REQ_GT, REQ_GE, REQ_EQ
+};
+
+struct req_clause {
+	enum req_op op;
+	char *key;
+};
+
+struct _mportVersionReq {
+	size_t count;
+	struct req_clause clauses[];
+};
+
+static bool
+is_req_op(char c)
+{
+
+	return (c == '<' || c == '>' || c == '=');
+}
+
+/* mport_version_req_compile(require)
+ *
+ * Compile a version requirement for mport_version_req_match().  Returns
+ * NULL, with the error set, if it is malformed.
+ */
+MPORT_PUBLIC_API mportVersionReq *
+mport_version_req_compile(const char *require)
+{
+	mportVersionReq *req;
+	struct req_clause *c;
+	const char *p, *start;
+	char *version;
+	size_t max = 0;
+
+	for (p = require; *p != '\0'; p++)
+		if (is_req_op(*p))
+			max++;
+
+	if (max == 0) {
+		SET_ERRORX(MPORT_ERR_FATAL, "Malformed version requirement: %s", require);
+		return (NULL);
+	}
+
+	if ((req = calloc(1, sizeof(*req) + max * sizeof(struct req_clause))) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Memory allocation failed");
+		return (NULL);
+	}
+
+	p = require;
+	while (*p != '\0') {
+		if (*p == ',' || isspace((unsigned char)*p)) {
+			p++;
+			continue;
 		}
-	} else {
-		char *s = strdup(require);
-		if (s == NULL) {
-			RETURN_ERROR(MPORT_ERR_FATAL, "Memory allocation failed");
+
+		c = &req->clauses[req->count];
+		if (p[0] == '<')
+			c->op = p[1] == '=' ? REQ_LE : REQ_LT;
+		else if (p[0] == '>')
+			c->op = p[1] == '=' ? REQ_GE : REQ_GT;
+		else if (p[0] == '=')
+			c->op = REQ_EQ;
+		else
+			goto malformed;
+		p += (p[1] == '=') ? 2 : 1;
+		while (isspace((unsigned char)*p))
+			p++;
+
+		for (start = p; *p != '\0' && !is_req_op(*p) && !isspace((unsigned char)*p); p++) {
+			/* a comma ahead of an operator ends the clause */
+			if (*p == ',' && (p[1] == '\0' || p[1] == ',' || is_req_op(p[1]) ||
+			    isspace((unsigned char)p[1])))
+				break;
 		}
 
-		if (less[1] > 0) {
-			// second one is less than e.g. <1.5
-			s[less[1]] = '\0';
-			if (s[less[1] + 1] == '=') {
-				ret = (mport_version_cmp(baseline, &s[less[1] + 2]) <= 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			} else {
-				ret = (mport_version_cmp(baseline, &s[less[1] + 1]) < 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			}
-		} else if (less[0] > greater[0]) {
-			// second one is less than e.g. <1.5
-			s[less[0]] = '\0';
-			if (s[less[0] + 1] == '=') {
-				ret = (mport_version_cmp(baseline, &s[less[0] + 2]) <= 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			} else {
-				ret = (mport_version_cmp(baseline, &s[less[0] + 1]) < 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			}
-		} else if (greater[1] > 0) {
-			// second one is greater
-			s[greater[1]] = '\0';
-			if (s[greater[1] + 1] == '=') {
-				ret = (mport_version_cmp(baseline, &s[greater[1] + 2]) >= 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			} else {
-				ret = (mport_version_cmp(baseline, &s[greater[1] + 1]) > 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			}
-		} else if (greater[0] > less[0]) {
-			// second one is greater
-			s[greater[0]] = '\0';
-			if (s[greater[0] + 1] == '=') {
-				ret = (mport_version_cmp(baseline, &s[greater[0] + 2]) >= 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			} else {
-				ret = (mport_version_cmp(baseline, &s[greater[0] + 1]) > 0) ? 0 : -1;
-				if (ret == -1) {
-					free(s);
-					s = NULL;
-					return (ret);
-				}
-			}
+		if (p == start)
+			goto malformed;
+
+		version = strndup(start, p - start);
+		c->key = version == NULL ? NULL : mport_version_key(version);
+		free(version);
+		if (c->key == NULL) {
+			mport_version_req_free(req);
+			SET_ERROR(MPORT_ERR_FATAL, "Memory allocation failed");
+			return (NULL);
 		}
 
-		if (greater[0] > 0) {
-			s[greater[0]] = '\0';
-			ret = (mport_version_cmp(baseline, &s[greater[0] + 1]) > 0) ? 0 : -1;
-			if (ret == -1) {
-				free(s);
-				s = NULL;
-				return (ret);
-			}
-		} else if (less[0] > 0) {
-			s[less[0]] = '\0';
-			ret = (mport_version_cmp(baseline, &s[less[0] + 1]) < 0) ? 0 : -1;
-			if (ret == -1) {
-				free(s);
-				s = NULL;
-				return (ret);
-			}
+		req->count++;
+	}
+
+	if (req->count > 0)
+		return (req);
+
+malformed:
+	mport_version_req_free(req);
+	SET_ERRORX(MPORT_ERR_FATAL, "Malformed version requirement: %s", require);
+	return (NULL);
+}
+
+/* mport_version_req_match(req, key)
+ *
+ * Returns true if the version whose mport_version_key() is key meets every
+ * clause of req.
+ */
+MPORT_PUBLIC_API bool
+mport_version_req_match(const mportVersionReq *req, const char *key)
+{
+	const struct req_clause *c;
+	int cmp;
+
+	for (c = req->clauses; c < req->clauses + req->count; c++) {
+		cmp = strcmp(key, c->key);
+
+		switch (c->op) {
+			case REQ_LT:
+				if (cmp >= 0)
+					return (false);
+				break;
+			case REQ_LE:
+				if (cmp > 0)
+					return (false);
+				break;
+			case REQ_GT:
+				if (cmp <= 0)
+					return (false);
+				break;
+			case REQ_GE:
+				if (cmp < 0)
+					return (false);
+				break;
+			case REQ_EQ:
+				if (cmp != 0)
+					return (false);
+				break;
 		}
+	}
+
+	return (true);
+}
+
+MPORT_PUBLIC_API void
+mport_version_req_free(mportVersionReq *req)
+{
+	size_t i;
+
+	if (req == NULL)
+		return;
+
+	for (i = 0; i < req->count; i++)
+		free(req->clauses[i].key);
+
+	free(req);
+}
+
 
-		free(s);
-		s = NULL;
+struct reqcache_entry {
+	mportVersionReq *req;
+	char text[];
+};
+
+struct mport_reqcache {
+	struct mport_arena *arena;
+	struct ohash reqs;
+};
+
+static struct ohash_info reqcache_info = {
+	offsetof(struct reqcache_entry, text), NULL, mport_ohash_calloc, mport_ohash_free, mport_ohash_alloc
+};
+
+/* mport_version_req_cached(mport, require)
+ *
+ * Like mport_version_req_compile(), but each requirement is compiled once per
+ * instance and kept until the instance is freed, so the result must not be
+ * freed.  Returns NULL, with the error set, if it is malformed.
+ */
+const mportVersionReq *
+mport_version_req_cached(mportInstance *mport, const char *require)
+{
+	struct mport_reqcache *cache;
+	struct reqcache_entry *e;
+	unsigned int slot;
+	size_t len;
+
+	if ((cache = mport->reqs) == NULL) {
+		if ((cache = calloc(1, sizeof(struct mport_reqcache))) == NULL ||
+		    (cache->arena = mport_arena_new()) == NULL) {
+			free(cache);
+			SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			return (NULL);
+		}
+		ohash_init(&cache->reqs, 6, &reqcache_info);
+		mport->reqs = cache;
 	}
 
-    return (ret);
+	slot = ohash_qlookup(&cache->reqs, require);
+	if ((e = ohash_find(&cache->reqs, slot)) != NULL)
+		return (e->req);
+
+	len = strlen(require) + 1;
+	if ((e = mport_arena_alloc(cache->arena, sizeof(*e) + len)) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		return (NULL);
+	}
+	memcpy(e->text, require, len);
+	if ((e->req = mport_version_req_compile(require)) == NULL)
+		return (NULL);
+	ohash_insert(&cache->reqs, slot, e);
+
+	return (e->req);
+}
+
+void
+mport_reqcache_free(struct mport_reqcache *cache)
+{
+	struct reqcache_entry *e;
+	unsigned int i;
+
+	if (cache == NULL)
+		return;
+
+	for (e = ohash_first(&cache->reqs, &i); e != NULL; e = ohash_next(&cache->reqs, &i))
+		mport_version_req_free(e->req);
+
+	ohash_delete(&cache->reqs);
+	mport_arena_free(cache->arena);
+	free(cache);
+}
+
+
+/* Returns 0 if baseline meets the given requirement, -1 if the requirement
+ * was not met, and a value greater than 0 on error.  some examples:
+ *
+ * mport_version_require_check("2.0.1", ">=2.0") == 0
+ * mport_version_require_check("4.1.2", ">5.1")  == -1
+ * mport_version_require_check("3.1.4", "|")     > 0
+ * multi example:
+ * mport_version_require_check("0.2.1", ">=1.4.0<1.5")
+ *
+ * Callers checking the same requirement often should compile it once with
+ * mport_version_req_compile() instead.
+ */
+int
+mport_version_require_check(const char *baseline, const char *require)
+{
+	mportVersionReq *req;
+	char *key;
+	int ret;
+
+	if ((req = mport_version_req_compile(require)) == NULL)
+		RETURN_CURRENT_ERROR;
+
+	if ((key = mport_version_key(baseline)) == NULL) {
+		mport_version_req_free(req);
+		RETURN_ERROR(MPORT_ERR_FATAL, "Memory allocation failed");
+	}
+
+	ret = mport_version_req_match(req, key) ? 0 : -1;
+
+	free(key);
+	mport_version_req_free(req);
+
+	return (ret);
 }
 
 static void
@@ -299,6 +489,13 @@ parse_version(const char *in, struct version *v)
     char *lessthan;
     char *greaterthan;
 
+    if (s == NULL) {
+        v->version = NULL;
+        v->revision = 0;
+        v->epoch = 0;
+        return;
+    }
+
     underscore = rindex(s, '_');
     comma = rindex(s, ',');
 	lessthan = rindex(s, '<');
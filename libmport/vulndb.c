@@ -0,0 +1,372 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * The vulnerability database lists, per product, the CVEs affecting it and
+ * the ranges of versions affected.  Each bound is stored with its version
+ * key and whether it is itself affected; a NULL bound is open, so a row with
+ * neither covers every version.  The package URL the range was published
+ * for is kept when the security site gives one.  The database is kept next to
+ * the index and attached as "vuln", so a whole system can be audited with
+ * one join against the packages table, and without network access.  It is
+ * either downloaded from the mirrors, or generated from the security site
+ * for the packages installed here (which needs network access once).
+ *
+ * Packages name their product with a CPE; the database is keyed on its
+ * vendor:product part, see mport_cpe_product().
+ */
+
+struct vulndb_gen {
+	sqlite3 *db;
+	sqlite3_stmt *insert;
+	const char *product;
+};
+
+static int vulndb_attach(mportInstance *);
+static int vulndb_detach(mportInstance *);
+static int vulndb_create(sqlite3 *);
+static int vulndb_insert_cb(const struct mport_cve *, void *);
+
+/* mport_vulndb_load(mport)
+ *
+ * Attach the vulnerability database, if there is one.  Returns MPORT_OK
+ * when it is available.
+ */
+MPORT_PUBLIC_API int
+mport_vulndb_load(mportInstance *mport)
+{
+
+	if (mport == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+
+	if (mport->flags & MPORT_INST_HAVE_VULNDB)
+		return (MPORT_OK);
+
+	if (!mport_file_exists(MPORT_VULNDB_FILE))
+		RETURN_ERROR(MPORT_ERR_WARN, "No vulnerability database");
+
+	return (vulndb_attach(mport));
+}
+
+/* mport_vulndb_update(mport)
+ *
+ * Download the vulnerability database from the mirrors.  The index must be
+ * loaded.
+ */
+MPORT_PUBLIC_API int
+mport_vulndb_update(mportInstance *mport)
+{
+	char tmpfile[] = MPORT_VULNDB_FILE ".XXXXXX";
+	int fd;
+
+	if (mport == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+
+	if ((fd = mkstemp(tmpfile)) == -1)
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't make tmp file: %s", strerror(errno));
+	close(fd);
+
+	if (mport_fetch_vulndb(mport, tmpfile) != MPORT_OK) {
+		unlink(tmpfile);
+		RETURN_CURRENT_ERROR;
+	}
+
+	if (vulndb_detach(mport) != MPORT_OK || rename(tmpfile, MPORT_VULNDB_FILE) != 0) {
+		unlink(tmpfile);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't install %s: %s", MPORT_VULNDB_FILE, strerror(errno));
+	}
+
+	(void)chmod(MPORT_VULNDB_FILE, 0644);
+
+	return (vulndb_attach(mport));
+}
+
+/* mport_vulndb_generate(mport)
+ *
+ * Build the vulnerability database from the security site, asking once
+ * about each product installed.  Afterwards, audits of this system work
+ * offline.
+ */
+MPORT_PUBLIC_API int
+mport_vulndb_generate(mportInstance *mport)
+{
+	char tmpfile[] = MPORT_VULNDB_FILE ".XXXXXX";
+	mportPackageMeta **packs = NULL, **pack;
+	struct vulndb_gen gen;
+	sqlite3_stmt *seen = NULL;
+	FILE *fp;
+	char *product;
+	int fd, total = 0, current = 0, ret = MPORT_OK;
+
+	if (mport == NULL)
+		RETURN_ERROR(MPORT_ERR_FATAL, "mport not initialized");
+
+	if (mport_pkgmeta_list(mport, &packs) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (packs == NULL)
+		RETURN_ERROR(MPORT_ERR_WARN, "No packages installed.");
+
+	if ((fd = mkstemp(tmpfile)) == -1) {
+		mport_pkgmeta_vec_free(packs);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't make tmp file: %s", strerror(errno));
+	}
+	close(fd);
+
+	gen.insert = NULL;
+	if (sqlite3_open(tmpfile, &gen.db) != SQLITE_OK) {
+		ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(gen.db));
+		goto DONE;
+	}
+
+	if (vulndb_create(gen.db) != MPORT_OK ||
+	    mport_db_prepare(gen.db, &gen.insert,
+	    "INSERT INTO vulnerabilities (cve_id, product, min_version, min_version_key, min_inclusive, "
+	    "max_version, max_version_key, max_inclusive, purl, severity, description, score) "
+	    "VALUES (?,?,?,?,?,?,?,?,?,?,?,?)") != MPORT_OK ||
+	    mport_db_prepare(gen.db, &seen, "INSERT OR IGNORE INTO products (product) VALUES (?)") != MPORT_OK) {
+		ret = mport_err_code();
+		goto DONE;
+	}
+
+	for (pack = packs; *pack != NULL; pack++)
+		total++;
+
+	mport_call_progress_init_cb(mport, "Fetching vulnerability data");
+	mport_db_do(gen.db, "BEGIN TRANSACTION");
+
+	for (pack = packs; *pack != NULL && ret == MPORT_OK; pack++) {
+		(mport->progress_step_cb)(++current, total, (*pack)->name);
+
+		if ((*pack)->cpe == NULL || (*pack)->cpe[0] == '\0' ||
+		    (product = mport_cpe_product((*pack)->cpe)) == NULL)
+			continue;
+
+		/* several packages can share a product; ask about it once */
+		sqlite3_bind_text(seen, 1, product, -1, SQLITE_STATIC);
+		if (sqlite3_step(seen) != SQLITE_DONE) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(gen.db));
+		} else if (sqlite3_changes(gen.db) > 0) {
+			if ((fp = mport_fetch_cves(mport, (*pack)->cpe)) == NULL) {
+				ret = mport_err_code();
+			} else {
+				gen.product = product;
+				ret = mport_cve_parse(fp, vulndb_insert_cb, &gen);
+				fclose(fp);
+			}
+		}
+		sqlite3_reset(seen);
+		free(product);
+	}
+
+	(mport->progress_free_cb)();
+
+	if (ret == MPORT_OK && mport_db_do(gen.db, "COMMIT") != MPORT_OK)
+		ret = mport_err_code();
+
+DONE:
+	sqlite3_finalize(seen);
+	sqlite3_finalize(gen.insert);
+	sqlite3_close(gen.db);
+	mport_pkgmeta_vec_free(packs);
+
+	if (ret != MPORT_OK) {
+		unlink(tmpfile);
+		return (ret);
+	}
+
+	if (vulndb_detach(mport) != MPORT_OK || rename(tmpfile, MPORT_VULNDB_FILE) != 0) {
+		unlink(tmpfile);
+		RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't install %s: %s", MPORT_VULNDB_FILE, strerror(errno));
+	}
+
+	(void)chmod(MPORT_VULNDB_FILE, 0644);
+
+	return (vulndb_attach(mport));
+}
+
+/* store each affected range of a CVE for the product being generated */
+static int
+vulndb_insert_cb(const struct mport_cve *cve, void *arg)
+{
+	struct vulndb_gen *gen = arg;
+	const struct mport_cve_range *range;
+	char *minkey, *maxkey;
+	size_t i;
+	int ret = MPORT_OK;
+
+	for (i = 0; i < cve->nranges && ret == MPORT_OK; i++) {
+		range = &cve->ranges[i];
+		minkey = maxkey = NULL;
+		if ((range->min != NULL && (minkey = mport_version_key(range->min)) == NULL) ||
+		    (range->max != NULL && (maxkey = mport_version_key(range->max)) == NULL)) {
+			free(minkey);
+			RETURN_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		}
+
+		/* unset bounds stay NULL, cleared by sqlite3_clear_bindings() */
+		sqlite3_bind_text(gen->insert, 1, cve->id, -1, SQLITE_STATIC);
+		sqlite3_bind_text(gen->insert, 2, gen->product, -1, SQLITE_STATIC);
+		if (minkey != NULL) {
+			sqlite3_bind_text(gen->insert, 3, range->min, -1, SQLITE_STATIC);
+			sqlite3_bind_text(gen->insert, 4, minkey, -1, SQLITE_STATIC);
+		}
+		sqlite3_bind_int(gen->insert, 5, !range->min_excluded);
+		if (maxkey != NULL) {
+			sqlite3_bind_text(gen->insert, 6, range->max, -1, SQLITE_STATIC);
+			sqlite3_bind_text(gen->insert, 7, maxkey, -1, SQLITE_STATIC);
+		}
+		sqlite3_bind_int(gen->insert, 8, !range->max_excluded);
+		sqlite3_bind_text(gen->insert, 9, range->purl, -1, SQLITE_STATIC);
+		sqlite3_bind_text(gen->insert, 10, cve->severity, -1, SQLITE_STATIC);
+		sqlite3_bind_text(gen->insert, 11, cve->description, -1, SQLITE_STATIC);
+		if (cve->score >= 0)
+			sqlite3_bind_double(gen->insert, 12, cve->score);
+
+		if (sqlite3_step(gen->insert) != SQLITE_DONE)
+			ret = SET_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(gen->db));
+
+		sqlite3_reset(gen->insert);
+		sqlite3_clear_bindings(gen->insert);
+		free(minkey);
+		free(maxkey);
+	}
+
+	return (ret);
+}
+
+static int
+vulndb_create(sqlite3 *db)
+{
+
+	if (mport_db_do(db, "CREATE TABLE vulnerabilities (cve_id text NOT NULL, product text NOT NULL, "
+	    "min_version text, min_version_key text, min_inclusive integer NOT NULL DEFAULT 1, "
+	    "max_version text, max_version_key text, max_inclusive integer NOT NULL DEFAULT 1, "
+	    "purl text, severity text, description text, score real)") != MPORT_OK ||
+	    mport_db_do(db, "CREATE INDEX vulnerabilities_product ON vulnerabilities (product, max_version_key)") != MPORT_OK ||
+	    mport_db_do(db, "CREATE TABLE products (product text NOT NULL PRIMARY KEY)") != MPORT_OK ||
+	    mport_db_do(db, "PRAGMA user_version = %d", MPORT_VULNDB_VERSION) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	return (MPORT_OK);
+}
+
+static int
+vulndb_attach(mportInstance *mport)
+{
+	int version;
+
+	if (mport_db_do(mport->db, "ATTACH %Q AS vuln", MPORT_VULNDB_FILE) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	/* one from before version ranges can't be queried; audits go online */
+	if (mport_db_count(mport->db, &version, "PRAGMA vuln.user_version") != MPORT_OK ||
+	    version < MPORT_VULNDB_VERSION) {
+		(void)mport_db_do(mport->db, "DETACH vuln");
+		RETURN_ERROR(MPORT_ERR_WARN, "Vulnerability database is out of date");
+	}
+
+	mport->flags |= MPORT_INST_HAVE_VULNDB;
+
+	return (MPORT_OK);
+}
+
+static int
+vulndb_detach(mportInstance *mport)
+{
+
+	if (!(mport->flags & MPORT_INST_HAVE_VULNDB))
+		return (MPORT_OK);
+
+	if (mport_db_do(mport->db, "DETACH vuln") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	mport->flags &= ~MPORT_INST_HAVE_VULNDB;
+
+	return (MPORT_OK);
+}
+
+/* mport_cpe_product(cpe)
+ *
+ * Return the vendor:product part of a CPE, in either the 2.3 formatted
+ * string ("cpe:2.3:a:vendor:product:version:...") or the 2.2 URI
+ * ("cpe:/a:vendor:product:version") binding, or NULL.
+ */
+char *
+mport_cpe_product(const char *cpe)
+{
+	const char *vendor, *end;
+
+	if (strncmp(cpe, "cpe:2.3:", 8) == 0)
+		vendor = cpe + 8;
+	else if (strncmp(cpe, "cpe:/", 5) == 0)
+		vendor = cpe + 5;
+	else
+		return (NULL);
+
+	/* skip the part */
+	if ((vendor = strchr(vendor, ':')) == NULL)
+		return (NULL);
+	vendor++;
+
+	/* and take up to the end of the product */
+	if ((end = strchr(vendor, ':')) == NULL || (end = strchr(end + 1, ':')) == NULL)
+		end = vendor + strlen(vendor);
+
+	return (strndup(vendor, end - vendor));
+}
+
+/* version of mport_cpe_product() that is bound to the sqlite3 database. */
+void
+mport_cpe_product_sqlite(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	const char *cpe;
+	char *product;
+
+	assert(argc == 1);
+
+	if ((cpe = (const char *)sqlite3_value_text(argv[0])) == NULL ||
+	    (product = mport_cpe_product(cpe)) == NULL) {
+		sqlite3_result_null(context);
+		return;
+	}
+
+	sqlite3_result_text(context, product, -1, free);
+}
@@ -0,0 +1,319 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2026 Lucas Holt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <zdict.h>
+#include "mport.h"
+#include "mport_private.h"
+
+/*
+ * Repository wide zstd dictionaries.  Small bundles compress poorly on their
+ * own, since every +CONTENTS.db and file set starts from an empty window.
+ * A dictionary trained over a sample of them gives each one a useful window
+ * to start from.  Bundles record the dictionary ID in their zstd frame
+ * header; the dictionaries themselves ship in the index (in a dictionaries
+ * table) and are installed into MPORT_ZDICT_DIR as <id>.zdict.
+ */
+
+/* only the start of each sample bundle is used for training */
+#define ZDICT_SAMPLE_MAX	(128 * 1024)
+#define ZDICT_DEFAULT_SIZE	(112 * 1024)
+
+static ssize_t read_sample(const char *, void *, size_t);
+
+/*
+ * mport_zdict_read_file(path, &size)
+ *
+ * Read a dictionary file into memory.  Returns NULL and sets the error on
+ * failure.  The caller should free the buffer.
+ */
+void *
+mport_zdict_read_file(const char *path, size_t *sizep)
+{
+	struct stat st;
+	void *dict;
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		SET_ERRORX(MPORT_ERR_FATAL, "Couldn't open dictionary %s: %s", path, strerror(errno));
+		return (NULL);
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		SET_ERRORX(MPORT_ERR_FATAL, "Invalid dictionary %s", path);
+		close(fd);
+		return (NULL);
+	}
+
+	if ((dict = malloc(st.st_size)) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		close(fd);
+		return (NULL);
+	}
+
+	len = read(fd, dict, st.st_size);
+	close(fd);
+
+	if (len != st.st_size) {
+		SET_ERRORX(MPORT_ERR_FATAL, "Couldn't read dictionary %s", path);
+		free(dict);
+		return (NULL);
+	}
+
+	*sizep = st.st_size;
+
+	return (dict);
+}
+
+/*
+ * mport_zdict_load(id, &size)
+ *
+ * Load the installed dictionary with the given ID.
+ */
+void *
+mport_zdict_load(unsigned int id, size_t *sizep)
+{
+	char path[FILENAME_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/%u.zdict", MPORT_ZDICT_DIR, id);
+
+	if (!mport_file_exists(path)) {
+		SET_ERRORX(MPORT_ERR_FATAL,
+		    "Package needs zstd dictionary %u, which is not installed.  Try updating the index.", id);
+		return (NULL);
+	}
+
+	return (mport_zdict_read_file(path, sizep));
+}
+
+/*
+ * mport_zdict_sync(db)
+ *
+ * Install any dictionaries shipped in the attached index that we don't have
+ * yet.  Indexes without a dictionaries table are fine, as is not being able
+ * to write to the instance directory (we're not root); bundles needing a
+ * missing dictionary will fail with a clear error instead.
+ */
+int
+mport_zdict_sync(sqlite3 *db)
+{
+	char path[FILENAME_MAX];
+	char tmp[FILENAME_MAX];
+	sqlite3_stmt *stmt;
+	const void *dict;
+	int count, fd, ret, len;
+	unsigned int id;
+
+	if (mport_db_count(db, &count,
+	    "SELECT COUNT(*) FROM idx.sqlite_master WHERE type='table' AND name='dictionaries'") != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (count == 0 || access(MPORT_INST_DIR, W_OK) != 0)
+		return (MPORT_OK);
+
+	if (mport_mkdir(MPORT_ZDICT_DIR) != MPORT_OK)
+		RETURN_CURRENT_ERROR;
+
+	if (mport_db_prepare(db, &stmt, "SELECT id, dict FROM idx.dictionaries") != MPORT_OK) {
+		sqlite3_finalize(stmt);
+		RETURN_CURRENT_ERROR;
+	}
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		id = (unsigned int)sqlite3_column_int64(stmt, 0);
+		dict = sqlite3_column_blob(stmt, 1);
+		len = sqlite3_column_bytes(stmt, 1);
+
+		(void)snprintf(path, sizeof(path), "%s/%u.zdict", MPORT_ZDICT_DIR, id);
+		if (dict == NULL || mport_file_exists(path))
+			continue;
+
+		/* write and rename, so a reader never sees half a dictionary */
+		(void)snprintf(tmp, sizeof(tmp), "%s/.%u.zdict.XXXXXX", MPORT_ZDICT_DIR, id);
+		if ((fd = mkstemp(tmp)) == -1) {
+			sqlite3_finalize(stmt);
+			RETURN_ERRORX(MPORT_ERR_FATAL, "Couldn't create %s: %s", tmp, strerror(errno));
+		}
+
+		if (write(fd, dict, len) != len || fchmod(fd, 0644) != 0 || close(fd) != 0 ||
+		    rename(tmp, path) != 0) {
+			SET_ERRORX(MPORT_ERR_FATAL, "Couldn't install dictionary %u: %s", id, strerror(errno));
+			(void)unlink(tmp);
+			sqlite3_finalize(stmt);
+			RETURN_CURRENT_ERROR;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_DONE)
+		RETURN_ERROR(MPORT_ERR_FATAL, sqlite3_errmsg(db));
+
+	return (MPORT_OK);
+}
+
+/*
+ * mport_zdict_train(bundles, outfile, dictsize, &id)
+ *
+ * Train a dictionary of at most dictsize bytes (0 for the default) over the
+ * uncompressed contents of the given bundles, and write it to outfile.  The
+ * new dictionary's ID is returned in id; that is the ID to use for it in the
+ * index's dictionaries table.
+ */
+MPORT_PUBLIC_API int
+mport_zdict_train(const char **bundles, const char *outfile, size_t dictsize, unsigned int *idp)
+{
+	char *samples = NULL, *tmp;
+	size_t *sizes = NULL, *tmpsizes;
+	size_t nsamples = 0, used = 0, alloced = 0, dictlen;
+	ssize_t len;
+	void *dict = NULL;
+	int fd, ret = MPORT_OK;
+
+	if (dictsize == 0)
+		dictsize = ZDICT_DEFAULT_SIZE;
+
+	for (; *bundles != NULL; bundles++) {
+		if (used + ZDICT_SAMPLE_MAX > alloced) {
+			alloced = alloced == 0 ? ZDICT_SAMPLE_MAX * 64 : alloced * 2;
+			if ((tmp = realloc(samples, alloced)) == NULL) {
+				ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+				goto DONE;
+			}
+			samples = tmp;
+		}
+
+		if ((tmpsizes = reallocarray(sizes, nsamples + 1, sizeof(size_t))) == NULL) {
+			ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+			goto DONE;
+		}
+		sizes = tmpsizes;
+
+		if ((len = read_sample(*bundles, samples + used, ZDICT_SAMPLE_MAX)) < 0) {
+			ret = mport_err_code();
+			goto DONE;
+		}
+
+		if (len == 0)
+			continue;
+
+		sizes[nsamples++] = len;
+		used += len;
+	}
+
+	if (nsamples == 0) {
+		ret = SET_ERROR(MPORT_ERR_FATAL, "No samples to train a dictionary with.");
+		goto DONE;
+	}
+
+	if ((dict = malloc(dictsize)) == NULL) {
+		ret = SET_ERROR(MPORT_ERR_FATAL, "Out of memory.");
+		goto DONE;
+	}
+
+	dictlen = ZDICT_trainFromBuffer(dict, dictsize, samples, sizes, (unsigned)nsamples);
+	if (ZDICT_isError(dictlen)) {
+		ret = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't train dictionary: %s", ZDICT_getErrorName(dictlen));
+		goto DONE;
+	}
+
+	if ((fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		ret = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't open %s: %s", outfile, strerror(errno));
+		goto DONE;
+	}
+
+	if (write(fd, dict, dictlen) != (ssize_t)dictlen) {
+		ret = SET_ERRORX(MPORT_ERR_FATAL, "Couldn't write %s: %s", outfile, strerror(errno));
+		close(fd);
+		goto DONE;
+	}
+	close(fd);
+
+	if (idp != NULL)
+		*idp = ZDICT_getDictID(dict, dictlen);
+
+DONE:
+	free(dict);
+	free(sizes);
+	free(samples);
+
+	return (ret);
+}
+
+/* read up to max bytes of the uncompressed archive of bundle into buf */
+static ssize_t
+read_sample(const char *bundle, void *buf, size_t max)
+{
+	struct archive *a;
+	struct archive_entry *entry;
+	size_t used = 0;
+	la_ssize_t len;
+
+	if ((a = archive_read_new()) == NULL) {
+		SET_ERROR(MPORT_ERR_FATAL, "Couldn't initialize archive read");
+		return (-1);
+	}
+
+	archive_read_support_filter_all(a);
+	archive_read_support_format_raw(a);
+
+	if (archive_read_open_filename(a, bundle, 10240) != ARCHIVE_OK ||
+	    archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+		SET_ERRORX(MPORT_ERR_FATAL, "%s: %s", bundle, archive_error_string(a));
+		archive_read_free(a);
+		return (-1);
+	}
+
+	while (used < max) {
+		len = archive_read_data(a, (char *)buf + used, max - used);
+		if (len < 0) {
+			SET_ERRORX(MPORT_ERR_FATAL, "%s: %s", bundle, archive_error_string(a));
+			archive_read_free(a);
+			return (-1);
+		}
+		if (len == 0)
+			break;
+		used += len;
+	}
+
+	archive_read_free(a);
+
+	return ((ssize_t)used);
+}
@@ -265,7 +265,7 @@ main(int argc, char *argv[])
 				mport_update(mport, (*packs)->name);
 				packs++;
 			}
-			mport_pkgmeta_free(*packs_orig);
+			mport_pkgmeta_vec_free(packs_orig);
 		} else { 
 			for (i = 1; i < argc; i++) {
 				tempResultCode = mport_update(mport, argv[i]);
@@ -318,23 +318,39 @@ main(int argc, char *argv[])
 
 		int local_argc = argc;
 		char *const *local_argv = argv;
-		int rflag = 0;
+		int rflag = 0, uflag = 0, gflag = 0;
 
 		if (local_argc > 1) {
 			int ch2;
-			while ((ch2 = getopt(local_argc, local_argv, "r")) != -1) {
+			while ((ch2 = getopt(local_argc, local_argv, "gru")) != -1) {
 				switch (ch2) {
+				case 'g':
+					gflag = 1;
+					break;
 				case 'r':
 					rflag = 1;
 					break;
+				case 'u':
+					uflag = 1;
+					break;
 				}
 			}
 			local_argc -= optind;
 			local_argv += optind;
+		} else {
+			local_argc = 0;
 		}
 
-		if (argc > 1) {
-			resultCode = audit_package(mport, argv[1], rflag > 0);
+		resultCode = MPORT_OK;
+		if (uflag)
+			resultCode = mport_vulndb_update(mport);
+		else if (gflag)
+			resultCode = mport_vulndb_generate(mport);
+
+		if (resultCode != MPORT_OK) {
+			warnx("%s", mport_err_string());
+		} else if (local_argc > 0) {
+			resultCode = audit_package(mport, local_argv[0], rflag > 0);
 		} else {
 			resultCode = audit(mport, rflag > 0);
 		}
@@ -534,7 +550,7 @@ usage(void)
 
 	fprintf(stderr,
 	    "usage: mport [-c chroot dir] [-o output] [-fqUVv] <command> args:\n"
-	    "       mport audit\n"
+	    "       mport audit [-gru] [package name]\n"
 	    "       mport autoremove\n"
 	    "       mport clean\n"
 	    "       mport config get [setting name]\n"
@@ -652,10 +668,18 @@ selectMirror(mportInstance *mport)
 	return MPORT_OK;
 }
 
+static int
+search_print(const mportIndexEntry *e, void *arg)
+{
+
+	fprintf(stdout, "%s\t%s\t%s\n", e->pkgname, e->version, e->comment);
+
+	return (MPORT_OK);
+}
+
 int
 search(mportInstance *mport, char **query)
 {
-	mportIndexEntry **indexEntry = NULL;
 
 	if (query == NULL || *query == NULL) {
 		fprintf(stderr, "Search terms required\n");
@@ -663,19 +687,11 @@ search(mportInstance *mport, char **query)
 	}
 
 	while (query != NULL && *query != NULL) {
-		mport_index_search_term(mport, &indexEntry, *query);
-		if (indexEntry == NULL || *indexEntry == NULL) {
-			query++;
-			continue;
-		}
-
-		while (indexEntry != NULL && *indexEntry != NULL) {
-			fprintf(stdout, "%s\t%s\t%s\n", (*indexEntry)->pkgname,
-			    (*indexEntry)->version, (*indexEntry)->comment);
-			indexEntry++;
+		if (mport_index_foreach(mport, search_print, NULL, "pkg glob %Q or comment glob %Q",
+		    *query, *query) != MPORT_OK) {
+			warnx("%s", mport_err_string());
+			return (1);
 		}
-
-		mport_index_entry_free_vec(indexEntry);
 		query++;
 	}
 
@@ -711,7 +727,7 @@ lock(mportInstance *mport, const char *packageName)
 
 	if (packs != NULL) {
 		mport_lock_lock(mport, (*packs));
-		mport_pkgmeta_free(*packs);
+		mport_pkgmeta_vec_free(packs);
 		return (MPORT_OK);
 	}
 
@@ -725,7 +741,7 @@ unlock(mportInstance *mport, const char *packageName)
 
 	if (packs != NULL) {
 		mport_lock_unlock(mport, (*packs));
-		mport_pkgmeta_free(*packs);
+		mport_pkgmeta_vec_free(packs);
 		return (MPORT_OK);
 	}
 
@@ -941,68 +957,63 @@ configSet(mportInstance *mport, const char *settingName, const char *val)
 	return 0;
 }
 
+static int
+purl_print(const mportPackageMeta *pack, void *arg)
+{
+	int *purl_total = arg;
+
+	printf("pkg:mport/midnightbsd/%s@%s?arch=%s&osrel=%s\n", pack->name,
+	    pack->version, MPORT_ARCH, pack->os_release);
+	(*purl_total)++;
+
+	return (MPORT_OK);
+}
+
 int
 purlList(mportInstance *mport)
 {
-	mportPackageMeta **packs = NULL;
 	int purl_total = 0;
 
-	if (mport_pkgmeta_list(mport, &packs) != MPORT_OK) {
+	if (mport_pkgmeta_foreach(mport, purl_print, &purl_total, NULL) != MPORT_OK) {
 		warnx("%s", mport_err_string());
 		return mport_err_code();
 	}
 
 	mport_drop_privileges();
 
-	if (packs == NULL) {
+	if (purl_total == 0) {
 		warnx("No packages installed.");
 		return (1);
 	}
 
-	while (*packs != NULL) {
-		printf("pkg:mport/midnightbsd/%s@%s?arch=%s&osrel=%s\n", (*packs)->name,
-		    (*packs)->version, MPORT_ARCH, (*packs)->os_release);
-		purl_total++;
-		packs++;
-	}
-	mport_pkgmeta_vec_free(packs);
+	return (0);
+}
 
-	if (purl_total == 0) {
-		errx(EX_SOFTWARE, "No packages contained PURL information.");
+static int
+cpe_print(const mportPackageMeta *pack, void *arg)
+{
+	int *cpe_total = arg;
+
+	if (pack->cpe[0] != '\0') {
+		printf("%s\n", pack->cpe);
+		(*cpe_total)++;
 	}
 
-	return (0);
+	return (MPORT_OK);
 }
 
 int
 cpeList(mportInstance *mport)
 {
-	mportPackageMeta **packs = NULL;
-	mportPackageMeta **packs_orig = NULL;
 	int cpe_total = 0;
 
-	if (mport_pkgmeta_list(mport, &packs_orig) != MPORT_OK) {
+	if (mport_pkgmeta_foreach(mport, cpe_print, &cpe_total, NULL) != MPORT_OK) {
 		warnx("%s", mport_err_string());
 		return mport_err_code();
 	}
 
 	mport_drop_privileges();
 
-	if (packs_orig == NULL) {
-		warnx("No packages installed.");
-		return (1);
-	}
-
-    packs = packs_orig;
-	while (*packs != NULL) {
-		if ((*packs)->cpe != NULL && strlen((*packs)->cpe) > 0) {
-			printf("%s\n", (*packs)->cpe);
-			cpe_total++;
-		}
-		packs++;
-	}
-	mport_pkgmeta_vec_free(packs_orig);
-
 	if (cpe_total == 0) {
 		errx(EX_SOFTWARE, "No packages contained CPE information.");
 	}
@@ -1120,34 +1131,63 @@ clean(mportInstance *mport)
 	return (result);
 }
 
-int
-audit(mportInstance *mport, bool dependsOn)
+struct audit_each {
+	mportInstance *mport;
+	bool dependsOn;
+	int count;
+};
+
+static int
+audit_each(const mportPackageMeta *pack, void *arg)
 {
-	mportPackageMeta **packs = NULL;
+	struct audit_each *a = arg;
+	char *output;
 
-	if (mport_pkgmeta_list(mport, &packs) != MPORT_OK) {
-		warnx("%s", mport_err_string());
-		return (1);
-	}
+	a->count++;
 
-	if (packs == NULL) {
-		fprintf(stderr, "No packages installed.\n");
-		return (1);
+	output = mport_audit(a->mport, pack->name, a->dependsOn);
+	if (output != NULL && output[0] != '\0') {
+		if (a->mport->verbosity == MPORT_VQUIET)
+			printf("%s", output);
+		else
+			printf("%s\n", output);
 	}
+	free(output);
 
-	while (*packs != NULL) {
-		char *output = mport_audit(mport, (*packs)->name, dependsOn);
-		if (output != NULL && output[0] != '\0') {
+	return (MPORT_OK);
+}
+
+int
+audit(mportInstance *mport, bool dependsOn)
+{
+	struct audit_each a = { mport, dependsOn, 0 };
+	char *output;
+
+	/* with a local vulnerability database, it's one query */
+	if (mport_vulndb_load(mport) == MPORT_OK) {
+		if ((output = mport_audit_installed(mport, dependsOn)) == NULL) {
+			warnx("%s", mport_err_string());
+			return (1);
+		}
+		if (output[0] != '\0') {
 			if (mport->verbosity == MPORT_VQUIET)
 				printf("%s", output);
 			else
 				printf("%s\n", output);
-			free(output);
 		}
-		packs++;
+		free(output);
+		return (0);
 	}
 
-	mport_pkgmeta_vec_free(packs);
+	if (mport_pkgmeta_foreach(mport, audit_each, &a, NULL) != MPORT_OK) {
+		warnx("%s", mport_err_string());
+		return (1);
+	}
+
+	if (a.count == 0) {
+		fprintf(stderr, "No packages installed.\n");
+		return (1);
+	}
 
 	return (0);
 }